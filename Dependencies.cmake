@@ -97,6 +97,15 @@ function(cloysterhpc_setup_dependencies)
     endif()
   endif()
 
+  # TLS for the native HTTP client (services/http.cpp)
+  if(NOT TARGET OpenSSL::SSL)
+    if (cloysterhpc_ENABLE_CONAN)
+      CPMFindPackage(NAME OpenSSL)
+    else()
+      find_package(OpenSSL REQUIRED)
+    endif()
+  endif()
+
   # Standalone packages
   include(FindPackageHandleStandardArgs)
 
@@ -12,6 +12,8 @@ set(COMMON_LIBS
         fmt::fmt
         gsl::gsl-lite
         magic_enum::magic_enum
+        OpenSSL::SSL
+        OpenSSL::Crypto
         resolv
         SDBusCpp::sdbus-c++
         spdlog::spdlog
@@ -15,6 +15,7 @@ class MyProjectConan(ConanFile):
         self.requires("gsl-lite/[>=0.41.0 <0.42.0]")
         self.requires("doctest/[>=2.4.0 <2.5.0]")
         self.requires("sdbus-cpp/[>=2.0.0 <2.1.0]")
+        self.requires("openssl/[>=3.0.0 <4.0.0]")
 
         # We're using host's glibmm
         # self.requires("glibmm/[>=2.78.1 <2.79.0]")
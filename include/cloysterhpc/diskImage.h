@@ -6,41 +6,66 @@
 #ifndef CLOYSTERHPC_DISKIMAGE_H_
 #define CLOYSTERHPC_DISKIMAGE_H_
 
-#include <array>
 #include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
 
+#include <cloysterhpc/const.h>
 #include <cloysterhpc/models/os.h>
 
 /**
  * @class DiskImage
  * @brief Manages disk image paths and validation for known images.
  *
- * The DiskImage class provides functionality to handle disk image paths,
- * verify if a disk image is known, and check if it has a verified checksum.
+ * Images are identified by probing the release they carry, so renamed and
+ * custom images are classified without reading them whole. The checksum of
+ * known images is only verified when asked for with `--verify-disk-image`.
  */
 class DiskImage {
+public:
+    /**
+     * @brief An entry of the known images file.
+     */
+    struct KnownImage {
+        std::string filename;
+        std::string product;
+        cloyster::models::OS::Distro distro;
+        std::string version;
+        std::string arch;
+        std::string sha256;
+    };
+
+    static constexpr auto knownImagesPath
+        = INSTALL_PATH "/conf/images/known-images.conf";
+
 private:
     std::filesystem::path m_path;
     std::optional<cloyster::models::OS::Distro> m_distro = std::nullopt;
-
-    // BUG: This is bad design, and also overrides what's inside the map
-    // variable on the class that holds the checksums.
-    /**
-     * @brief List of known disk image filenames.
-     */
-    static constexpr auto m_knownImageFilename { std::to_array<const char*>(
-        { "AlmaLinux-8.8-x86_64-dvd.iso", "OracleLinux-R8-U8-x86_64-dvd.iso",
-            "rhel-8.8-x86_64-dvd.iso", "Rocky-8.8-x86_64-dvd1.iso",
-            "Rocky-9.5-x86_64-dvd.iso" }) };
+    std::optional<KnownImage> m_knownImage = std::nullopt;
 
 public:
     [[nodiscard]] const std::filesystem::path& getPath() const;
     [[nodiscard]] cloyster::models::OS::Distro getDistro() const;
     void setPath(const std::filesystem::path& path);
 
+    /**
+     * @brief Loads the known images file.
+     *
+     * @param path Path to the file, tests use the one in the source tree.
+     * @return The images, in the order they are listed.
+     */
+    static std::vector<KnownImage> loadKnownImages(
+        const std::filesystem::path& path = knownImagesPath);
+
     /**
      * @brief Checks if the given disk image is known.
      *
+     * The image is probed for its release, falling back to the filename for
+     * images that can't be probed or whose product is not listed. The distro
+     * is set for any image whose product is listed, even when the release
+     * itself is not, and otherwise guessed from the filename.
+     *
      * @param path Filesystem path to the disk image to check.
      * @return True if the disk image is known, false otherwise.
      */
@@ -49,10 +74,13 @@ public:
     /**
      * @brief Checks if the given disk image has a verified checksum.
      *
+     * Hashes the whole image, unless its checksum is already cached.
+     *
      * @param path Filesystem path to the disk image to check.
      * @return True if the disk image has a verified checksum, false otherwise.
      */
-    static bool hasVerifiedChecksum(const std::filesystem::path& path);
+    [[nodiscard]] bool hasVerifiedChecksum(
+        const std::filesystem::path& path) const;
 };
 
 #endif // CLOYSTERHPC_DISKIMAGE_H_
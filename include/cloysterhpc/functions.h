@@ -11,6 +11,8 @@
 #include <algorithm>
 #include <filesystem>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #ifdef BUILD_TESTING
 #include <doctest/doctest.h>
@@ -87,6 +89,9 @@ void removeFile(std::string_view filename);
 /**
  * @brief Creates a backup of a file.
  *
+ * The contents go to the services::files::BackupStore, a content that is
+ * already there is not copied again.
+ *
  * @param filename The name of the file to backup.
  */
 void backupFile(std::string_view filename);
@@ -94,15 +99,23 @@ void backupFile(std::string_view filename);
 /**
  * @brief Changes a value in a configuration file.
  *
+ * Only the value is rewritten, the comments and the rest of the file are
+ * kept. Several changes are better done in a single files::ConfFile, that
+ * writes the file once.
+ *
  * @param filename The name of the configuration file.
- * @param key The key of the value to change.
+ * @param key The key of the value to change, section.key for the keys of
+ *  a section.
  * @param value The new value to set.
  */
 void changeValueInConfigurationFile(
     const std::string&, const std::string&, std::string_view);
 
 /**
- * @brief Adds a string to a file.
+ * @brief Adds a string to a file, unless its lines are already there.
+ *
+ * Several edits of the same file are better done in a single
+ * files::FileEditSession, that writes the file once.
  *
  * @param filename The name of the file to add the string to.
  * @param string The string to add to the file.
@@ -115,6 +128,10 @@ std::string findAndReplace(const std::string_view& source,
 /**
  * @brief Copies a file, skip copying if it exists
  *
+ * The copy goes through services::files::copyFile, sharing the blocks of
+ * the source where the filesystem can. Directories are copied with their
+ * contents.
+ *
  * @param source The source file to copy.
  * @param destination The path where the source file will be copied.
  */
@@ -139,6 +156,10 @@ struct HTTPRepo {
 
 HTTPRepo createHTTPRepo(const std::string_view repoName);
 
+/**
+ * @brief Moves the files of @p sourcePath with @p extension to the backup
+ * store, once. @p backupPath links to them and marks them as backed up.
+ */
 void backupFilesByExtension(
     const wrappers::DestinationPath& backupPath,
     const wrappers::SourcePath& sourcePath,
@@ -280,37 +301,24 @@ void moveFilesWithExtension(
     removeFilesWithExtension(source, extension);
 }
 
-// @FIXME: Yes, curl works I know, but no.. fix this, use boost for
-//   requests and asynchronous I/O so we can run a bunch of these
-//   concurrently
-std::string getHttpStatus(const auto& url, const std::size_t maxRetries = 3)
-{
-    auto runner = cloyster::Singleton<IRunner>::get();
-    auto opts = cloyster::Singleton<services::Options>::get();
-    if (opts->shouldSkip("http-status")) {
-        LOG_WARN("Skipping HTTP status check for {}, assuming 200 (reason: --skip=http-status in the command line)", url);
-        return "200";
-    }
-    constexpr auto getHttpStatusInner = [](const auto& url, const auto& runner) {
-        auto lines = runner->checkOutput(fmt::format(R"(bash -c "curl -sSLI {} | awk '/HTTP/ {{print $2}}' | tail -1" )", url));
-        if (lines.size() > 0) {
-            return lines[0];
-        }
-        return std::string("CURL ERROR");
-    };
-
+/**
+ * @brief Returns the HTTP status of a batch of URLs, following redirects
+ *
+ * The URLs are probed concurrently by services::http, keep-alive connections
+ * are reused per host. A request answered with 5xx is retried up to
+ * maxRetries times. URLs that could not be reached map to "HTTP ERROR".
+ *
+ * @param urls The URLs to check, duplicates are requested once
+ * @param maxRetries Attempts per URL
+ * @return A map from each URL to its status code, ex: "200"
+ */
+std::unordered_map<std::string, std::string> getHttpStatuses(
+    const std::vector<std::string>& urls, std::size_t maxRetries = 3);
 
-    std::string header;
-    for (std::size_t i = 0; i < maxRetries; ++i) {
-        header = getHttpStatusInner(url, runner);     
-        LOG_DEBUG("HTTP status of {}: {}", url, header);
-        if (!header.starts_with("5")) {
-            LOG_DEBUG("HTTP {} error, retry {}", header, i);
-            return header;
-        }
-    }
-    return header;
-};
+/**
+ * @brief Returns the HTTP status of a single URL, see getHttpStatuses
+ */
+std::string getHttpStatus(const std::string& url, std::size_t maxRetries = 3);
 
 [[noreturn]] void abort(const fmt::string_view& fmt, auto&&... args) {
     throw std::runtime_error(fmt::format(fmt::runtime(fmt), std::forward<decltype(args)>(args)...));
@@ -7,7 +7,11 @@
 #define CLOYSTERHPC_PRESENTERNODESOPERATIONALSYSTEM_H_
 
 #include <cloysterhpc/presenter/Presenter.h>
+#include <filesystem>
+#include <map>
 #include <optional>
+#include <string>
+#include <vector>
 
 namespace cloyster::presenter {
 
@@ -36,6 +40,11 @@ private:
             struct Progress {
                 static constexpr const auto download
                     = "Downloading ISO from {0}\nSource: {1}";
+                static constexpr const auto cancelled
+                    = "The download was cancelled, it resumes from where it "
+                      "stopped on the next attempt.";
+                static constexpr const auto failed
+                    = "The download failed:\n{}";
             };
         };
 
@@ -80,6 +89,11 @@ private:
     std::optional<PresenterNodesVersionCombo> selectVersion(OS::Distro distro);
     std::string getDownloadURL(
         OS::Distro distro, PresenterNodesVersionCombo version);
+    // Downloads the ISO chosen by the user, nothing if the download was
+    // cancelled or failed
+    std::optional<std::filesystem::path> downloadIso(
+        const std::vector<std::string>& distroNames,
+        const std::map<std::string, OS::Distro>& distros);
 
 public:
     PresenterNodesOperationalSystem(
@@ -0,0 +1,126 @@
+#ifndef CLOYSTERHPC_ASYNCRUNNER_H_
+#define CLOYSTERHPC_ASYNCRUNNER_H_
+
+#include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <cloysterhpc/services/runner.h>
+
+namespace cloyster::services {
+
+/**
+ * @class AsyncRunner
+ * @brief Runs commands as C++20 coroutines on a boost::asio io_context.
+ *
+ * The runner owns an io_context driven by a background thread. Every
+ * command is a coroutine that reads stdout and stderr through
+ * boost::process async pipes and waits for the exit without blocking a
+ * thread, so many commands can be in flight at the same time.
+ *
+ * The blocking IRunner methods wait for the coroutine to finish, code that
+ * wants to overlap long jobs uses submit(), or co_await execute() from a
+ * coroutine spawned on executor(). The blocking methods must not be called
+ * from inside the io_context thread.
+ */
+class AsyncRunner : public IRunner {
+public:
+    AsyncRunner();
+    AsyncRunner(const AsyncRunner&) = delete;
+    AsyncRunner(AsyncRunner&&) = delete;
+    AsyncRunner& operator=(const AsyncRunner&) = delete;
+    AsyncRunner& operator=(AsyncRunner&&) = delete;
+    ~AsyncRunner() override;
+
+    /**
+     * @brief Runs a command, completes when it exits and both of its
+     * output streams are closed.
+     *
+     * The command leads its own process group, which is killed when
+     * @p timeout runs out or the global CancellationToken is raised. The
+     * default timeout is the one of the calling thread, see ScopedTimeout.
+     *
+     * @throws CommandTimeoutError, CommandCancelledError
+     */
+    virtual boost::asio::awaitable<CommandResult> execute(std::string cmd,
+        std::chrono::milliseconds timeout = ScopedTimeout::current());
+
+    [[nodiscard]] boost::asio::io_context::executor_type executor();
+
+    int executeCommand(const std::string& cmd) override;
+    int executeCommand(
+        const std::string& cmd, std::list<std::string>& output) override;
+    int executeCommand(const std::string& cmd, OutputBuffer& output) override;
+    CommandProxy executeCommandIter(
+        const std::string& cmd, Stream out = Stream::Stdout) override;
+    void checkCommand(const std::string& cmd) override;
+    std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
+    int downloadFile(const std::string& url, const std::string& file) override;
+    int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
+    std::future<CommandResult> submit(const std::string& cmd) override;
+
+protected:
+    // Waits, from outside of the io_context, for a coroutine to finish
+    template <typename T> T wait(boost::asio::awaitable<T> task);
+
+private:
+    boost::asio::io_context m_ctx;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        m_work;
+    std::thread m_thread;
+    // Interactive commands are handed to newt as a pipe, which is what the
+    // blocking runner already does
+    Runner m_blocking;
+
+    boost::asio::awaitable<void> batchWorker(
+        const std::vector<std::string>& cmds, std::size_t& next,
+        std::vector<CommandResult>& results,
+        std::chrono::milliseconds timeout);
+};
+
+/**
+ * @class MockAsyncRunner
+ * @brief Coroutine aware mock, records the commands without running them.
+ *
+ * Every command takes @p delay to complete on the io_context clock, so the
+ * tests can check that overlapping jobs are really in flight together.
+ */
+class MockAsyncRunner final : public AsyncRunner {
+public:
+    explicit MockAsyncRunner(
+        std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+
+    boost::asio::awaitable<CommandResult> execute(std::string cmd,
+        std::chrono::milliseconds timeout = ScopedTimeout::current()) override;
+
+    // Result returned for a given command, the default is exit code 0 and
+    // no output
+    void setResult(const std::string& cmd, CommandResult result);
+
+    [[nodiscard]] std::vector<std::string> listCommands() const;
+    [[nodiscard]] std::size_t maxInFlight() const;
+
+private:
+    std::chrono::milliseconds m_delay;
+    mutable std::mutex m_mutex;
+    std::map<std::string, CommandResult> m_results;
+    std::vector<std::string> m_cmds;
+    std::size_t m_inFlight = 0;
+    std::size_t m_maxInFlight = 0;
+};
+
+} // namespace cloyster::services
+
+#endif // CLOYSTERHPC_ASYNCRUNNER_H_
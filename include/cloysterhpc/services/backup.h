@@ -0,0 +1,90 @@
+#ifndef CLOYSTERHPC_BACKUP_H_
+#define CLOYSTERHPC_BACKUP_H_
+
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+#include <cloysterhpc/const.h>
+
+namespace cloyster::services::files {
+
+struct BackupEntry final {
+    // The run of cloysterhpc that took the backup
+    std::string run;
+    std::string timestamp;
+    // SHA-256 of the contents, empty if the file did not exist
+    std::string digest;
+    std::filesystem::path path;
+    std::filesystem::perms mode = std::filesystem::perms::none;
+    uid_t uid = 0;
+    gid_t gid = 0;
+};
+
+/**
+ * @class BackupStore
+ * @brief Content addressed store of the files changed by cloysterhpc.
+ *
+ * Each content is kept once under objects/, named by its SHA-256, so backing
+ * up a file that did not change costs a read and a line in the index. The
+ * copies are reflinks where the filesystem supports them, files moved aside
+ * are renamed into the store. The index lists, for each backup, the run, the
+ * time, the digest, the mode and the owner of the file.
+ */
+class BackupStore final {
+public:
+    explicit BackupStore(
+        std::filesystem::path root
+        = std::filesystem::path(installPath) / "backup" / "store",
+        std::string run = currentRun());
+
+    /**
+     * @brief Keeps the current contents of @p path.
+     *
+     * A path that does not exist is recorded as such, restoring it removes
+     * the file.
+     *
+     * @return The digest of the contents, empty if the file does not exist
+     */
+    std::string backup(const std::filesystem::path& path);
+
+    // Like backup(), then removes @p path
+    std::string stash(const std::filesystem::path& path);
+
+    // Every backup, oldest first
+    [[nodiscard]] std::vector<BackupEntry> list() const;
+    // The runs with backups, oldest first
+    [[nodiscard]] std::vector<std::string> runs() const;
+
+    /**
+     * @brief Puts back the files backed up by @p run as they were before it
+     * changed them.
+     *
+     * @return The number of files restored
+     */
+    std::size_t restore(std::string_view run) const;
+
+    [[nodiscard]] const std::string& run() const { return m_run; }
+    [[nodiscard]] std::filesystem::path object(std::string_view digest) const;
+
+    // The run of this process, its start time and PID
+    static std::string currentRun();
+
+private:
+    std::filesystem::path m_root;
+    std::string m_run;
+    mutable std::mutex m_mutex;
+    // What this run already backed up, as path and digest
+    std::set<std::pair<std::string, std::string>> m_recorded;
+
+    std::string store(const std::filesystem::path& path, bool move);
+    void record(const BackupEntry& entry);
+};
+
+} // namespace cloyster::services::files
+
+#endif // CLOYSTERHPC_BACKUP_H_
@@ -0,0 +1,91 @@
+#ifndef CLOYSTERHPC_CACHINGRUNNER_H_
+#define CLOYSTERHPC_CACHINGRUNNER_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cloysterhpc/services/runner.h>
+
+namespace cloyster::services {
+
+/**
+ * @class CachingRunner
+ * @brief Decorator that memoizes the output of read-only commands.
+ *
+ * Commands starting with one of the pure prefixes (uname -r, rpm -q,
+ * locale -a...) are run once, later calls are answered from the cache as
+ * long as they succeeded. Any command starting with one of the mutating
+ * prefixes (dnf, rpm -i...) and every script drops the whole cache, since
+ * it may change what the pure commands report. Everything else is passed
+ * through to the wrapped runner untouched.
+ */
+class CachingRunner final : public IRunner {
+public:
+    struct Stats {
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t invalidations = 0;
+    };
+
+    static std::vector<std::string> defaultPureCommands();
+    static std::vector<std::string> defaultMutatingCommands();
+
+    explicit CachingRunner(std::unique_ptr<IRunner> runner,
+        std::vector<std::string> pure = defaultPureCommands(),
+        std::vector<std::string> mutating = defaultMutatingCommands());
+    CachingRunner(const CachingRunner&) = delete;
+    CachingRunner(CachingRunner&&) = delete;
+    CachingRunner& operator=(const CachingRunner&) = delete;
+    CachingRunner& operator=(CachingRunner&&) = delete;
+    ~CachingRunner() override;
+
+    int executeCommand(const std::string& cmd) override;
+    int executeCommand(
+        const std::string& cmd, std::list<std::string>& output) override;
+    int executeCommand(const std::string& cmd, OutputBuffer& output) override;
+    CommandProxy executeCommandIter(
+        const std::string& cmd, Stream out = Stream::Stdout) override;
+    void checkCommand(const std::string& cmd) override;
+    std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
+    int downloadFile(const std::string& url, const std::string& file) override;
+    int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
+    std::future<CommandResult> submit(const std::string& cmd) override;
+
+    [[nodiscard]] bool isPure(const std::string& cmd) const;
+    [[nodiscard]] bool isMutating(const std::string& cmd) const;
+
+    // Drops every cached output
+    void invalidate();
+    [[nodiscard]] Stats stats() const;
+
+private:
+    struct Entry {
+        int exitCode;
+        std::string output;
+    };
+
+    std::unique_ptr<IRunner> m_runner;
+    std::vector<std::string> m_pure;
+    std::vector<std::string> m_mutating;
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, Entry> m_cache;
+    Stats m_stats;
+
+    // Answers a pure command from the cache, or runs it with fetch
+    int cached(const std::string& cmd, OutputBuffer& output,
+        const std::function<int(OutputBuffer&)>& fetch);
+    void invalidateIfMutating(const std::string& cmd);
+};
+
+} // namespace cloyster::services
+
+#endif // CLOYSTERHPC_CACHINGRUNNER_H_
@@ -0,0 +1,50 @@
+#ifndef CLOYSTERHPC_CANCELLATION_H_
+#define CLOYSTERHPC_CANCELLATION_H_
+
+#include <atomic>
+
+namespace cloyster::services {
+
+/**
+ * @class CancellationToken
+ * @brief Flag that interrupts the running commands when raised.
+ *
+ * The token is backed by an eventfd, so the runners can poll it along with
+ * the pipes of a command. cancel() is async-signal-safe and may be called
+ * from any thread or from a signal handler.
+ */
+class CancellationToken final {
+public:
+    CancellationToken();
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken(CancellationToken&&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+    CancellationToken& operator=(CancellationToken&&) = delete;
+    ~CancellationToken();
+
+    void cancel() noexcept;
+    void reset();
+    [[nodiscard]] bool cancelled() const noexcept;
+
+    // Polls readable once the token is cancelled, until reset()
+    [[nodiscard]] int fd() const noexcept { return m_fd; }
+
+    // Token observed by every command the runners start
+    static CancellationToken& global();
+
+    /**
+     * @brief SIGINT and SIGTERM cancel the global token.
+     *
+     * The handlers are one shot, a second signal has the default behavior,
+     * so a stuck process can still be interrupted.
+     */
+    static void installSignalHandlers();
+
+private:
+    int m_fd;
+    std::atomic<bool> m_cancelled = false;
+};
+
+} // namespace cloyster::services
+
+#endif // CLOYSTERHPC_CANCELLATION_H_
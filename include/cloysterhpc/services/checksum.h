@@ -0,0 +1,78 @@
+#ifndef CLOYSTERHPC_CHECKSUM_H_
+#define CLOYSTERHPC_CHECKSUM_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// EVP_MD_CTX of OpenSSL
+struct evp_md_ctx_st;
+
+namespace cloyster::services::files {
+
+// Called with the bytes hashed so far and the size of the file
+using ChecksumProgress
+    = std::function<void(std::uint64_t hashed, std::uint64_t total)>;
+
+/**
+ * @class Sha256
+ * @brief Incremental SHA-256 through OpenSSL EVP, the one every digest of
+ * cloysterhpc goes through.
+ */
+class Sha256 final {
+public:
+    Sha256();
+
+    void update(std::string_view data);
+    // Ends the digest, as a lowercase hex string
+    std::string hex();
+
+private:
+    struct Free final {
+        void operator()(evp_md_ctx_st* ctx) const;
+    };
+    std::unique_ptr<evp_md_ctx_st, Free> m_ctx;
+};
+
+/**
+ * @brief SHA-256 of a file, as a lowercase hex string
+ *
+ * The file is mapped and hashed through OpenSSL EVP, which picks the SHA-NI
+ * or AVX2 code paths of the CPU. A helper thread faults the mapping in ahead
+ * of the digest, so the disk reads overlap the hashing.
+ */
+std::string sha256(
+    const std::filesystem::path& path, const ChecksumProgress& progress = {});
+
+/**
+ * @class ChecksumCache
+ * @brief Remembers the SHA-256 of files between runs.
+ *
+ * Entries are keyed by device, inode, size and modification time, a file
+ * that is replaced or modified is hashed again.
+ */
+class ChecksumCache final {
+public:
+    static constexpr auto defaultPath = "/var/cache/cloysterhpc/checksums";
+
+    explicit ChecksumCache(std::filesystem::path cacheFile = defaultPath);
+
+    [[nodiscard]] std::optional<std::string> lookup(
+        const std::filesystem::path& path) const;
+    void store(const std::filesystem::path& path, const std::string& digest);
+
+    // Cached digest of @p path, hashing and storing it on a miss
+    std::string sha256(const std::filesystem::path& path,
+        const ChecksumProgress& progress = {});
+
+private:
+    std::filesystem::path m_cacheFile;
+};
+
+} // namespace cloyster::services::files
+
+#endif // CLOYSTERHPC_CHECKSUM_H_
@@ -0,0 +1,112 @@
+#ifndef CLOYSTERHPC_CONFFILE_H_
+#define CLOYSTERHPC_CONFFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cloyster::services::files {
+
+/**
+ * @class ConfFile
+ * @brief Configuration file edited in place.
+ *
+ * Only the values that change are rewritten: comments, blank lines, the
+ * lines without a key, the order and the spacing are kept byte for byte.
+ * Keys missing from the file are added at the end of their section. Every
+ * change is written at once by commit().
+ */
+class ConfFile final {
+public:
+    enum class Format : std::uint8_t {
+        // [section] headers and key=value, comments start with # or ;
+        Ini,
+        // key=value, as in /etc/sysconfig and slurm.conf
+        KeyEquals,
+        // key value, as in sshd_config and chrony.conf
+        KeyValue
+    };
+
+    // A missing file is edited as an empty one, and created on commit
+    explicit ConfFile(std::filesystem::path path, Format format = Format::Ini);
+
+    // The last value of the key, as the programs reading these files do
+    [[nodiscard]] std::optional<std::string> get(
+        std::string_view key, std::string_view section = {}) const;
+
+    /**
+     * @brief Sets every occurrence of the key to @p value, or adds the key
+     * if it is not in the file.
+     *
+     * The value is written as is, quotes included.
+     */
+    void set(std::string_view key, std::string_view value,
+        std::string_view section = {});
+
+    /**
+     * @brief Removes the lines of the key.
+     *
+     * @return The number of lines removed
+     */
+    std::size_t remove(std::string_view key, std::string_view section = {});
+
+    // The file as it would be written
+    [[nodiscard]] std::string contents() const;
+    [[nodiscard]] bool changed() const;
+
+    // The removed and added lines
+    [[nodiscard]] std::string diff() const;
+
+    /**
+     * @brief Writes the file if it changed, logging the diff instead on dry
+     * runs.
+     *
+     * @return True if the file was written, or would be on a dry run
+     * @throws FileException when the file cannot be written
+     */
+    bool commit();
+
+    [[nodiscard]] const std::filesystem::path& path() const { return m_path; }
+
+private:
+    struct Entry final {
+        std::string section;
+        std::string key;
+        // Byte ranges in the original contents, the line includes its
+        // newline
+        std::size_t lineBegin = 0;
+        std::size_t lineEnd = 0;
+        std::size_t valueBegin = 0;
+        std::size_t valueEnd = 0;
+        // The line has a key and no value, nor a separator before it
+        bool bare = false;
+        bool original = true;
+        bool removed = false;
+        // Set when the value changed, or for the keys added
+        std::optional<std::string> value;
+        // A section header written before an added key
+        std::string header;
+    };
+
+    std::filesystem::path m_path;
+    Format m_format;
+    std::string m_data;
+    std::vector<Entry> m_entries;
+    // Positions of the entries by section and key
+    std::unordered_map<std::string, std::vector<std::size_t>> m_index;
+    // Where the keys added to each section go
+    std::unordered_map<std::string, std::size_t> m_sectionEnd;
+
+    void parse();
+    [[nodiscard]] std::string line(const Entry& entry) const;
+    [[nodiscard]] std::string originalLine(const Entry& entry) const;
+};
+
+} // namespace cloyster::services::files
+
+#endif // CLOYSTERHPC_CONFFILE_H_
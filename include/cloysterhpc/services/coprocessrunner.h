@@ -0,0 +1,79 @@
+#ifndef CLOYSTERHPC_COPROCESSRUNNER_H_
+#define CLOYSTERHPC_COPROCESSRUNNER_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/process.hpp>
+
+#include <cloysterhpc/services/runner.h>
+
+namespace cloyster::services {
+
+/**
+ * @class CoprocessRunner
+ * @brief Runs the commands through a single long-lived bash process.
+ *
+ * Each command is split in arguments the same way boost::process splits it
+ * for Runner, quoted for bash, and run in a subshell with its stdin closed,
+ * followed by a sentinel line carrying a per-command token and the exit
+ * status. The `bash -c "..."` wrappers used all over the code base run
+ * their script directly in the subshell, so they fork the coprocess instead
+ * of starting a new bash.
+ *
+ * Commands are serialized. Batches and interactive commands need concurrent
+ * processes and are handed to a regular Runner. The shell is restarted if
+ * it dies.
+ *
+ * The shell leads its own process group. A command that runs past its
+ * timeout, or the global CancellationToken, kills the whole group, shell
+ * included, and the next command starts a new shell.
+ */
+class CoprocessRunner final : public IRunner {
+public:
+    CoprocessRunner();
+    CoprocessRunner(const CoprocessRunner&) = delete;
+    CoprocessRunner(CoprocessRunner&&) = delete;
+    CoprocessRunner& operator=(const CoprocessRunner&) = delete;
+    CoprocessRunner& operator=(CoprocessRunner&&) = delete;
+    ~CoprocessRunner() override;
+
+    int executeCommand(const std::string& cmd) override;
+    int executeCommand(
+        const std::string& cmd, std::list<std::string>& output) override;
+    int executeCommand(const std::string& cmd, OutputBuffer& output) override;
+    CommandProxy executeCommandIter(
+        const std::string& cmd, Stream out = Stream::Stdout) override;
+    void checkCommand(const std::string& cmd) override;
+    std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
+    int downloadFile(const std::string& url, const std::string& file) override;
+    int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
+
+    // Arguments of @p cmd as boost::process would pass them to execve
+    [[nodiscard]] static std::vector<std::string> splitArguments(
+        const std::string& cmd);
+    // Bash code running @p cmd with the same arguments
+    [[nodiscard]] static std::string toShell(const std::string& cmd);
+
+private:
+    std::mutex m_mutex;
+    boost::process::opstream m_input;
+    boost::process::pipe m_output;
+    boost::process::child m_shell;
+    std::string m_token;
+    std::uint64_t m_sequence = 0;
+    Runner m_runner;
+
+    void start();
+    void stop();
+};
+
+} // namespace cloyster::services
+
+#endif // CLOYSTERHPC_COPROCESSRUNNER_H_
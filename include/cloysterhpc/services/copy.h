@@ -0,0 +1,84 @@
+#ifndef CLOYSTERHPC_COPY_H_
+#define CLOYSTERHPC_COPY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+/**
+ * @brief Copies files the cheapest way the filesystems allow
+ *
+ * A copy first tries to share the blocks of the source (FICLONE, on XFS and
+ * Btrfs), then lets the kernel copy the data (copy_file_range, which NFS
+ * and XFS can offload), then falls back to sendfile. The data never goes
+ * through user space.
+ */
+namespace cloyster::services::files {
+
+enum class CopyMethod : std::uint8_t { Skipped, Reflink, CopyRange, Sendfile };
+
+struct CopyOptions final {
+    // Replace existing files, else they are left alone
+    bool overwrite = false;
+    // Give the copies the owner of the sources, when running as root
+    bool preserveOwner = true;
+    // Files copied at the same time, zero picks from the CPUs
+    unsigned jobs = 0;
+};
+
+struct CopyReport final {
+    std::size_t files = 0;
+    std::uint64_t bytes = 0;
+    // Copies sharing the blocks of the source, no data was copied
+    std::size_t reflinked = 0;
+    // Existing files left alone
+    std::size_t skipped = 0;
+
+    void add(CopyMethod method, std::uint64_t size);
+};
+
+// @p size bytes at @p source of one file, copied to @p target of another
+struct CopyExtent final {
+    std::uint64_t source = 0;
+    std::uint64_t target = 0;
+    std::uint64_t size = 0;
+};
+
+/**
+ * @brief Copies @p extent between the open files @p from and @p to.
+ *
+ * The blocks are shared with FICLONERANGE where the extent is aligned to
+ * them, the fallbacks are those of copyFile(). @p name only appears in the
+ * errors.
+ *
+ * @throws FileException when the extent cannot be copied, or @p from ends
+ * before it
+ */
+CopyMethod copyExtent(int from, int to, const CopyExtent& extent,
+    const std::filesystem::path& name);
+
+/**
+ * @brief Copies the file @p from to @p to, keeping its mode.
+ *
+ * @throws FileException when the file cannot be copied
+ */
+CopyMethod copyFile(const std::filesystem::path& from,
+    const std::filesystem::path& to, const CopyOptions& options = {});
+
+// Copies the files into @p directory, at the same time
+CopyReport copyFiles(std::span<const std::filesystem::path> files,
+    const std::filesystem::path& directory, const CopyOptions& options = {});
+
+/**
+ * @brief Copies the directory @p from into @p to.
+ *
+ * Directories and symbolic links are created first, then the files are
+ * copied at the same time. Modes and owners are kept.
+ */
+CopyReport copyTree(const std::filesystem::path& from,
+    const std::filesystem::path& to, const CopyOptions& options = {});
+
+} // namespace cloyster::services::files
+
+#endif // CLOYSTERHPC_COPY_H_
@@ -0,0 +1,42 @@
+#ifndef CLOYSTERHPC_DESCRIPTOR_H_
+#define CLOYSTERHPC_DESCRIPTOR_H_
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace cloyster::services::files {
+
+/**
+ * @class Descriptor
+ * @brief Owns a file descriptor and closes it.
+ *
+ * A negative descriptor, such as the result of a failed open(2), owns
+ * nothing, so the callers check get() and report errno themselves.
+ */
+class Descriptor final {
+public:
+    Descriptor() = default;
+    explicit Descriptor(int fd) noexcept
+        : m_fd(fd)
+    {
+    }
+    Descriptor(const Descriptor&) = delete;
+    Descriptor& operator=(const Descriptor&) = delete;
+    Descriptor(Descriptor&& other) noexcept;
+    Descriptor& operator=(Descriptor&& other) noexcept;
+    ~Descriptor();
+
+    [[nodiscard]] int get() const noexcept { return m_fd; }
+
+private:
+    int m_fd = -1;
+};
+
+// "<what> <path>: <error>" with the error of errno
+std::string errorMessage(
+    std::string_view what, const std::filesystem::path& path);
+
+} // namespace cloyster::services::files
+
+#endif // CLOYSTERHPC_DESCRIPTOR_H_
@@ -0,0 +1,83 @@
+#ifndef CLOYSTER_SERVICES_DOWNLOADER_H
+#define CLOYSTER_SERVICES_DOWNLOADER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <stop_token>
+#include <string>
+
+/**
+ * @brief Native segmented downloader for ISOs and other large files
+ *
+ * The file is split in segments fetched concurrently with HTTP range
+ * requests on a private boost::asio io_context, written in place with
+ * pwrite and hashed with SHA-256 while it arrives. The data lands in
+ * `<file>.part`, next to a small state file recording the progress of each
+ * segment, so an interrupted download resumes where it stopped. The part
+ * file is renamed to its final name once it is complete and verified.
+ */
+namespace cloyster::services::http {
+
+using namespace std::chrono_literals;
+
+struct DownloadProgress final {
+    std::uint64_t received = 0;
+    // Unknown when the server does not send a Content-Length
+    std::optional<std::uint64_t> total;
+    // Average over this run, resumed bytes are not counted
+    double bytesPerSecond = 0;
+    std::optional<std::chrono::seconds> eta;
+
+    [[nodiscard]] std::optional<double> percent() const;
+};
+
+struct DownloadOptions final {
+    // Range requests in flight at the same time
+    std::size_t segments = 4;
+    // Files smaller than segments * minSegmentSize use fewer segments
+    std::uint64_t minSegmentSize = 8 * 1024 * 1024;
+    // Applies to each connect, TLS handshake, write and read
+    std::chrono::milliseconds timeout = 30s;
+    std::size_t maxRedirects = 10;
+    // Attempts per segment, each one resumes where the previous stopped
+    std::size_t maxRetries = 5;
+    // Lowercase hex digest the file must match
+    std::optional<std::string> sha256;
+    std::function<void(const DownloadProgress&)> progress;
+    std::chrono::milliseconds progressInterval = 250ms;
+    // Stops the download, it stays resumable
+    std::stop_token stop;
+};
+
+struct DownloadResult final {
+    std::filesystem::path path;
+    std::uint64_t size = 0;
+    // Empty when an up to date file was kept and no digest was requested
+    std::string sha256;
+    // Bytes already on disk from a previous attempt
+    std::uint64_t resumed = 0;
+    // The file was already complete, like wget -N
+    bool upToDate = false;
+};
+
+/**
+ * @brief Download @p url to @p file
+ *
+ * An existing @p file with the same size as the remote one is kept. Servers
+ * without range support are downloaded over a single stream, from the
+ * beginning.
+ *
+ * @throws std::runtime_error on HTTP errors, when the retries run out or when
+ * the digest does not match; CommandCancelledError when stopped or when the
+ * global CancellationToken is raised.
+ */
+DownloadResult download(const std::string& url,
+    const std::filesystem::path& file, const DownloadOptions& options = {});
+
+} // namespace cloyster::services::http
+
+#endif // CLOYSTER_SERVICES_DOWNLOADER_H
@@ -0,0 +1,107 @@
+#ifndef CLOYSTERHPC_FILEEDIT_H_
+#define CLOYSTERHPC_FILEEDIT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cloyster::services::files {
+
+/**
+ * @brief Replaces the contents of @p path at once.
+ *
+ * Writes a temporary file next to @p path and renames it over, so readers
+ * see either the old or the new contents. The mode and owner of the file
+ * are kept, and a symbolic link is followed instead of replaced.
+ *
+ * @throws FileException when the file cannot be written
+ */
+void writeFileAtomically(
+    const std::filesystem::path& path, std::string_view contents);
+
+/**
+ * @class FileEditSession
+ * @brief Several edits of a text file, written once.
+ *
+ * The file is read when the session starts and kept as lines, with an index
+ * of the line contents and of the key each line starts with, so looking for
+ * a line does not scan the file. commit() writes a temporary file next to
+ * the original and renames it over, keeping the mode and owner, unless the
+ * contents did not change. On dry runs it only logs the diff.
+ */
+class FileEditSession final {
+public:
+    // A missing file is edited as an empty one, and created on commit
+    explicit FileEditSession(std::filesystem::path path);
+
+    /**
+     * @brief Appends @p text unless its lines are already in the file, one
+     * after the other.
+     *
+     * @return True if the text was appended
+     */
+    bool appendIfAbsent(std::string_view text);
+
+    /**
+     * @brief Replaces the lines equal to @p line.
+     *
+     * @return The number of lines replaced
+     */
+    std::size_t replaceLine(std::string_view line, std::string_view replacement);
+
+    /**
+     * @brief Removes the lines that set @p key, such as "key value" or
+     * "key=value".
+     *
+     * @return The number of lines removed
+     */
+    std::size_t removeLinesWithKey(std::string_view key);
+
+    // The file as it would be written
+    [[nodiscard]] std::string contents() const;
+    [[nodiscard]] bool changed() const;
+
+    // The removed and added lines, in the order of the file
+    [[nodiscard]] std::string diff() const;
+
+    /**
+     * @brief Writes the file if it changed.
+     *
+     * @return True if the file was written, or would be on a dry run
+     * @throws FileException when the file cannot be written
+     */
+    bool commit();
+
+    [[nodiscard]] const std::filesystem::path& path() const { return m_path; }
+
+private:
+    struct Line final {
+        std::string text;
+        // The text read from the file, empty for the lines added
+        std::string before;
+        bool original = false;
+        bool removed = false;
+    };
+
+    std::filesystem::path m_path;
+    std::string m_original;
+    std::vector<Line> m_lines;
+    bool m_finalNewline = true;
+    // Positions of the lines that are not removed, by the hash of their
+    // text and of their key
+    std::unordered_multimap<std::size_t, std::size_t> m_byText;
+    std::unordered_multimap<std::size_t, std::size_t> m_byKey;
+
+    void index(std::size_t position);
+    void unindex(std::size_t position);
+    [[nodiscard]] bool containsBlock(
+        const std::vector<std::string_view>& block) const;
+};
+
+} // namespace cloyster::services::files
+
+#endif // CLOYSTERHPC_FILEEDIT_H_
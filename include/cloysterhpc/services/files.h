@@ -10,8 +10,6 @@
 
 namespace cloyster::services::files {
 
-constexpr std::size_t CHUNK_SIZE = 16384;
-
 template <typename File>
 concept IsKeyFileReadable = requires(
     const File& file, const std::string& group, const std::string& key) {
@@ -94,8 +92,8 @@ static_assert(concepts::IsMoveable<KeyFile>);
 static_assert(!concepts::IsCopyable<KeyFile>);
 
 std::string checksum(const std::string& data);
-std::string checksum(const std::filesystem::path& path,
-    const std::size_t chunkSize = CHUNK_SIZE);
+// SHA-256 of a file, see sha256() in checksum.h
+std::string checksum(const std::filesystem::path& path);
 };
 
 #endif
@@ -0,0 +1,88 @@
+#ifndef CLOYSTER_SERVICES_HTTP_H
+#define CLOYSTER_SERVICES_HTTP_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Native HTTP(S) client used to probe repository URLs
+ *
+ * The client runs every request of a batch as a coroutine on a private
+ * boost::asio io_context, so dozens of `repomd.xml` and GPG key checks are
+ * done concurrently without forking a curl process per URL. Connections are
+ * kept alive and reused per scheme/host/port.
+ */
+namespace cloyster::services::http {
+
+using namespace std::chrono_literals;
+
+enum class Method : std::uint8_t { Head, Get };
+
+/**
+ * @brief Split view of an absolute http:// or https:// URL
+ */
+struct Url final {
+    std::string scheme; // http or https
+    std::string host;
+    std::string port;
+    std::string target; // path and query, always starts with /
+
+    [[nodiscard]] static std::optional<Url> parse(std::string_view url);
+
+    // scheme://host:port, used as the key of the connection pool
+    [[nodiscard]] std::string origin() const;
+    [[nodiscard]] std::string str() const;
+    [[nodiscard]] bool tls() const { return scheme == "https"; }
+
+    // Resolve a Location header value against this URL
+    [[nodiscard]] std::optional<Url> resolve(std::string_view location) const;
+};
+
+struct ProbeOptions final {
+    Method method = Method::Head;
+    // Requests in flight at the same time for the whole batch
+    std::size_t concurrency = 16;
+    // Open connections to the same origin, idle ones are reused
+    std::size_t connectionsPerHost = 4;
+    // Applies to each connect, TLS handshake, write and read
+    std::chrono::milliseconds timeout = 15s;
+    std::size_t maxRedirects = 10;
+    // Attempts per URL, a new attempt is made only on 5xx answers
+    std::size_t maxRetries = 3;
+};
+
+struct ProbeResult final {
+    // Status of the last response after following redirects, 0 when the
+    // request failed before receiving a response
+    unsigned int status = 0;
+    std::string effectiveUrl;
+    std::string error;
+
+    [[nodiscard]] bool ok() const { return status == 200; }
+};
+
+using ProbeResults = std::unordered_map<std::string, ProbeResult>;
+
+/**
+ * @brief Probe a batch of URLs concurrently
+ *
+ * Duplicated URLs are requested once. Every URL in the input has an entry
+ * in the output, transport errors are reported in ProbeResult::error.
+ */
+ProbeResults probe(
+    const std::vector<std::string>& urls, const ProbeOptions& options = {});
+
+/**
+ * @brief Probe a single URL, see probe(urls, options)
+ */
+ProbeResult probe(const std::string& url, const ProbeOptions& options = {});
+
+} // namespace cloyster::services::http
+
+#endif // CLOYSTER_SERVICES_HTTP_H
@@ -0,0 +1,153 @@
+#ifndef CLOYSTER_SERVICES_HTTPCLIENT_H
+#define CLOYSTER_SERVICES_HTTPCLIENT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+
+#include <cloysterhpc/services/http.h>
+
+/**
+ * @brief Connection plumbing shared by the prober and the downloader
+ *
+ * Both go through the same Connector, so every HTTPS request is verified
+ * against the system trust store and the host name, with SNI, the same way.
+ */
+namespace cloyster::services::http {
+
+constexpr auto userAgent = "cloysterhpc";
+
+[[nodiscard]] bool isRedirect(unsigned int status);
+
+struct Proxy final {
+    Url url;
+    // Proxy-Authorization value, empty when the proxy URL has no credentials
+    std::string authorization;
+};
+
+/**
+ * @brief The proxy @p url goes through, picked from the environment as curl
+ * does: http_proxy for http, https_proxy or HTTPS_PROXY for https, then
+ * all_proxy or ALL_PROXY, unless the host matches no_proxy or NO_PROXY.
+ * Loopback hosts never go through a proxy.
+ *
+ * @throws std::runtime_error when the proxy is not an http:// URL
+ */
+[[nodiscard]] std::optional<Proxy> proxyFor(const Url& url);
+
+struct Connection final {
+    std::unique_ptr<boost::beast::tcp_stream> plain;
+    std::unique_ptr<boost::beast::ssl_stream<boost::beast::tcp_stream>> secure;
+    boost::beast::flat_buffer buffer;
+    // Taken from the idle pool instead of freshly connected
+    bool reused = false;
+    // Plain HTTP sent to a proxy, HTTPS goes through a CONNECT tunnel instead
+    std::optional<Proxy> forward;
+
+    boost::beast::tcp_stream& socket()
+    {
+        return secure ? boost::beast::get_lowest_layer(*secure) : *plain;
+    }
+};
+
+/**
+ * @class Connector
+ * @brief Resolves, connects and runs the TLS handshake, each step bounded
+ * by the timeout. Connections go through the proxy of proxyFor(), HTTPS
+ * ones in a CONNECT tunnel.
+ */
+class Connector final {
+    boost::asio::io_context& m_ctx;
+    boost::asio::ssl::context m_tls { boost::asio::ssl::context::tls_client };
+    boost::asio::ip::tcp::resolver m_resolver;
+    std::chrono::milliseconds m_timeout;
+
+public:
+    Connector(boost::asio::io_context& ctx, std::chrono::milliseconds timeout);
+
+    boost::asio::awaitable<std::unique_ptr<Connection>> connect(const Url& url);
+
+private:
+    boost::asio::awaitable<void> tunnel(
+        boost::beast::tcp_stream& socket, const Url& url, const Proxy& proxy);
+};
+
+/**
+ * @brief Request for @p url with the Host and User-Agent headers set.
+ *
+ * Requests sent to a proxy, @p forward, carry the absolute URL and the
+ * credentials of the proxy.
+ */
+[[nodiscard]] boost::beast::http::request<boost::beast::http::empty_body>
+makeRequest(boost::beast::http::verb verb, const Url& url, bool keepAlive,
+    const std::optional<Proxy>& forward);
+
+#ifdef BUILD_TESTING
+/**
+ * @class LoopbackServer
+ * @brief HTTP server on a random loopback port for the tests, each accepted
+ * connection is handed to the session coroutine on the server thread.
+ */
+class LoopbackServer final {
+public:
+    using Session = std::function<boost::asio::awaitable<void>(
+        boost::asio::ip::tcp::socket)>;
+
+    explicit LoopbackServer(Session session);
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+    LoopbackServer(LoopbackServer&&) = delete;
+    LoopbackServer& operator=(LoopbackServer&&) = delete;
+    ~LoopbackServer();
+
+    [[nodiscard]] std::string url(std::string_view path) const;
+    [[nodiscard]] std::size_t connections() const { return m_connections; }
+
+private:
+    boost::asio::io_context m_ctx;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    Session m_session;
+    std::atomic<std::size_t> m_connections = 0;
+    std::thread m_thread;
+
+    boost::asio::awaitable<void> listen();
+};
+
+/**
+ * @class ProxyEnvironment
+ * @brief Clears the proxy variables for a test, and puts them back when
+ * destroyed.
+ */
+class ProxyEnvironment final {
+public:
+    ProxyEnvironment();
+    ProxyEnvironment(const ProxyEnvironment&) = delete;
+    ProxyEnvironment& operator=(const ProxyEnvironment&) = delete;
+    ProxyEnvironment(ProxyEnvironment&&) = delete;
+    ProxyEnvironment& operator=(ProxyEnvironment&&) = delete;
+    ~ProxyEnvironment();
+
+    void set(const char* name, const std::string& value);
+
+private:
+    std::vector<std::pair<const char*, std::optional<std::string>>> m_saved;
+};
+#endif
+
+} // namespace cloyster::services::http
+
+#endif // CLOYSTER_SERVICES_HTTPCLIENT_H
@@ -0,0 +1,124 @@
+#ifndef CLOYSTERHPC_IPMI_H_
+#define CLOYSTERHPC_IPMI_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <cloysterhpc/services/bmc.h>
+
+/**
+ * @brief Native IPMI 2.0 client for the BMCs of the nodes
+ *
+ * Sessions are RMCP+ over UDP, authenticated with RAKP-HMAC-SHA1 and
+ * protected with HMAC-SHA1-96 and AES-CBC-128 (cipher suite 3, what
+ * `ipmitool -I lanplus` picks by default). Every BMC of a batch is talked
+ * to at once from a single thread on a private boost::asio io_context,
+ * instead of an rpower or ipmitool process per node.
+ */
+namespace cloyster::services::ipmi {
+
+using namespace std::chrono_literals;
+
+struct Endpoint final {
+    std::string host;
+    std::uint16_t port = 623;
+    std::string username;
+    std::string password;
+};
+
+enum class PowerState : std::uint8_t { Off, On };
+
+// Values of the Chassis Control command
+enum class ChassisControl : std::uint8_t {
+    PowerOff = 0x00,
+    PowerOn = 0x01,
+    PowerCycle = 0x02,
+    HardReset = 0x03,
+    SoftShutdown = 0x05
+};
+
+// Boot device selectors of the boot flags parameter
+enum class BootDevice : std::uint8_t {
+    Network = 0x04,
+    Disk = 0x08,
+    Cdrom = 0x14,
+    Setup = 0x18
+};
+
+struct Reply final {
+    // Empty on success
+    std::string error;
+    // Set by powerState(), and by netboot() to the state before the reset
+    std::optional<PowerState> power;
+
+    [[nodiscard]] bool ok() const { return error.empty(); }
+};
+
+/**
+ * @class IPMIBackend
+ * @brief BMC operations on a batch of endpoints.
+ *
+ * Replies are in the order of the endpoints, a BMC that fails does not
+ * fail the others.
+ */
+class IPMIBackend {
+public:
+    IPMIBackend() = default;
+    IPMIBackend(const IPMIBackend&) = delete;
+    IPMIBackend(IPMIBackend&&) = delete;
+    IPMIBackend& operator=(const IPMIBackend&) = delete;
+    IPMIBackend& operator=(IPMIBackend&&) = delete;
+    virtual ~IPMIBackend() = default;
+
+    virtual std::vector<Reply> powerState(std::span<const Endpoint> bmcs) = 0;
+    virtual std::vector<Reply> chassisControl(
+        std::span<const Endpoint> bmcs, ChassisControl control)
+        = 0;
+    virtual std::vector<Reply> setBootDevice(std::span<const Endpoint> bmcs,
+        BootDevice device, bool persistent = false)
+        = 0;
+
+    /**
+     * @brief Boots from the network once, resetting the nodes that are on
+     * and powering on the others, in a single session per BMC.
+     */
+    virtual std::vector<Reply> netboot(std::span<const Endpoint> bmcs) = 0;
+};
+
+struct ClientOptions final {
+    // BMCs with a session open at the same time
+    std::size_t concurrency = 256;
+    // For each request, then the request is sent again
+    std::chrono::milliseconds timeout = 1s;
+    std::size_t retries = 3;
+};
+
+/**
+ * @class Client
+ * @brief IPMIBackend that speaks RMCP+ to the BMCs.
+ */
+class Client final : public IPMIBackend {
+public:
+    explicit Client(ClientOptions options = {});
+
+    std::vector<Reply> powerState(std::span<const Endpoint> bmcs) override;
+    std::vector<Reply> chassisControl(
+        std::span<const Endpoint> bmcs, ChassisControl control) override;
+    std::vector<Reply> setBootDevice(std::span<const Endpoint> bmcs,
+        BootDevice device, bool persistent = false) override;
+    std::vector<Reply> netboot(std::span<const Endpoint> bmcs) override;
+
+private:
+    ClientOptions m_options;
+};
+
+[[nodiscard]] Endpoint endpoint(const BMC& bmc);
+
+} // namespace cloyster::services::ipmi
+
+#endif // CLOYSTERHPC_IPMI_H_
@@ -0,0 +1,164 @@
+#ifndef CLOYSTERHPC_ISO9660_H_
+#define CLOYSTERHPC_ISO9660_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Read-only access to ISO9660 images without mounting them
+ *
+ * The image is memory mapped and only the pages that are looked at are
+ * read: the volume descriptors, the directories on the way and the files
+ * themselves. File names are taken from Rock Ridge when the image has it,
+ * since Joliet truncates long names, then from the Joliet tree, then from
+ * the plain ISO9660 names.
+ */
+namespace cloyster::services::iso9660 {
+
+constexpr std::size_t sectorSize = 2048;
+
+struct VolumeDescriptor final {
+    std::string systemId;
+    std::string volumeId;
+    std::string publisherId;
+    std::string applicationId;
+    // In logical blocks
+    std::uint32_t volumeSize = 0;
+};
+
+/**
+ * @brief What an installation image says about itself
+ *
+ * Read from `.treeinfo`, or from `media.repo` and the volume label on
+ * images that do not carry one.
+ */
+struct Release final {
+    // Product name, such as "Rocky Linux" or "Red Hat Enterprise Linux"
+    std::string name;
+    std::string version;
+    std::string arch;
+    std::string volumeId;
+};
+
+class Image final {
+public:
+    struct Entry final {
+        // Relative to the root of the image, such as "BaseOS/repodata"
+        std::string path;
+        bool directory = false;
+        std::uint64_t size = 0;
+        // Byte offsets and lengths in the image, files over 4GiB have several
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> extents;
+    };
+
+    /**
+     * @throws std::runtime_error if @p path is not an ISO9660 image
+     */
+    explicit Image(const std::filesystem::path& path);
+    Image(const Image&) = delete;
+    Image(Image&& other) noexcept;
+    Image& operator=(const Image&) = delete;
+    Image& operator=(Image&&) = delete;
+    ~Image();
+
+    [[nodiscard]] const VolumeDescriptor& primary() const { return m_primary; }
+    [[nodiscard]] bool joliet() const { return m_jolietRoot.has_value(); }
+    [[nodiscard]] bool rockRidge() const { return m_rockRidge; }
+
+    /**
+     * @brief Contents of the file at @p path, such as "/.treeinfo"
+     *
+     * Names are compared case insensitively. Files larger than @p limit are
+     * not read.
+     */
+    [[nodiscard]] std::optional<std::string> readFile(
+        std::string_view path, std::size_t limit = 1024 * 1024) const;
+
+    // Every file and directory of the image, sorted by path
+    [[nodiscard]] std::vector<Entry> entries() const;
+
+private:
+    struct Extent {
+        std::uint32_t block = 0;
+        std::uint32_t size = 0;
+        bool directory = false;
+    };
+
+    struct Record {
+        std::string name;
+        Extent extent;
+        // Set on all but the last record of a multi-extent file
+        bool more = false;
+    };
+
+    std::span<const std::byte> m_data;
+    VolumeDescriptor m_primary;
+    Extent m_root;
+    std::optional<Extent> m_jolietRoot;
+    bool m_rockRidge = false;
+
+    [[nodiscard]] bool useJoliet() const { return !m_rockRidge && joliet(); }
+    [[nodiscard]] Extent root() const
+    {
+        return useJoliet() ? *m_jolietRoot : m_root;
+    }
+
+    [[nodiscard]] std::span<const std::byte> sectors(
+        std::uint64_t block, std::uint64_t size) const;
+    [[nodiscard]] std::vector<Record> records(const Extent& directory) const;
+    [[nodiscard]] std::optional<Extent> find(
+        const Extent& directory, std::string_view name) const;
+};
+
+// The release of an installation image, std::nullopt for other images
+std::optional<Release> probe(const std::filesystem::path& path);
+
+struct ExtractOptions final {
+    // Copy threads, 0 uses one per CPU up to 8
+    unsigned threads = 0;
+    // Large files are split in pieces of this size between the threads
+    std::uint64_t chunkSize = 64 * 1024 * 1024;
+    // Called with the bytes copied so far and the bytes to copy
+    std::function<void(std::uint64_t copied, std::uint64_t total)> progress;
+    std::chrono::milliseconds progressInterval { 1000 };
+    std::stop_token stop;
+};
+
+struct ExtractResult final {
+    std::size_t files = 0;
+    // Unchanged since the last extraction, according to the manifest
+    std::size_t skipped = 0;
+    std::uint64_t bytesCopied = 0;
+    // Shared with the image through reflinks, a subset of bytesCopied
+    std::uint64_t bytesCloned = 0;
+};
+
+/**
+ * @brief Copies the contents of an image into @p destination
+ *
+ * The file extents are copied by several threads with FICLONERANGE when the
+ * filesystem can share them with the image, then copy_file_range, then
+ * plain reads and writes. A manifest in @p destination remembers what was
+ * extracted from which image, files that still match are skipped.
+ *
+ * @throws CommandCancelledError when stopped or cancelled
+ */
+ExtractResult extract(const std::filesystem::path& image,
+    const std::filesystem::path& destination,
+    const ExtractOptions& options = {});
+
+constexpr auto manifestName = ".cloysterhpc-extract";
+
+} // namespace cloyster::services::iso9660
+
+#endif // CLOYSTERHPC_ISO9660_H_
@@ -22,7 +22,19 @@ struct Options final {
     bool airGap;
     bool unattended;
     bool disableMirrors;
+    bool asyncRunner;
+    bool persistentShell;
+    bool verifyDiskImage;
+    bool powerWaveByRack;
+    bool nativeIpmi;
+    bool listBackups;
     std::size_t logLevelInput;
+    std::size_t commandTimeout;
+    std::size_t nodeBatchSize;
+    std::size_t imageIoJobs;
+    std::size_t powerWaveSize;
+    double replayTimeScale;
+    double powerWaveThreshold;
     std::string error;
     std::string config;
     std::string helpText;
@@ -33,6 +45,10 @@ struct Options final {
     std::string zabbixVersion;
     std::string xcatVersion;
     std::string dumpAnswerfile;
+    std::string recordTrace;
+    std::string replayTrace;
+    std::string traceFile;
+    std::string restoreBackup;
     std::string stopAfterStep;
     std::set<std::string> skipSteps;
     std::set<std::string> forceSteps;
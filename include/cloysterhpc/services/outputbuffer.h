@@ -0,0 +1,76 @@
+#ifndef CLOYSTERHPC_OUTPUTBUFFER_H_
+#define CLOYSTERHPC_OUTPUTBUFFER_H_
+
+#include <cstddef>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cloyster::services {
+
+/**
+ * @class OutputBuffer
+ * @brief Captured output of a command, split in lines.
+ *
+ * The output is kept in a single contiguous arena with the offsets of the
+ * line breaks alongside it, so capturing thousands of lines (rpm -qa,
+ * locale -a, timedatectl list-timezones) costs a handful of allocations
+ * instead of one per line. Lines are exposed as std::string_view without the
+ * line break and stay valid until the buffer is written to or destroyed.
+ *
+ * The buffer is move only, hand it over to the caller instead of copying.
+ */
+class OutputBuffer final {
+public:
+    OutputBuffer() = default;
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer(OutputBuffer&&) noexcept = default;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(OutputBuffer&&) noexcept = default;
+    ~OutputBuffer() = default;
+
+    /**
+     * @brief Returns at least @p size writable bytes at the end of the
+     * arena, commit() must be called with the number of bytes written.
+     */
+    [[nodiscard]] std::span<char> prepare(std::size_t size);
+    void commit(std::size_t size);
+
+    void append(std::string_view data);
+
+    [[nodiscard]] std::size_t size() const;
+    [[nodiscard]] bool empty() const { return size() == 0; }
+    [[nodiscard]] std::string_view operator[](std::size_t index) const;
+    [[nodiscard]] std::string_view front() const { return (*this)[0]; }
+    [[nodiscard]] std::string_view back() const { return (*this)[size() - 1]; }
+
+    // The whole output, line breaks included
+    [[nodiscard]] std::string_view text() const { return { m_data.data(), m_size }; }
+
+    [[nodiscard]] auto lines() const
+    {
+        return std::views::iota(std::size_t { 0 }, size())
+            | std::views::transform(
+                [this](std::size_t index) { return (*this)[index]; });
+    }
+
+    // Copies the lines, for the interfaces that still take strings
+    [[nodiscard]] std::vector<std::string> toVector() const;
+
+    // Drops everything after the first @p size bytes of text()
+    void truncate(std::size_t size);
+    void clear();
+
+private:
+    std::string m_data;
+    // Bytes of m_data in use, the rest is capacity handed out by prepare()
+    std::size_t m_size = 0;
+    // Offset of every line break in m_data
+    std::vector<std::size_t> m_breaks;
+};
+
+} // namespace cloyster::services
+
+#endif // CLOYSTERHPC_OUTPUTBUFFER_H_
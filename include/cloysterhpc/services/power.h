@@ -0,0 +1,161 @@
+#ifndef CLOYSTERHPC_POWER_H_
+#define CLOYSTERHPC_POWER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <cloysterhpc/models/node.h>
+#include <cloysterhpc/services/ipmi.h>
+
+/**
+ * @brief Staged power control of the nodes
+ *
+ * Resetting every node at once floods DHCP, TFTP and HTTP on the headnode
+ * and trips the PDUs, so the nodes are reset in waves. The next wave only
+ * starts once enough of the current one fetched its image.
+ */
+namespace cloyster::services::power {
+
+struct Target final {
+    std::string node;
+    // Nodes of the same group, such as a rack, are reset in the same waves
+    std::string group;
+    // Nodes without a BMC are left alone
+    bool bmc = true;
+};
+
+/**
+ * @class Backend
+ * @brief Talks to the BMCs on behalf of rollout().
+ */
+class Backend {
+public:
+    Backend() = default;
+    Backend(const Backend&) = delete;
+    Backend(Backend&&) = delete;
+    Backend& operator=(const Backend&) = delete;
+    Backend& operator=(Backend&&) = delete;
+    virtual ~Backend() = default;
+
+    /**
+     * @brief Sets the nodes to boot from the network and resets them.
+     *
+     * The status the nodes report for fetched() must be cleared first, so
+     * nothing left from an earlier boot is counted.
+     *
+     * @return The error of each node that failed, the others were reset
+     */
+    virtual std::map<std::string, std::string> netboot(
+        const std::vector<std::string>& nodes)
+        = 0;
+
+    // The nodes of @p nodes that fetched their image since they were reset
+    virtual std::set<std::string> fetched(
+        const std::vector<std::string>& nodes)
+        = 0;
+};
+
+/**
+ * @class XCATBackend
+ * @brief Resets the nodes with rsetboot and rpower, and follows them
+ * through the status xCAT keeps for each node.
+ *
+ * The status is cleared with chdef right before the reset, the node sets
+ * it again as it netboots.
+ */
+class XCATBackend final : public Backend {
+public:
+    std::map<std::string, std::string> netboot(
+        const std::vector<std::string>& nodes) override;
+    std::set<std::string> fetched(
+        const std::vector<std::string>& nodes) override;
+
+    // The rack attribute of the nodes that have one
+    static std::map<std::string, std::string> racks(
+        const std::vector<std::string>& nodes);
+};
+
+/**
+ * @class NativeBackend
+ * @brief Resets the nodes through the native IPMI client, in a single
+ * session per BMC, and follows them like XCATBackend.
+ */
+class NativeBackend final : public Backend {
+public:
+    NativeBackend(
+        ipmi::IPMIBackend& ipmi, std::map<std::string, ipmi::Endpoint> bmcs);
+
+    std::map<std::string, std::string> netboot(
+        const std::vector<std::string>& nodes) override;
+    std::set<std::string> fetched(
+        const std::vector<std::string>& nodes) override;
+
+private:
+    ipmi::IPMIBackend& m_ipmi;
+    std::map<std::string, ipmi::Endpoint> m_bmcs;
+    XCATBackend m_xcat;
+};
+
+struct RolloutOptions final {
+    // Nodes reset at once, zero resets a whole group at once
+    std::size_t waveSize = 64;
+    // Waves never mix nodes of different groups
+    bool byGroup = false;
+    // Fraction of a wave that must fetch its image before the next wave
+    double threshold = 0.9;
+    // Times a failed node is tried again, waiting longer each time
+    unsigned retries = 3;
+    std::chrono::milliseconds backoff { 5000 };
+    std::chrono::milliseconds maxBackoff { 60000 };
+    std::chrono::milliseconds pollInterval { 5000 };
+    // Go on with the next wave after this long, even below the threshold
+    std::chrono::milliseconds waveTimeout { 600000 };
+};
+
+enum class State : std::uint8_t { Skipped, Failed, Reset, Fetched };
+
+struct NodeResult final {
+    std::string node;
+    State state = State::Skipped;
+    // Starting from 1, zero if the node was skipped
+    std::size_t wave = 0;
+    unsigned attempts = 0;
+    std::string error;
+};
+
+struct RolloutReport final {
+    // In the order of the targets
+    std::vector<NodeResult> nodes;
+    std::size_t waves = 0;
+
+    [[nodiscard]] std::size_t count(State state) const;
+};
+
+// Nodes of the targets to reset in each wave, in order
+std::vector<std::vector<std::string>> waves(
+    std::span<const Target> targets, const RolloutOptions& options);
+
+/**
+ * @brief Resets the targets wave after wave.
+ *
+ * The nodes that failed are tried again within their wave. The last wave
+ * is not waited for, its nodes are left in the Reset state.
+ *
+ * @throws CommandCancelledError when the global CancellationToken is raised
+ */
+RolloutReport rollout(std::span<const Target> targets, Backend& backend,
+    const RolloutOptions& options = {});
+
+// A target for each node, grouped by rack when @p racks is set
+std::vector<Target> targets(std::span<const cloyster::models::Node> nodes,
+    const std::map<std::string, std::string>& racks = {});
+
+} // namespace cloyster::services::power
+
+#endif // CLOYSTERHPC_POWER_H_
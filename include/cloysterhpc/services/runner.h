@@ -8,37 +8,201 @@
 
 #include <boost/process.hpp>
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include <cloysterhpc/services/outputbuffer.h>
 #include <cloysterhpc/services/scriptbuilder.h>
 
 namespace cloyster::services {
 
+enum class Stream : std::uint8_t { Stdout, Stderr };
+
+/**
+ * @brief Thrown when a command runs past its timeout, its process group was
+ * killed.
+ */
+class CommandTimeoutError : public std::runtime_error {
+public:
+    CommandTimeoutError(
+        const std::string& command, std::chrono::milliseconds timeout);
+};
+
+/**
+ * @brief Thrown when the CancellationToken is raised while a command runs,
+ * or before it starts. Its process group was killed.
+ */
+class CommandCancelledError : public std::runtime_error {
+public:
+    explicit CommandCancelledError(const std::string& command);
+};
+
+/**
+ * @class ScopedTimeout
+ * @brief Overrides the timeout of the commands started by the calling thread
+ * while it is alive.
+ *
+ * The default is Options::commandTimeout, zero means no timeout.
+ */
+class ScopedTimeout final {
+public:
+    explicit ScopedTimeout(std::chrono::milliseconds timeout);
+    ScopedTimeout(const ScopedTimeout&) = delete;
+    ScopedTimeout(ScopedTimeout&&) = delete;
+    ScopedTimeout& operator=(const ScopedTimeout&) = delete;
+    ScopedTimeout& operator=(ScopedTimeout&&) = delete;
+    ~ScopedTimeout();
+
+    // Timeout that applies to a command started now by this thread
+    [[nodiscard]] static std::chrono::milliseconds current();
+
+private:
+    std::optional<std::chrono::milliseconds> m_previous;
+};
+
+// Shared by the runners to enforce the timeouts
+namespace process {
+
+    // Time the process group gets between SIGTERM and SIGKILL
+    constexpr auto terminateGracePeriod = std::chrono::seconds(3);
+
+    // When a command started now with @p timeout must stop, never for zero
+    std::chrono::steady_clock::time_point deadlineAfter(
+        std::chrono::milliseconds timeout);
+
+    // Milliseconds until @p deadline for poll and epoll_wait, -1 for none
+    int waitFor(std::chrono::steady_clock::time_point deadline);
+
+    // SIGTERM to the process group led by @p child, SIGKILL to what is left
+    // after terminateGracePeriod
+    void terminateGroup(boost::process::child& child);
+
+} // namespace process
+
 /**
- * @struct CommandProxy
+ * @class CommandProxy
  * @brief A command proxy to capture the command output while the command is
  * running.
  *
- * This structure is used to capture the output of a command in real-time,
- * useful for displaying progress in a dialog.
+ * This is used to capture the output of a command in real-time, useful for
+ * displaying progress in a dialog. Both stdout and stderr are read through
+ * non-blocking pipes multiplexed with epoll, so a command that writes a lot
+ * to the stream nobody is looking at never stalls on a full pipe.
+ *
+ * Each stream has a fixed size buffer allocated once; lines are handed out
+ * as views into it, without a heap allocation per line. A line longer than
+ * the buffer is returned in bufferSize chunks.
  */
-struct CommandProxy {
-    bool valid = false;
-    boost::process::child child;
-    boost::process::ipstream pipe_stream;
+class CommandProxy {
+public:
+    static constexpr std::size_t bufferSize = 64 * 1024;
+
+    struct Line {
+        Stream stream;
+        // Valid until the next call to next(), getline() or getUntil()
+        std::string_view text;
+    };
+
+    // An invalid proxy, getline() always returns std::nullopt
+    CommandProxy() = default;
+    CommandProxy(std::string command, boost::process::child&& child,
+        boost::process::pipe&& out, boost::process::pipe&& err,
+        Stream follow = Stream::Stdout,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+    CommandProxy(const CommandProxy&) = delete;
+    CommandProxy(CommandProxy&& other) noexcept;
+    CommandProxy& operator=(const CommandProxy&) = delete;
+    CommandProxy& operator=(CommandProxy&& other) noexcept;
+    ~CommandProxy();
+
+    [[nodiscard]] bool valid() const { return m_epoll != -1; }
+
+    /**
+     * @brief Waits for the next line of either stream.
+     *
+     * @return The line without the delimiter, or std::nullopt once both
+     * streams are closed, at which point the exit status is available.
+     * @throws CommandTimeoutError, CommandCancelledError
+     */
+    std::optional<Line> next(char delimiter = '\n');
 
     /**
-     * @brief Gets a line of output from the command.
+     * @brief Gets a line of output from the followed stream, lines from the
+     * other stream are drained and dropped.
      *
      * @return An optional string containing a line of output if available,
      * otherwise std::nullopt.
      */
     std::optional<std::string> getline();
     std::optional<std::string> getUntil(char chr);
+
+    /**
+     * @brief File descriptor that polls readable when there is output to
+     * read, meant for event loops such as newtFormWatchFd.
+     */
+    [[nodiscard]] int fd() const { return m_epoll; }
+
+    /**
+     * @brief True if next() would return without waiting on the pipes.
+     *
+     * The fd() only reports new output, lines that were already read into
+     * the buffers must be drained while this is true.
+     */
+    [[nodiscard]] bool ready() const;
+
+    // Exit status of the command, set once next() returned std::nullopt
+    [[nodiscard]] std::optional<int> exitCode() const { return m_exitCode; }
+
+private:
+    // epoll tag of the cancellation token, the channels use their index
+    static constexpr std::uint32_t tokenEvent = 2;
+
+    struct Channel {
+        boost::process::pipe pipe;
+        std::unique_ptr<char[]> buffer;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        bool open = false;
+    };
+
+    std::string m_command;
+    boost::process::child m_child;
+    std::array<Channel, 2> m_channels;
+    int m_epoll = -1;
+    std::chrono::steady_clock::time_point m_deadline
+        = std::chrono::steady_clock::time_point::max();
+    std::chrono::milliseconds m_timeout {};
+    Stream m_follow = Stream::Stdout;
+    // Channel and size of the last returned line, it is only discarded on
+    // the next read so the returned view stays valid
+    std::size_t m_pending = 0;
+    std::size_t m_pendingSize = 0;
+    std::optional<int> m_exitCode;
+
+    std::optional<Line> takeLine(std::size_t index, char delimiter);
+    void fill(Channel& channel);
+    void close(Channel& channel);
+    std::optional<std::string> getFollowed(char delimiter);
 };
 
-enum class Stream : std::uint8_t { Stdout, Stderr };
+/**
+ * @struct CommandResult
+ * @brief Exit code and output of a command run in a batch.
+ */
+struct CommandResult {
+    int exitCode = 0;
+    std::vector<std::string> output;
+    // Only filled by runners that capture the standard error
+    std::vector<std::string> errorOutput;
+};
 
 /**
  * Works as an abstraction for command execution.
@@ -54,27 +218,71 @@ public:
 
     virtual int executeCommand(const std::string&) = 0;
     virtual int executeCommand(const std::string&, std::list<std::string>& output) = 0;
+    /**
+     * @brief Same as executeCommand(cmd, output), capturing the output in a
+     * single buffer instead of a string per line.
+     */
+    virtual int executeCommand(const std::string&, OutputBuffer& output) = 0;
     virtual CommandProxy executeCommandIter(
         const std::string&, Stream out = Stream::Stdout)
         = 0;
     virtual void checkCommand(const std::string&) = 0;
     virtual std::vector<std::string> checkOutput(const std::string&) = 0;
+    /**
+     * @brief Same as checkOutput, prefer it for commands with a large output.
+     */
+    virtual OutputBuffer captureOutput(const std::string&) = 0;
+    /**
+     * @brief Downloads @p url into the directory @p file, like `wget -NP`.
+     *
+     * Runner uses the native segmented downloader, see http::download.
+     */
     virtual int downloadFile(const std::string& url, const std::string& file)
         = 0;
 
     virtual int run(const ScriptBuilder& script) = 0;
+
+    /**
+     * @brief Runs independent commands concurrently.
+     *
+     * At most @p concurrency commands run at the same time, zero means one
+     * per hardware thread. The results are in the same order as @p cmds,
+     * regardless of the order the commands finish.
+     */
+    virtual std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds, std::size_t concurrency = 0)
+        = 0;
+
+    /**
+     * @brief Same as executeBatch, but throws if any command failed.
+     */
+    void checkBatch(
+        const std::vector<std::string>& cmds, std::size_t concurrency = 0);
+
+    /**
+     * @brief Starts a command that the caller will wait for later.
+     *
+     * Runners that can overlap commands with other work return right away,
+     * the default implementation runs the command before returning.
+     */
+    virtual std::future<CommandResult> submit(const std::string& cmd);
 };
 
 class Runner final : public IRunner {
 public:
     int executeCommand(const std::string& cmd) override;
     int executeCommand(const std::string&, std::list<std::string>& output) override;
+    int executeCommand(const std::string&, OutputBuffer& output) override;
     CommandProxy executeCommandIter(
         const std::string& cmd, Stream out = Stream::Stdout) override;
     void checkCommand(const std::string& cmd) override;
     std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
     int downloadFile(const std::string& url, const std::string& file) override;
     int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
 };
 
 class DryRunner final : public IRunner {
@@ -83,10 +291,15 @@ public:
         const std::string& cmd, Stream out = Stream::Stdout) override;
     int executeCommand(const std::string& cmd) override;
     int executeCommand(const std::string&, std::list<std::string>& output) override;
+    int executeCommand(const std::string&, OutputBuffer& output) override;
     void checkCommand(const std::string& cmd) override;
     std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
     int downloadFile(const std::string& url, const std::string& file) override;
     int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
 };
 
 class MockRunner final : public IRunner {
@@ -95,10 +308,15 @@ public:
         const std::string& cmd, Stream out = Stream::Stdout) override;
     int executeCommand(const std::string& cmd) override;
     int executeCommand(const std::string&, std::list<std::string>& output) override;
+    int executeCommand(const std::string&, OutputBuffer& output) override;
     void checkCommand(const std::string& cmd) override;
     std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
     int downloadFile(const std::string& url, const std::string& file) override;
     int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
 
     [[nodiscard]] const std::vector<std::string>& listCommands() const;
 
@@ -0,0 +1,109 @@
+#ifndef CLOYSTERHPC_TRACER_H_
+#define CLOYSTERHPC_TRACER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cloysterhpc/services/runner.h>
+
+namespace cloyster::services {
+
+/**
+ * @class Tracer
+ * @brief Collects the timing of every command and installation step.
+ *
+ * Steps are delimited by Options::maybeStopAfterStep, the commands run
+ * before a step mark are attributed to that step. finish() writes a
+ * Chrome/Perfetto trace-event JSON file, which can be opened in
+ * chrome://tracing or ui.perfetto.dev, and logs the slowest commands and the
+ * time spent in each step.
+ */
+class Tracer final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Command {
+        std::string command;
+        std::size_t step;
+        std::size_t thread;
+        Clock::time_point start;
+        Clock::time_point end;
+        int exitCode;
+        std::size_t outputBytes;
+
+        [[nodiscard]] Clock::duration duration() const { return end - start; }
+    };
+
+    struct Step {
+        std::string name;
+        Clock::time_point start;
+        Clock::time_point end;
+    };
+
+    explicit Tracer(std::filesystem::path output, std::size_t summarySize = 10);
+
+    void command(std::string command, Clock::time_point start,
+        Clock::time_point end, int exitCode, std::size_t outputBytes);
+
+    // Ends the current step, naming it
+    void step(const std::string& name);
+
+    // Writes the trace and logs the summary, only the first call does
+    void finish();
+
+    [[nodiscard]] std::string json() const;
+    [[nodiscard]] std::vector<Command> slowest(std::size_t count) const;
+    [[nodiscard]] std::vector<Step> steps() const;
+
+private:
+    std::filesystem::path m_output;
+    std::size_t m_summarySize;
+    Clock::time_point m_origin;
+    mutable std::mutex m_mutex;
+    std::vector<Command> m_commands;
+    std::vector<Step> m_steps;
+    std::map<std::thread::id, std::size_t> m_threads;
+    bool m_finished = false;
+
+    void logSummary() const;
+};
+
+/**
+ * @class TracingRunner
+ * @brief Decorator that reports every command to a Tracer.
+ */
+class TracingRunner final : public IRunner {
+public:
+    TracingRunner(std::unique_ptr<IRunner> runner, Tracer& tracer);
+
+    int executeCommand(const std::string& cmd) override;
+    int executeCommand(
+        const std::string& cmd, std::list<std::string>& output) override;
+    int executeCommand(const std::string& cmd, OutputBuffer& output) override;
+    CommandProxy executeCommandIter(
+        const std::string& cmd, Stream out = Stream::Stdout) override;
+    void checkCommand(const std::string& cmd) override;
+    std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
+    int downloadFile(const std::string& url, const std::string& file) override;
+    int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
+    std::future<CommandResult> submit(const std::string& cmd) override;
+
+private:
+    std::unique_ptr<IRunner> m_runner;
+    Tracer& m_tracer;
+};
+
+} // namespace cloyster::services
+
+#endif // CLOYSTERHPC_TRACER_H_
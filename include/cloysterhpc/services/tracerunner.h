@@ -0,0 +1,128 @@
+#ifndef CLOYSTERHPC_TRACERUNNER_H_
+#define CLOYSTERHPC_TRACERUNNER_H_
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cloysterhpc/services/runner.h>
+
+namespace cloyster::services {
+
+/**
+ * @brief One command of a trace, as seen by the runner.
+ *
+ * The trace file starts with a "CLOYSTER-TRACE 1" line, followed by one
+ * record per command: a header line with the exit code, the wall time in
+ * microseconds and the sizes in bytes of the command, stdout and stderr,
+ * then the raw bytes of the three of them and a line break.
+ */
+struct TraceRecord {
+    std::string command;
+    int exitCode = 0;
+    std::chrono::microseconds duration {};
+    std::string output;
+    std::string errorOutput;
+};
+
+/**
+ * @class RecordingRunner
+ * @brief Decorator that writes every command and its results to a trace.
+ *
+ * The standard error is only recorded when the wrapped runner captures it,
+ * which is the case for the results of executeBatch and submit. Commands of
+ * a batch are recorded with the wall time of the whole batch.
+ */
+class RecordingRunner final : public IRunner {
+public:
+    RecordingRunner(
+        std::unique_ptr<IRunner> runner, const std::filesystem::path& trace);
+    RecordingRunner(const RecordingRunner&) = delete;
+    RecordingRunner(RecordingRunner&&) = delete;
+    RecordingRunner& operator=(const RecordingRunner&) = delete;
+    RecordingRunner& operator=(RecordingRunner&&) = delete;
+    ~RecordingRunner() override = default;
+
+    int executeCommand(const std::string& cmd) override;
+    int executeCommand(
+        const std::string& cmd, std::list<std::string>& output) override;
+    int executeCommand(const std::string& cmd, OutputBuffer& output) override;
+    CommandProxy executeCommandIter(
+        const std::string& cmd, Stream out = Stream::Stdout) override;
+    void checkCommand(const std::string& cmd) override;
+    std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
+    int downloadFile(const std::string& url, const std::string& file) override;
+    int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
+    std::future<CommandResult> submit(const std::string& cmd) override;
+
+private:
+    std::unique_ptr<IRunner> m_runner;
+    std::mutex m_mutex;
+    std::ofstream m_trace;
+
+    void record(const TraceRecord& record);
+};
+
+/**
+ * @class ReplayRunner
+ * @brief Serves the results of a trace back without running anything.
+ *
+ * A command recorded more than once gets its results in the recorded
+ * order, the last one is repeated when they run out. Commands missing from
+ * the trace succeed with no output and are listed by unmatched().
+ *
+ * With a @p timeScale greater than zero every command takes its recorded
+ * wall time multiplied by it, zero replays as fast as possible.
+ */
+class ReplayRunner final : public IRunner {
+public:
+    explicit ReplayRunner(
+        const std::filesystem::path& trace, double timeScale = 0.0);
+
+    int executeCommand(const std::string& cmd) override;
+    int executeCommand(
+        const std::string& cmd, std::list<std::string>& output) override;
+    int executeCommand(const std::string& cmd, OutputBuffer& output) override;
+    CommandProxy executeCommandIter(
+        const std::string& cmd, Stream out = Stream::Stdout) override;
+    void checkCommand(const std::string& cmd) override;
+    std::vector<std::string> checkOutput(const std::string& cmd) override;
+    OutputBuffer captureOutput(const std::string& cmd) override;
+    int downloadFile(const std::string& url, const std::string& file) override;
+    int run(const ScriptBuilder& script) override;
+    std::vector<CommandResult> executeBatch(
+        const std::vector<std::string>& cmds,
+        std::size_t concurrency = 0) override;
+    std::future<CommandResult> submit(const std::string& cmd) override;
+
+    [[nodiscard]] std::vector<std::string> unmatched() const;
+
+private:
+    struct Recorded {
+        std::vector<TraceRecord> records;
+        std::size_t next = 0;
+    };
+
+    double m_timeScale;
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, Recorded> m_commands;
+    std::vector<std::string> m_unmatched;
+
+    // Results of the next occurrence of the command, without waiting
+    TraceRecord take(const std::string& cmd);
+    void wait(std::chrono::microseconds duration) const;
+    TraceRecord replay(const std::string& cmd);
+};
+
+} // namespace cloyster::services
+
+#endif // CLOYSTERHPC_TRACERUNNER_H_
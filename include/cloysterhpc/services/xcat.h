@@ -8,15 +8,23 @@
 
 #include "scriptbuilder.h"
 #include <filesystem>
+#include <future>
+#include <list>
+#include <map>
+#include <optional>
+#include <set>
+#include <span>
 #include <string>
 
 #include <fmt/format.h>
 #include <fmt/ranges.h> // for std::vector formatters
 
 #include <cloysterhpc/const.h>
+#include <cloysterhpc/models/os.h>
 #include <cloysterhpc/services/execution.h>
 #include <cloysterhpc/services/log.h>
 #include <cloysterhpc/services/provisioner.h>
+#include <cloysterhpc/services/runner.h>
 #include <cloysterhpc/services/shell.h>
 
 namespace cloyster::services {
@@ -30,22 +38,6 @@ namespace cloyster::services {
  */
 class XCAT : public Provisioner {
 public:
-    struct Image {
-        std::vector<std::string_view> otherpkgs = {};
-        // @TODO: We need to support more than one osimage (:
-        //   this can be a default osimage though
-        std::string osimage;
-        std::filesystem::path chroot;
-        std::vector<std::string> postinstall = { "#!/bin/sh\n\n" };
-        std::vector<std::string> synclists;
-    };
-
-    struct ImageInstallArgs final {
-        std::string imageName;
-        std::filesystem::path rootfs;
-        std::filesystem::path postinstall;
-        std::filesystem::path pkglist;
-    };
     /**
      * @enum ImageType
      * @brief Defines the types of OS images.
@@ -62,45 +54,99 @@ public:
      */
     enum class NodeType : bool { Compute, Service };
 
+    /**
+     * @brief Definition of an osimage, see makeImage().
+     *
+     * Each image has its own package lists and postinstall scripts, so
+     * several of them can be configured and built side by side.
+     */
+    struct Image {
+        std::vector<std::string_view> otherpkgs = {};
+        std::string osimage;
+        std::filesystem::path chroot;
+        std::vector<std::string> postinstall = { "#!/bin/sh\n\n" };
+        std::vector<std::string> synclists;
+        // Extra otherpkgdir entries, set by configureOSImageDefinition
+        std::vector<std::string> otherpkgdirs;
+        ImageType imageType = ImageType::Netboot;
+        NodeType nodeType = NodeType::Compute;
+        cloyster::models::OS::Arch arch = cloyster::models::OS::Arch::x86_64;
+        // Scripts applied to the rootimg by customizeImage
+        std::vector<ScriptBuilder> customizations;
+
+        // Files under /install/custom/netboot, named after the osimage
+        [[nodiscard]] std::filesystem::path otherpkglistFile() const;
+        [[nodiscard]] std::filesystem::path postinstallFile() const;
+        [[nodiscard]] std::filesystem::path synclistsFile() const;
+    };
+
+    struct ImageInstallArgs final {
+        std::string imageName;
+        std::filesystem::path rootfs;
+        std::filesystem::path postinstall;
+        std::filesystem::path pkglist;
+    };
+
     [[nodiscard]] ImageInstallArgs getImageInstallArgs(
         ImageType imageType, NodeType nodeType
     );
+    [[nodiscard]] static ImageInstallArgs getImageInstallArgs(
+        const Image& image);
 
 
 private:
+    // The compute image of the architecture of the first node
     Image m_stateless;
 
+    // Shared steps already done by an earlier image of the same run
+    std::set<std::string> m_localRepos;
+    std::map<std::string, std::list<std::string>> m_resolvedPackages;
+
 
     static void setDHCPInterfaces(std::string_view interface);
     static void setDomain(std::string_view domain);
 
     /**
-     * @brief Copies installation media to the disk image.
+     * @brief Starts copying the installation media from the disk image.
+     *
+     * The image is extracted to /install/<distro>/<arch> in the background
+     * while the image configuration is generated, then the osdistro and its
+     * netboot osimages are defined from the xCAT templates. Reruns only copy
+     * the files that changed. When the extraction fails, or xCAT has no
+     * templates for the distro, copycds copies and registers the media.
+     *
+     * @throws std::runtime_error if the osdistro or the compute osimage are
+     * still not defined afterwards
      *
      * @param diskImage The path to the disk image.
+     * @param arch The architecture of the disk image.
+     * @return The pending copycds command, see IRunner::submit.
      */
-    void copycds(const std::filesystem::path& diskImage) const;
+    [[nodiscard]] static std::future<CommandResult> copycds(
+        const std::filesystem::path& diskImage,
+        cloyster::models::OS::Arch arch);
 
     /**
      * @brief Generates the OS image.
      *
      * This function creates the OS image based on the configuration.
      */
-    void genimage();
+    static void genimage(const Image& image);
 
     /**
      * @brief Packs the OS image.
      *
      * This function packages the OS image for deployment.
      */
-    void packimage();
+    static void packimage(const Image& image);
 
     /**
      * @brief Sets the nodes for a specific image.
      *
      * @param nodes The nodes to set for the image.
+     * @param image The image the nodes boot.
      */
-    void nodeset(std::string_view nodes);
+    static void nodeset(std::string_view nodes, const Image& image);
 
     /**
      * @brief Creates the necessary directory tree.
@@ -114,86 +160,141 @@ private:
      *
      * This function sets up SELinux configurations in the image
      */
-    void configureSELinux();
+    static void configureSELinux(Image& image);
 
     /**
      * @brief Configures OpenHPC settings.
      *
      * This function sets up OpenHPC configurations.
      */
-    void configureOpenHPC();
+    static void configureOpenHPC(Image& image);
 
     /**
      * @brief Configures the time service.
      *
      * This function sets up the time synchronization service.
      */
-    void configureTimeService();
+    static void configureTimeService(Image& image);
+
+    /**
+     * @brief Configures InfiniBand settings of an image.
+     *
+     * The local repository of the OFED kernel modules is created once and
+     * shared by every image.
+     */
+    void configureInfiniband(Image& image);
 
     /**
      * @brief Configures SLURM settings.
      *
      * This function sets up SLURM for job scheduling and management.
      */
-    void configureSLURM();
+    static void configureSLURM(Image& image);
 
     /**
      * @brief Generates the file listing other packages.
      *
      * This function creates a file that lists additional packages to install.
      */
-    void generateOtherPkgListFile();
+    static void generateOtherPkgListFile(const Image& image);
 
     /**
      * @brief Generates the post-installation script file.
      *
      * This function creates the post-installation script file.
      */
-    void generatePostinstallFile();
+    static void generatePostinstallFile(Image& image);
 
     /**
      * @brief Generates the synchronization list file.
      *
      * This function creates the synchronization list file.
      */
-    static void generateSynclistsFile();
+    static void generateSynclistsFile(const Image& image);
 
     /**
      * @brief Configures the OS image definition.
      *
-     * This function sets up the OS image definition in xCAT.
+     * This function sets up the OS image definition in xCAT. The package
+     * list, postinstall and synclists of @p image replace the ones the
+     * osimage had, the otherpkgdir entries are added to its own.
+     *
+     * @param image The image to define.
+     * @param repos The repositories added to otherpkgdir.
      */
-    void configureOSImageDefinition();
+    static void configureOSImageDefinition(
+        const Image& image, const std::vector<std::string>& repos);
 
     /**
      * @brief Customizes the OS image.
      *
-     * This function applies customizations to the OS image.
+     * This function applies the customizations of the image.
      */
-    void customizeImage(const std::vector<ScriptBuilder>& customizations) const;
+    static void customizeImage(const Image& image);
 
     /**
-     * @brief Adds a node to the cluster.
+     * @brief Digests of everything that goes into an image.
      *
-     * @param node The node to add.
+     * A change to the packages needs a new genimage, a change to the
+     * configuration only needs the postinstall scripts to run again.
      */
-    static void addNode(const cloyster::models::Node& node);
+    struct Fingerprint {
+        std::string packages;
+        std::string configuration;
+    };
 
     /**
-     * @brief Generates the OS image name based on type and node.
+     * @brief Computes the fingerprint of an image.
      *
-     * @param imageType The type of image (Install or Netboot).
-     * @param nodeType The type of node (Compute or Service).
+     * Covers the package lists and directories, the repositories, the
+     * versions the packages resolve to, the postinstall script, the
+     * synclists and the customization scripts.
+     *
+     * @param image The image, configured and with its files generated.
+     * @param repos The repositories added to otherpkgdir.
+     * @throws std::runtime_error if the package versions cannot be queried
      */
-    void generateOSImageName(ImageType, NodeType);
+    [[nodiscard]] Fingerprint imageFingerprint(
+        const Image& image, const std::vector<std::string>& repos);
+
+    [[nodiscard]] static std::filesystem::path fingerprintPath(
+        const Image& image);
+    [[nodiscard]] static std::optional<Fingerprint> storedFingerprint(
+        const Image& image);
+    static void storeFingerprint(
+        const Image& image, const Fingerprint& fingerprint);
 
     /**
-     * @brief Generates the OS image path based on type and node.
+     * @brief Runs the postinstall script on the existing rootimg.
      *
-     * @param imageType The type of image (Install or Netboot).
-     * @param nodeType The type of node (Compute or Service).
+     * Used instead of genimage when only the configuration changed, so
+     * every postinstall fragment must leave an image it already ran on as
+     * it is.
      */
-    void generateOSImagePath(ImageType, NodeType);
+    static void rerunPostinstall(const Image& image);
+
+    /**
+     * @brief Builds the stanza that defines a node, as read by mkdef -z.
+     *
+     * @param node The node to define.
+     * @return The stanza, ending with a blank line.
+     */
+    static std::string nodeStanza(const cloyster::models::Node& node);
+
+    /**
+     * @brief Defines nodes in xCAT with a single mkdef -z.
+     *
+     * @param nodes The nodes to define.
+     * @return True if mkdef succeeded.
+     */
+    static bool importNodes(std::span<const cloyster::models::Node> nodes);
+
+    /**
+     * @brief Adds a node to the cluster.
+     *
+     * @param node The node to add.
+     */
+    static void addNode(const cloyster::models::Node& node);
 
     /**
      * @brief Configures settings specific to Enterprise Linux 9 (EL9).
@@ -233,11 +334,27 @@ public:
      */
     void setup();
 
+    /**
+     * @brief Names an image and locates its rootimg.
+     *
+     * @param imageType The type of image (Install or Netboot).
+     * @param nodeType The type of node (Compute or Service).
+     * @param arch The architecture of the nodes that boot it.
+     */
+    [[nodiscard]] static Image makeImage(ImageType imageType,
+        NodeType nodeType, cloyster::models::OS::Arch arch);
+
+    /**
+     * @brief A netboot compute image for each architecture of the nodes.
+     */
+    [[nodiscard]] static std::vector<Image> computeImages();
+
     /**
      * @brief Creates an OS image.
      *
      * This function creates an OS image for either Netboot or Install, and for
-     * either Compute or Service nodes.
+     * either Compute or Service nodes, for the architecture of the first
+     * node. See createImages().
      *
      * @param imageType The type of image to create (default is Netboot).
      * @param nodeType The type of node to create the image for (default is
@@ -248,6 +365,19 @@ public:
         const std::vector<ScriptBuilder>& customizations = {}
     );
 
+    /**
+     * @brief Creates several OS images.
+     *
+     * The images are configured one after the other, then genimage and
+     * packimage run for several of them at once, within the CPU count and
+     * the `--image-io-jobs` budget. The installation media and the shared
+     * repositories are only set up once. An existing image is only
+     * generated again when its fingerprint changed, see imageFingerprint().
+     *
+     * @param images The images, see makeImage().
+     */
+    void createImages(std::vector<Image> images);
+
     /**
      * @brief Adds nodes to the provisioning system.
      *
@@ -258,23 +388,18 @@ public:
     /**
      * @brief Sets the OS image for nodes.
      *
-     * This function assigns the created OS image to the nodes.
+     * Nodes boot the compute image of their architecture.
      */
     void setNodesImage();
 
     /**
-     * @brief Sets the boot configuration for nodes.
-     *
-     * This function configures the nodes to boot using the assigned OS image.
-     */
-    static void setNodesBoot();
-
-    /**
-     * @brief Resets the nodes.
+     * @brief Boots the nodes from the network.
      *
-     * This function resets the nodes.
+     * The nodes with a BMC are reset in waves of `--power-wave-size`, one
+     * rack at a time with `--power-wave-by-rack`. Each wave waits for most
+     * of the previous one to fetch its image, see power::rollout().
      */
-    static void resetNodes();
+    void bootNodes();
 
     /**
      * @brief Configures InfiniBand settings.
@@ -0,0 +1,96 @@
+#ifndef CLOYSTERHPC_TESTS_H_
+#define CLOYSTERHPC_TESTS_H_
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fmt/format.h>
+
+#include <stdlib.h>
+
+/**
+ * @brief Fixtures shared by the tests embedded in the sources
+ */
+namespace cloyster::tests {
+
+/**
+ * @class TemporaryDirectory
+ * @brief A private directory created with mkdtemp, removed with everything
+ * in it when destroyed.
+ *
+ * The name is unique and the directory is only accessible to its owner, so
+ * tests running at the same time, in the same process or not, never see
+ * each other's files.
+ */
+class TemporaryDirectory final {
+    static std::filesystem::path create(std::string_view prefix)
+    {
+        auto name = (std::filesystem::temp_directory_path()
+            / fmt::format("cloyster-{}-XXXXXX", prefix))
+                        .string();
+        if (::mkdtemp(name.data()) == nullptr) {
+            throw std::system_error(errno, std::system_category(), name);
+        }
+        return name;
+    }
+
+public:
+    const std::filesystem::path path;
+
+    explicit TemporaryDirectory(std::string_view prefix = "test")
+        : path(create(prefix))
+    {
+    }
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+    TemporaryDirectory(TemporaryDirectory&&) = delete;
+    TemporaryDirectory& operator=(TemporaryDirectory&&) = delete;
+    ~TemporaryDirectory()
+    {
+        std::error_code ignored;
+        std::filesystem::remove_all(path, ignored);
+    }
+};
+
+/**
+ * @class TemporaryFile
+ * @brief Path to @p filename inside its own TemporaryDirectory.
+ *
+ * The file is only created when @p contents are given, otherwise it is left
+ * for the test to create.
+ */
+class TemporaryFile final {
+    TemporaryDirectory m_directory;
+
+public:
+    const std::filesystem::path path;
+
+    explicit TemporaryFile(std::string_view filename = "file")
+        : path(m_directory.path / filename)
+    {
+    }
+
+    TemporaryFile(std::string_view filename, std::string_view contents)
+        : TemporaryFile(filename)
+    {
+        std::ofstream(path, std::ios::binary)
+            .write(contents.data(),
+                static_cast<std::streamsize>(contents.size()));
+    }
+
+    [[nodiscard]] std::string read() const
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(ifs),
+            std::istreambuf_iterator<char>() };
+    }
+};
+
+} // namespace cloyster::tests
+
+#endif // CLOYSTERHPC_TESTS_H_
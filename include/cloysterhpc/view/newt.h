@@ -270,17 +270,17 @@ public:
     }
 
     /**
-     * Show a progress message dialog
+     * Show a progress dialog driven by an event source
      * @param title
      * @param message
-     * @param command
-     * @param fPercent A function to transform a command output
-     * into a percent (a 0 to 100 value)
+     * @param fd A descriptor that polls readable when there is news
+     * @param fProgress Called when fd is readable, returns a percent (a 0
+     * to 100 value) and a status line, or std::nullopt once it is over
+     * @return false if the user cancelled
      */
-    bool progressMenu(const char* title, const char* message,
-        cloyster::services::CommandProxy&&,
-        std::function<std::optional<double>(cloyster::services::CommandProxy&)>
-            fPercent);
+    bool progressMenu(const char* title, const char* message, int fd,
+        std::function<std::optional<std::pair<double, std::string>>()>
+            fProgress);
 
     // TODO:
     //  * Optimize for std::string_view and std::string.
@@ -31,6 +31,7 @@ cmake --build build
 echo "INSTALL: $PWD"
 mkdir -p %{buildroot}/usr/bin
 mkdir -p %{buildroot}/opt/cloysterhpc/conf/repos/
+mkdir -p %{buildroot}/opt/cloysterhpc/conf/images/
 install -m 755 build/src/cloysterhpc %{buildroot}/usr/bin/cloysterhpc
 install -m 644 repos/repos.conf %{buildroot}/opt/cloysterhpc/conf/repos/repos.conf
 install -m 644 repos/alma.conf %{buildroot}/opt/cloysterhpc/conf/repos/alma.conf
@@ -38,6 +39,7 @@ install -m 644 repos/rhel.conf %{buildroot}/opt/cloysterhpc/conf/repos/rhel.conf
 install -m 644 repos/oracle.conf %{buildroot}/opt/cloysterhpc/conf/repos/oracle.conf
 install -m 644 repos/rocky-upstream.conf %{buildroot}/opt/cloysterhpc/conf/repos/rocky-upstream.conf
 install -m 644 repos/rocky-vault.conf %{buildroot}/opt/cloysterhpc/conf/repos/rocky-vault.conf
+install -m 644 images/known-images.conf %{buildroot}/opt/cloysterhpc/conf/images/known-images.conf
 
 %files
 /usr/bin/cloysterhpc
@@ -47,6 +49,7 @@ install -m 644 repos/rocky-vault.conf %{buildroot}/opt/cloysterhpc/conf/repos/ro
 /opt/cloysterhpc/conf/repos/oracle.conf
 /opt/cloysterhpc/conf/repos/rocky-upstream.conf
 /opt/cloysterhpc/conf/repos/rocky-vault.conf
+/opt/cloysterhpc/conf/images/known-images.conf
 
 %changelog
 * Tue Jun 10 2025 Daniel Hilst <daniel@versatushpc.com.br> - 1.0-2
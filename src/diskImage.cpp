@@ -8,15 +8,37 @@
 #include <cloysterhpc/diskImage.h>
 #include <cloysterhpc/functions.h>
 #include <cloysterhpc/models/os.h>
+#include <cloysterhpc/services/checksum.h>
 #include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/iso9660.h>
 #include <cloysterhpc/services/log.h>
 #include <cloysterhpc/services/options.h>
-#include <unordered_map>
+#include <cloysterhpc/tests.h>
+#include <cloysterhpc/utils/enums.h>
 
-// @FIXME: This file need some work
-//
-// - The ISO can be probed for more information usign isoinfo command
-// - The isKnownImage is initializing data, this is a little weird
+namespace {
+
+// The distro of the images named after the upstream ISOs
+std::optional<cloyster::models::OS::Distro> distroFromFilename(
+    std::string_view filename)
+{
+    using cloyster::models::OS;
+    if (filename.starts_with("Rocky")) {
+        return OS::Distro::Rocky;
+    }
+    if (filename.starts_with("rhel")) {
+        return OS::Distro::RHEL;
+    }
+    if (filename.starts_with("OracleLinux")) {
+        return OS::Distro::OL;
+    }
+    if (filename.starts_with("AlmaLinux")) {
+        return OS::Distro::AlmaLinux;
+    }
+    return std::nullopt;
+}
+
+} // namespace
 
 const std::filesystem::path& DiskImage::getPath() const { return m_path; }
 
@@ -25,41 +47,101 @@ void DiskImage::setPath(const std::filesystem::path& path)
     if (path.extension() != ".iso")
         throw std::runtime_error("Disk Image must have ISO extension");
 
-    // Verify checksum only if the image is known.
-    if (isKnownImage(path)) {
-#ifdef NDEBUG
+    // Verify checksum only if the image is known and it was asked for
+    const auto opts = cloyster::Singleton<cloyster::services::Options>::get();
+    if (isKnownImage(path) && opts->verifyDiskImage) {
         if (!hasVerifiedChecksum(path))
             throw std::runtime_error("Disk Image checksum isn't valid");
-#endif
     }
 
     m_path = path;
 }
 
+std::vector<DiskImage::KnownImage> DiskImage::loadKnownImages(
+    const std::filesystem::path& path)
+{
+    using namespace cloyster::utils;
+
+    LOG_DEBUG("Loading known images: {}", path.string())
+    if (!cloyster::functions::exists(path)) {
+        LOG_WARN("Known images file {} does not exist", path.string())
+        return {};
+    }
+
+    const auto file = cloyster::services::files::KeyFile(path);
+    std::vector<KnownImage> images;
+    for (const auto& group : file.getGroups()) {
+        const auto distro = enums::ofStringOpt<cloyster::models::OS::Distro>(
+            file.getString(group, "distro"), enums::Case::Insensitive);
+        if (!distro) {
+            throw std::runtime_error(fmt::format(
+                "Unsupported distro for the known image {} in {}", group,
+                path.string()));
+        }
+
+        images.push_back(KnownImage {
+            .filename = group,
+            .product = file.getString(group, "product"),
+            .distro = distro.value(),
+            .version = file.getString(group, "version"),
+            .arch = file.getString(group, "arch"),
+            .sha256 = file.getString(group, "sha256"),
+        });
+    }
+
+    return images;
+}
+
 bool DiskImage::isKnownImage(const std::filesystem::path& path)
 {
-    for (const auto& image : m_knownImageFilename) {
-        if (path.filename().string() == image) {
-            LOG_TRACE("Disk image is recognized")
-
-            auto imageView = std::string_view(image);
-            if (imageView.starts_with("Rocky")) {
-                m_distro = cloyster::models::OS::Distro::Rocky;
-            } else if (imageView.starts_with("rhel")) {
-                m_distro = cloyster::models::OS::Distro::RHEL;
-            } else if (imageView.starts_with("OracleLinux")) {
-                m_distro = cloyster::models::OS::Distro::OL;
-            } else if (imageView.starts_with("AlmaLinux")) {
-                m_distro = cloyster::models::OS::Distro::AlmaLinux;
-            } else {
-                throw std::logic_error(fmt::format(
-                    "Can't determine the distro for the image {}", image));
+    const auto images = loadKnownImages();
+    m_knownImage = std::nullopt;
+    m_distro = std::nullopt;
+
+    std::optional<cloyster::services::iso9660::Release> release;
+    try {
+        release = cloyster::services::iso9660::probe(path);
+    } catch (const std::exception& ex) {
+        LOG_WARN("Could not probe the disk image {}: {}", path.string(), ex.what())
+    }
+
+    if (release) {
+        LOG_INFO("Disk image {} is {} {} ({})", path, release->name,
+            release->version, release->arch)
+        for (const auto& image : images) {
+            if (image.product != release->name) {
+                continue;
+            }
+
+            m_distro = image.distro;
+            if (image.version == release->version
+                && image.arch == release->arch) {
+                m_knownImage = image;
+                break;
             }
+        }
+    }
 
-            return true;
+    // The probe failed, or found a product missing from the known images
+    if (!m_distro) {
+        const auto filename = path.filename().string();
+        for (const auto& image : images) {
+            if (filename == image.filename) {
+                m_distro = image.distro;
+                m_knownImage = image;
+                break;
+            }
+        }
+        if (!m_distro) {
+            m_distro = distroFromFilename(filename);
         }
     }
 
+    if (m_knownImage) {
+        LOG_TRACE("Disk image is recognized as {}", m_knownImage->filename)
+        return true;
+    }
+
     LOG_TRACE("Disk image is unknown. Maybe you're using a custom image or "
               "changed the default name?");
     return false;
@@ -71,47 +153,38 @@ cloyster::models::OS::Distro DiskImage::getDistro() const
     return m_distro.value();
 }
 
-// BUG: Consider removing/reimplement this method
-bool DiskImage::hasVerifiedChecksum(const std::filesystem::path& path)
+bool DiskImage::hasVerifiedChecksum(const std::filesystem::path& path) const
 {
-
     const auto opts = cloyster::Singleton<cloyster::services::Options>::get();
     if (opts->dryRun) {
         LOG_INFO("Dry Run: Would verify disk image checksum.")
         return true;
     }
 
-    LOG_INFO("Verifying disk image checksum... This may take a while, use "
-             "`--skip disk-checksum` to skip")
     if (opts->shouldSkip("disk-checksum")) {
         LOG_WARN(
             "Skiping disk the image checksum because `--skip disk-checksum`");
         return true;
     }
 
-    // BUG: This should no be hardcoded here. An ancillary file should be used
-    std::unordered_map<std::string, std::string> hash_map = {
-        { "rhel-8.8-x86_64-dvd.iso",
-            "517abcc67ee3b7212f57e180f5d30be3e8269e7a99e127a3399b7935c7e00a0"
-            "9" },
-        { "OracleLinux-R8-U8-x86_64-dvd.iso",
-            "cae39116245ff7c3c86d5305d9c11430ce5c4e512987563435ac59c37a082d7"
-            "e" },
-        { "Rocky-8.8-x86_64-dvd1.iso",
-            "7b8bdfe189cf24ae5c2d6a88f7a0b5f3012d23f9332c47943d538b4bc03a370"
-            "4" },
-        { "AlmaLinux-8.8-x86_64-dvd.iso",
-            "635b30b967b509a32a1a3d81401db9861922acb396d065922b39405a43a04a3"
-            "1" },
-        { "Rocky-9.5-x86_64-dvd.iso",
-            "ba60c3653640b5747610ddfb4d09520529bef2d1d83c1feb86b0c84dff31e04"
-            "e" }
-    };
-
-    auto checksum = cloyster::services::files::checksum(path);
+    if (!m_knownImage) {
+        LOG_WARN("No known checksum for the disk image {}", path.string())
+        return false;
+    }
+
+    LOG_INFO("Verifying disk image checksum... This may take a while, use "
+             "`--skip disk-checksum` to skip")
+
+    // Later runs against the same image answer from the cache
+    cloyster::services::files::ChecksumCache cache;
+    auto checksum = cache.sha256(
+        path, [&](std::uint64_t hashed, std::uint64_t total) {
+            LOG_DEBUG("Verifying {}: {}%", path.filename().string(),
+                total == 0 ? 100 : hashed * 100 / total)
+        });
     LOG_INFO("SHA256 checksum of file {} is: {}", path.string(), checksum);
 
-    if (checksum == hash_map.find(path.filename().string())->second) {
+    if (checksum == m_knownImage->sha256) {
         LOG_TRACE("Checksum - The disk image is valid")
         return true;
     }
@@ -130,6 +203,34 @@ bool DiskImage::hasVerifiedChecksum(const std::filesystem::path& path)
 
 TEST_SUITE("Disk image test suite")
 {
+    TEST_CASE("Load the known images file")
+    {
+        // The tests may run from any directory
+        const auto images = DiskImage::loadKnownImages(
+            std::filesystem::path(__FILE__).parent_path().parent_path()
+            / "images/known-images.conf");
+        REQUIRE(images.size() == 5);
+
+        const auto rocky = std::ranges::find(
+            images, "Rocky-9.5-x86_64-dvd.iso", &DiskImage::KnownImage::filename);
+        REQUIRE(rocky != images.end());
+        CHECK(rocky->product == "Rocky Linux");
+        CHECK(rocky->distro == cloyster::models::OS::Distro::Rocky);
+        CHECK(rocky->version == "9.5");
+        CHECK(rocky->arch == "x86_64");
+        CHECK(rocky->sha256.size() == 64);
+    }
+
+    TEST_CASE("Unknown images get their distro from the filename")
+    {
+        const cloyster::tests::TemporaryFile iso(
+            "Rocky-8.0-custom.iso", std::string(64 * 1024, 'x'));
+
+        DiskImage image;
+        CHECK_FALSE(image.isKnownImage(iso.path));
+        CHECK(image.getDistro() == cloyster::models::OS::Distro::Rocky);
+    }
+
     /*
     DiskImage diskImage;
     const auto path = std::filesystem::current_path() / "/sample/checksum.iso";
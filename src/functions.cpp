@@ -16,6 +16,11 @@
 #include <boost/process.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <cloysterhpc/services/backup.h>
+#include <cloysterhpc/services/conffile.h>
+#include <cloysterhpc/services/copy.h>
+#include <cloysterhpc/services/fileedit.h>
+#include <cloysterhpc/services/http.h>
 #include <cloysterhpc/services/log.h>
 
 #include <fmt/chrono.h>
@@ -171,88 +176,54 @@ std::string getCurrentTimestamp()
     return result;
 }
 
+namespace {
+    services::files::BackupStore& backupStore()
+    {
+        static services::files::BackupStore store;
+        return store;
+    }
+}
+
 /* Backup file */
 void backupFile(std::string_view filename)
 {
-    const auto& backupFile = fmt::format(
-        "{}/backup{}_{}", installPath, filename, getCurrentTimestamp());
-
     auto opts = cloyster::Singleton<cloyster::services::Options>::get();
     if (opts->dryRun) {
-        LOG_WARN("Dryn Run: Would create a backup copy of {} on {}", filename,
-            backupFile);
+        LOG_WARN("Dry Run: Would create a backup copy of {}", filename)
         return;
     }
 
-    // Create the directory structure
-    createDirectory(std::filesystem::absolute(backupFile).parent_path());
-
-    std::fstream file(backupFile);
-    if (!file.is_open()) {
-        // Backup the file
-        std::filesystem::copy_file(filename, backupFile);
-        LOG_DEBUG("Created a backup copy of {} on {}", filename, backupFile)
-    }
+    const auto digest = backupStore().backup(filename);
+    LOG_DEBUG("Created a backup copy of {} as {}", filename,
+        digest.empty() ? "missing" : digest)
 }
 
-/* TODO:
- *  - Do not treat .conf files as .ini files!
- *  - Discover why boost removes comments on files while parsing INI config
- *  - Replace boost with glib's GKeyFile?
- *  - http://www.gtkbook.com/gtkbook/keyfile.html
- */
 void changeValueInConfigurationFile(
     const std::string& filename, const std::string& key, std::string_view value)
 {
-    boost::property_tree::ptree tree;
+    cloyster::services::files::ConfFile file(filename);
 
-    auto opts = cloyster::Singleton<cloyster::services::Options>::get();
-    if (opts->dryRun) {
-        LOG_INFO("Dry Run: Would change the {} on {} in configuration file {}",
-            value, key, filename);
-        return;
-    }
-
-    try {
-        boost::property_tree::ini_parser::read_ini(filename, tree);
-    } catch (boost::property_tree::ini_parser_error& ex) {
-        LOG_ERROR("Error: {}", ex.what())
+    // Keys of a section are given as section.key
+    if (const auto dot = key.find('.'); dot != std::string::npos) {
+        file.set(key.substr(dot + 1), value, key.substr(0, dot));
+    } else {
+        file.set(key, value);
     }
 
-    tree.put(key, value);
-    boost::property_tree::write_ini(filename, tree);
+    file.commit();
 }
 
 void addStringToFile(std::string_view filename, std::string_view string)
 {
-    // Check if file already contains the string to avoid duplicate lines.
-    std::ifstream ifs(std::string { filename });
-    std::string content((std::istreambuf_iterator<char>(ifs)),
-        (std::istreambuf_iterator<char>()));
+    cloyster::services::files::FileEditSession session(filename);
 
-    if (content.find(string) != std::string::npos) {
+    // Check if file already contains the string to avoid duplicate lines.
+    if (!session.appendIfAbsent(string)) {
         LOG_DEBUG("File {} already contains line(s):\n{}\n", filename, string)
         return;
     }
 
-#ifdef _LIBCPP_VERSION
-    std::ofstream file(filename, std::ios_base::app);
-#else
-    std::ofstream file(std::string { filename }, std::ios_base::app);
-#endif
-    auto opts = cloyster::Singleton<cloyster::services::Options>::get();
-    if (opts->dryRun) {
-        LOG_WARN(
-            "Dry Run: Would add a string in file {}:\n{}", filename, string);
-        return;
-    }
-
-    if (!file.is_open())
-        throw std::runtime_error(
-            fmt::format("Error opening file: {}", filename));
-
-    file << string;
-    LOG_DEBUG("Added line(s):\n{}\n => to file: {}", string, filename)
+    session.commit();
 }
 
 std::string findAndReplace(const std::string_view& source,
@@ -279,16 +250,15 @@ void copyFile(std::filesystem::path source, std::filesystem::path destination)
         return;
     }
 
-    try {
-        LOG_DEBUG("Copying file {} to {}", source, destination);
-        std::filesystem::copy(source, destination);
-    } catch (const std::filesystem::filesystem_error& ex) {
-        if (ex.code().default_error_condition() == std::errc::file_exists) {
-            LOG_WARN("File {} already exists, skip copying", source);
-            return;
-        }
+    LOG_DEBUG("Copying file {} to {}", source, destination);
+    if (std::filesystem::is_directory(source)) {
+        services::files::copyTree(source, destination);
+        return;
+    }
 
-        throw;
+    if (services::files::copyFile(source, destination)
+        == services::files::CopyMethod::Skipped) {
+        LOG_WARN("File {} already exists, skip copying", source);
     }
 }
 
@@ -364,14 +334,73 @@ void backupFilesByExtension(
         std::filesystem::remove_all(backupPath);
     }
 
-    if (!cloyster::functions::exists(backupPath)) {
-        LOG_INFO("Backing up {} files from {} to {}", extension, sourcePath, backupPath);
-        cloyster::functions::createDirectory(backupPath.get());
-        cloyster::functions::moveFilesWithExtension(sourcePath.get(), backupPath.get(), extension.get());
-    } else {
+    if (cloyster::functions::exists(backupPath)) {
         LOG_INFO("Backup path {} already exists, skipping", backupPath);
+        return;
+    }
+
+    LOG_INFO("Backing up {} files from {} to {}", extension, sourcePath, backupPath);
+    if (opts->dryRun) {
+        return;
+    }
+
+    // The files are moved into the backup store, backupPath gets copies of
+    // them. The store objects are read only and shared between runs, so the
+    // copies must not be hard links to them.
+    createDirectory(backupPath.get());
+    const auto lower = utils::string::lower(extension.get());
+    for (const auto& entry :
+        std::filesystem::directory_iterator(sourcePath.get())) {
+        if (!entry.is_regular_file()
+            || utils::string::lower(entry.path().extension().string())
+                != lower) {
+            continue;
+        }
+
+        const auto mode = entry.status().permissions();
+        const auto digest = backupStore().stash(entry.path());
+        const auto copy = backupPath.get() / entry.path().filename();
+        services::files::copyFile(backupStore().object(digest), copy,
+            { .overwrite = true, .preserveOwner = true, .jobs = 0 });
+        std::filesystem::permissions(copy, mode);
+        LOG_DEBUG("Moved {} to the backup store as {}", entry.path(), digest);
     }
 }
+
+std::unordered_map<std::string, std::string> getHttpStatuses(
+    const std::vector<std::string>& urls, const std::size_t maxRetries)
+{
+    std::unordered_map<std::string, std::string> statuses;
+    const auto opts = cloyster::Singleton<services::Options>::get();
+    if (opts->shouldSkip("http-status")) {
+        for (const auto& url : urls) {
+            LOG_WARN("Skipping HTTP status check for {}, assuming 200 (reason: "
+                     "--skip=http-status in the command line)",
+                url);
+            statuses[url] = "200";
+        }
+        return statuses;
+    }
+
+    const auto results = services::http::probe(
+        urls, services::http::ProbeOptions { .maxRetries = maxRetries });
+    for (const auto& [url, result] : results) {
+        if (result.status == 0) {
+            LOG_DEBUG("HTTP request to {} failed: {}", url, result.error);
+            statuses[url] = "HTTP ERROR";
+            continue;
+        }
+        statuses[url] = std::to_string(result.status);
+    }
+
+    return statuses;
+}
+
+std::string getHttpStatus(const std::string& url, const std::size_t maxRetries)
+{
+    return getHttpStatuses({ url }, maxRetries).at(url);
+}
+
 TEST_SUITE_END();
 
 }; // namespace cloyster
@@ -5,6 +5,8 @@
 
 #include <cctype>
 #include <cstdlib>
+#include <filesystem>
+#include <set>
 
 #include <cloysterhpc/cloyster.h>
 #include <cloysterhpc/const.h>
@@ -12,11 +14,15 @@
 #include <cloysterhpc/functions.h>
 #include <cloysterhpc/models/cluster.h>
 #include <cloysterhpc/presenter/PresenterInstall.h>
+#include <cloysterhpc/services/backup.h>
+#include <cloysterhpc/services/cancellation.h>
 #include <cloysterhpc/services/files.h>
 #include <cloysterhpc/services/init.h>
 #include <cloysterhpc/services/log.h>
 #include <cloysterhpc/services/options.h>
+#include <cloysterhpc/services/runner.h>
 #include <cloysterhpc/services/shell.h>
+#include <cloysterhpc/services/tracer.h>
 #include <cloysterhpc/services/xcat.h>
 #include <cloysterhpc/verification.h>
 #include <cloysterhpc/view/newt.h>
@@ -109,6 +115,34 @@ int main(int argc, const char** argv)
         cloyster::checkEffectiveUserId();
     }
 
+    if (opts->listBackups) {
+        const cloyster::services::files::BackupStore store;
+        for (const auto& entry : store.list()) {
+            LOG_INFO("{}  {}  {}  {}", entry.run, entry.timestamp,
+                entry.digest.empty() ? "(missing)" : entry.digest.substr(0, 12),
+                entry.path.string())
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (!opts->restoreBackup.empty()) {
+        const cloyster::services::files::BackupStore store;
+        if (opts->dryRun) {
+            std::set<std::filesystem::path> paths;
+            for (const auto& entry : store.list()) {
+                if (entry.run == opts->restoreBackup
+                    && paths.insert(entry.path).second) {
+                    LOG_INFO("Dry Run: Would restore {}", entry.path.string())
+                }
+            }
+            return paths.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+        const auto restored = store.restore(opts->restoreBackup);
+        LOG_INFO("Restored {} files backed up by {}", restored,
+            opts->restoreBackup)
+        return restored > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     // --test implies --unattended
     if (!opts->testCommand.empty()) {
         opts->unattended = true;
@@ -176,10 +210,23 @@ int main(int argc, const char** argv)
     }
 #endif
     LOG_TRACE("Starting execution engine");
+    // Ctrl+C stops the running command and its children, a second one
+    // kills the installer right away
+    cloyster::services::CancellationToken::installSignalHandlers();
     std::unique_ptr<Execution> executionEngine
         = std::make_unique<cloyster::services::Shell>();
 
-    executionEngine->install();
+    try {
+        executionEngine->install();
+    } catch (const cloyster::services::CommandCancelledError& ex) {
+        LOG_ERROR("Installation interrupted: {}", ex.what())
+        Log::shutdown();
+        return EXIT_FAILURE;
+    }
+
+    if (!opts->traceFile.empty()) {
+        cloyster::Singleton<cloyster::services::Tracer>::get()->finish();
+    }
 
     LOG_INFO("{} has successfully ended", productName)
     Log::shutdown();
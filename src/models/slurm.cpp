@@ -6,7 +6,9 @@
 #include <cloysterhpc/functions.h>
 #include <cloysterhpc/models/cluster.h>
 #include <cloysterhpc/models/slurm.h>
+#include <cloysterhpc/services/fileedit.h>
 #include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/options.h>
 #include <cloysterhpc/services/osservice.h>
 #include <filesystem>
 
@@ -26,10 +28,8 @@ void SLURM::installServer()
 void SLURM::configureServer()
 {
     const std::string configurationFile { "/etc/slurm/slurm.conf" };
-    cloyster::functions::removeFile(configurationFile);
 
     // Ensure that the directory exists
-    // TODO: This may be made on cloyster::addStringToFile?
     cloyster::functions::createDirectory("/etc/slurm");
 
     std::vector<std::string> nodes;
@@ -50,7 +50,11 @@ void SLURM::configureServer()
         fmt::arg("partitionName", getDefaultQueue()),
         fmt::arg("nodesDeclaration", fmt::join(nodes, "\n"))) };
 
-    cloyster::functions::addStringToFile(configurationFile, conf);
+    if (cloyster::Singleton<cloyster::services::Options>::get()->dryRun) {
+        LOG_INFO("Dry Run: Would write file {}", configurationFile)
+        return;
+    }
+    cloyster::services::files::writeFileAtomically(configurationFile, conf);
 }
 
 void SLURM::enableServer()
@@ -106,13 +106,14 @@ void OFED::install() const
             // Get the last rpm in /tmp/DOCA*/ folder
             // On dry-run the below command will not run so we
             // cannot get the output of it
-            auto rpm = runner->checkOutput(
+            auto rpm = runner->captureOutput(
                 "bash -c \"find /tmp/DOCA*/ -name '*.rpm' -printf '%T@ %p\n' | "
                 "sort -nk1 | tail -1 | awk '{print $2}'\"");
-            assert(rpm.size() > 0); // at last one line
+            assert(!rpm.empty()); // at last one line
 
             // Install the (last) generated rpm
-            runner->executeCommand(fmt::format("dnf install -y {}", rpm[0]));
+            runner->executeCommand(
+                fmt::format("dnf install -y {}", rpm.front()));
 
             runner->checkCommand(R"(dnf makecache --repo=doca*)");
             runner->checkCommand("dnf install -y doca-ofed mlnx-fw-updater");
@@ -5,17 +5,22 @@
 
 #include <cloysterhpc/functions.h>
 #include <cloysterhpc/presenter/PresenterNodesOperationalSystem.h>
+#include <cloysterhpc/services/downloader.h>
 #include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/runner.h>
 
 #include <algorithm>
-#include <boost/algorithm/string/classification.hpp>
-#include <boost/algorithm/string/split.hpp>
-#include <boost/lexical_cast.hpp>
 #include <filesystem>
 #include <fmt/args.h>
 #include <fmt/core.h>
+#include <mutex>
 #include <ranges>
 #include <string_view>
+#include <system_error>
+#include <thread>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -115,6 +120,125 @@ PresenterNodesOperationalSystem::selectVersion(OS::Distro distro)
     return std::nullopt;
 }
 
+std::optional<std::filesystem::path>
+PresenterNodesOperationalSystem::downloadIso(
+    const std::vector<std::string>& distroNames,
+    const std::map<std::string, OS::Distro>& distros)
+{
+    // Download remote ISO
+    auto distroToDownload = m_view->listMenu(Messages::title,
+        Messages::OperationalSystemDownloadIso::SecondStage::question,
+        distroNames,
+        Messages::OperationalSystemDownloadIso::SecondStage::help);
+
+    auto selectedDistro = distros.find(distroToDownload);
+
+    auto versioncombo = selectVersion(selectedDistro->second);
+    std::string distroDownloadURL
+        = getDownloadURL(selectedDistro->second, *versioncombo);
+    std::string isoName
+        = distroDownloadURL.substr(distroDownloadURL.find_last_of('/'));
+
+    const auto isoPath = fs::path("/root") / isoName.substr(1);
+
+    // The download runs on its own thread and wakes the dialog up
+    // through an eventfd whenever it has news
+    const int events = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (events == -1) {
+        throw std::system_error(errno, std::system_category(), "eventfd");
+    }
+    const auto notify = [events]() {
+        const std::uint64_t value = 1;
+        [[maybe_unused]] const auto written
+            = ::write(events, &value, sizeof(value));
+    };
+
+    std::mutex mutex;
+    cloyster::services::http::DownloadProgress current;
+    bool done = false;
+    std::exception_ptr error;
+    std::jthread worker([&](std::stop_token stop) {
+        cloyster::services::http::DownloadOptions options;
+        options.stop = std::move(stop);
+        options.progress = [&](const auto& progress) {
+            {
+                std::scoped_lock lock(mutex);
+                current = progress;
+            }
+            notify();
+        };
+        try {
+            cloyster::services::http::download(
+                distroDownloadURL, isoPath, options);
+        } catch (...) {
+            std::scoped_lock lock(mutex);
+            error = std::current_exception();
+        }
+        {
+            std::scoped_lock lock(mutex);
+            done = true;
+        }
+        notify();
+    });
+
+    auto desc = fmt::format(
+        Messages::OperationalSystemDownloadIso::Progress::download,
+        selectedDistro->first, distroDownloadURL);
+    const bool finished = m_view->progressMenu(Messages::title,
+        desc.c_str(), events,
+        [&]() -> std::optional<std::pair<double, std::string>> {
+            std::uint64_t value = 0;
+            [[maybe_unused]] const auto read
+                = ::read(events, &value, sizeof(value));
+
+            std::scoped_lock lock(mutex);
+            if (done) {
+                return std::nullopt;
+            }
+            constexpr double mebibyte = 1024 * 1024;
+            auto status = fmt::format("{:.0f} of {:.0f} MiB at {:.1f} MiB/s",
+                static_cast<double>(current.received) / mebibyte,
+                static_cast<double>(current.total.value_or(0)) / mebibyte,
+                current.bytesPerSecond / mebibyte);
+            if (current.eta) {
+                status += fmt::format(", {}m{:02}s left",
+                    current.eta->count() / 60, current.eta->count() % 60);
+            }
+            return std::make_pair(current.percent().value_or(0), status);
+        });
+
+    if (!finished) {
+        worker.request_stop();
+    }
+    worker.join();
+    ::close(events);
+
+    if (!finished) {
+        LOG_WARN("ISO download cancelled, it resumes on the next attempt")
+        m_view->message(Messages::title,
+            Messages::OperationalSystemDownloadIso::Progress::cancelled);
+        return std::nullopt;
+    }
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (const cloyster::services::CommandCancelledError&) {
+            LOG_WARN("ISO download cancelled, it resumes on the next attempt")
+            m_view->message(Messages::title,
+                Messages::OperationalSystemDownloadIso::Progress::cancelled);
+        } catch (const std::exception& ex) {
+            LOG_ERROR("ISO download failed: {}", ex.what())
+            const auto message = fmt::format(
+                Messages::OperationalSystemDownloadIso::Progress::failed,
+                ex.what());
+            m_view->message(Messages::title, message.c_str());
+        }
+        return std::nullopt;
+    }
+
+    return isoPath;
+}
+
 PresenterNodesOperationalSystem::PresenterNodesOperationalSystem(
     std::unique_ptr<Cluster>& model, std::unique_ptr<Newt>& view)
     : Presenter(model, view)
@@ -131,80 +255,20 @@ PresenterNodesOperationalSystem::PresenterNodesOperationalSystem(
     distros["Rocky Linux"] = OS::Distro::Rocky;
     distros["Oracle Linux"] = OS::Distro::OL;
 
-    // Download remote ISO image or use local image
-
-    auto downloadIso = false;
-
-    downloadIso = m_view->yesNoQuestion(Messages::title,
-        Messages::OperationalSystemDownloadIso::FirstStage::question,
-        Messages::OperationalSystemDirectoryPath::help);
-
-    if (downloadIso) {
-
-        // Download remote ISO
-        auto distroToDownload = m_view->listMenu(Messages::title,
-            Messages::OperationalSystemDownloadIso::SecondStage::question,
-            distroNames,
-            Messages::OperationalSystemDownloadIso::SecondStage::help);
-
-        auto selectedDistro = distros.find(distroToDownload);
-
-        auto versioncombo = selectVersion(selectedDistro->second);
-        std::string distroDownloadURL
-            = getDownloadURL(selectedDistro->second, *versioncombo);
-        std::string isoName
-            = distroDownloadURL.substr(distroDownloadURL.find_last_of('/'));
-
-        //@TODO Implement newt GUI progress bar
-        auto command = Singleton<IRunner>::get()->executeCommandIter(
-            fmt::format("wget -NP /root {}", distroDownloadURL),
-            cloyster::services::Stream::Stderr);
-
-        auto desc = fmt::format(
-            Messages::OperationalSystemDownloadIso::Progress::download,
-            selectedDistro->first, distroDownloadURL);
-        m_view->progressMenu(Messages::title, desc.c_str(), std::move(command),
-            [&](cloyster::services::CommandProxy& cmd)
-                -> std::optional<double> {
-                auto out = cmd.getline();
-                if (!out) {
-                    return std::nullopt;
-                }
-                std::string line = *out;
-
-                // If we have a line like ERROR 404: Not Found
-                // this means, obviously, that we did not found the URL.
-                if (line.contains("ERROR 404: Not Found")) {
-                    LOG_ERROR("URL {} not found", distroDownloadURL);
-                    return std::nullopt;
-                }
-
-                // Line example
-                //  <<<338950K .......... .......... .......... ..........
-                //  ..........  3% 31.8M 10m40s>>
-
-                // TODO: (on the progress bar) maybe allow altering some menu
-                // parameters (like the text)
-                std::vector<std::string> slots;
-
-                boost::split(slots, line, boost::is_any_of("\t\r "),
-                    boost::token_compress_on);
+    // Download remote ISO image or use local image, a download that is
+    // cancelled or fails goes back to this question
 
-                if (slots.size() <= 6) {
-                    return std::make_optional(0.0);
-                }
-
-                auto num = slots[6].substr(0, slots[6].find_first_of('%'));
-
-                try {
-                    return std::make_optional(boost::lexical_cast<double>(num));
-                } catch (boost::bad_lexical_cast&) {
-                    return std::make_optional(0.0);
-                }
-            });
+    std::optional<std::filesystem::path> isoPath;
+    while (!isoPath
+        && m_view->yesNoQuestion(Messages::title,
+            Messages::OperationalSystemDownloadIso::FirstStage::question,
+            Messages::OperationalSystemDirectoryPath::help)) {
+        isoPath = downloadIso(distroNames, distros);
+    }
 
-        m_model->setDiskImage(fmt::format("/root/{}", isoName));
-        LOG_DEBUG("Selected ISO: {}", fmt::format("/root/{}", isoName))
+    if (isoPath) {
+        m_model->setDiskImage(*isoPath);
+        LOG_DEBUG("Selected ISO: {}", isoPath->string())
 
     } else {
         // Operational system directory path selection
@@ -0,0 +1,538 @@
+#include <algorithm>
+#include <csignal>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/process.hpp>
+#include <boost/process/async.hpp>
+#include <boost/process/extend.hpp>
+#include <fmt/format.h>
+
+#include <cloysterhpc/functions.h>
+#include <cloysterhpc/services/asyncrunner.h>
+#include <cloysterhpc/services/cancellation.h>
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/log.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace {
+
+namespace asio = boost::asio;
+namespace bp = boost::process;
+using asio::awaitable;
+using asio::use_awaitable;
+using cloyster::services::CommandResult;
+
+/**
+ * @brief One shot event a coroutine can wait for
+ *
+ * Only used from the io_context thread.
+ */
+class Event final {
+    asio::steady_timer m_timer;
+    bool m_set = false;
+
+public:
+    explicit Event(const asio::any_io_executor& executor)
+        : m_timer(executor, asio::steady_timer::time_point::max())
+    {
+    }
+
+    void set()
+    {
+        m_set = true;
+        m_timer.cancel();
+    }
+
+    [[nodiscard]] bool isSet() const { return m_set; }
+
+    awaitable<void> wait()
+    {
+        if (m_set) {
+            co_return;
+        }
+        boost::system::error_code ec;
+        co_await m_timer.async_wait(asio::redirect_error(use_awaitable, ec));
+    }
+};
+
+awaitable<void> readLines(bp::async_pipe& pipe, std::vector<std::string>& lines)
+{
+    std::string buffer;
+    while (true) {
+        boost::system::error_code ec;
+        const auto size = co_await asio::async_read_until(pipe,
+            asio::dynamic_buffer(buffer), '\n',
+            asio::redirect_error(use_awaitable, ec));
+        if (ec) {
+            // EOF, keep the last line even without a line break
+            if (!buffer.empty()) {
+                lines.emplace_back(std::move(buffer));
+            }
+            co_return;
+        }
+
+        lines.emplace_back(buffer.substr(0, size - 1));
+        LOG_TRACE("{}", lines.back())
+        buffer.erase(0, size);
+    }
+}
+
+// Every command leads its own process group, as with Runner
+const auto newProcessGroup = bp::extend::on_exec_setup(
+    [](auto& /*executor*/) { ::setpgid(0, 0); });
+
+// State shared with the handlers of the child process, they may outlive
+// the coroutine if it is torn down
+struct Execution final {
+    enum class Interruption : std::uint8_t { Timeout, Cancellation };
+
+    bp::async_pipe out;
+    bp::async_pipe err;
+    Event exited;
+    Event stderrClosed;
+    int exitCode = 0;
+
+    // The deadline, the token and the grace period before SIGKILL
+    asio::steady_timer deadline;
+    asio::posix::stream_descriptor token;
+    asio::steady_timer grace;
+    pid_t group = 0;
+    std::optional<Interruption> interruption;
+
+    Execution(asio::io_context& ctx, const asio::any_io_executor& executor)
+        : out(ctx)
+        , err(ctx)
+        , exited(executor)
+        , stderrClosed(executor)
+        , deadline(executor)
+        , token(executor)
+        , grace(executor)
+    {
+    }
+
+    // SIGTERM to the process group, SIGKILL after the grace period
+    void interrupt(const std::shared_ptr<Execution>& self, Interruption reason)
+    {
+        if (interruption || exited.isSet()) {
+            return;
+        }
+        interruption = reason;
+        ::killpg(group, SIGTERM);
+        grace.expires_after(cloyster::services::process::terminateGracePeriod);
+        grace.async_wait([self](const boost::system::error_code& error) {
+            // The group outlives its leader while any member is alive
+            if (!error) {
+                ::killpg(self->group, SIGKILL);
+            }
+        });
+    }
+
+    // Interrupts the command at the deadline or when the token is raised
+    void watch(const std::shared_ptr<Execution>& self,
+        std::chrono::steady_clock::time_point at)
+    {
+        // The child may be reaped before it gets here
+        if (exited.isSet()) {
+            return;
+        }
+        if (at != std::chrono::steady_clock::time_point::max()) {
+            deadline.expires_at(at);
+            deadline.async_wait([self](const boost::system::error_code& error) {
+                if (!error) {
+                    self->interrupt(self, Interruption::Timeout);
+                }
+            });
+        }
+
+        const int fd = ::dup(cloyster::services::CancellationToken::global().fd());
+        if (fd == -1) {
+            throw std::system_error(errno, std::system_category(), "dup");
+        }
+        token.assign(fd);
+        token.async_wait(asio::posix::stream_descriptor::wait_read,
+            [self](const boost::system::error_code& error) {
+                if (!error) {
+                    self->interrupt(self, Interruption::Cancellation);
+                }
+            });
+    }
+
+    // Called on exit, what the interrupted command started goes with it
+    void unwatch()
+    {
+        if (interruption) {
+            ::killpg(group, SIGKILL);
+        }
+        deadline.cancel();
+        grace.cancel();
+        // The token is only open once watch() ran
+        boost::system::error_code ignored;
+        token.close(ignored);
+    }
+};
+
+} // anonymous namespace
+
+namespace cloyster::services {
+
+AsyncRunner::AsyncRunner()
+    : m_work(asio::make_work_guard(m_ctx))
+    , m_thread([this]() { m_ctx.run(); })
+{
+}
+
+AsyncRunner::~AsyncRunner()
+{
+    // Let the submitted jobs finish before tearing down the io_context
+    m_work.reset();
+    m_thread.join();
+}
+
+asio::io_context::executor_type AsyncRunner::executor()
+{
+    return m_ctx.get_executor();
+}
+
+template <typename T> T AsyncRunner::wait(asio::awaitable<T> task)
+{
+    if (m_ctx.get_executor().running_in_this_thread()) {
+        throw std::logic_error(
+            "AsyncRunner: blocking call from inside the io_context, "
+            "co_await execute() instead");
+    }
+    return asio::co_spawn(m_ctx, std::move(task), asio::use_future).get();
+}
+
+awaitable<CommandResult> AsyncRunner::execute(
+    std::string cmd, std::chrono::milliseconds timeout)
+{
+    const auto executor = co_await asio::this_coro::executor;
+    LOG_DEBUG("Running command: {}", cmd)
+    if (CancellationToken::global().cancelled()) {
+        throw CommandCancelledError(cmd);
+    }
+
+    auto state = std::make_shared<Execution>(m_ctx, executor);
+    const auto deadline = process::deadlineAfter(timeout);
+    bp::child child(cmd, bp::std_out > state->out, bp::std_err > state->err,
+        m_ctx, newProcessGroup,
+        bp::on_exit([state](int exitCode, const std::error_code&) {
+            state->exitCode = exitCode;
+            state->exited.set();
+            state->unwatch();
+        }));
+    state->group = static_cast<pid_t>(child.id());
+    state->watch(state, deadline);
+
+    CommandResult result;
+    asio::co_spawn(executor, readLines(state->err, result.errorOutput),
+        [state](const std::exception_ptr&) { state->stderrClosed.set(); });
+    co_await readLines(state->out, result.output);
+    co_await state->stderrClosed.wait();
+    co_await state->exited.wait();
+
+    if (state->interruption == Execution::Interruption::Timeout) {
+        LOG_WARN("Command timed out after {}ms: {}", timeout.count(), cmd)
+        throw CommandTimeoutError(cmd, timeout);
+    }
+    if (state->interruption == Execution::Interruption::Cancellation) {
+        LOG_WARN("Cancelling command: {}", cmd)
+        throw CommandCancelledError(cmd);
+    }
+
+    result.exitCode = state->exitCode;
+    LOG_DEBUG("Exit code: {}", result.exitCode)
+    co_return result;
+}
+
+int AsyncRunner::executeCommand(const std::string& cmd)
+{
+    return wait(execute(cmd)).exitCode;
+}
+
+int AsyncRunner::executeCommand(
+    const std::string& cmd, std::list<std::string>& output)
+{
+    auto result = wait(execute(cmd));
+    std::ranges::move(result.output, std::back_inserter(output));
+    return result.exitCode;
+}
+
+int AsyncRunner::executeCommand(const std::string& cmd, OutputBuffer& output)
+{
+    auto result = wait(execute(cmd));
+    for (const auto& line : result.output) {
+        output.append(line);
+        output.append("\n");
+    }
+    return result.exitCode;
+}
+
+CommandProxy AsyncRunner::executeCommandIter(
+    const std::string& cmd, Stream out)
+{
+    return m_blocking.executeCommandIter(cmd, out);
+}
+
+void AsyncRunner::checkCommand(const std::string& cmd)
+{
+    if (executeCommand(cmd) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+}
+
+std::vector<std::string> AsyncRunner::checkOutput(const std::string& cmd)
+{
+    auto result = wait(execute(cmd));
+    if (result.exitCode != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+    return std::move(result.output);
+}
+
+OutputBuffer AsyncRunner::captureOutput(const std::string& cmd)
+{
+    OutputBuffer output;
+    if (executeCommand(cmd, output) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+    return output;
+}
+
+int AsyncRunner::downloadFile(const std::string& url, const std::string& file)
+{
+    // The native downloader runs its own event loop
+    return Runner().downloadFile(url, file);
+}
+
+int AsyncRunner::run(const ScriptBuilder& script)
+{
+    std::string&& content = script.toString();
+    const auto hash = cloyster::services::files::checksum(content);
+    const std::filesystem::path path = fmt::format("/tmp/{}.sh", hash);
+    functions::installFile(path, std::move(content));
+    executeCommand(fmt::format("chmod +x {}", path));
+    executeCommand(path);
+    return 0;
+}
+
+awaitable<void> AsyncRunner::batchWorker(const std::vector<std::string>& cmds,
+    std::size_t& next, std::vector<CommandResult>& results,
+    std::chrono::milliseconds timeout)
+{
+    // Workers share the index, they all run on the io_context thread
+    while (next < cmds.size()) {
+        const auto index = next++;
+        results[index] = co_await execute(cmds[index], timeout);
+    }
+}
+
+std::vector<CommandResult> AsyncRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t concurrency)
+{
+    std::vector<CommandResult> results(cmds.size());
+    if (cmds.empty()) {
+        return results;
+    }
+
+    if (concurrency == 0) {
+        concurrency = std::max(1U, std::thread::hardware_concurrency());
+    }
+    concurrency = std::min(concurrency, cmds.size());
+    LOG_DEBUG("Running {} commands with {} coroutines", cmds.size(),
+        concurrency);
+
+    // The timeout of the calling thread, the workers run on the io_context
+    const auto timeout = ScopedTimeout::current();
+    std::size_t next = 0;
+    std::vector<std::future<void>> workers;
+    workers.reserve(concurrency);
+    for (std::size_t i = 0; i < concurrency; ++i) {
+        workers.emplace_back(asio::co_spawn(m_ctx,
+            batchWorker(cmds, next, results, timeout), asio::use_future));
+    }
+    // Every worker has to finish before the results go away
+    std::exception_ptr error;
+    for (auto& worker : workers) {
+        try {
+            worker.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    return results;
+}
+
+std::future<CommandResult> AsyncRunner::submit(const std::string& cmd)
+{
+    LOG_DEBUG("Submitting command: {}", cmd)
+    return asio::co_spawn(m_ctx, execute(cmd), asio::use_future);
+}
+
+MockAsyncRunner::MockAsyncRunner(std::chrono::milliseconds delay)
+    : m_delay(delay)
+{
+}
+
+awaitable<CommandResult> MockAsyncRunner::execute(
+    std::string cmd, std::chrono::milliseconds /*timeout*/)
+{
+    CommandResult result;
+    {
+        std::scoped_lock lock(m_mutex);
+        m_cmds.push_back(cmd);
+        m_maxInFlight = std::max(m_maxInFlight, ++m_inFlight);
+        if (const auto it = m_results.find(cmd); it != m_results.end()) {
+            result = it->second;
+        }
+    }
+
+    asio::steady_timer timer(co_await asio::this_coro::executor, m_delay);
+    co_await timer.async_wait(use_awaitable);
+
+    std::scoped_lock lock(m_mutex);
+    --m_inFlight;
+    co_return result;
+}
+
+void MockAsyncRunner::setResult(const std::string& cmd, CommandResult result)
+{
+    std::scoped_lock lock(m_mutex);
+    m_results[cmd] = std::move(result);
+}
+
+std::vector<std::string> MockAsyncRunner::listCommands() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_cmds;
+}
+
+std::size_t MockAsyncRunner::maxInFlight() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_maxInFlight;
+}
+
+TEST_SUITE_BEGIN("cloyster::services::asyncrunner");
+
+TEST_CASE("AsyncRunner runs real processes")
+{
+    AsyncRunner runner;
+
+    std::list<std::string> output;
+    CHECK(runner.executeCommand(R"(sh -c "echo out; echo err >&2; exit 4")",
+              output)
+        == 4);
+    CHECK(output == std::list<std::string> { "out" });
+
+    auto result = runner.submit(R"(sh -c "echo err >&2; printf partial")").get();
+    CHECK(result.exitCode == 0);
+    CHECK(result.output == std::vector<std::string> { "partial" });
+    CHECK(result.errorOutput == std::vector<std::string> { "err" });
+
+    CHECK_THROWS_AS(runner.checkCommand("false"), std::runtime_error);
+    CHECK(runner.checkOutput("echo checked")
+        == std::vector<std::string> { "checked" });
+
+    const auto results
+        = runner.executeBatch({ R"(sh -c "sleep 0.2; echo slow")",
+                                  "echo fast" },
+            2);
+    REQUIRE(results.size() == 2);
+    CHECK(results[0].output == std::vector<std::string> { "slow" });
+    CHECK(results[1].output == std::vector<std::string> { "fast" });
+
+    {
+        const ScopedTimeout timeout(std::chrono::milliseconds(200));
+        CHECK_THROWS_AS(runner.executeCommand("sleep 5"), CommandTimeoutError);
+        CHECK_THROWS_AS(
+            runner.submit(R"(sh -c "sleep 5 & wait")").get(),
+            CommandTimeoutError);
+        CHECK_THROWS_AS(runner.executeBatch({ "true", "sleep 5" }, 2),
+            CommandTimeoutError);
+    }
+
+    std::thread canceller([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        CancellationToken::global().cancel();
+    });
+    CHECK_THROWS_AS(runner.executeCommand("sleep 5"), CommandCancelledError);
+    canceller.join();
+    CancellationToken::global().reset();
+    CHECK(runner.executeCommand("true") == 0);
+}
+
+TEST_CASE("MockAsyncRunner")
+{
+    using namespace std::chrono_literals;
+    SUBCASE("submitted jobs overlap")
+    {
+        MockAsyncRunner runner(50ms);
+        runner.setResult("lsdef -t osimage",
+            { .exitCode = 1, .output = {}, .errorOutput = {} });
+        auto copycds = runner.submit("copycds rocky.iso");
+        CHECK(runner.executeCommand("lsdef -t osimage") == 1);
+        CHECK(copycds.get().exitCode == 0);
+        CHECK(runner.maxInFlight() == 2);
+    }
+
+    SUBCASE("batches respect the concurrency limit")
+    {
+        MockAsyncRunner runner(50ms);
+        const auto results = runner.executeBatch(
+            { "ln -sf a b", "ln -sf c d", "ln -sf e f", "ln -sf g h" }, 2);
+        CHECK(results.size() == 4);
+        CHECK(runner.maxInFlight() == 2);
+        CHECK(runner.listCommands().size() == 4);
+    }
+
+    SUBCASE("coroutines can await commands directly")
+    {
+        MockAsyncRunner runner;
+        auto job = asio::co_spawn(
+            runner.executor(),
+            [&runner]() -> awaitable<int> {
+                auto first = co_await runner.execute("genimage compute");
+                auto second = co_await runner.execute("packimage compute");
+                co_return first.exitCode + second.exitCode;
+            },
+            asio::use_future);
+        CHECK(job.get() == 0);
+        CHECK(runner.listCommands()
+            == std::vector<std::string> {
+                "genimage compute", "packimage compute" });
+    }
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services
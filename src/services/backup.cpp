@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+#include <cloysterhpc/services/backup.h>
+#include <cloysterhpc/services/checksum.h>
+#include <cloysterhpc/services/copy.h>
+#include <cloysterhpc/services/descriptor.h>
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::files {
+
+namespace {
+
+    std::string timestamp()
+    {
+        return fmt::format("{:%FT%TZ}",
+            std::chrono::time_point_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now()));
+    }
+
+    // A name next to @p path for a file renamed over it afterwards
+    std::filesystem::path temporaryName(const std::filesystem::path& path)
+    {
+        static std::atomic<unsigned> counter = 0;
+        auto result = path;
+        result += fmt::format(".{}.{}.tmp", ::getpid(), counter++);
+        return result;
+    }
+
+    // Copies into the store share the blocks where the filesystem can
+    constexpr CopyOptions storeCopy {
+        .overwrite = true, .preserveOwner = false, .jobs = 0
+    };
+
+    std::optional<BackupEntry> parseEntry(std::string_view line)
+    {
+        std::array<std::string_view, 6> fields;
+        for (auto& field : fields) {
+            const auto tab = line.find('\t');
+            if (tab == std::string_view::npos) {
+                return std::nullopt;
+            }
+            field = line.substr(0, tab);
+            line.remove_prefix(tab + 1);
+        }
+
+        try {
+            return BackupEntry { .run = std::string(fields[0]),
+                .timestamp = std::string(fields[1]),
+                .digest = std::string(fields[2] == "-" ? "" : fields[2]),
+                .path = std::filesystem::path(line),
+                .mode = static_cast<std::filesystem::perms>(
+                    std::stoul(std::string(fields[3]), nullptr, 8)),
+                .uid = static_cast<uid_t>(std::stoul(std::string(fields[4]))),
+                .gid
+                = static_cast<gid_t>(std::stoul(std::string(fields[5]))) };
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }
+
+}
+
+BackupStore::BackupStore(std::filesystem::path root, std::string run)
+    : m_root(std::move(root))
+    , m_run(std::move(run))
+{
+}
+
+std::string BackupStore::currentRun()
+{
+    static const auto run = fmt::format("{:%Y%m%dT%H%M%SZ}-{}",
+        std::chrono::time_point_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now()),
+        ::getpid());
+    return run;
+}
+
+std::filesystem::path BackupStore::object(std::string_view digest) const
+{
+    return m_root / "objects" / digest.substr(0, 2) / digest.substr(2);
+}
+
+std::string BackupStore::backup(const std::filesystem::path& path)
+{
+    return store(path, false);
+}
+
+std::string BackupStore::stash(const std::filesystem::path& path)
+{
+    return store(path, true);
+}
+
+std::string BackupStore::store(const std::filesystem::path& path, bool move)
+{
+    BackupEntry entry { .run = m_run,
+        .timestamp = timestamp(),
+        .digest = {},
+        .path = std::filesystem::absolute(path),
+        .mode = std::filesystem::perms::none,
+        .uid = 0,
+        .gid = 0 };
+
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0) {
+        if (errno != ENOENT) {
+            throw FileException(errorMessage("Cannot stat", path));
+        }
+        record(entry);
+        return {};
+    }
+    if (!S_ISREG(st.st_mode)) {
+        throw FileException(
+            fmt::format("Cannot back up {}: not a file", path.string()));
+    }
+    entry.mode = static_cast<std::filesystem::perms>(st.st_mode & 07777);
+    entry.uid = st.st_uid;
+    entry.gid = st.st_gid;
+    entry.digest = files::sha256(path);
+
+    auto target = object(entry.digest);
+    bool kept = false;
+    if (!std::filesystem::exists(target)) {
+        std::filesystem::create_directories(target.parent_path());
+
+        // The file itself becomes the object, unless it is on another
+        // filesystem
+        if (move && !std::filesystem::is_symlink(path)
+            && ::rename(path.c_str(), target.c_str()) == 0) {
+            kept = true;
+        } else {
+            const auto temporary = temporaryName(target);
+            copyFile(path, temporary, storeCopy);
+
+            // The file may have changed since it was hashed
+            entry.digest = files::sha256(temporary);
+            target = object(entry.digest);
+            std::filesystem::create_directories(target.parent_path());
+            std::filesystem::rename(temporary, target);
+        }
+        std::filesystem::permissions(target,
+            std::filesystem::perms::owner_read
+                | std::filesystem::perms::group_read
+                | std::filesystem::perms::others_read);
+    }
+
+    if (move && !kept) {
+        std::filesystem::remove(path);
+    }
+
+    record(entry);
+    return entry.digest;
+}
+
+void BackupStore::record(const BackupEntry& entry)
+{
+    std::lock_guard lock(m_mutex);
+    if (!m_recorded.emplace(entry.path.string(), entry.digest).second) {
+        return;
+    }
+
+    std::filesystem::create_directories(m_root);
+    const auto index = m_root / "index";
+    const Descriptor fd(::open(
+        index.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+    if (fd.get() < 0) {
+        throw FileException(errorMessage("Cannot open", index));
+    }
+
+    // A single write, lines of concurrent runs are not interleaved
+    const auto line = fmt::format("{}\t{}\t{}\t{:o}\t{}\t{}\t{}\n", entry.run,
+        entry.timestamp, entry.digest.empty() ? "-" : entry.digest,
+        static_cast<unsigned>(entry.mode), entry.uid, entry.gid,
+        entry.path.string());
+    if (::write(fd.get(), line.data(), line.size())
+        != static_cast<ssize_t>(line.size())) {
+        throw FileException(errorMessage("Cannot write", index));
+    }
+}
+
+std::vector<BackupEntry> BackupStore::list() const
+{
+    std::vector<BackupEntry> entries;
+    std::ifstream index(m_root / "index");
+    std::string line;
+    while (std::getline(index, line)) {
+        if (auto entry = parseEntry(line)) {
+            entries.push_back(std::move(*entry));
+        } else {
+            LOG_WARN("Ignoring a malformed line of the backup index: {}", line)
+        }
+    }
+    return entries;
+}
+
+std::vector<std::string> BackupStore::runs() const
+{
+    std::vector<std::string> runs;
+    for (const auto& entry : list()) {
+        if (std::ranges::find(runs, entry.run) == runs.end()) {
+            runs.push_back(entry.run);
+        }
+    }
+    return runs;
+}
+
+std::size_t BackupStore::restore(std::string_view run) const
+{
+    // The first backup of a file in the run is its state before the run
+    std::map<std::filesystem::path, BackupEntry> files;
+    for (auto& entry : list()) {
+        if (entry.run == run) {
+            files.try_emplace(entry.path, std::move(entry));
+        }
+    }
+
+    for (const auto& [path, entry] : files) {
+        const auto target = std::filesystem::is_symlink(path)
+            ? std::filesystem::canonical(path)
+            : path;
+
+        if (entry.digest.empty()) {
+            LOG_DEBUG("Removing {}, it did not exist before {}",
+                path.string(), run)
+            std::filesystem::remove(target);
+            continue;
+        }
+
+        LOG_DEBUG("Restoring {} from {}", path.string(), entry.digest)
+        std::filesystem::create_directories(target.parent_path());
+        const auto temporary = temporaryName(target);
+        copyFile(object(entry.digest), temporary, storeCopy);
+        if (::chown(temporary.c_str(), entry.uid, entry.gid) != 0) {
+            const auto message = errorMessage("Cannot set the owner of", path);
+            std::filesystem::remove(temporary);
+            throw FileException(message);
+        }
+        std::filesystem::permissions(temporary, entry.mode);
+        std::filesystem::rename(temporary, target);
+    }
+
+    return files.size();
+}
+
+} // namespace cloyster::services::files
+
+TEST_SUITE_BEGIN("cloyster::services::files");
+
+namespace {
+    using cloyster::services::files::BackupStore;
+
+    using cloyster::tests::TemporaryDirectory;
+
+    void writeFile(const std::filesystem::path& path, std::string_view data)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc)
+            .write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    std::string readFile(const std::filesystem::path& path)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(ifs),
+            std::istreambuf_iterator<char>() };
+    }
+
+    std::size_t countObjects(const std::filesystem::path& root)
+    {
+        std::size_t count = 0;
+        for (const auto& entry :
+            std::filesystem::recursive_directory_iterator(root / "objects")) {
+            count += entry.is_regular_file() ? 1 : 0;
+        }
+        return count;
+    }
+}
+
+TEST_CASE("BackupStore keeps each content once")
+{
+    TemporaryDirectory dir;
+    const auto root = dir.path / "store";
+    const auto hosts = dir.path / "hosts";
+    const auto copy = dir.path / "hosts.copy";
+    writeFile(hosts, "127.0.0.1 localhost\n");
+    writeFile(copy, "127.0.0.1 localhost\n");
+
+    for (const auto* run : { "first", "second" }) {
+        BackupStore store(root, run);
+        const auto digest = store.backup(hosts);
+        CHECK(store.backup(copy) == digest);
+        CHECK(store.backup(hosts) == digest);
+        CHECK(readFile(store.object(digest)) == "127.0.0.1 localhost\n");
+    }
+    CHECK(countObjects(root) == 1);
+
+    const BackupStore store(root, "third");
+    CHECK(store.runs() == std::vector<std::string> { "first", "second" });
+    const auto entries = store.list();
+    REQUIRE(entries.size() == 4);
+    CHECK(entries[0].path == hosts);
+    CHECK(entries[1].path == copy);
+    CHECK(entries[0].digest == entries[3].digest);
+}
+
+TEST_CASE("BackupStore restores a run")
+{
+    TemporaryDirectory dir;
+    const auto root = dir.path / "store";
+    const auto chrony = dir.path / "chrony.conf";
+    const auto repos = dir.path / "yum.repos.d";
+    const auto created = dir.path / "90-dns-none.conf";
+    std::filesystem::create_directories(repos);
+    writeFile(chrony, "pool 2.rocky.pool.ntp.org iburst\n");
+    std::filesystem::permissions(chrony, std::filesystem::perms(0640));
+    writeFile(repos / "rocky.repo", "[baseos]\n");
+
+    BackupStore store(root, "install");
+    store.backup(chrony);
+    store.backup(created);
+    const auto digest = store.stash(repos / "rocky.repo");
+    CHECK_FALSE(std::filesystem::exists(repos / "rocky.repo"));
+    CHECK(readFile(store.object(digest)) == "[baseos]\n");
+
+    writeFile(chrony, "local stratum 10\n");
+    store.backup(chrony);
+    writeFile(created, "[main]\ndns=none\n");
+    writeFile(repos / "rocky.repo", "[OpenHPC]\n");
+
+    CHECK(store.restore("install") == 3);
+    CHECK(readFile(chrony) == "pool 2.rocky.pool.ntp.org iburst\n");
+    CHECK((std::filesystem::status(chrony).permissions()
+              & std::filesystem::perms::all)
+        == std::filesystem::perms(0640));
+    CHECK(readFile(repos / "rocky.repo") == "[baseos]\n");
+    CHECK_FALSE(std::filesystem::exists(created));
+    CHECK(store.restore("missing") == 0);
+}
+
+TEST_SUITE_END();
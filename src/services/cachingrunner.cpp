@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/services/cachingrunner.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/patterns/singleton.h>
+#include <cloysterhpc/services/options.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services {
+
+std::vector<std::string> CachingRunner::defaultPureCommands()
+{
+    return {
+        "uname ",
+        "rpm -q",
+        R"(bash -c "rpm -q )",
+        "locale -a",
+        R"(bash -c "localectl status)",
+        "timedatectl list-timezones",
+    };
+}
+
+std::vector<std::string> CachingRunner::defaultMutatingCommands()
+{
+    return {
+        "dnf ",
+        "yum ",
+        "rpm -i",
+        "rpm -U",
+        "rpm -F",
+        "rpm -e",
+        "grubby ",
+        "localectl set-",
+        "timedatectl set-",
+        "subscription-manager ",
+    };
+}
+
+CachingRunner::CachingRunner(std::unique_ptr<IRunner> runner,
+    std::vector<std::string> pure, std::vector<std::string> mutating)
+    : m_runner(std::move(runner))
+    , m_pure(std::move(pure))
+    , m_mutating(std::move(mutating))
+{
+}
+
+CachingRunner::~CachingRunner()
+{
+    LOG_DEBUG("Command cache: {} hits, {} misses, {} invalidations",
+        m_stats.hits, m_stats.misses, m_stats.invalidations)
+}
+
+bool CachingRunner::isPure(const std::string& cmd) const
+{
+    return std::ranges::any_of(
+        m_pure, [&cmd](const auto& prefix) { return cmd.starts_with(prefix); });
+}
+
+bool CachingRunner::isMutating(const std::string& cmd) const
+{
+    return std::ranges::any_of(m_mutating,
+        [&cmd](const auto& prefix) { return cmd.starts_with(prefix); });
+}
+
+void CachingRunner::invalidate()
+{
+    std::scoped_lock lock(m_mutex);
+    if (!m_cache.empty()) {
+        LOG_TRACE("Dropping {} cached command outputs", m_cache.size())
+        m_cache.clear();
+    }
+    ++m_stats.invalidations;
+}
+
+CachingRunner::Stats CachingRunner::stats() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_stats;
+}
+
+void CachingRunner::invalidateIfMutating(const std::string& cmd)
+{
+    if (isMutating(cmd)) {
+        invalidate();
+    }
+}
+
+int CachingRunner::cached(const std::string& cmd, OutputBuffer& output,
+    const std::function<int(OutputBuffer&)>& fetch)
+{
+    {
+        std::scoped_lock lock(m_mutex);
+        if (const auto it = m_cache.find(cmd); it != m_cache.end()) {
+            ++m_stats.hits;
+            LOG_DEBUG("Cached command: {}", cmd)
+            output.append(it->second.output);
+            return it->second.exitCode;
+        }
+        ++m_stats.misses;
+    }
+
+    // Not holding the lock, a concurrent miss on the same command only
+    // costs an extra run
+    OutputBuffer fetched;
+    const int exitCode = fetch(fetched);
+    if (exitCode == 0) {
+        std::scoped_lock lock(m_mutex);
+        m_cache.insert_or_assign(cmd,
+            Entry { .exitCode = exitCode,
+                .output = std::string(fetched.text()) });
+    }
+
+    if (output.empty()) {
+        output = std::move(fetched);
+    } else {
+        output.append(fetched.text());
+    }
+    return exitCode;
+}
+
+int CachingRunner::executeCommand(const std::string& cmd)
+{
+    if (isPure(cmd)) {
+        OutputBuffer output;
+        return executeCommand(cmd, output);
+    }
+
+    const int exitCode = m_runner->executeCommand(cmd);
+    invalidateIfMutating(cmd);
+    return exitCode;
+}
+
+int CachingRunner::executeCommand(
+    const std::string& cmd, std::list<std::string>& output)
+{
+    if (isPure(cmd)) {
+        OutputBuffer buffer;
+        const int exitCode = executeCommand(cmd, buffer);
+        for (const auto line : buffer.lines()) {
+            output.emplace_back(line);
+        }
+        return exitCode;
+    }
+
+    const int exitCode = m_runner->executeCommand(cmd, output);
+    invalidateIfMutating(cmd);
+    return exitCode;
+}
+
+int CachingRunner::executeCommand(const std::string& cmd, OutputBuffer& output)
+{
+    if (isPure(cmd)) {
+        return cached(cmd, output, [this, &cmd](OutputBuffer& fetched) {
+            return m_runner->executeCommand(cmd, fetched);
+        });
+    }
+
+    const int exitCode = m_runner->executeCommand(cmd, output);
+    invalidateIfMutating(cmd);
+    return exitCode;
+}
+
+CommandProxy CachingRunner::executeCommandIter(
+    const std::string& cmd, Stream out)
+{
+    // The command is still running when the proxy is returned
+    invalidateIfMutating(cmd);
+    return m_runner->executeCommandIter(cmd, out);
+}
+
+void CachingRunner::checkCommand(const std::string& cmd)
+{
+    if (isPure(cmd)) {
+        if (executeCommand(cmd) != 0) {
+            throw std::runtime_error(
+                fmt::format("ERROR: Command failed '{}'", cmd));
+        }
+        return;
+    }
+
+    m_runner->checkCommand(cmd);
+    invalidateIfMutating(cmd);
+}
+
+std::vector<std::string> CachingRunner::checkOutput(const std::string& cmd)
+{
+    if (isPure(cmd)) {
+        return captureOutput(cmd).toVector();
+    }
+
+    auto output = m_runner->checkOutput(cmd);
+    invalidateIfMutating(cmd);
+    return output;
+}
+
+OutputBuffer CachingRunner::captureOutput(const std::string& cmd)
+{
+    OutputBuffer output;
+    if (isPure(cmd)) {
+        // captureOutput throws on failures, so they are never cached
+        cached(cmd, output, [this, &cmd](OutputBuffer& fetched) {
+            fetched = m_runner->captureOutput(cmd);
+            return 0;
+        });
+        return output;
+    }
+
+    output = m_runner->captureOutput(cmd);
+    invalidateIfMutating(cmd);
+    return output;
+}
+
+int CachingRunner::downloadFile(const std::string& url, const std::string& file)
+{
+    return m_runner->downloadFile(url, file);
+}
+
+int CachingRunner::run(const ScriptBuilder& script)
+{
+    // Scripts are opaque, assume they changed something
+    const int exitCode = m_runner->run(script);
+    invalidate();
+    return exitCode;
+}
+
+std::vector<CommandResult> CachingRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t concurrency)
+{
+    auto results = m_runner->executeBatch(cmds, concurrency);
+    if (std::ranges::any_of(
+            cmds, [this](const auto& cmd) { return isMutating(cmd); })) {
+        invalidate();
+    }
+    return results;
+}
+
+std::future<CommandResult> CachingRunner::submit(const std::string& cmd)
+{
+    // The command may still be running when this returns, outputs cached
+    // meanwhile could be stale, but nothing mutating is submitted today
+    invalidateIfMutating(cmd);
+    return m_runner->submit(cmd);
+}
+
+TEST_SUITE_BEGIN("cloyster::services::cachingrunner");
+
+TEST_CASE("CachingRunner")
+{
+    SUBCASE("pure commands are run once")
+    {
+        auto mock = std::make_unique<MockRunner>();
+        const auto& commands = mock->listCommands();
+        CachingRunner runner(std::move(mock));
+
+        CHECK(runner.executeCommand("uname -r") == 0);
+        CHECK(runner.executeCommand("uname -r") == 0);
+        std::list<std::string> output;
+        CHECK(runner.executeCommand("uname -r", output) == 0);
+        CHECK(runner.stats().hits == 2);
+        CHECK(runner.stats().misses == 1);
+
+        runner.executeCommand("chdef -t osimage compute");
+        CHECK(runner.executeCommand("uname -r") == 0);
+        CHECK(runner.stats().hits == 3);
+
+        runner.executeCommand("dnf -y install kernel");
+        CHECK(runner.executeCommand("uname -r") == 0);
+        CHECK(runner.stats().misses == 2);
+        CHECK(runner.stats().invalidations == 1);
+
+        CHECK(commands
+            == std::vector<std::string> { "uname -r",
+                "chdef -t osimage compute", "dnf -y install kernel",
+                "uname -r" });
+    }
+
+    SUBCASE("cached output is replayed")
+    {
+        cloyster::Singleton<Options>::init(
+            std::make_unique<Options>(Options {}));
+        CachingRunner runner(std::make_unique<Runner>(),
+            { "date +%N", "false" }, { "touch " });
+
+        const auto first = runner.checkOutput("date +%N");
+        CHECK(runner.captureOutput("date +%N").toVector() == first);
+
+        runner.executeBatch({ "true", "touch /dev/null" });
+        CHECK(runner.stats().invalidations == 1);
+        CHECK(runner.checkOutput("date +%N") != first);
+
+        // Failures are not cached
+        CHECK_THROWS_AS(runner.checkCommand("false"), std::runtime_error);
+        CHECK_THROWS_AS(runner.checkCommand("false"), std::runtime_error);
+        CHECK(runner.stats().misses == 4);
+    }
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services
@@ -0,0 +1,99 @@
+#include <csignal>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cloysterhpc/services/cancellation.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace {
+
+extern "C" void cancelOnSignal(int /*signal*/)
+{
+    cloyster::services::CancellationToken::global().cancel();
+}
+
+} // anonymous namespace
+
+namespace cloyster::services {
+
+CancellationToken::CancellationToken()
+    : m_fd(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+    if (m_fd == -1) {
+        throw std::system_error(errno, std::system_category(), "eventfd");
+    }
+}
+
+CancellationToken::~CancellationToken() { ::close(m_fd); }
+
+void CancellationToken::cancel() noexcept
+{
+    m_cancelled = true;
+    const std::uint64_t value = 1;
+    // Only fails if the counter would overflow, it is readable anyway
+    [[maybe_unused]] const auto written = ::write(m_fd, &value, sizeof(value));
+}
+
+void CancellationToken::reset()
+{
+    std::uint64_t value = 0;
+    [[maybe_unused]] const auto read = ::read(m_fd, &value, sizeof(value));
+    m_cancelled = false;
+}
+
+bool CancellationToken::cancelled() const noexcept { return m_cancelled; }
+
+CancellationToken& CancellationToken::global()
+{
+    static CancellationToken token;
+    return token;
+}
+
+void CancellationToken::installSignalHandlers()
+{
+    // Construct the token now, not from inside the handler
+    global();
+
+    struct sigaction action {};
+    action.sa_handler = cancelOnSignal;
+    action.sa_flags = SA_RESETHAND | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    for (const int signal : { SIGINT, SIGTERM }) {
+        if (::sigaction(signal, &action, nullptr) == -1) {
+            throw std::system_error(errno, std::system_category(), "sigaction");
+        }
+    }
+}
+
+TEST_SUITE_BEGIN("cloyster::services::cancellation");
+
+TEST_CASE("CancellationToken")
+{
+    CancellationToken token;
+    CHECK_FALSE(token.cancelled());
+
+    token.cancel();
+    token.cancel();
+    CHECK(token.cancelled());
+    std::uint64_t value = 0;
+    CHECK(::read(token.fd(), &value, sizeof(value)) == sizeof(value));
+    CHECK(value == 2);
+
+    token.cancel();
+    token.reset();
+    CHECK_FALSE(token.cancelled());
+    CHECK(::read(token.fd(), &value, sizeof(value)) == -1);
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services
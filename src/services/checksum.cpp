@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+#include <openssl/evp.h>
+
+#include <cloysterhpc/services/checksum.h>
+#include <cloysterhpc/services/descriptor.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace {
+
+// Granularity of the digest updates and of the progress reports
+constexpr std::uint64_t hashWindow = 8 * 1024 * 1024;
+// How far ahead of the digest the helper thread faults the mapping in
+constexpr std::uint64_t prefetchWindow = 32 * 1024 * 1024;
+constexpr std::uint64_t prefetchAhead = 4 * prefetchWindow;
+constexpr std::uint64_t progressStep = 64 * 1024 * 1024;
+
+using cloyster::services::files::Sha256;
+
+// Files that cannot be mapped, such as pipes and some pseudo filesystems
+std::string hashByReading(int fd, const cloyster::services::files::ChecksumProgress& progress)
+{
+    Sha256 digest;
+    std::vector<char> buffer(1024 * 1024);
+    std::uint64_t hashed = 0;
+    while (true) {
+        const auto size = ::read(fd, buffer.data(), buffer.size());
+        if (size == 0) {
+            break;
+        }
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(), "read");
+        }
+        digest.update({ buffer.data(), static_cast<std::size_t>(size) });
+        hashed += static_cast<std::uint64_t>(size);
+        if (progress) {
+            progress(hashed, hashed);
+        }
+    }
+    return digest.hex();
+}
+
+struct CacheKey final {
+    std::uint64_t device = 0;
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0; // nanoseconds
+
+    static std::optional<CacheKey> of(const std::filesystem::path& path)
+    {
+        struct stat st {};
+        if (::stat(path.c_str(), &st) == -1) {
+            return std::nullopt;
+        }
+        return CacheKey { .device = st.st_dev,
+            .inode = st.st_ino,
+            .size = static_cast<std::uint64_t>(st.st_size),
+            .mtime = st.st_mtim.tv_sec * 1'000'000'000 + st.st_mtim.tv_nsec };
+    }
+
+    bool operator==(const CacheKey&) const = default;
+};
+
+struct CacheEntry final {
+    CacheKey key;
+    std::string digest;
+};
+
+std::vector<CacheEntry> loadCache(const std::filesystem::path& file)
+{
+    std::vector<CacheEntry> entries;
+    std::ifstream input(file);
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        CacheEntry entry;
+        if (fields >> entry.key.device >> entry.key.inode >> entry.key.size
+                >> entry.key.mtime >> entry.digest) {
+            entries.push_back(std::move(entry));
+        }
+    }
+    return entries;
+}
+
+} // anonymous namespace
+
+namespace cloyster::services::files {
+
+void Sha256::Free::operator()(evp_md_ctx_st* ctx) const
+{
+    EVP_MD_CTX_free(ctx);
+}
+
+Sha256::Sha256()
+    : m_ctx(EVP_MD_CTX_new())
+{
+    if (!m_ctx || !EVP_DigestInit_ex(m_ctx.get(), EVP_sha256(), nullptr)) {
+        throw std::runtime_error("ERROR: Cannot initialize SHA-256");
+    }
+}
+
+void Sha256::update(std::string_view data)
+{
+    EVP_DigestUpdate(m_ctx.get(), data.data(), data.size());
+}
+
+std::string Sha256::hex()
+{
+    std::array<unsigned char, EVP_MAX_MD_SIZE> digest {};
+    unsigned int size = 0;
+    EVP_DigestFinal_ex(m_ctx.get(), digest.data(), &size);
+    std::string out;
+    out.reserve(size * 2);
+    for (unsigned int i = 0; i < size; ++i) {
+        out += fmt::format("{:02x}", digest[i]);
+    }
+    return out;
+}
+
+std::string sha256(
+    const std::filesystem::path& path, const ChecksumProgress& progress)
+{
+    const Descriptor fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() == -1) {
+        throw std::filesystem::filesystem_error("Failed to open file", path,
+            std::error_code(errno, std::system_category()));
+    }
+    struct stat st {};
+    if (::fstat(fd.get(), &st) == -1) {
+        throw std::system_error(errno, std::system_category(), "fstat");
+    }
+    const auto size = static_cast<std::uint64_t>(st.st_size);
+    if (!S_ISREG(st.st_mode)) {
+        return hashByReading(fd.get(), progress);
+    }
+    if (size == 0) {
+        return Sha256().hex();
+    }
+
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (mapping == MAP_FAILED) {
+        LOG_DEBUG("Cannot map {}, reading it instead", path.string())
+        return hashByReading(fd.get(), progress);
+    }
+    const auto* data = static_cast<const char*>(mapping);
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    // Faulting the pages in on another thread keeps both the disk reads and
+    // the page faults off the digest loop. MADV_POPULATE_READ needs Linux
+    // 5.14, older kernels get an asynchronous readahead hint instead.
+    std::atomic<std::uint64_t> hashed = 0;
+    std::jthread prefetcher([&](const std::stop_token& stop) {
+        int advice = MADV_POPULATE_READ;
+        for (std::uint64_t offset = 0; offset < size && !stop.stop_requested();
+             offset += prefetchWindow) {
+            for (auto current = hashed.load(); offset >= current + prefetchAhead;
+                 current = hashed.load()) {
+                hashed.wait(current);
+            }
+            const auto length = std::min(prefetchWindow, size - offset);
+            if (offset + length <= hashed.load()) {
+                continue;
+            }
+            auto* window = const_cast<char*>(data) + offset;
+            if (::madvise(window, length, advice) == -1 && advice != MADV_WILLNEED) {
+                advice = MADV_WILLNEED;
+                ::madvise(window, length, advice);
+            }
+        }
+    });
+
+    Sha256 digest;
+    std::uint64_t reported = 0;
+    try {
+        for (std::uint64_t offset = 0; offset < size; offset += hashWindow) {
+            const auto length = std::min(hashWindow, size - offset);
+            digest.update({ data + offset, length });
+            hashed.store(offset + length);
+            hashed.notify_one();
+
+            if (progress
+                && (offset + length - reported >= progressStep
+                    || offset + length == size)) {
+                reported = offset + length;
+                progress(reported, size);
+            }
+        }
+    } catch (...) {
+        prefetcher.request_stop();
+        hashed.store(size);
+        hashed.notify_one();
+        prefetcher.join();
+        ::munmap(mapping, size);
+        throw;
+    }
+
+    prefetcher.join();
+    ::munmap(mapping, size);
+    return digest.hex();
+}
+
+ChecksumCache::ChecksumCache(std::filesystem::path cacheFile)
+    : m_cacheFile(std::move(cacheFile))
+{
+}
+
+std::optional<std::string> ChecksumCache::lookup(
+    const std::filesystem::path& path) const
+{
+    const auto key = CacheKey::of(path);
+    if (!key) {
+        return std::nullopt;
+    }
+    for (const auto& entry : loadCache(m_cacheFile)) {
+        if (entry.key == *key) {
+            return entry.digest;
+        }
+    }
+    return std::nullopt;
+}
+
+void ChecksumCache::store(
+    const std::filesystem::path& path, const std::string& digest)
+{
+    const auto key = CacheKey::of(path);
+    if (!key) {
+        return;
+    }
+
+    // Drop the stale entries of the same file, then replace the cache file
+    // at once so a concurrent reader never sees it half written
+    auto entries = loadCache(m_cacheFile);
+    std::erase_if(entries, [&](const CacheEntry& entry) {
+        return entry.key.device == key->device && entry.key.inode == key->inode;
+    });
+    entries.push_back({ .key = *key, .digest = digest });
+
+    try {
+        std::filesystem::create_directories(m_cacheFile.parent_path());
+        auto temporary = m_cacheFile;
+        temporary += fmt::format(".{}", ::getpid());
+        {
+            std::ofstream output(temporary, std::ios::trunc);
+            for (const auto& entry : entries) {
+                output << fmt::format("{} {} {} {} {}\n", entry.key.device,
+                    entry.key.inode, entry.key.size, entry.key.mtime,
+                    entry.digest);
+            }
+            if (!output) {
+                throw std::runtime_error(
+                    fmt::format("Cannot write {}", temporary.string()));
+            }
+        }
+        std::filesystem::rename(temporary, m_cacheFile);
+    } catch (const std::exception& ex) {
+        LOG_WARN("Cannot update the checksum cache: {}", ex.what())
+    }
+}
+
+std::string ChecksumCache::sha256(
+    const std::filesystem::path& path, const ChecksumProgress& progress)
+{
+    if (auto digest = lookup(path)) {
+        LOG_DEBUG("Checksum of {} found in the cache", path.string())
+        return std::move(*digest);
+    }
+
+    auto digest = files::sha256(path, progress);
+    store(path, digest);
+    return digest;
+}
+
+TEST_SUITE_BEGIN("cloyster::services::checksum");
+
+namespace {
+    using cloyster::tests::TemporaryDirectory;
+
+    void writeFile(const std::filesystem::path& path, std::string_view data)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc)
+            .write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+}
+
+TEST_CASE("sha256")
+{
+    TemporaryDirectory dir;
+
+    writeFile(dir.path / "empty", "");
+    CHECK(sha256(dir.path / "empty")
+        == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    writeFile(dir.path / "abc", "abc");
+    CHECK(sha256(dir.path / "abc")
+        == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    // Crosses several hash and prefetch windows, and ends mid window
+    std::string large(prefetchAhead + hashWindow + 12345, '\0');
+    for (std::size_t i = 0; i < large.size(); ++i) {
+        large[i] = static_cast<char>(i % 251);
+    }
+    writeFile(dir.path / "large", large);
+    Sha256 expected;
+    expected.update(large);
+
+    std::vector<std::uint64_t> reports;
+    CHECK(sha256(dir.path / "large",
+              [&](std::uint64_t hashed, std::uint64_t total) {
+                  CHECK(total == large.size());
+                  reports.push_back(hashed);
+              })
+        == expected.hex());
+    REQUIRE_FALSE(reports.empty());
+    CHECK(std::ranges::is_sorted(reports));
+    CHECK(reports.back() == large.size());
+
+    CHECK_THROWS_AS(
+        sha256(dir.path / "missing"), std::filesystem::filesystem_error);
+}
+
+TEST_CASE("ChecksumCache")
+{
+    TemporaryDirectory dir;
+    const auto image = dir.path / "image.iso";
+    writeFile(image, "abc");
+    ChecksumCache cache(dir.path / "cache" / "checksums");
+
+    CHECK(cache.lookup(image) == std::nullopt);
+    const auto digest = cache.sha256(image);
+    CHECK(cache.lookup(image) == digest);
+
+    // A hit does not read the file: a fake digest comes back as is
+    cache.store(image, "cafe");
+    CHECK(cache.sha256(image) == "cafe");
+
+    // Modified files miss, and replace their old entry
+    writeFile(image, "abcd");
+    std::filesystem::last_write_time(image,
+        std::filesystem::last_write_time(image) + std::chrono::seconds(1));
+    CHECK(cache.lookup(image) == std::nullopt);
+    CHECK(cache.sha256(image) != "cafe");
+    CHECK(loadCache(dir.path / "cache" / "checksums").size() == 1);
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services::files
@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <ranges>
+#include <utility>
+
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/patterns/singleton.h>
+#include <cloysterhpc/services/conffile.h>
+#include <cloysterhpc/services/fileedit.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/options.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::files {
+
+namespace {
+
+    constexpr std::string_view blanks = " \t";
+
+    std::string_view trim(std::string_view text)
+    {
+        const auto begin = text.find_first_not_of(blanks);
+        if (begin == std::string_view::npos) {
+            return {};
+        }
+        const auto end = text.find_last_not_of(blanks);
+        return text.substr(begin, end - begin + 1);
+    }
+
+    std::string indexKey(std::string_view section, std::string_view key)
+    {
+        return fmt::format("{}\n{}", section, key);
+    }
+
+}
+
+ConfFile::ConfFile(std::filesystem::path path, Format format)
+    : m_path(std::move(path))
+    , m_format(format)
+{
+    std::ifstream ifs(m_path, std::ios::binary);
+    if (ifs.is_open()) {
+        m_data.assign(std::istreambuf_iterator<char>(ifs),
+            std::istreambuf_iterator<char>());
+    }
+    parse();
+}
+
+void ConfFile::parse()
+{
+    const std::string_view data = m_data;
+    std::string section;
+    std::optional<std::size_t> firstHeader;
+
+    for (std::size_t begin = 0; begin < data.size();) {
+        const auto newline = data.find('\n', begin);
+        const auto end
+            = newline == std::string_view::npos ? data.size() : newline + 1;
+        auto contentEnd = newline == std::string_view::npos ? data.size()
+                                                            : newline;
+        if (contentEnd > begin && data[contentEnd - 1] == '\r') {
+            --contentEnd;
+        }
+        const auto lineBegin = begin;
+        begin = end;
+
+        const auto content = data.substr(lineBegin, contentEnd - lineBegin);
+        const auto first = content.find_first_not_of(blanks);
+        if (first == std::string_view::npos || content[first] == '#'
+            || (m_format == Format::Ini && content[first] == ';')) {
+            continue;
+        }
+
+        if (m_format == Format::Ini && content[first] == '[') {
+            const auto close = content.find(']', first);
+            if (close != std::string_view::npos) {
+                section = trim(content.substr(first + 1, close - first - 1));
+                m_sectionEnd.try_emplace(section, end);
+                firstHeader = firstHeader.value_or(lineBegin);
+                continue;
+            }
+        }
+
+        Entry entry;
+        entry.section = section;
+        entry.lineBegin = lineBegin;
+        entry.lineEnd = end;
+        std::size_t valueBegin = 0;
+        if (m_format == Format::KeyValue) {
+            const auto keyEnd = std::min(
+                content.find_first_of(blanks, first), content.size());
+            entry.key = content.substr(first, keyEnd - first);
+            valueBegin = std::min(
+                content.find_first_not_of(blanks, keyEnd), content.size());
+            entry.bare = valueBegin == content.size();
+            if (entry.bare) {
+                valueBegin = keyEnd;
+            }
+        } else {
+            const auto equals = content.find('=', first);
+            if (equals == std::string_view::npos) {
+                continue;
+            }
+            entry.key = trim(content.substr(first, equals - first));
+            valueBegin = std::min(
+                content.find_first_not_of(blanks, equals + 1), content.size());
+        }
+        const auto valueEnd = std::max(
+            valueBegin, content.find_last_not_of(blanks) + 1);
+        entry.valueBegin = lineBegin + valueBegin;
+        entry.valueEnd = lineBegin + valueEnd;
+
+        m_index[indexKey(section, entry.key)].push_back(m_entries.size());
+        m_sectionEnd[section] = end;
+        m_entries.push_back(std::move(entry));
+    }
+
+    // Keys outside of the sections go before the first one
+    if (m_format == Format::Ini && firstHeader) {
+        m_sectionEnd.try_emplace({}, *firstHeader);
+    } else {
+        m_sectionEnd[{}] = data.size();
+    }
+}
+
+std::string ConfFile::originalLine(const Entry& entry) const
+{
+    auto text = std::string_view(m_data).substr(
+        entry.lineBegin, entry.lineEnd - entry.lineBegin);
+    while (text.ends_with('\n') || text.ends_with('\r')) {
+        text.remove_suffix(1);
+    }
+    return std::string(text);
+}
+
+std::string ConfFile::line(const Entry& entry) const
+{
+    if (!entry.original) {
+        return fmt::format("{}{}{}", entry.key,
+            m_format == Format::KeyValue ? " " : "=", entry.value.value());
+    }
+
+    auto text = originalLine(entry);
+    if (entry.value) {
+        text.replace(entry.valueBegin - entry.lineBegin,
+            entry.valueEnd - entry.valueBegin,
+            entry.bare ? " " + *entry.value : *entry.value);
+    }
+    return text;
+}
+
+std::optional<std::string> ConfFile::get(
+    std::string_view key, std::string_view section) const
+{
+    if (m_format != Format::Ini) {
+        section = {};
+    }
+
+    const auto it = m_index.find(indexKey(section, key));
+    if (it == m_index.end()) {
+        return std::nullopt;
+    }
+    for (const auto position : it->second | std::views::reverse) {
+        const auto& entry = m_entries[position];
+        if (entry.removed) {
+            continue;
+        }
+        if (entry.value) {
+            return entry.value;
+        }
+        return m_data.substr(
+            entry.valueBegin, entry.valueEnd - entry.valueBegin);
+    }
+    return std::nullopt;
+}
+
+void ConfFile::set(
+    std::string_view key, std::string_view value, std::string_view section)
+{
+    if (m_format != Format::Ini) {
+        section = {};
+    }
+
+    auto& positions = m_index[indexKey(section, key)];
+    bool found = false;
+    for (const auto position : positions) {
+        auto& entry = m_entries[position];
+        if (!entry.removed) {
+            entry.value = value;
+            found = true;
+        }
+    }
+    if (found) {
+        return;
+    }
+
+    Entry entry;
+    entry.section = section;
+    entry.key = key;
+    entry.original = false;
+    entry.value = value;
+    if (const auto end = m_sectionEnd.find(entry.section);
+        end != m_sectionEnd.end()) {
+        entry.lineBegin = end->second;
+    } else {
+        // A new section, at the end of the file
+        entry.lineBegin = m_data.size();
+        entry.header = fmt::format("[{}]", section);
+        m_sectionEnd.emplace(entry.section, m_data.size());
+    }
+    entry.lineEnd = entry.lineBegin;
+
+    positions.push_back(m_entries.size());
+    m_entries.push_back(std::move(entry));
+}
+
+std::size_t ConfFile::remove(std::string_view key, std::string_view section)
+{
+    if (m_format != Format::Ini) {
+        section = {};
+    }
+
+    const auto it = m_index.find(indexKey(section, key));
+    if (it == m_index.end()) {
+        return 0;
+    }
+
+    std::size_t removed = 0;
+    for (const auto position : it->second) {
+        auto& entry = m_entries[position];
+        if (!entry.removed) {
+            entry.removed = true;
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+std::string ConfFile::contents() const
+{
+    struct Patch final {
+        std::size_t begin;
+        std::size_t end;
+        std::string text;
+        bool insertion;
+    };
+
+    std::vector<Patch> patches;
+    for (const auto& entry : m_entries) {
+        if (!entry.original) {
+            if (!entry.removed) {
+                patches.push_back({ .begin = entry.lineBegin,
+                    .end = entry.lineBegin,
+                    .text = entry.header.empty()
+                        ? fmt::format("{}\n", line(entry))
+                        : fmt::format("\n{}\n{}\n", entry.header, line(entry)),
+                    .insertion = true });
+            }
+        } else if (entry.removed) {
+            patches.push_back({ .begin = entry.lineBegin,
+                .end = entry.lineEnd,
+                .text = {},
+                .insertion = false });
+        } else if (entry.value) {
+            patches.push_back({ .begin = entry.valueBegin,
+                .end = entry.valueEnd,
+                .text = entry.bare ? " " + *entry.value : *entry.value,
+                .insertion = false });
+        }
+    }
+
+    // Insertions go before the line that starts where they do
+    std::ranges::stable_sort(patches, [](const auto& a, const auto& b) {
+        return std::pair { a.begin, a.end } < std::pair { b.begin, b.end };
+    });
+
+    std::string result;
+    result.reserve(m_data.size());
+    std::size_t cursor = 0;
+    for (const auto& patch : patches) {
+        result.append(m_data, cursor, patch.begin - cursor);
+        if (patch.insertion && !result.empty() && !result.ends_with('\n')) {
+            result += '\n';
+        }
+        result += patch.text;
+        cursor = patch.end;
+    }
+    result.append(m_data, cursor);
+    return result;
+}
+
+bool ConfFile::changed() const { return contents() != m_data; }
+
+std::string ConfFile::diff() const
+{
+    auto result = fmt::format("--- {0}\n+++ {0}\n", m_path.string());
+    for (const auto& entry : m_entries) {
+        if (!entry.original) {
+            if (!entry.removed) {
+                if (!entry.header.empty()) {
+                    result += fmt::format("+{}\n", entry.header);
+                }
+                result += fmt::format("+{}\n", line(entry));
+            }
+            continue;
+        }
+
+        const auto before = originalLine(entry);
+        if (entry.removed) {
+            result += fmt::format("-{}\n", before);
+        } else if (const auto after = line(entry); after != before) {
+            result += fmt::format("-{}\n+{}\n", before, after);
+        }
+    }
+    return result;
+}
+
+bool ConfFile::commit()
+{
+    const auto data = contents();
+    if (data == m_data) {
+        LOG_DEBUG("File {} is unchanged", m_path.string())
+        return false;
+    }
+
+    auto opts = cloyster::Singleton<cloyster::services::Options>::get();
+    if (opts->dryRun) {
+        LOG_INFO("Dry Run: Would change the file {}:\n{}", m_path.string(),
+            diff())
+        return true;
+    }
+
+    writeFileAtomically(m_path, data);
+    LOG_DEBUG("Changed the file {}:\n{}", m_path.string(), diff())
+
+    // Further changes start from what was written
+    *this = ConfFile(m_path, m_format);
+    return true;
+}
+
+} // namespace cloyster::services::files
+
+TEST_SUITE_BEGIN("cloyster::services::files");
+
+namespace {
+    using cloyster::services::files::ConfFile;
+
+    using cloyster::tests::TemporaryFile;
+
+    void initOptions()
+    {
+        cloyster::Singleton<cloyster::services::Options>::init(
+            std::make_unique<cloyster::services::Options>(
+                cloyster::services::Options {}));
+    }
+}
+
+TEST_CASE("ConfFile changes only the values")
+{
+    initOptions();
+    const TemporaryFile file("test.conf",
+        "# This file controls the state of SELinux\n"
+        "SELINUX=enforcing   \n"
+        "; not a comment on sysconfig files\n"
+        "\n"
+        "SELINUXTYPE = targeted\r\n"
+        "SELINUX=permissive");
+
+    ConfFile conf(file.path, ConfFile::Format::KeyEquals);
+    CHECK(conf.get("SELINUX") == "permissive");
+    CHECK(conf.get("SELINUXTYPE") == "targeted");
+    conf.set("SELINUX", "disabled");
+    conf.set("SELINUXTYPE", "minimum");
+    conf.set("SETLOCALDEFS", "0");
+    CHECK(conf.get("SELINUX") == "disabled");
+    CHECK(file.read().find("disabled") == std::string::npos);
+
+    CHECK(conf.commit());
+    CHECK(file.read()
+        == "# This file controls the state of SELinux\n"
+           "SELINUX=disabled   \n"
+           "; not a comment on sysconfig files\n"
+           "\n"
+           "SELINUXTYPE = minimum\r\n"
+           "SELINUX=disabled\n"
+           "SETLOCALDEFS=0\n");
+    CHECK_FALSE(conf.commit());
+}
+
+TEST_CASE("ConfFile keeps sshd_config and chrony.conf lines")
+{
+    initOptions();
+    const TemporaryFile file("test.conf",
+        "#PermitRootLogin prohibit-password\n"
+        "PermitRootLogin yes\n"
+        "Match User backup\n"
+        "\tX11Forwarding no\n"
+        "rtcsync\n"
+        "server 0.pool.ntp.org iburst\n");
+
+    ConfFile conf(file.path, ConfFile::Format::KeyValue);
+    CHECK(conf.get("PermitRootLogin") == "yes");
+    CHECK(conf.get("rtcsync") == "");
+    conf.set("PermitRootLogin", "no");
+    conf.set("rtcsync", "yes");
+    CHECK(conf.remove("server") == 1);
+    conf.set("local", "stratum 10");
+    CHECK(conf.contents()
+        == "#PermitRootLogin prohibit-password\n"
+           "PermitRootLogin no\n"
+           "Match User backup\n"
+           "\tX11Forwarding no\n"
+           "rtcsync yes\n"
+           "local stratum 10\n");
+    CHECK(conf.diff()
+        == fmt::format("--- {0}\n+++ {0}\n"
+                       "-PermitRootLogin yes\n+PermitRootLogin no\n"
+                       "-rtcsync\n+rtcsync yes\n"
+                       "-server 0.pool.ntp.org iburst\n"
+                       "+local stratum 10\n",
+            file.path.string()));
+}
+
+TEST_CASE("ConfFile adds the keys to their section")
+{
+    initOptions();
+    const TemporaryFile file("test.conf",
+        "top = 1\n"
+        "[main]\n"
+        "; comment\n"
+        "dns=default\n"
+        "\n"
+        "[logging]\n");
+
+    ConfFile conf(file.path);
+    CHECK(conf.get("dns", "main") == "default");
+    CHECK(conf.get("dns") == std::nullopt);
+    conf.set("dns", "none", "main");
+    conf.set("rc-manager", "unmanaged", "main");
+    conf.set("level", "WARN", "logging");
+    conf.set("enabled", "true", "connectivity");
+    conf.set("other", "2");
+    CHECK(conf.contents()
+        == "top = 1\n"
+           "other=2\n"
+           "[main]\n"
+           "; comment\n"
+           "dns=none\n"
+           "rc-manager=unmanaged\n"
+           "\n"
+           "[logging]\n"
+           "level=WARN\n"
+           "\n"
+           "[connectivity]\n"
+           "enabled=true\n");
+}
+
+TEST_CASE("ConfFile round trips the file when nothing changes")
+{
+    initOptions();
+    std::string contents;
+    for (std::size_t i = 0; i < 20000; ++i) {
+        contents += fmt::format("# node {0}\nNodeName=n{0:05} CPUs=64  \n\n"
+                                "[part{0}]\r\n key{0} = value {0}\n",
+            i);
+    }
+    const TemporaryFile file("test.conf", contents);
+
+    for (const auto format : { ConfFile::Format::Ini,
+             ConfFile::Format::KeyEquals, ConfFile::Format::KeyValue }) {
+        ConfFile conf(file.path, format);
+        CHECK(conf.contents() == contents);
+        conf.set("key7", conf.get("key7", "part7").value(), "part7");
+        CHECK_FALSE(conf.changed());
+        CHECK_FALSE(conf.commit());
+    }
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,375 @@
+#include <array>
+#include <charconv>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <boost/process/extend.hpp>
+#include <fmt/format.h>
+
+#include <cloysterhpc/functions.h>
+#include <cloysterhpc/patterns/singleton.h>
+#include <cloysterhpc/services/cancellation.h>
+#include <cloysterhpc/services/coprocessrunner.h>
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/options.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace {
+
+constexpr std::size_t readChunkSize = 64 * 1024;
+
+std::string quote(std::string_view arg)
+{
+    std::string quoted = "'";
+    for (const char chr : arg) {
+        if (chr == '\'') {
+            quoted += R"('\'')";
+        } else {
+            quoted += chr;
+        }
+    }
+    quoted += '\'';
+    return quoted;
+}
+
+std::string randomToken()
+{
+    std::random_device device;
+    return fmt::format("__CLOYSTER_{:08x}{:08x}_", device(), device());
+}
+
+} // anonymous namespace
+
+namespace cloyster::services {
+
+CoprocessRunner::CoprocessRunner()
+    : m_token(randomToken())
+{
+    start();
+}
+
+CoprocessRunner::~CoprocessRunner() { stop(); }
+
+void CoprocessRunner::start()
+{
+    m_input = boost::process::opstream();
+    m_output = boost::process::pipe();
+    // The shell leads its own process group, so a timeout or a
+    // cancellation also reaches the command it runs
+    m_shell = boost::process::child(
+        boost::process::search_path("bash"), "--noprofile", "--norc",
+        boost::process::std_in < m_input, boost::process::std_out > m_output,
+        boost::process::extend::on_exec_setup(
+            [](auto& /*executor*/) { ::setpgid(0, 0); }));
+    LOG_DEBUG("Started the shell coprocess, pid {}", m_shell.id())
+}
+
+void CoprocessRunner::stop()
+{
+    if (m_shell.running()) {
+        m_input << "exit\n" << std::flush;
+    }
+    m_input.pipe().close();
+    if (m_shell.valid()) {
+        m_shell.wait();
+    }
+}
+
+std::vector<std::string> CoprocessRunner::splitArguments(const std::string& cmd)
+{
+    // Mirrors boost::process::detail::posix::build_args: split on spaces
+    // outside double quotes, strip the quotes around a whole argument and
+    // unescape \"
+    const auto entry = [](std::string_view part) {
+        std::string arg(part);
+        if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') {
+            arg = arg.substr(1, arg.size() - 2);
+        }
+        for (auto pos = arg.find(R"(\")"); pos != std::string::npos;
+             pos = arg.find(R"(\")", pos + 1)) {
+            arg.replace(pos, 2, "\"");
+        }
+        return arg;
+    };
+
+    std::vector<std::string> args;
+    bool inQuote = false;
+    std::size_t partBegin = 0;
+    for (std::size_t i = 0; i < cmd.size(); ++i) {
+        if (cmd[i] == '"') {
+            inQuote = !inQuote;
+        }
+        if (!inQuote && cmd[i] == ' ') {
+            if (i != 0 && cmd[i - 1] != ' ') {
+                args.push_back(entry(
+                    std::string_view(cmd).substr(partBegin, i - partBegin)));
+            }
+            partBegin = i + 1;
+        }
+    }
+    if (partBegin != cmd.size()) {
+        args.push_back(entry(std::string_view(cmd).substr(partBegin)));
+    }
+    return args;
+}
+
+std::string CoprocessRunner::toShell(const std::string& cmd)
+{
+    const auto args = splitArguments(cmd);
+
+    // The script of a bash -c wrapper runs in the subshell itself, eval
+    // keeps a syntax error in it from desynchronizing the coprocess
+    if (args.size() == 3 && args[0] == "bash" && args[1] == "-c") {
+        return fmt::format("( eval {} ) </dev/null", quote(args[2]));
+    }
+
+    std::string script = "( ";
+    for (const auto& arg : args) {
+        script += quote(arg);
+        script += ' ';
+    }
+    script += ") </dev/null";
+    return script;
+}
+
+int CoprocessRunner::executeCommand(const std::string& cmd)
+{
+    OutputBuffer output;
+    return executeCommand(cmd, output);
+}
+
+int CoprocessRunner::executeCommand(
+    const std::string& cmd, std::list<std::string>& output)
+{
+    OutputBuffer buffer;
+    const int exitCode = executeCommand(cmd, buffer);
+    for (const auto line : buffer.lines()) {
+        output.emplace_back(line);
+    }
+    return exitCode;
+}
+
+int CoprocessRunner::executeCommand(const std::string& cmd, OutputBuffer& output)
+{
+    std::scoped_lock lock(m_mutex);
+    if (!m_shell.running()) {
+        LOG_WARN("The shell coprocess is gone, starting a new one")
+        start();
+    }
+
+    LOG_DEBUG("Running command: {}", cmd)
+    auto& token = CancellationToken::global();
+    if (token.cancelled()) {
+        throw CommandCancelledError(cmd);
+    }
+    const auto timeout = ScopedTimeout::current();
+    const auto deadline = process::deadlineAfter(timeout);
+
+    const auto sentinel = fmt::format("\n{}{} ", m_token, m_sequence++);
+    m_input << toShell(cmd) << '\n'
+            << fmt::format(R"(printf '\n%s %d\n' '{}' "$?")",
+                   sentinel.substr(1, sentinel.size() - 2))
+            << '\n'
+            << std::flush;
+
+    const auto begin = output.text().size();
+    std::size_t searchFrom = begin;
+    const int fd = m_output.native_source();
+    while (true) {
+        // The shell goes with the command, the next one starts a new shell
+        std::array<pollfd, 2> fds {
+            pollfd { .fd = fd, .events = POLLIN, .revents = 0 },
+            pollfd { .fd = token.fd(), .events = POLLIN, .revents = 0 },
+        };
+        const int count
+            = ::poll(fds.data(), fds.size(), process::waitFor(deadline));
+        if (count == -1 && errno != EINTR) {
+            throw std::system_error(errno, std::system_category(), "poll");
+        }
+        if (token.cancelled()) {
+            LOG_WARN("Cancelling command: {}", cmd)
+            process::terminateGroup(m_shell);
+            output.truncate(begin);
+            throw CommandCancelledError(cmd);
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            LOG_WARN(
+                "Command timed out after {}ms: {}", timeout.count(), cmd)
+            process::terminateGroup(m_shell);
+            output.truncate(begin);
+            throw CommandTimeoutError(cmd, timeout);
+        }
+        if (count <= 0 || fds[0].revents == 0) {
+            continue;
+        }
+
+        auto span = output.prepare(readChunkSize);
+        const auto size = ::read(fd, span.data(), span.size());
+        if (size == 0) {
+            m_shell.wait();
+            output.truncate(begin);
+            throw std::runtime_error(fmt::format(
+                "ERROR: The shell coprocess exited running '{}'", cmd));
+        }
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(), "read");
+        }
+        output.commit(static_cast<std::size_t>(size));
+
+        const auto text = output.text();
+        const auto pos = text.find(sentinel, searchFrom);
+        if (pos == std::string_view::npos) {
+            // The sentinel may be split between two reads
+            searchFrom = std::max(begin,
+                text.size() > sentinel.size() ? text.size() - sentinel.size()
+                                               : begin);
+            continue;
+        }
+
+        const auto status = text.substr(pos + sentinel.size());
+        const auto end = status.find('\n');
+        if (end == std::string_view::npos) {
+            searchFrom = pos;
+            continue;
+        }
+
+        int exitCode = 0;
+        std::from_chars(status.data(), status.data() + end, exitCode);
+        output.truncate(pos);
+        for (const auto line : output.lines()) {
+            LOG_TRACE("{}", line)
+        }
+        LOG_DEBUG("Exit code: {}", exitCode)
+        return exitCode;
+    }
+}
+
+CommandProxy CoprocessRunner::executeCommandIter(
+    const std::string& cmd, Stream out)
+{
+    return m_runner.executeCommandIter(cmd, out);
+}
+
+void CoprocessRunner::checkCommand(const std::string& cmd)
+{
+    if (executeCommand(cmd) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+}
+
+std::vector<std::string> CoprocessRunner::checkOutput(const std::string& cmd)
+{
+    return captureOutput(cmd).toVector();
+}
+
+OutputBuffer CoprocessRunner::captureOutput(const std::string& cmd)
+{
+    OutputBuffer output;
+    if (executeCommand(cmd, output) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+    return output;
+}
+
+int CoprocessRunner::downloadFile(const std::string& url, const std::string& file)
+{
+    return m_runner.downloadFile(url, file);
+}
+
+int CoprocessRunner::run(const ScriptBuilder& script)
+{
+    std::string&& content = script.toString();
+    const auto hash = cloyster::services::files::checksum(content);
+    const std::filesystem::path path = fmt::format("/tmp/{}.sh", hash);
+    functions::installFile(path, std::move(content));
+    executeCommand(fmt::format("chmod +x {}", path));
+    executeCommand(path);
+    return 0;
+}
+
+std::vector<CommandResult> CoprocessRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t concurrency)
+{
+    return m_runner.executeBatch(cmds, concurrency);
+}
+
+TEST_SUITE_BEGIN("cloyster::services::coprocessrunner");
+
+TEST_CASE("CoprocessRunner::splitArguments")
+{
+    using Args = std::vector<std::string>;
+    CHECK(CoprocessRunner::splitArguments("chdef -t  osimage compute")
+        == Args { "chdef", "-t", "osimage", "compute" });
+    CHECK(CoprocessRunner::splitArguments(
+              R"(dnf -y groupinstall "Development Tools")")
+        == Args { "dnf", "-y", "groupinstall", "Development Tools" });
+    CHECK(CoprocessRunner::splitArguments(
+              R"(bash -c "echo \"quoted\" | wc -c")")
+        == Args { "bash", "-c", R"(echo "quoted" | wc -c)" });
+    CHECK(CoprocessRunner::toShell("echo it's") == "( 'echo' 'it'\\''s' ) </dev/null");
+}
+
+TEST_CASE("CoprocessRunner runs commands in one shell")
+{
+    cloyster::Singleton<Options>::init(std::make_unique<Options>(Options {}));
+    CoprocessRunner runner;
+
+    std::list<std::string> output;
+    CHECK(runner.executeCommand(R"(bash -c "echo one; echo two; exit 3")",
+              output)
+        == 3);
+    CHECK(output == std::list<std::string> { "one", "two" });
+
+    CHECK(runner.checkOutput("printf partial")
+        == std::vector<std::string> { "partial" });
+    CHECK(runner.captureOutput("true").empty());
+    CHECK(runner.executeCommand(R"(bash -c "echo 'unterminated")") == 2);
+    CHECK_THROWS_AS(runner.checkCommand("false"), std::runtime_error);
+
+    // Builtins run in the subshell and cannot break the coprocess
+    CHECK(runner.executeCommand("exit 4") == 4);
+    CHECK(runner.executeCommand("cd /nonexistent") == 1);
+
+    // Large output with no line break at the end
+    auto large = runner.captureOutput("head -c 200000 /dev/zero");
+    CHECK(large.text().size() == 200000);
+
+    // Every command shares the same shell process
+    const auto first = runner.checkOutput(R"(bash -c "echo $$")");
+    CHECK(runner.checkOutput(R"(bash -c "echo $$")") == first);
+
+    // The shell is replaced when it dies
+    CHECK_THROWS_AS(
+        runner.executeCommand(R"(bash -c "kill -9 $$")"), std::runtime_error);
+    CHECK(runner.checkOutput("echo back") == std::vector<std::string> { "back" });
+    CHECK(runner.checkOutput(R"(bash -c "echo $$")") != first);
+
+    // A timeout kills the shell, the next command gets a new one
+    {
+        const ScopedTimeout timeout(std::chrono::milliseconds(200));
+        CHECK_THROWS_AS(runner.executeCommand("sleep 5"), CommandTimeoutError);
+    }
+    CHECK(runner.checkOutput("echo again")
+        == std::vector<std::string> { "again" });
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services
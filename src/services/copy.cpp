@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/services/copy.h>
+#include <cloysterhpc/services/descriptor.h>
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::files {
+
+namespace {
+
+    // Errors of the clone ioctls and of copy_file_range when the kernel or
+    // the filesystems cannot share or copy between the files
+    bool unsupported(int error)
+    {
+        return error == EXDEV || error == ENOSYS || error == EOPNOTSUPP
+            || error == ENOTTY || error == EINVAL || error == EBADF;
+    }
+
+    // Copies with copy_file_range, nothing when the kernel cannot copy
+    // between the files. Returns less than @p extent when @p in is shorter.
+    std::optional<std::uint64_t> copyInKernel(int in, int out,
+        const CopyExtent& extent, const std::filesystem::path& name)
+    {
+        std::uint64_t copied = 0;
+        while (copied < extent.size) {
+            auto inOffset = static_cast<loff_t>(extent.source + copied);
+            auto outOffset = static_cast<loff_t>(extent.target + copied);
+            const auto count = ::copy_file_range(
+                in, &inOffset, out, &outOffset, extent.size - copied, 0);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (copied == 0 && unsupported(errno)) {
+                    return std::nullopt;
+                }
+                throw FileException(errorMessage("Cannot copy", name));
+            }
+            if (count == 0) {
+                break;
+            }
+            copied += static_cast<std::uint64_t>(count);
+        }
+        return copied;
+    }
+
+    // Copies with sendfile, which every filesystem supports
+    std::uint64_t copyWithSendfile(int in, int out, const CopyExtent& extent,
+        const std::filesystem::path& name)
+    {
+        if (::lseek(out, static_cast<off_t>(extent.target), SEEK_SET) < 0) {
+            throw FileException(errorMessage("Cannot copy", name));
+        }
+        auto offset = static_cast<off_t>(extent.source);
+        std::uint64_t copied = 0;
+        while (copied < extent.size) {
+            const auto count
+                = ::sendfile(out, in, &offset, extent.size - copied);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw FileException(errorMessage("Cannot copy", name));
+            }
+            if (count == 0) {
+                break;
+            }
+            copied += static_cast<std::uint64_t>(count);
+        }
+        return copied;
+    }
+
+    // Copies the whole file, a source that shrank while being copied is
+    // copied as far as it goes
+    CopyMethod copyData(int in, int out, std::uint64_t size,
+        const std::filesystem::path& from)
+    {
+        if (::ioctl(out, FICLONE, in) == 0) {
+            return CopyMethod::Reflink;
+        }
+        const CopyExtent extent { .source = 0, .target = 0, .size = size };
+        if (copyInKernel(in, out, extent, from)) {
+            return CopyMethod::CopyRange;
+        }
+        copyWithSendfile(in, out, extent, from);
+        return CopyMethod::Sendfile;
+    }
+
+    CopyMethod copyRegular(const std::filesystem::path& from,
+        const std::filesystem::path& to, const CopyOptions& options,
+        std::uint64_t& size)
+    {
+        const Descriptor in(::open(from.c_str(), O_RDONLY | O_CLOEXEC));
+        if (in.get() < 0) {
+            throw FileException(errorMessage("Cannot open", from));
+        }
+        struct stat st {};
+        if (::fstat(in.get(), &st) != 0) {
+            throw FileException(errorMessage("Cannot stat", from));
+        }
+        if (!S_ISREG(st.st_mode)) {
+            throw FileException(
+                fmt::format("Cannot copy {}: not a file", from.string()));
+        }
+
+        const auto flags = O_WRONLY | O_CREAT | O_CLOEXEC
+            | (options.overwrite ? O_TRUNC : O_EXCL);
+        const Descriptor out(::open(to.c_str(), flags, st.st_mode & 07777));
+        if (out.get() < 0) {
+            if (errno == EEXIST) {
+                return CopyMethod::Skipped;
+            }
+            throw FileException(errorMessage("Cannot create", to));
+        }
+
+        size = static_cast<std::uint64_t>(st.st_size);
+        const auto method = copyData(in.get(), out.get(), size, from);
+
+        if (::fchmod(out.get(), st.st_mode & 07777) != 0) {
+            throw FileException(errorMessage("Cannot set the mode of", to));
+        }
+        if (options.preserveOwner && ::geteuid() == 0
+            && ::fchown(out.get(), st.st_uid, st.st_gid) != 0) {
+            throw FileException(errorMessage("Cannot set the owner of", to));
+        }
+        return method;
+    }
+
+    // Copies each pair of sources and destinations on a few threads
+    CopyReport copyAll(
+        const std::vector<std::pair<std::filesystem::path,
+            std::filesystem::path>>& copies,
+        const CopyOptions& options)
+    {
+        CopyReport report;
+        const auto jobs = options.jobs != 0
+            ? options.jobs
+            : std::min(8U, std::max(1U, std::thread::hardware_concurrency()));
+        const auto threads = static_cast<unsigned>(std::min<std::size_t>(
+            jobs, std::max<std::size_t>(1, copies.size())));
+
+        std::atomic<std::size_t> next = 0;
+        std::mutex mutex;
+        std::exception_ptr error;
+        {
+            std::vector<std::jthread> workers;
+            for (unsigned i = 0; i < threads; ++i) {
+                workers.emplace_back([&] {
+                    try {
+                        for (auto index = next++; index < copies.size();
+                            index = next++) {
+                            const auto& [from, to] = copies[index];
+                            std::uint64_t size = 0;
+                            const auto method
+                                = copyRegular(from, to, options, size);
+                            const std::scoped_lock lock(mutex);
+                            report.add(method, size);
+                        }
+                    } catch (...) {
+                        const std::scoped_lock lock(mutex);
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                        next = copies.size();
+                    }
+                });
+            }
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return report;
+    }
+
+}
+
+void CopyReport::add(CopyMethod method, std::uint64_t size)
+{
+    if (method == CopyMethod::Skipped) {
+        ++skipped;
+        return;
+    }
+
+    ++files;
+    bytes += size;
+    if (method == CopyMethod::Reflink) {
+        ++reflinked;
+    }
+}
+
+CopyMethod copyExtent(int from, int to, const CopyExtent& extent,
+    const std::filesystem::path& name)
+{
+    // Unaligned extents fail with EINVAL, the others may still clone
+    const file_clone_range range { .src_fd = from,
+        .src_offset = extent.source,
+        .src_length = extent.size,
+        .dest_offset = extent.target };
+    if (::ioctl(to, FICLONERANGE, &range) == 0) {
+        return CopyMethod::Reflink;
+    }
+
+    auto method = CopyMethod::CopyRange;
+    auto copied = copyInKernel(from, to, extent, name);
+    if (!copied) {
+        method = CopyMethod::Sendfile;
+        copied = copyWithSendfile(from, to, extent, name);
+    }
+    if (*copied != extent.size) {
+        throw FileException(fmt::format(
+            "Cannot copy {}: it ends before the extent", name.string()));
+    }
+    return method;
+}
+
+CopyMethod copyFile(const std::filesystem::path& from,
+    const std::filesystem::path& to, const CopyOptions& options)
+{
+    std::uint64_t size = 0;
+    return copyRegular(from, to, options, size);
+}
+
+CopyReport copyFiles(std::span<const std::filesystem::path> files,
+    const std::filesystem::path& directory, const CopyOptions& options)
+{
+    std::vector<std::pair<std::filesystem::path, std::filesystem::path>>
+        copies;
+    copies.reserve(files.size());
+    for (const auto& file : files) {
+        copies.emplace_back(file, directory / file.filename());
+    }
+
+    return copyAll(copies, options);
+}
+
+CopyReport copyTree(const std::filesystem::path& from,
+    const std::filesystem::path& to, const CopyOptions& options)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<std::pair<fs::path, fs::path>> copies;
+    // Modes and owners of the directories are set once their files are in
+    std::vector<std::pair<fs::path, struct stat>> directories;
+    std::size_t links = 0;
+
+    const auto addDirectory
+        = [&](const fs::path& source, const fs::path& target) {
+              struct stat st {};
+              if (::stat(source.c_str(), &st) != 0) {
+                  throw FileException(errorMessage("Cannot stat", source));
+              }
+              fs::create_directories(target);
+              directories.emplace_back(target, st);
+          };
+
+    addDirectory(from, to);
+    for (const auto& entry : fs::recursive_directory_iterator(from)) {
+        const auto target = to / entry.path().lexically_relative(from);
+        if (entry.is_symlink()) {
+            if (fs::is_symlink(target) || fs::exists(target)) {
+                if (!options.overwrite) {
+                    continue;
+                }
+                fs::remove(target);
+            }
+            fs::create_symlink(fs::read_symlink(entry.path()), target);
+            ++links;
+        } else if (entry.is_directory()) {
+            addDirectory(entry.path(), target);
+        } else if (entry.is_regular_file()) {
+            copies.emplace_back(entry.path(), target);
+        } else {
+            LOG_WARN("Not copying {}, it is not a file, a directory or a "
+                     "symbolic link",
+                entry.path().string())
+        }
+    }
+
+    const auto report = copyAll(copies, options);
+
+    for (const auto& [directory, st] : directories | std::views::reverse) {
+        if (::chmod(directory.c_str(), st.st_mode & 07777) != 0) {
+            throw FileException(
+                errorMessage("Cannot set the mode of", directory));
+        }
+        if (options.preserveOwner && ::geteuid() == 0
+            && ::chown(directory.c_str(), st.st_uid, st.st_gid) != 0) {
+            throw FileException(
+                errorMessage("Cannot set the owner of", directory));
+        }
+    }
+
+    LOG_DEBUG("Copied {} files, {} bytes and {} links from {} to {}, {} "
+              "reflinked and {} skipped",
+        report.files, report.bytes, links, from.string(), to.string(),
+        report.reflinked, report.skipped)
+    return report;
+}
+
+} // namespace cloyster::services::files
+
+TEST_SUITE_BEGIN("cloyster::services::files");
+
+namespace {
+    using namespace cloyster::services::files;
+
+    using cloyster::tests::TemporaryDirectory;
+
+    void writeFile(const std::filesystem::path& path, std::string_view data)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc)
+            .write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    std::string readFile(const std::filesystem::path& path)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(ifs),
+            std::istreambuf_iterator<char>() };
+    }
+
+    std::filesystem::perms mode(const std::filesystem::path& path)
+    {
+        return std::filesystem::symlink_status(path).permissions()
+            & std::filesystem::perms::all;
+    }
+}
+
+TEST_CASE("copyFile skips existing files unless told to overwrite them")
+{
+    TemporaryDirectory dir;
+    writeFile(dir.path / "shadow", "root:*:19000::::::\n");
+    std::filesystem::permissions(dir.path / "shadow",
+        std::filesystem::perms::owner_read | std::filesystem::perms::owner_write);
+    writeFile(dir.path / "copy", "old\n");
+
+    CHECK(copyFile(dir.path / "shadow", dir.path / "copy")
+        == CopyMethod::Skipped);
+    CHECK(readFile(dir.path / "copy") == "old\n");
+    CHECK(copyFile(dir.path / "shadow", dir.path / "copy",
+              { .overwrite = true, .preserveOwner = true, .jobs = 0 })
+        != CopyMethod::Skipped);
+    CHECK(readFile(dir.path / "copy") == "root:*:19000::::::\n");
+    CHECK(mode(dir.path / "copy") == mode(dir.path / "shadow"));
+    CHECK_THROWS_AS(copyFile(dir.path / "missing", dir.path / "other"),
+        FileException);
+}
+
+TEST_CASE("copyTree copies the files and keeps the modes")
+{
+    TemporaryDirectory dir;
+    const auto source = dir.path / "source";
+    std::filesystem::create_directories(source / "Modules" / "empty");
+    std::string large(3 * 1024 * 1024 + 7, 'x');
+    writeFile(source / "Modules" / "kernel.rpm", large);
+    for (int i = 0; i < 50; ++i) {
+        writeFile(source / fmt::format("{}.conf", i), fmt::format("{}\n", i));
+    }
+    std::filesystem::permissions(
+        source / "0.conf", std::filesystem::perms(0755));
+    std::filesystem::permissions(
+        source / "Modules" / "empty", std::filesystem::perms(0700));
+    std::filesystem::create_symlink("Modules/kernel.rpm", source / "link");
+
+    const auto report = copyTree(source, dir.path / "target");
+    CHECK(report.files == 51);
+    CHECK(report.skipped == 0);
+    CHECK(report.bytes == large.size() + 10 * 2 + 40 * 3);
+    CHECK(readFile(dir.path / "target" / "Modules" / "kernel.rpm") == large);
+    CHECK(readFile(dir.path / "target" / "49.conf") == "49\n");
+    CHECK(mode(dir.path / "target" / "0.conf") == std::filesystem::perms(0755));
+    CHECK(mode(dir.path / "target" / "Modules" / "empty")
+        == std::filesystem::perms(0700));
+    CHECK(std::filesystem::read_symlink(dir.path / "target" / "link")
+        == "Modules/kernel.rpm");
+
+    const auto again = copyTree(source, dir.path / "target");
+    CHECK(again.files == 0);
+    CHECK(again.skipped == 51);
+}
+
+TEST_CASE("copyExtent copies a range between open files")
+{
+    TemporaryDirectory dir;
+    writeFile(dir.path / "image", "0123456789abcdef");
+    writeFile(dir.path / "file", "........");
+
+    const Descriptor from(
+        ::open((dir.path / "image").c_str(), O_RDONLY | O_CLOEXEC));
+    const Descriptor to(
+        ::open((dir.path / "file").c_str(), O_WRONLY | O_CLOEXEC));
+    REQUIRE(from.get() >= 0);
+    REQUIRE(to.get() >= 0);
+
+    CHECK(copyExtent(from.get(), to.get(),
+              { .source = 10, .target = 2, .size = 4 }, dir.path / "image")
+        != CopyMethod::Skipped);
+    CHECK(readFile(dir.path / "file") == "..abcd..");
+    CHECK_THROWS_AS(copyExtent(from.get(), to.get(),
+                        { .source = 12, .target = 0, .size = 8 },
+                        dir.path / "image"),
+        FileException);
+}
+
+TEST_SUITE_END();
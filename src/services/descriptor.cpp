@@ -0,0 +1,41 @@
+#include <cstring>
+#include <utility>
+
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/services/descriptor.h>
+
+namespace cloyster::services::files {
+
+Descriptor::Descriptor(Descriptor&& other) noexcept
+    : m_fd(std::exchange(other.m_fd, -1))
+{
+}
+
+Descriptor& Descriptor::operator=(Descriptor&& other) noexcept
+{
+    if (this != &other) {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+        m_fd = std::exchange(other.m_fd, -1);
+    }
+    return *this;
+}
+
+Descriptor::~Descriptor()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+std::string errorMessage(
+    std::string_view what, const std::filesystem::path& path)
+{
+    return fmt::format("{} {}: {}", what, path.string(), std::strerror(errno));
+}
+
+} // namespace cloyster::services::files
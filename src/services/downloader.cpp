@@ -0,0 +1,884 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <fmt/format.h>
+
+#include <cloysterhpc/services/cancellation.h>
+#include <cloysterhpc/services/checksum.h>
+#include <cloysterhpc/services/descriptor.h>
+#include <cloysterhpc/services/downloader.h>
+#include <cloysterhpc/services/http.h>
+#include <cloysterhpc/services/httpclient.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/runner.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::http {
+
+namespace {
+    namespace asio = boost::asio;
+    namespace beast = boost::beast;
+    namespace bhttp = boost::beast::http;
+    using asio::awaitable;
+    using asio::use_awaitable;
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::size_t chunkSize = 256 * 1024;
+    constexpr std::string_view stateMagic = "CLOYSTER-DOWNLOAD 1";
+    // Losing this much progress on a crash is fine, renaming the state file
+    // on every chunk is not
+    constexpr auto saveInterval = std::chrono::seconds(1);
+    constexpr auto unknownEnd = std::numeric_limits<std::uint64_t>::max();
+
+    std::string_view view(beast::string_view text)
+    {
+        return { text.data(), text.size() };
+    }
+
+    std::optional<std::uint64_t> toNumber(std::string_view text)
+    {
+        std::uint64_t value = 0;
+        const auto [end, ec]
+            = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (ec != std::errc() || end != text.data() + text.size()) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    class File final {
+        files::Descriptor m_fd;
+
+    public:
+        File(const std::filesystem::path& path, int flags)
+            : m_fd(::open(path.c_str(), flags | O_CLOEXEC, 0644))
+        {
+            if (m_fd.get() == -1) {
+                throw std::system_error(
+                    errno, std::system_category(), path.string());
+            }
+        }
+
+        [[nodiscard]] int fd() const { return m_fd.get(); }
+
+        void write(std::uint64_t offset, std::string_view data) const
+        {
+            while (!data.empty()) {
+                const auto size = ::pwrite(m_fd.get(), data.data(), data.size(),
+                    static_cast<off_t>(offset));
+                if (size == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::system_category(), "pwrite");
+                }
+                data.remove_prefix(static_cast<std::size_t>(size));
+                offset += static_cast<std::uint64_t>(size);
+            }
+        }
+
+        std::size_t read(std::uint64_t offset, std::span<char> buffer) const
+        {
+            while (true) {
+                const auto size = ::pread(m_fd.get(), buffer.data(), buffer.size(),
+                    static_cast<off_t>(offset));
+                if (size >= 0) {
+                    return static_cast<std::size_t>(size);
+                }
+                if (errno != EINTR) {
+                    throw std::system_error(errno, std::system_category(), "pread");
+                }
+            }
+        }
+    };
+
+    struct Segment final {
+        std::uint64_t begin = 0;
+        std::uint64_t end = 0;
+        std::uint64_t written = 0;
+
+        [[nodiscard]] std::uint64_t next() const { return begin + written; }
+        [[nodiscard]] bool done() const { return next() >= end; }
+    };
+
+    // What the part file holds, saved next to it
+    struct State final {
+        std::string url;
+        std::uint64_t size = 0;
+        std::string validator;
+        std::vector<Segment> segments;
+
+        static std::optional<State> load(const std::filesystem::path& path)
+        {
+            std::ifstream file(path);
+            std::string magic;
+            if (!std::getline(file, magic) || magic != stateMagic) {
+                return std::nullopt;
+            }
+
+            State state;
+            std::size_t count = 0;
+            if (!std::getline(file, state.url)
+                || !std::getline(file, state.validator)
+                || !(file >> state.size >> count)) {
+                return std::nullopt;
+            }
+            state.segments.resize(count);
+            for (auto& segment : state.segments) {
+                if (!(file >> segment.begin >> segment.end >> segment.written)
+                    || segment.begin > segment.end
+                    || segment.written > segment.end - segment.begin) {
+                    return std::nullopt;
+                }
+            }
+            return state;
+        }
+
+        void save(const std::filesystem::path& path) const
+        {
+            auto temporary = path;
+            temporary += ".new";
+            {
+                std::ofstream file(temporary, std::ios::trunc);
+                file << stateMagic << '\n'
+                     << url << '\n'
+                     << validator << '\n'
+                     << size << ' ' << segments.size() << '\n';
+                for (const auto& segment : segments) {
+                    file << segment.begin << ' ' << segment.end << ' '
+                         << segment.written << '\n';
+                }
+            }
+            std::filesystem::rename(temporary, path);
+        }
+    };
+
+    struct Remote final {
+        Url url;
+        std::optional<std::uint64_t> size;
+        bool ranges = false;
+        // ETag, or Last-Modified, a change means the part file is stale
+        std::string validator;
+    };
+
+    /**
+     * @brief Per download state, every coroutine runs on the same single
+     * threaded io_context so nothing here is locked
+     */
+    class Transfer final {
+        Connector m_connector;
+        const DownloadOptions& m_options;
+        const std::string& m_name;
+        std::optional<File> m_file;
+        State& m_state;
+        std::filesystem::path m_statePath;
+
+        files::Sha256 m_hash;
+        std::uint64_t m_hashed = 0;
+        std::unique_ptr<char[]> m_hashBuffer;
+
+        std::uint64_t m_resumed = 0;
+        Clock::time_point m_start = Clock::now();
+        Clock::time_point m_lastReport;
+        Clock::time_point m_lastSave;
+
+        void checkStopped() const
+        {
+            if (m_options.stop.stop_requested()
+                || CancellationToken::global().cancelled()) {
+                throw CommandCancelledError(fmt::format("download {}", m_name));
+            }
+        }
+
+        template <typename Stream>
+        awaitable<void> writeRequest(Connection& conn, Stream& stream,
+            const bhttp::request<bhttp::empty_body>& req)
+        {
+            conn.socket().expires_after(m_options.timeout);
+            co_await bhttp::async_write(stream, req, use_awaitable);
+        }
+
+        template <typename Stream>
+        awaitable<bhttp::response<bhttp::empty_body>> readHead(
+            Connection& conn, Stream& stream)
+        {
+            bhttp::response_parser<bhttp::empty_body> parser;
+            parser.skip(true);
+            conn.socket().expires_after(m_options.timeout);
+            co_await bhttp::async_read(stream, conn.buffer, parser, use_awaitable);
+            co_return parser.release();
+        }
+
+        template <typename Stream>
+        awaitable<void> readBody(Connection& conn, Stream& stream,
+            const bhttp::request<bhttp::empty_body>& req, Segment& segment)
+        {
+            co_await writeRequest(conn, stream, req);
+
+            bhttp::response_parser<bhttp::buffer_body> parser;
+            // ISOs are several GB, the segment bounds what is kept
+            parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+            conn.socket().expires_after(m_options.timeout);
+            co_await bhttp::async_read_header(
+                stream, conn.buffer, parser, use_awaitable);
+
+            const auto status = parser.get().result_int();
+            const bool ranged = req.count(bhttp::field::range) != 0;
+            if (ranged && status == 206) {
+                const auto range
+                    = view(parser.get()[bhttp::field::content_range]);
+                if (!range.starts_with(
+                        fmt::format("bytes {}-", segment.next()))) {
+                    throw std::runtime_error(fmt::format(
+                        "ERROR: Unexpected range '{}' downloading {}", range,
+                        m_name));
+                }
+            } else if (ranged && status == 200 && segment.next() != 0) {
+                throw std::runtime_error(fmt::format(
+                    "ERROR: The server ignored a range request for {}", m_name));
+            } else if (status != 200 || segment.next() != 0) {
+                throw std::runtime_error(fmt::format(
+                    "ERROR: HTTP {} downloading {}", status, m_name));
+            }
+
+            std::vector<char> chunk(chunkSize);
+            while (!parser.is_done() && !segment.done()) {
+                checkStopped();
+                auto& body = parser.get().body();
+                body.data = chunk.data();
+                body.size = chunk.size();
+
+                beast::error_code ec;
+                conn.socket().expires_after(m_options.timeout);
+                co_await bhttp::async_read_some(stream, conn.buffer, parser,
+                    asio::redirect_error(use_awaitable, ec));
+                if (ec && ec != bhttp::error::need_buffer) {
+                    throw beast::system_error(ec);
+                }
+
+                const auto size = chunk.size() - body.size;
+                const auto kept = static_cast<std::size_t>(
+                    std::min<std::uint64_t>(size, segment.end - segment.next()));
+                written(segment, std::string_view(chunk.data(), kept));
+            }
+
+            if (segment.end == unknownEnd) {
+                segment.end = segment.next();
+            }
+        }
+
+        void written(Segment& segment, std::string_view data)
+        {
+            const auto offset = segment.next();
+            m_file->write(offset, data);
+            segment.written += data.size();
+
+            // Hash straight from memory while this is the first gap, data
+            // past it is read back from the page cache when its turn comes
+            if (offset == m_hashed) {
+                m_hash.update(data);
+                m_hashed += data.size();
+            }
+            catchUp();
+            report(false);
+        }
+
+        // Hash what is contiguous from the hash cursor on
+        void catchUp()
+        {
+            for (const auto& segment : m_state.segments) {
+                if (m_hashed < segment.begin) {
+                    break;
+                }
+                while (m_hashed < segment.next()) {
+                    const auto size = m_file->read(m_hashed,
+                        { m_hashBuffer.get(),
+                            static_cast<std::size_t>(std::min<std::uint64_t>(
+                                chunkSize, segment.next() - m_hashed)) });
+                    if (size == 0) {
+                        throw std::runtime_error(fmt::format(
+                            "ERROR: Short part file downloading {}", m_name));
+                    }
+                    m_hash.update({ m_hashBuffer.get(), size });
+                    m_hashed += size;
+                }
+                if (!segment.done()) {
+                    break;
+                }
+            }
+        }
+
+    public:
+        Transfer(asio::io_context& ctx, const DownloadOptions& options,
+            const std::string& name, State& state,
+            std::filesystem::path statePath)
+            : m_connector(ctx, options.timeout)
+            , m_options(options)
+            , m_name(name)
+            , m_state(state)
+            , m_statePath(std::move(statePath))
+            , m_hashBuffer(std::make_unique_for_overwrite<char[]>(chunkSize))
+        {
+        }
+
+        // Size, range support and validator, after following redirects
+        awaitable<Remote> inspect(const std::string& url)
+        {
+            auto current = Url::parse(url);
+            if (!current) {
+                throw std::runtime_error(fmt::format("ERROR: Invalid URL {}", url));
+            }
+
+            for (std::size_t hop = 0; hop <= m_options.maxRedirects; ++hop) {
+                auto conn = co_await m_connector.connect(*current);
+                const auto req = makeRequest(
+                    bhttp::verb::head, *current, false, conn->forward);
+                bhttp::response<bhttp::empty_body> res;
+                if (conn->secure) {
+                    co_await writeRequest(*conn, *conn->secure, req);
+                    res = co_await readHead(*conn, *conn->secure);
+                } else {
+                    co_await writeRequest(*conn, *conn->plain, req);
+                    res = co_await readHead(*conn, *conn->plain);
+                }
+
+                const auto status = res.result_int();
+                if (isRedirect(status)) {
+                    auto next
+                        = current->resolve(view(res[bhttp::field::location]));
+                    if (!next) {
+                        throw std::runtime_error(fmt::format(
+                            "ERROR: Invalid redirect downloading {}", url));
+                    }
+                    current = std::move(next);
+                    continue;
+                }
+
+                Remote remote { .url = *current };
+                // Some servers refuse HEAD, a plain GET still works
+                if (status == 405 || status == 501) {
+                    co_return remote;
+                }
+                if (status != 200) {
+                    throw std::runtime_error(fmt::format(
+                        "ERROR: HTTP {} downloading {}", status, url));
+                }
+
+                remote.size = toNumber(view(res[bhttp::field::content_length]));
+                remote.ranges = remote.size
+                    && view(res[bhttp::field::accept_ranges]) == "bytes";
+                remote.validator = view(res[bhttp::field::etag]);
+                if (remote.validator.empty()) {
+                    remote.validator = view(res[bhttp::field::last_modified]);
+                }
+                co_return remote;
+            }
+
+            throw std::runtime_error(
+                fmt::format("ERROR: Too many redirects for {}", url));
+        }
+
+        awaitable<void> fetch(const Url& url, Segment& segment, bool ranged)
+        {
+            for (std::size_t attempt = 1; !segment.done(); ++attempt) {
+                try {
+                    auto conn = co_await m_connector.connect(url);
+                    auto req = makeRequest(
+                        bhttp::verb::get, url, false, conn->forward);
+                    if (ranged) {
+                        req.set(bhttp::field::range,
+                            fmt::format("bytes={}-{}", segment.next(),
+                                segment.end - 1));
+                    }
+                    if (conn->secure) {
+                        co_await readBody(*conn, *conn->secure, req, segment);
+                    } else {
+                        co_await readBody(*conn, *conn->plain, req, segment);
+                    }
+                    if (!segment.done()) {
+                        throw std::runtime_error(fmt::format(
+                            "ERROR: Connection closed downloading {}", m_name));
+                    }
+                } catch (const CommandCancelledError&) {
+                    throw;
+                } catch (const std::runtime_error& ex) {
+                    // Only a ranged download can pick up where it stopped
+                    if (!ranged || attempt >= m_options.maxRetries) {
+                        throw;
+                    }
+                    LOG_DEBUG("Retrying segment {}-{} of {}: {}",
+                        segment.next(), segment.end, m_name, ex.what())
+                }
+            }
+        }
+
+        void open(const std::filesystem::path& path, bool resume)
+        {
+            m_file.emplace(path, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC));
+            if (resume) {
+                m_resumed = received();
+                catchUp();
+            } else if (m_state.size != 0) {
+                // Reserve the space up front, this is only a hint
+                ::posix_fallocate(
+                    m_file->fd(), 0, static_cast<off_t>(m_state.size));
+            }
+        }
+
+        // Flushes and closes the part file
+        void close()
+        {
+            ::fdatasync(m_file->fd());
+            m_file.reset();
+        }
+
+        [[nodiscard]] std::uint64_t received() const
+        {
+            std::uint64_t total = 0;
+            for (const auto& segment : m_state.segments) {
+                total += segment.written;
+            }
+            return total;
+        }
+
+        // Progress to the callback and the state file, at most once per
+        // interval unless it is the last one
+        void report(bool last)
+        {
+            const auto now = Clock::now();
+            if (m_state.size != 0 && (last || now - m_lastSave >= saveInterval)) {
+                m_lastSave = now;
+                m_state.save(m_statePath);
+            }
+
+            if (!m_options.progress
+                || (!last && now - m_lastReport < m_options.progressInterval)) {
+                return;
+            }
+            m_lastReport = now;
+
+            DownloadProgress progress;
+            progress.received = received();
+            if (m_state.size != 0 || last) {
+                progress.total = m_state.size;
+            }
+            const auto elapsed
+                = std::chrono::duration<double>(now - m_start).count();
+            if (elapsed > 0) {
+                progress.bytesPerSecond
+                    = static_cast<double>(progress.received - m_resumed)
+                    / elapsed;
+            }
+            if (progress.total && progress.bytesPerSecond > 0) {
+                progress.eta = std::chrono::seconds(static_cast<std::int64_t>(
+                    static_cast<double>(*progress.total - progress.received)
+                    / progress.bytesPerSecond));
+            }
+            m_options.progress(progress);
+        }
+
+        [[nodiscard]] std::uint64_t resumedBytes() const { return m_resumed; }
+        std::string digest() { return m_hash.hex(); }
+    };
+
+    template <typename T>
+    T runSync(asio::io_context& ctx, awaitable<T> task)
+    {
+        std::optional<T> result;
+        std::exception_ptr error;
+        asio::co_spawn(ctx, std::move(task),
+            [&](const std::exception_ptr& eptr, T value) {
+                error = eptr;
+                result = std::move(value);
+            });
+        ctx.run();
+        ctx.restart();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*result);
+    }
+
+    std::vector<Segment> plan(
+        std::uint64_t size, const DownloadOptions& options)
+    {
+        const auto wanted = std::max<std::uint64_t>(
+            1, size / std::max<std::uint64_t>(1, options.minSegmentSize));
+        const auto count = std::clamp<std::uint64_t>(
+            std::min<std::uint64_t>(options.segments, wanted), 1, 64);
+
+        std::vector<Segment> segments;
+        const auto step = size / count;
+        for (std::uint64_t i = 0; i < count; ++i) {
+            segments.push_back({ .begin = i * step,
+                .end = i + 1 == count ? size : (i + 1) * step,
+                .written = 0 });
+        }
+        return segments;
+    }
+
+} // anonymous namespace
+
+std::optional<double> DownloadProgress::percent() const
+{
+    if (!total) {
+        return std::nullopt;
+    }
+    if (*total == 0) {
+        return 100.0;
+    }
+    return 100.0 * static_cast<double>(received)
+        / static_cast<double>(*total);
+}
+
+DownloadResult download(const std::string& url,
+    const std::filesystem::path& file, const DownloadOptions& options)
+{
+    auto partPath = file;
+    partPath += ".part";
+    auto statePath = partPath;
+    statePath += ".state";
+
+    asio::io_context ctx;
+    State state { .url = url };
+    Transfer transfer(ctx, options, url, state, statePath);
+    const auto remote = runSync(ctx, transfer.inspect(url));
+    LOG_DEBUG("Downloading {} from {}, {} bytes, ranges {}", file.string(),
+        remote.url.str(), remote.size ? std::to_string(*remote.size) : "unknown",
+        remote.ranges)
+
+    if (remote.size && std::filesystem::exists(file)
+        && std::filesystem::file_size(file) == *remote.size) {
+        LOG_INFO("{} is up to date", file.string())
+        DownloadResult result { .path = file,
+            .size = *remote.size,
+            .sha256 = {},
+            .resumed = 0,
+            .upToDate = true };
+        if (options.sha256) {
+            result.sha256 = files::sha256(file);
+            if (result.sha256 != *options.sha256) {
+                throw std::runtime_error(fmt::format(
+                    "ERROR: SHA-256 mismatch for {}: expected {}, got {}",
+                    file.string(), *options.sha256, result.sha256));
+            }
+        }
+        return result;
+    }
+
+    state.size = remote.size.value_or(0);
+    state.validator = remote.validator;
+    const auto previous = State::load(statePath);
+    const bool resume = remote.ranges && previous && previous->url == url
+        && previous->size == state.size
+        && previous->validator == state.validator
+        && std::filesystem::exists(partPath);
+    if (resume) {
+        state.segments = previous->segments;
+    } else if (remote.ranges) {
+        state.segments = plan(state.size, options);
+    } else {
+        state.segments
+            = { { .begin = 0, .end = remote.size.value_or(unknownEnd), .written = 0 } };
+    }
+
+    if (resume) {
+        LOG_INFO("Resuming the download of {}", file.string())
+    }
+    transfer.open(partPath, resume);
+
+    std::exception_ptr error;
+    for (auto& segment : state.segments) {
+        asio::co_spawn(ctx, transfer.fetch(remote.url, segment, remote.ranges),
+            [&](const std::exception_ptr& eptr) {
+                if (eptr && !error) {
+                    error = eptr;
+                    ctx.stop();
+                }
+            });
+    }
+    ctx.run();
+
+    if (error) {
+        transfer.report(true);
+        std::rethrow_exception(error);
+    }
+
+    const auto size = transfer.received();
+    state.size = size;
+    transfer.report(true);
+
+    DownloadResult result { .path = file,
+        .size = size,
+        .sha256 = transfer.digest(),
+        .resumed = transfer.resumedBytes(),
+        .upToDate = false };
+    transfer.close();
+    if (options.sha256 && result.sha256 != *options.sha256) {
+        std::filesystem::remove(partPath);
+        std::filesystem::remove(statePath);
+        throw std::runtime_error(
+            fmt::format("ERROR: SHA-256 mismatch for {}: expected {}, got {}",
+                url, *options.sha256, result.sha256));
+    }
+
+    std::filesystem::rename(partPath, file);
+    std::filesystem::remove(statePath);
+    LOG_INFO("Downloaded {}, SHA-256 {}", file.string(), result.sha256)
+    return result;
+}
+
+TEST_SUITE_BEGIN("cloyster::services::downloader");
+
+namespace {
+    /**
+     * @brief Loopback HTTP/1.1 server serving generated content
+     *
+     * - /file supports range requests
+     * - /plain ignores them and sends no Accept-Ranges
+     * - /redirect answers 302 to /file
+     * - /missing answers 404
+     * - /flaky cuts every other response in half
+     *
+     * Requests with an absolute URL, sent to it as a proxy, get the same
+     * answers.
+     */
+    class FileServer final {
+
+        awaitable<void> session(asio::ip::tcp::socket socket)
+        {
+            beast::flat_buffer buffer;
+            try {
+                bhttp::request<bhttp::empty_body> req;
+                co_await bhttp::async_read(socket, buffer, req, use_awaitable);
+                ++requests;
+
+                bhttp::response<bhttp::string_body> res {
+                    bhttp::status::ok, req.version()
+                };
+                res.keep_alive(false);
+                auto target = view(req.target());
+                if (const auto scheme = target.find("://");
+                    scheme != std::string_view::npos) {
+                    target = target.substr(target.find('/', scheme + 3));
+                    ++proxied;
+                }
+                const bool ranged = target == "/file" || target == "/flaky";
+                if (target == "/redirect") {
+                    res.result(bhttp::status::found);
+                    res.set(bhttp::field::location, "/file");
+                } else if (target == "/missing") {
+                    res.result(bhttp::status::not_found);
+                } else {
+                    std::uint64_t begin = 0;
+                    std::uint64_t end = content.size();
+                    const auto range = view(req[bhttp::field::range]);
+                    if (ranged && range.starts_with("bytes=")) {
+                        const auto dash = range.find('-');
+                        begin = toNumber(range.substr(6, dash - 6)).value();
+                        end = toNumber(range.substr(dash + 1)).value() + 1;
+                        res.result(bhttp::status::partial_content);
+                        res.set(bhttp::field::content_range,
+                            fmt::format("bytes {}-{}/{}", begin, end - 1,
+                                content.size()));
+                    }
+                    if (ranged) {
+                        res.set(bhttp::field::accept_ranges, "bytes");
+                        res.set(bhttp::field::etag, R"("v1")");
+                    }
+                    res.body() = content.substr(begin, end - begin);
+                    res.prepare_payload();
+
+                    if (target == "/flaky" && req.method() == bhttp::verb::get
+                        && flaky++ % 2 == 0) {
+                        // Promise the whole body, send half of it
+                        bhttp::response_serializer<bhttp::string_body> sr { res };
+                        co_await bhttp::async_write_header(
+                            socket, sr, use_awaitable);
+                        co_await asio::async_write(socket,
+                            asio::buffer(res.body().data(), res.body().size() / 2),
+                            use_awaitable);
+                        co_return;
+                    }
+                }
+                co_await bhttp::async_write(socket, res, use_awaitable);
+            } catch (const std::exception&) {
+                // Client went away
+            }
+        }
+
+    public:
+        std::string content;
+        std::atomic<std::size_t> requests = 0;
+        std::atomic<std::size_t> flaky = 0;
+        std::atomic<std::size_t> proxied = 0;
+        // Last, it is stopped before the content goes away
+        LoopbackServer server { [this](asio::ip::tcp::socket socket) {
+            return session(std::move(socket));
+        } };
+
+        explicit FileServer(std::size_t size)
+        {
+            content.reserve(size);
+            for (std::size_t i = 0; i < size; ++i) {
+                content += static_cast<char>((i * 7 + i / 4096) % 251);
+            }
+        }
+
+        [[nodiscard]] std::string url(std::string_view path) const
+        {
+            return server.url(path);
+        }
+
+        [[nodiscard]] std::string digest() const
+        {
+            files::Sha256 hash;
+            hash.update(content);
+            return hash.hex();
+        }
+    };
+
+    std::string readAll(const std::filesystem::path& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return { std::istreambuf_iterator<char>(file), {} };
+    }
+
+    using cloyster::tests::TemporaryDirectory;
+}
+
+TEST_CASE("download against a loopback server")
+{
+    constexpr std::size_t size = 3 * 1024 * 1024 + 17;
+    const DownloadOptions small { .segments = 4, .minSegmentSize = 64 * 1024 };
+
+    SUBCASE("segmented download with redirect and digest")
+    {
+        FileServer server(size);
+        TemporaryDirectory dir;
+        auto options = small;
+        options.sha256 = server.digest();
+        std::vector<DownloadProgress> events;
+        options.progress
+            = [&](const DownloadProgress& event) { events.push_back(event); };
+
+        const auto result
+            = download(server.url("/redirect"), dir.path / "image.iso", options);
+        CHECK(result.size == size);
+        CHECK(result.sha256 == server.digest());
+        CHECK(readAll(dir.path / "image.iso") == server.content);
+        CHECK_FALSE(std::filesystem::exists(dir.path / "image.iso.part"));
+        // HEAD, redirected HEAD and one GET per segment
+        CHECK(server.requests == 6);
+        REQUIRE_FALSE(events.empty());
+        CHECK(events.back().received == size);
+        CHECK(events.back().percent() == 100.0);
+
+        // Like wget -N, a complete file is not downloaded again
+        const auto again = download(server.url("/file"), dir.path / "image.iso");
+        CHECK(again.upToDate);
+        CHECK(server.requests == 7);
+    }
+
+    SUBCASE("downloads through a proxy")
+    {
+        FileServer server(size);
+        TemporaryDirectory dir;
+        ProxyEnvironment environment;
+        environment.set("http_proxy", server.url(""));
+        const auto result = download("http://mirror.example.com/redirect",
+            dir.path / "image.iso", small);
+        CHECK(result.sha256 == server.digest());
+        CHECK(readAll(dir.path / "image.iso") == server.content);
+        CHECK(server.proxied == server.requests);
+    }
+
+    SUBCASE("servers without range support")
+    {
+        FileServer server(size);
+        TemporaryDirectory dir;
+        const auto result
+            = download(server.url("/plain"), dir.path / "plain", small);
+        CHECK(result.sha256 == server.digest());
+        CHECK(readAll(dir.path / "plain") == server.content);
+    }
+
+    SUBCASE("interrupted downloads resume")
+    {
+        FileServer server(size);
+        TemporaryDirectory dir;
+        std::stop_source stop;
+        auto options = small;
+        options.segments = 1;
+        options.progressInterval = 0ms;
+        options.stop = stop.get_token();
+        options.progress = [&](const DownloadProgress& event) {
+            if (event.received > size / 3) {
+                stop.request_stop();
+            }
+        };
+        CHECK_THROWS_AS(download(server.url("/file"), dir.path / "image.iso",
+                            options),
+            CommandCancelledError);
+        CHECK(std::filesystem::exists(dir.path / "image.iso.part"));
+
+        options.stop = {};
+        options.progress = nullptr;
+        options.sha256 = server.digest();
+        const auto result
+            = download(server.url("/file"), dir.path / "image.iso", options);
+        CHECK(result.resumed > size / 3);
+        CHECK(readAll(dir.path / "image.iso") == server.content);
+    }
+
+    SUBCASE("broken connections are retried from where they stopped")
+    {
+        FileServer server(size);
+        TemporaryDirectory dir;
+        const auto result
+            = download(server.url("/flaky"), dir.path / "flaky", small);
+        CHECK(result.sha256 == server.digest());
+        CHECK(server.flaky > 4);
+    }
+
+    SUBCASE("errors")
+    {
+        FileServer server(size);
+        TemporaryDirectory dir;
+        CHECK_THROWS_AS(download(server.url("/missing"), dir.path / "missing"),
+            std::runtime_error);
+
+        auto options = small;
+        options.sha256 = std::string(64, '0');
+        CHECK_THROWS_AS(
+            download(server.url("/file"), dir.path / "bad", options),
+            std::runtime_error);
+        CHECK_FALSE(std::filesystem::exists(dir.path / "bad"));
+        CHECK_FALSE(std::filesystem::exists(dir.path / "bad.part"));
+    }
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services::http
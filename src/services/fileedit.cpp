@@ -0,0 +1,399 @@
+#include <cerrno>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/patterns/singleton.h>
+#include <cloysterhpc/services/descriptor.h>
+#include <cloysterhpc/services/fileedit.h>
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/options.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::files {
+
+namespace {
+
+    std::size_t hash(std::string_view text)
+    {
+        return std::hash<std::string_view> {}(text);
+    }
+
+    // The first word of a line, up to a blank or an equal sign
+    std::string_view keyOf(std::string_view line)
+    {
+        const auto begin = line.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) {
+            return {};
+        }
+        line.remove_prefix(begin);
+        return line.substr(0, line.find_first_of(" \t="));
+    }
+
+    std::vector<std::string_view> splitLines(std::string_view text)
+    {
+        std::vector<std::string_view> lines;
+        while (!text.empty()) {
+            const auto end = text.find('\n');
+            lines.push_back(text.substr(0, end));
+            if (end == std::string_view::npos) {
+                break;
+            }
+            text.remove_prefix(end + 1);
+        }
+        return lines;
+    }
+
+}
+
+void writeFileAtomically(
+    const std::filesystem::path& link, std::string_view contents)
+{
+    // Renaming over a symbolic link would replace the link itself
+    const auto path = std::filesystem::is_symlink(link)
+        ? std::filesystem::canonical(link)
+        : link;
+
+    struct stat original {};
+    const bool exists = ::stat(path.c_str(), &original) == 0;
+
+    auto temporary = path;
+    temporary += ".XXXXXX";
+    std::string name = temporary.string();
+    const int fd = ::mkostemp(name.data(), O_CLOEXEC);
+    if (fd < 0) {
+        throw FileException(
+            errorMessage("Cannot create a file next to", path));
+    }
+
+    const auto fail = [&](std::string_view what) {
+        const auto message = errorMessage(what, path);
+        ::close(fd);
+        ::unlink(name.c_str());
+        throw FileException(message);
+    };
+
+    if (::fchmod(fd, exists ? original.st_mode & 07777 : 0644) != 0) {
+        fail("Cannot set the mode of");
+    }
+    if (exists && ::fchown(fd, original.st_uid, original.st_gid) != 0) {
+        fail("Cannot set the owner of");
+    }
+
+    auto pending = contents;
+    while (!pending.empty()) {
+        const auto written = ::write(fd, pending.data(), pending.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("Cannot write");
+        }
+        pending.remove_prefix(static_cast<std::size_t>(written));
+    }
+
+    if (::fsync(fd) != 0) {
+        fail("Cannot sync");
+    }
+    if (::close(fd) != 0) {
+        ::unlink(name.c_str());
+        throw FileException(errorMessage("Cannot close", path));
+    }
+    if (::rename(name.c_str(), path.c_str()) != 0) {
+        ::unlink(name.c_str());
+        throw FileException(errorMessage("Cannot replace", path));
+    }
+}
+
+FileEditSession::FileEditSession(std::filesystem::path path)
+    : m_path(std::move(path))
+{
+    std::ifstream ifs(m_path, std::ios::binary);
+    if (ifs.is_open()) {
+        m_original.assign(std::istreambuf_iterator<char>(ifs),
+            std::istreambuf_iterator<char>());
+    }
+
+    m_finalNewline = m_original.empty() || m_original.ends_with('\n');
+    const auto lines = splitLines(m_original);
+    m_lines.reserve(lines.size());
+    for (const auto& line : lines) {
+        m_lines.push_back({ .text = std::string(line),
+            .before = std::string(line),
+            .original = true,
+            .removed = false });
+        index(m_lines.size() - 1);
+    }
+}
+
+void FileEditSession::index(std::size_t position)
+{
+    const auto& text = m_lines[position].text;
+    m_byText.emplace(hash(text), position);
+    if (const auto key = keyOf(text); !key.empty()) {
+        m_byKey.emplace(hash(key), position);
+    }
+}
+
+void FileEditSession::unindex(std::size_t position)
+{
+    const auto erase = [position](auto& map, std::size_t hashed) {
+        auto [it, end] = map.equal_range(hashed);
+        for (; it != end; ++it) {
+            if (it->second == position) {
+                map.erase(it);
+                return;
+            }
+        }
+    };
+
+    const auto& text = m_lines[position].text;
+    erase(m_byText, hash(text));
+    if (const auto key = keyOf(text); !key.empty()) {
+        erase(m_byKey, hash(key));
+    }
+}
+
+bool FileEditSession::containsBlock(
+    const std::vector<std::string_view>& block) const
+{
+    auto [it, end] = m_byText.equal_range(hash(block.front()));
+    for (; it != end; ++it) {
+        auto position = it->second;
+        std::size_t matched = 0;
+        while (matched < block.size() && position < m_lines.size()) {
+            const auto& line = m_lines[position++];
+            if (line.removed) {
+                continue;
+            }
+            if (line.text != block[matched]) {
+                break;
+            }
+            ++matched;
+        }
+        if (matched == block.size()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FileEditSession::appendIfAbsent(std::string_view text)
+{
+    const auto block = splitLines(text);
+    if (block.empty() || containsBlock(block)) {
+        return false;
+    }
+
+    for (const auto& line : block) {
+        m_lines.push_back({ .text = std::string(line),
+            .before = {},
+            .original = false,
+            .removed = false });
+        index(m_lines.size() - 1);
+    }
+    m_finalNewline = text.ends_with('\n');
+    return true;
+}
+
+std::size_t FileEditSession::replaceLine(
+    std::string_view line, std::string_view replacement)
+{
+    if (line == replacement) {
+        return 0;
+    }
+
+    std::vector<std::size_t> positions;
+    auto [it, end] = m_byText.equal_range(hash(line));
+    for (; it != end; ++it) {
+        if (m_lines[it->second].text == line) {
+            positions.push_back(it->second);
+        }
+    }
+
+    for (const auto position : positions) {
+        unindex(position);
+        m_lines[position].text = replacement;
+        index(position);
+    }
+    return positions.size();
+}
+
+std::size_t FileEditSession::removeLinesWithKey(std::string_view key)
+{
+    std::vector<std::size_t> positions;
+    auto [it, end] = m_byKey.equal_range(hash(key));
+    for (; it != end; ++it) {
+        if (keyOf(m_lines[it->second].text) == key) {
+            positions.push_back(it->second);
+        }
+    }
+
+    for (const auto position : positions) {
+        unindex(position);
+        m_lines[position].removed = true;
+    }
+    return positions.size();
+}
+
+std::string FileEditSession::contents() const
+{
+    std::string result;
+    result.reserve(m_original.size());
+    bool empty = true;
+    for (const auto& line : m_lines) {
+        if (line.removed) {
+            continue;
+        }
+        if (!empty) {
+            result += '\n';
+        }
+        result += line.text;
+        empty = false;
+    }
+    if (!empty && m_finalNewline) {
+        result += '\n';
+    }
+    return result;
+}
+
+bool FileEditSession::changed() const { return contents() != m_original; }
+
+std::string FileEditSession::diff() const
+{
+    auto result = fmt::format("--- {0}\n+++ {0}\n", m_path.string());
+    for (const auto& line : m_lines) {
+        if (line.original && (line.removed || line.text != line.before)) {
+            result += fmt::format("-{}\n", line.before);
+        }
+        if (!line.removed && (!line.original || line.text != line.before)) {
+            result += fmt::format("+{}\n", line.text);
+        }
+    }
+    return result;
+}
+
+bool FileEditSession::commit()
+{
+    const auto data = contents();
+    if (data == m_original) {
+        LOG_DEBUG("File {} is unchanged", m_path.string())
+        return false;
+    }
+
+    auto opts = cloyster::Singleton<cloyster::services::Options>::get();
+    if (opts->dryRun) {
+        LOG_INFO("Dry Run: Would change the file {}:\n{}", m_path.string(),
+            diff())
+        return true;
+    }
+
+    writeFileAtomically(m_path, data);
+    LOG_DEBUG("Changed the file {}:\n{}", m_path.string(), diff())
+
+    // The session goes on from what was written
+    *this = FileEditSession(m_path);
+    return true;
+}
+
+} // namespace cloyster::services::files
+
+TEST_SUITE_BEGIN("cloyster::services::files");
+
+namespace {
+    using cloyster::services::files::FileEditSession;
+
+    using cloyster::tests::TemporaryFile;
+
+    void initOptions(bool dryRun)
+    {
+        auto opts = std::make_unique<cloyster::services::Options>(
+            cloyster::services::Options {});
+        opts->dryRun = dryRun;
+        cloyster::Singleton<cloyster::services::Options>::init(
+            std::move(opts));
+    }
+}
+
+TEST_CASE("FileEditSession edits the file in a single write")
+{
+    initOptions(false);
+    const TemporaryFile file("chrony.conf",
+        "# chrony\nserver a iburst\nallow 10.0.0.0/8\n"
+        "local stratum 10\nlogdir /var/log/chrony\n");
+    std::filesystem::permissions(file.path, std::filesystem::perms(0640));
+
+    FileEditSession session(file.path);
+    CHECK_FALSE(session.appendIfAbsent("server a iburst\n"));
+    CHECK_FALSE(
+        session.appendIfAbsent("allow 10.0.0.0/8\nlocal stratum 10\n"));
+    CHECK(session.appendIfAbsent("allow 10.0.0.0/8\nserver b iburst\n"));
+    CHECK(session.replaceLine("server a iburst", "server c iburst") == 1);
+    CHECK(session.removeLinesWithKey("logdir") == 1);
+    CHECK(session.removeLinesWithKey("log") == 0);
+    CHECK(file.read().starts_with("# chrony\nserver a iburst\n"));
+
+    CHECK(session.diff()
+        == fmt::format("--- {0}\n+++ {0}\n-server a iburst\n+server c "
+                       "iburst\n-logdir /var/log/chrony\n+allow "
+                       "10.0.0.0/8\n+server b iburst\n",
+            file.path.string()));
+    CHECK(session.commit());
+    CHECK(file.read()
+        == "# chrony\nserver c iburst\nallow 10.0.0.0/8\nlocal stratum 10\n"
+           "allow 10.0.0.0/8\nserver b iburst\n");
+    CHECK((std::filesystem::status(file.path).permissions()
+              & std::filesystem::perms::all)
+        == std::filesystem::perms(0640));
+
+    CHECK_FALSE(session.appendIfAbsent("server b iburst\n"));
+    CHECK_FALSE(session.commit());
+}
+
+TEST_CASE("FileEditSession keeps the missing final newline")
+{
+    initOptions(false);
+    const TemporaryFile file("test.conf", "a=1\nb=2");
+
+    FileEditSession session(file.path);
+    CHECK(session.removeLinesWithKey("a") == 1);
+    CHECK(session.contents() == "b=2");
+    CHECK(session.appendIfAbsent("c=3\n"));
+    CHECK(session.commit());
+    CHECK(file.read() == "b=2\nc=3\n");
+}
+
+TEST_CASE("FileEditSession does not write on dry runs")
+{
+    initOptions(true);
+    const TemporaryFile file("test.conf", "a\n");
+
+    FileEditSession session(file.path);
+    CHECK(session.appendIfAbsent("b\n"));
+    CHECK(session.commit());
+    CHECK(file.read() == "a\n");
+
+    const auto missing = file.path.string() + ".missing";
+    FileEditSession create(missing);
+    CHECK(create.appendIfAbsent("a\n"));
+    CHECK(create.commit());
+    CHECK_FALSE(std::filesystem::exists(missing));
+    initOptions(false);
+}
+
+TEST_SUITE_END();
@@ -1,51 +1,547 @@
+#include <cerrno>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <ios>
 #include <istream>
+#include <limits>
 #include <ranges>
 #include <stdexcept>
 #include <utility>
 
-#include <glibmm/checksum.h>
-#include <glibmm/fileutils.h>
-#include <glibmm/keyfile.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
 
+#include <cloysterhpc/services/checksum.h>
+#include <cloysterhpc/services/fileedit.h>
 #include <cloysterhpc/services/files.h>
 #include <cloysterhpc/services/log.h>
 #include <cloysterhpc/functions.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#if __has_include(<glibmm/keyfile.h>)
+#include <glibmm/keyfile.h>
+#define CLOYSTERHPC_BENCHMARK_GLIB
+#endif
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
 
 namespace cloyster::services::files {
 
+namespace {
+
+    constexpr std::string_view blanks = " \t";
+
+    // Read only mapping of a whole file
+    class Mapping final {
+        void* m_address = nullptr;
+        std::size_t m_size = 0;
+
+    public:
+        explicit Mapping(const std::filesystem::path& path)
+        {
+            const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                throw FileException(fmt::format(
+                    "Cannot open {}: {}", path.string(), std::strerror(errno)));
+            }
+            struct stat st {};
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw FileException(fmt::format(
+                    "Cannot stat {}: {}", path.string(), std::strerror(errno)));
+            }
+
+            m_size = static_cast<std::size_t>(st.st_size);
+            if (m_size > 0) {
+                m_address
+                    = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            ::close(fd);
+            if (m_address == MAP_FAILED) {
+                m_address = nullptr;
+                throw FileException(fmt::format(
+                    "Cannot map {}: {}", path.string(), std::strerror(errno)));
+            }
+        }
+        ~Mapping()
+        {
+            if (m_address != nullptr) {
+                ::munmap(m_address, m_size);
+            }
+        }
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+        Mapping(Mapping&&) = delete;
+        Mapping& operator=(Mapping&&) = delete;
+
+        [[nodiscard]] std::string_view view() const
+        {
+            return { static_cast<const char*>(m_address), m_size };
+        }
+    };
+
+    /**
+     * @brief Open addressing table from a group and a name to a position.
+     *
+     * The names are views, they must outlive the table. Groups are indexed
+     * under the group npos.
+     */
+    class FlatIndex final {
+    public:
+        static constexpr auto npos = std::numeric_limits<std::uint32_t>::max();
+
+        [[nodiscard]] std::optional<std::size_t> find(
+            std::uint32_t group, std::string_view name) const
+        {
+            if (m_slots.empty()) {
+                return std::nullopt;
+            }
+            const auto mask = m_slots.size() - 1;
+            const auto hashed = hash(group, name);
+            for (auto i = hashed & mask; m_slots[i].used; i = (i + 1) & mask) {
+                const auto& slot = m_slots[i];
+                if (slot.hash == hashed && slot.group == group
+                    && slot.name == name) {
+                    return slot.value;
+                }
+            }
+            return std::nullopt;
+        }
+
+        void assign(std::uint32_t group, std::string_view name, std::size_t value)
+        {
+            if ((m_size + 1) * 2 > m_slots.size()) {
+                grow();
+            }
+            const auto mask = m_slots.size() - 1;
+            const auto hashed = hash(group, name);
+            auto i = hashed & mask;
+            for (; m_slots[i].used; i = (i + 1) & mask) {
+                auto& slot = m_slots[i];
+                if (slot.hash == hashed && slot.group == group
+                    && slot.name == name) {
+                    slot.value = value;
+                    return;
+                }
+            }
+            m_slots[i] = { .hash = hashed,
+                .name = name,
+                .value = value,
+                .group = group,
+                .used = true };
+            ++m_size;
+        }
+
+        void clear()
+        {
+            m_slots.clear();
+            m_size = 0;
+        }
+
+    private:
+        struct Slot final {
+            std::size_t hash = 0;
+            std::string_view name;
+            std::size_t value = 0;
+            std::uint32_t group = 0;
+            bool used = false;
+        };
+
+        std::vector<Slot> m_slots;
+        std::size_t m_size = 0;
+
+        static std::size_t hash(std::uint32_t group, std::string_view name)
+        {
+            return std::hash<std::string_view> {}(name)
+                ^ (static_cast<std::size_t>(group) * 0x9E3779B97F4A7C15ULL);
+        }
+
+        void grow()
+        {
+            auto slots = std::move(m_slots);
+            m_slots.assign(std::max<std::size_t>(64, slots.size() * 2), {});
+            const auto mask = m_slots.size() - 1;
+            for (const auto& slot : slots) {
+                if (!slot.used) {
+                    continue;
+                }
+                auto i = slot.hash & mask;
+                while (m_slots[i].used) {
+                    i = (i + 1) & mask;
+                }
+                m_slots[i] = slot;
+            }
+        }
+    };
+
+    // Values are escaped as GKeyFile does, see escape()
+    std::string unescape(std::string_view value)
+    {
+        std::string result;
+        result.reserve(value.size());
+        for (std::size_t i = 0; i < value.size(); ++i) {
+            if (value[i] != '\\') {
+                result += value[i];
+                continue;
+            }
+            if (++i == value.size()) {
+                throw FileException("Key file contains an escape character "
+                                    "at the end of a line");
+            }
+            switch (value[i]) {
+                case 's':
+                    result += ' ';
+                    break;
+                case 'n':
+                    result += '\n';
+                    break;
+                case 't':
+                    result += '\t';
+                    break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case '\\':
+                    result += '\\';
+                    break;
+                default:
+                    throw FileException(fmt::format(
+                        "Key file contains an invalid escape sequence \\{}",
+                        value[i]));
+            }
+        }
+        return result;
+    }
+
+    std::string escape(std::string_view value)
+    {
+        std::string result;
+        result.reserve(value.size());
+        bool leading = true;
+        for (const char c : value) {
+            leading = leading && c == ' ';
+            switch (c) {
+                case ' ':
+                    result += leading ? "\\s" : " ";
+                    break;
+                case '\n':
+                    result += "\\n";
+                    break;
+                case '\t':
+                    result += "\\t";
+                    break;
+                case '\r':
+                    result += "\\r";
+                    break;
+                case '\\':
+                    result += "\\\\";
+                    break;
+                default:
+                    result += c;
+            }
+        }
+        return result;
+    }
+
+    std::string_view trimRight(std::string_view text)
+    {
+        const auto end = text.find_last_not_of(blanks);
+        return end == std::string_view::npos ? std::string_view()
+                                             : text.substr(0, end + 1);
+    }
+
+}
+
+/**
+ * The file is mapped and split in lines. Groups, keys and values are views
+ * over the mapping, indexed by a FlatIndex. Changed values and added keys
+ * are kept aside, toData() writes every other line as it was read.
+ */
 struct KeyFile::Impl {
-    std::filesystem::path m_path;
-    std::unique_ptr<Glib::KeyFile> m_keyfile;
+    enum class Kind : std::uint8_t { Other, Group, Entry };
+
+    struct Line final {
+        Kind kind = Kind::Other;
+        // As read, without the newline, empty for the lines added
+        std::string_view text;
+        std::uint32_t group = 0;
+        std::string_view key;
+        // Escaped, as in the file
+        std::string_view value;
+        bool modified = false;
+    };
+
+    struct Group final {
+        std::string_view name;
+        // Groups added, and the keys before the first group, have no header
+        bool header = false;
+        // The keys added go after this line, or first if there is none
+        std::optional<std::size_t> last;
+        std::vector<std::size_t> added;
+    };
 
-    Impl(Glib::KeyFile&& keyfile, std::filesystem::path path)
+    std::filesystem::path m_path;
+    std::unique_ptr<Mapping> m_mapping;
+    std::string m_data;
+    // Groups, keys and values set, stable as the views point to them
+    std::deque<std::string> m_strings;
+    std::vector<Line> m_lines;
+    std::size_t m_read = 0;
+    bool m_finalNewline = true;
+    // The keys before the first group are in the unnamed group 0
+    std::vector<Group> m_groups;
+    FlatIndex m_index;
+
+    explicit Impl(std::filesystem::path path)
         : m_path(std::move(path))
-        , m_keyfile(std::make_unique<Glib::KeyFile>(std::move(keyfile))) { };
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        m_strings.clear();
+        m_lines.clear();
+        m_groups.assign(1, Group {});
+        m_index.clear();
+        m_index.assign(FlatIndex::npos, {}, 0);
+        m_read = 0;
+        m_finalNewline = true;
+    }
+
+    void load()
+    {
+        reset();
+        m_data.clear();
+        m_mapping = std::make_unique<Mapping>(m_path);
+        parse(m_mapping->view());
+    }
+
+    void loadData(std::string data)
+    {
+        reset();
+        m_mapping.reset();
+        m_data = std::move(data);
+        parse(m_data);
+    }
 
+    void parse(std::string_view data)
+    {
+        std::uint32_t current = 0;
+        std::size_t number = 0;
+        while (!data.empty()) {
+            const auto newline = data.find('\n');
+            const auto text = data.substr(0, newline);
+            data.remove_prefix(
+                newline == std::string_view::npos ? data.size() : newline + 1);
+            m_finalNewline = newline != std::string_view::npos;
+            ++number;
+
+            Line line;
+            line.text = text;
+            auto content = text;
+            if (content.ends_with('\r')) {
+                content.remove_suffix(1);
+            }
+            content.remove_prefix(
+                std::min(content.find_first_not_of(blanks), content.size()));
+
+            if (content.empty() || content.starts_with('#')
+                || content.starts_with(';')) {
+                m_lines.push_back(line);
+                continue;
+            }
+
+            if (content.starts_with('[')) {
+                const auto close = content.rfind(']');
+                if (close == std::string_view::npos) {
+                    throw invalidLine(number, text);
+                }
+                current = group(content.substr(1, close - 1), true);
+                line.kind = Kind::Group;
+                line.group = current;
+                m_groups[current].last = m_lines.size();
+                m_lines.push_back(line);
+                continue;
+            }
+
+            const auto equals = content.find('=');
+            if (equals == std::string_view::npos) {
+                throw invalidLine(number, text);
+            }
+            line.kind = Kind::Entry;
+            line.group = current;
+            line.key = trimRight(content.substr(0, equals));
+            if (line.key.empty()) {
+                throw invalidLine(number, text);
+            }
+            line.value = content.substr(equals + 1);
+            line.value.remove_prefix(
+                std::min(line.value.find_first_not_of(blanks),
+                    line.value.size()));
+
+            m_index.assign(current, line.key, m_lines.size());
+            m_groups[current].last = m_lines.size();
+            m_lines.push_back(line);
+        }
+        m_read = m_lines.size();
+    }
+
+    [[nodiscard]] FileException invalidLine(
+        std::size_t number, std::string_view text) const
+    {
+        return FileException(fmt::format(
+            "{}:{}: not a key-value pair, group or comment: {}",
+            m_path.string(), number, text));
+    }
+
+    [[nodiscard]] std::string_view store(std::string text)
+    {
+        return m_strings.emplace_back(std::move(text));
+    }
+
+    // The group named @p name, added if missing
+    std::uint32_t group(std::string_view name, bool header = false)
+    {
+        if (const auto found = m_index.find(FlatIndex::npos, name)) {
+            m_groups[*found].header = m_groups[*found].header || header;
+            return static_cast<std::uint32_t>(*found);
+        }
+
+        const auto position = static_cast<std::uint32_t>(m_groups.size());
+        const auto stored = header ? name : store(std::string(name));
+        m_groups.push_back({ .name = stored,
+            .header = header,
+            .last = std::nullopt,
+            .added = {} });
+        m_index.assign(FlatIndex::npos, stored, position);
+        return position;
+    }
+
+    [[nodiscard]] const Line* entry(
+        std::string_view group, std::string_view key) const
+    {
+        const auto position = m_index.find(FlatIndex::npos, group);
+        if (!position) {
+            return nullptr;
+        }
+        const auto line
+            = m_index.find(static_cast<std::uint32_t>(*position), key);
+        return line ? &m_lines[*line] : nullptr;
+    }
+
+    void set(std::string_view groupName, std::string_view key,
+        std::string value)
+    {
+        if (key.empty() || key.find_first_of("=[]\n\r") != std::string::npos
+            || key != trimRight(key) || key.front() == ' ') {
+            throw FileException(fmt::format("Invalid key name: {}", key));
+        }
+        if (groupName.find_first_of("[]\n\r") != std::string::npos) {
+            throw FileException(
+                fmt::format("Invalid group name: {}", groupName));
+        }
+
+        const auto current = group(groupName);
+        if (const auto found = m_index.find(current, key)) {
+            auto& line = m_lines[*found];
+            line.value = store(std::move(value));
+            line.modified = true;
+            return;
+        }
+
+        const auto stored = store(std::string(key));
+        m_index.assign(current, stored, m_lines.size());
+        m_groups[current].added.push_back(m_lines.size());
+        m_lines.push_back({ .kind = Kind::Entry,
+            .text = {},
+            .group = current,
+            .key = stored,
+            .value = store(std::move(value)),
+            .modified = true });
+    }
+
+    [[nodiscard]] std::string toData() const
+    {
+        std::string result;
+        result.reserve(
+            m_mapping ? m_mapping->view().size() + 64 : m_data.size() + 64);
+
+        const auto newline = [&result] {
+            if (!result.empty() && !result.ends_with('\n')) {
+                result += '\n';
+            }
+        };
+        const auto writeAdded = [&](const Group& group) {
+            for (const auto position : group.added) {
+                const auto& line = m_lines[position];
+                newline();
+                result.append(line.key).append("=").append(line.value);
+                result += '\n';
+            }
+        };
+
+        // Keys added before any group
+        if (!m_groups.front().last) {
+            writeAdded(m_groups.front());
+        }
+
+        for (std::size_t i = 0; i < m_read; ++i) {
+            const auto& line = m_lines[i];
+            if (line.modified) {
+                result.append(line.key).append("=").append(line.value);
+            } else {
+                result.append(line.text);
+            }
+            if (i + 1 < m_read || m_finalNewline) {
+                result += '\n';
+            }
+
+            if (line.kind != Kind::Other) {
+                const auto& group = m_groups[line.group];
+                if (group.last == i) {
+                    writeAdded(group);
+                }
+            }
+        }
+
+        for (const auto& group : m_groups | std::views::drop(1)) {
+            if (group.header || group.added.empty()) {
+                continue;
+            }
+            newline();
+            if (!result.empty() && !result.ends_with("\n\n")) {
+                result += '\n';
+            }
+            result.append("[").append(group.name).append("]\n");
+            writeAdded(group);
+        }
+        return result;
+    }
 };
 
 KeyFile::KeyFile(const std::filesystem::path& path)
-    : m_impl(std::make_unique<KeyFile::Impl>(Glib::KeyFile(), path))
+    : m_impl(std::make_unique<KeyFile::Impl>(path))
 {
-    m_impl->m_path = path;
     if (cloyster::functions::exists(path)) {
-        m_impl->m_keyfile->load_from_file(path);
+        m_impl->load();
     }
 }
 
 KeyFile::~KeyFile() = default;
 
-namespace {
-    std::vector<std::string> toStrings(const std::vector<Glib::ustring>& input)
-    {
-        return input | std::views::transform([](const auto& group) {
-            return group.raw();
-        }) | std::ranges::to<std::vector<std::string>>();
-    }
-}
-
 std::vector<std::string> KeyFile::listAllPrefixedEntries(
     const std::string_view prefix) const
 {
@@ -58,75 +554,79 @@ std::vector<std::string> KeyFile::listAllPrefixedEntries(
 
 std::vector<std::string> KeyFile::getGroups() const
 {
-    return toStrings(m_impl->m_keyfile->get_groups());
+    std::vector<std::string> groups;
+    groups.reserve(m_impl->m_groups.size() - 1);
+    for (const auto& group : m_impl->m_groups | std::views::drop(1)) {
+        if (group.header || !group.added.empty()) {
+            groups.emplace_back(group.name);
+        }
+    }
+    return groups;
 }
 
 bool KeyFile::hasGroup(std::string_view group) const
 {
-    return m_impl->m_keyfile->has_group(std::string(group));
+    const auto found = m_impl->m_index.find(FlatIndex::npos, group);
+    if (!found || *found == 0) {
+        return false;
+    }
+    const auto& entry = m_impl->m_groups[*found];
+    return entry.header || !entry.added.empty();
 }
 
 std::string KeyFile::getString(
     const std::string& group, const std::string& key) const
 {
-    try {
-        return m_impl->m_keyfile->get_string(group, key).raw();
-    } catch (Glib::KeyFileError& e) {
+    const auto* line = m_impl->entry(group, key);
+    if (line == nullptr) {
         throw std::runtime_error(
             fmt::format("Keyfile Error, no such entry {} {}", group, key));
     }
+    return unescape(line->value);
 }
 
 std::string KeyFile::getString(
     const std::string& group, const std::string& key, std::string&& defaultValue) const
 {
-    try {
-        if (!m_impl->m_keyfile->has_key(group, key)) {
-            return std::move(defaultValue);
-        }
-        return m_impl->m_keyfile->get_string(group, key).raw();
-    } catch (Glib::KeyFileError& e) {
-        throw std::runtime_error(
-            fmt::format("Keyfile Error, no such entry {} {}", group, key));
+    const auto* line = m_impl->entry(group, key);
+    if (line == nullptr) {
+        return std::move(defaultValue);
     }
+    return unescape(line->value);
 }
 
 std::optional<std::string> KeyFile::getStringOpt(
     const std::string& group, const std::string& key) const
 {
-    if (m_impl->m_keyfile->has_key(group, key)) {
-        try {
-            return m_impl->m_keyfile->get_string(group, key).raw();
-        } catch (Glib::KeyFileError& e) {
-            throw std::runtime_error(
-                fmt::format("Keyfile Error, no such entry {} {}", group, key));
-        }
+    const auto* line = m_impl->entry(group, key);
+    if (line == nullptr) {
+        return std::nullopt;
     }
-    return std::nullopt;
+    return unescape(line->value);
 }
 
 bool KeyFile::getBoolean(const std::string& group, const std::string& key) const
 {
-    try {
-        return m_impl->m_keyfile->get_boolean(group, key);
-    } catch (Glib::KeyFileError& e) {
-        throw std::runtime_error(
-            fmt::format("Keyfile Error, no such entry {} {}", group, key));
+    const auto* line = m_impl->entry(group, key);
+    const auto value
+        = line == nullptr ? std::string_view() : trimRight(line->value);
+    if (value == "true" || value == "1") {
+        return true;
+    }
+    if (value == "false" || value == "0") {
+        return false;
     }
+    throw std::runtime_error(
+        fmt::format("Keyfile Error, no such entry {} {}", group, key));
 }
 
-std::string KeyFile::toData() const { return m_impl->m_keyfile->to_data(); }
+std::string KeyFile::toData() const { return m_impl->toData(); }
 
 void KeyFile::setString(
     const std::string& group, const std::string& key, const std::string& value)
 {
     LOG_ASSERT(group.size() > 0, "Trying to write to file with empty group");
-    try {
-        m_impl->m_keyfile->set_string(group, key, value);
-    } catch (const Glib::Error& e) {
-        LOG_ERROR("KeyFile::setString error {}", e.what().raw());
-        throw FileException(e.what());
-    }
+    m_impl->set(group, key, escape(value));
 }
 
 void KeyFile::setString(const std::string& group, const std::string& key,
@@ -134,67 +634,182 @@ void KeyFile::setString(const std::string& group, const std::string& key,
 {
     LOG_ASSERT(group.size() > 0, "Trying to write to file with empty group");
     if (value) {
-        try {
-            m_impl->m_keyfile->set_string(group, key, value.value());
-        } catch (const Glib::Error& e) {
-            LOG_ERROR("KeyFile::setString error {}", e.what().raw());
-            throw FileException(e.what().raw());
-        }
+        m_impl->set(group, key, escape(value.value()));
     }
 }
 
 void KeyFile::setBoolean(
     const std::string& group, const std::string& key, const bool value)
 {
-    try {
-        m_impl->m_keyfile->set_boolean(group, key, value);
-    } catch (const Glib::Error& e) {
-        LOG_ERROR("KeyFile::setString error {}", e.what().raw());
-        throw FileException(e.what());
-    }
+    m_impl->set(group, key, value ? "true" : "false");
 }
 
-void KeyFile::save() { m_impl->m_keyfile->save_to_file(m_impl->m_path); }
+void KeyFile::save() { writeFileAtomically(m_impl->m_path, toData()); }
 
-void KeyFile::load() { m_impl->m_keyfile->load_from_file(m_impl->m_path); }
+void KeyFile::load() { m_impl->load(); }
 
-void KeyFile::loadData(const std::string& data) { m_impl->m_keyfile->load_from_data(data); }
+void KeyFile::loadData(const std::string& data) { m_impl->loadData(data); }
 
 std::string checksum(const std::string& data)
 {
-    Glib::Checksum checksum(Glib::Checksum::ChecksumType::CHECKSUM_SHA256);
-    checksum.update(data);
-    return checksum.get_string();
+    Sha256 digest;
+    digest.update(data);
+    return digest.hex();
 }
 
-std::string checksum(
-    const std::filesystem::path& path, const std::size_t chunkSize)
+std::string checksum(const std::filesystem::path& path)
 {
-    Glib::Checksum checksum(Glib::Checksum::ChecksumType::CHECKSUM_SHA256);
-    std::ifstream file(path, std::ios::in | std::ios::binary);
-    if (!file.is_open()) {
-        throw std::filesystem::filesystem_error(
-            "Failed to open file", path, std::error_code());
-    }
+    return sha256(path);
+}
 
-    std::vector<std::byte> buffer(chunkSize);
+} // namespace cloyster::services::files
 
-    while (file.read(reinterpret_cast<std::istream::char_type*>(buffer.data()),
-        static_cast<std::streamsize>(buffer.size()))) {
-        auto bytesRead = static_cast<gsize>(file.gcount());
+TEST_SUITE_BEGIN("cloyster::services::files");
 
-        checksum.update(
-            reinterpret_cast<const unsigned char*>(buffer.data()), bytesRead);
-    }
+namespace {
+    using cloyster::services::files::KeyFile;
+
+    using cloyster::tests::TemporaryFile;
 
-    // Handle any leftover bytes after the while loop ends
-    auto bytesRead = static_cast<gsize>(file.gcount());
-    if (bytesRead > 0) {
-        checksum.update(
-            reinterpret_cast<const unsigned char*>(buffer.data()), bytesRead);
+    std::string answerfile(std::size_t nodes)
+    {
+        std::string data = "# Generated\n[information]\ncluster_name=bench\n"
+                           "\n[node]\nprefix=n\nnode_ip=172.26.0.1\n";
+        for (std::size_t i = 1; i <= nodes; ++i) {
+            data += fmt::format("\n[node.{0}]\nhostname=n{0:05}\n"
+                                "mac_address=52:54:00:{1:02x}:{2:02x}:01\n"
+                                "node_ip=172.26.{1}.{2}\nsockets=2\n"
+                                "cores_per_socket=32\nthreads_per_core=1\n",
+                i, i / 256, i % 256);
+        }
+        return data;
     }
+}
 
-    return checksum.get_string();
+TEST_CASE("KeyFile reads and writes groups and keys")
+{
+    const TemporaryFile file("keyfile.ini",
+        "# Answerfile\n"
+        "[information]\n"
+        "cluster_name = cloyster  \n"
+        "company_name=VersatusHPC\n"
+        "\n"
+        "; a comment is kept too\n"
+        "[node.1]\r\n"
+        "hostname=n01\r\n"
+        "motd=\\sWelcome\\nto the cluster\\\\\n"
+        "[information]\n"
+        "administrator_email=root@localhost\n"
+        "enabled=true");
+
+    KeyFile keyfile(file.path);
+    CHECK(keyfile.getGroups()
+        == std::vector<std::string> { "information", "node.1" });
+    CHECK(keyfile.hasGroup("node.1"));
+    CHECK_FALSE(keyfile.hasGroup("node.2"));
+    CHECK(keyfile.getString("information", "cluster_name") == "cloyster  ");
+    CHECK(keyfile.getString("node.1", "hostname") == "n01");
+    CHECK(keyfile.getString("node.1", "motd") == " Welcome\nto the cluster\\");
+    CHECK(keyfile.getString("information", "administrator_email")
+        == "root@localhost");
+    CHECK(keyfile.getBoolean("information", "enabled"));
+    CHECK(keyfile.getStringOpt("node.1", "missing") == std::nullopt);
+    CHECK(keyfile.getStringOpt("missing", "missing") == std::nullopt);
+    CHECK(keyfile.getString("node.2", "hostname", "none") == "none");
+    CHECK_THROWS((void)keyfile.getString("node.2", "hostname"));
+    CHECK_THROWS((void)keyfile.getBoolean("information", "company_name"));
+    CHECK(keyfile.listAllPrefixedEntries("node.")
+        == std::vector<std::string> { "node.1" });
+
+    keyfile.setString("information", "company_name", std::string(" Versatus\tHPC"));
+    keyfile.setString("node.1", "sockets", std::string("2"));
+    keyfile.setBoolean("node.2", "enabled", false);
+    CHECK(keyfile.getString("information", "company_name") == " Versatus\tHPC");
+    CHECK(keyfile.toData()
+        == "# Answerfile\n"
+           "[information]\n"
+           "cluster_name = cloyster  \n"
+           "company_name=\\sVersatus\\tHPC\n"
+           "\n"
+           "; a comment is kept too\n"
+           "[node.1]\r\n"
+           "hostname=n01\r\n"
+           "motd=\\sWelcome\\nto the cluster\\\\\n"
+           "sockets=2\n"
+           "[information]\n"
+           "administrator_email=root@localhost\n"
+           "enabled=true\n"
+           "\n"
+           "[node.2]\n"
+           "enabled=false\n");
+
+    keyfile.save();
+    KeyFile saved(file.path);
+    CHECK(saved.toData() == keyfile.toData());
+    CHECK(saved.getGroups()
+        == std::vector<std::string> { "information", "node.1", "node.2" });
+
+    keyfile.loadData("[repo]\nenabled=1\n");
+    CHECK(keyfile.getGroups() == std::vector<std::string> { "repo" });
+    CHECK(keyfile.getBoolean("repo", "enabled"));
+    CHECK_THROWS_AS(keyfile.loadData("[repo]\nnot a key\n"),
+        cloyster::services::files::FileException);
 }
 
-} // namespace cloyster::services::files
+TEST_CASE("KeyFile round trips a file byte for byte")
+{
+    const auto data = answerfile(100);
+    const TemporaryFile file("keyfile.ini", data);
+    const KeyFile keyfile(file.path);
+    CHECK(keyfile.toData() == data);
+    CHECK(keyfile.listAllPrefixedEntries("node.").size() == 100);
+    CHECK(keyfile.getString("node.100", "node_ip") == "172.26.0.100");
+}
+
+TEST_CASE("KeyFile benchmark on a 10,000 node answerfile" * doctest::skip())
+{
+    using clock = std::chrono::steady_clock;
+    constexpr std::size_t nodes = 10000;
+    const TemporaryFile file("keyfile.ini", answerfile(nodes));
+
+    const auto measure = [&](const auto& read) {
+        const auto start = clock::now();
+        std::size_t found = 0;
+        for (int round = 0; round < 10; ++round) {
+            found = read();
+        }
+        CHECK(found == nodes);
+        return std::chrono::duration<double, std::milli>(clock::now() - start)
+            / 10;
+    };
+
+    const auto native = measure([&] {
+        const KeyFile keyfile(file.path);
+        std::size_t found = 0;
+        for (const auto& group : keyfile.listAllPrefixedEntries("node.")) {
+            found += keyfile.getString(group, "hostname").empty() ? 0 : 1;
+            (void)keyfile.getString(group, "node_ip");
+        }
+        return found;
+    });
+    MESSAGE(fmt::format("KeyFile: {:.2f} ms", native.count()));
+
+#ifdef CLOYSTERHPC_BENCHMARK_GLIB
+    const auto glib = measure([&] {
+        Glib::KeyFile keyfile;
+        keyfile.load_from_file(file.path.string());
+        std::size_t found = 0;
+        for (const auto& group : keyfile.get_groups()) {
+            if (!group.raw().starts_with("node.")) {
+                continue;
+            }
+            found += keyfile.get_string(group, "hostname").empty() ? 0 : 1;
+            (void)keyfile.get_string(group, "node_ip");
+        }
+        return found;
+    });
+    MESSAGE(fmt::format("Glib::KeyFile: {:.2f} ms", glib.count()));
+#endif
+}
+
+TEST_SUITE_END();
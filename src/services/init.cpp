@@ -1,4 +1,9 @@
 #include <cloysterhpc/models/cluster.h>
+#include <cloysterhpc/services/asyncrunner.h>
+#include <cloysterhpc/services/cachingrunner.h>
+#include <cloysterhpc/services/coprocessrunner.h>
+#include <cloysterhpc/services/tracer.h>
+#include <cloysterhpc/services/tracerunner.h>
 #include <cloysterhpc/services/init.h>
 #include <cloysterhpc/services/osservice.h>
 #include <cloysterhpc/patterns/singleton.h>
@@ -21,17 +26,55 @@ void initializeSingletonsOptions(std::unique_ptr<Options>&& opts)
         return cloyster::functions::makeUniqueDerived<MessageBus, DBusClient>(
             "org.freedesktop.systemd1", "/org/freedesktop/systemd1");
     });
+    if (!Singleton<Options>::get()->traceFile.empty()) {
+        cloyster::Singleton<Tracer>::init(
+            std::make_unique<Tracer>(Singleton<Options>::get()->traceFile));
+    }
     cloyster::Singleton<cloyster::services::IRunner>::init([&]() {
         using cloyster::services::IRunner;
         using cloyster::services::DryRunner;
         using cloyster::services::Runner;
+        using cloyster::services::AsyncRunner;
+        using cloyster::services::CachingRunner;
+        using cloyster::services::CoprocessRunner;
+        using cloyster::services::RecordingRunner;
+        using cloyster::services::ReplayRunner;
+        using cloyster::services::TracingRunner;
         auto opts = Singleton<Options>::get();
 
-        if (opts->dryRun) {
-            return cloyster::functions::makeUniqueDerived<IRunner, DryRunner>();
+        std::unique_ptr<IRunner> runner;
+        if (!opts->replayTrace.empty()) {
+            runner = std::make_unique<ReplayRunner>(
+                opts->replayTrace, opts->replayTimeScale);
+        } else if (opts->dryRun) {
+            runner = cloyster::functions::makeUniqueDerived<IRunner, DryRunner>();
+        } else {
+            if (opts->asyncRunner) {
+                runner = cloyster::functions::makeUniqueDerived<IRunner,
+                    AsyncRunner>();
+            } else if (opts->persistentShell) {
+                runner = cloyster::functions::makeUniqueDerived<IRunner,
+                    CoprocessRunner>();
+            } else {
+                runner
+                    = cloyster::functions::makeUniqueDerived<IRunner, Runner>();
+            }
+
+            if (!opts->recordTrace.empty()) {
+                runner = std::make_unique<RecordingRunner>(
+                    std::move(runner), opts->recordTrace);
+            }
+        }
+
+        if (!opts->traceFile.empty()) {
+            runner = std::make_unique<TracingRunner>(
+                std::move(runner), *Singleton<Tracer>::get());
         }
 
-        return cloyster::functions::makeUniqueDerived<IRunner, Runner>();
+        // Read-only queries (uname -r, rpm -q kernel, locale -a...) are
+        // asked many times per run, answer them from a cache
+        return std::unique_ptr<IRunner>(
+            std::make_unique<CachingRunner>(std::move(runner)));
     });
 }
 
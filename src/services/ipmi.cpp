@@ -0,0 +1,1214 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <fmt/format.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <cloysterhpc/services/ipmi.h>
+#include <cloysterhpc/services/log.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::ipmi {
+
+namespace {
+    namespace asio = boost::asio;
+    using asio::awaitable;
+    using asio::use_awaitable;
+    using asio::ip::udp;
+
+    using Bytes = std::vector<std::uint8_t>;
+    using View = std::span<const std::uint8_t>;
+
+    // Version 6, no RMCP ACK, class IPMI
+    constexpr std::array<std::uint8_t, 4> rmcpHeader { 0x06, 0x00, 0xFF, 0x07 };
+    constexpr std::uint8_t authTypeRMCPPlus = 0x06;
+    constexpr std::uint8_t encryptedBit = 0x80;
+    constexpr std::uint8_t authenticatedBit = 0x40;
+    // RMCP header, auth type, payload type, session id, sequence and length
+    constexpr std::size_t headerSize = 16;
+    // HMAC-SHA1-96
+    constexpr std::size_t authCodeSize = 12;
+
+    namespace payload {
+        constexpr std::uint8_t ipmi = 0x00;
+        constexpr std::uint8_t openSessionRequest = 0x10;
+        constexpr std::uint8_t openSessionResponse = 0x11;
+        constexpr std::uint8_t rakp1 = 0x12;
+        constexpr std::uint8_t rakp2 = 0x13;
+        constexpr std::uint8_t rakp3 = 0x14;
+        constexpr std::uint8_t rakp4 = 0x15;
+    }
+
+    namespace netfn {
+        constexpr std::uint8_t chassis = 0x00;
+        constexpr std::uint8_t app = 0x06;
+    }
+
+    namespace command {
+        constexpr std::uint8_t getChassisStatus = 0x01;
+        constexpr std::uint8_t chassisControl = 0x02;
+        constexpr std::uint8_t setBootOptions = 0x08;
+        constexpr std::uint8_t closeSession = 0x3C;
+    }
+
+    constexpr std::uint8_t bmcAddress = 0x20;
+    constexpr std::uint8_t consoleAddress = 0x81;
+    constexpr std::uint8_t administrator = 0x04;
+    // Administrator, the user is looked up by name only
+    constexpr std::uint8_t requestedRole = 0x14;
+    constexpr std::uint8_t bootFlagsParameter = 0x05;
+
+    void append(Bytes& out, View bytes)
+    {
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    }
+
+    void append(Bytes& out, std::string_view text)
+    {
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    void append32(Bytes& out, std::uint32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8) {
+            out.push_back(static_cast<std::uint8_t>(value >> shift));
+        }
+    }
+
+    std::uint32_t read32(View bytes, std::size_t offset)
+    {
+        std::uint32_t value = 0;
+        for (std::size_t i = 0; i < 4; ++i) {
+            value |= static_cast<std::uint32_t>(bytes[offset + i]) << (8 * i);
+        }
+        return value;
+    }
+
+    bool same(View lhs, View rhs)
+    {
+        return lhs.size() == rhs.size()
+            && CRYPTO_memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+    }
+
+    Bytes randomBytes(std::size_t size)
+    {
+        Bytes bytes(size);
+        if (RAND_bytes(bytes.data(), static_cast<int>(size)) != 1) {
+            throw std::runtime_error("Could not generate random bytes");
+        }
+        return bytes;
+    }
+
+    Bytes hmac(View key, View data)
+    {
+        std::array<unsigned char, EVP_MAX_MD_SIZE> digest {};
+        unsigned int size = 0;
+        if (HMAC(EVP_sha1(), key.data(), static_cast<int>(key.size()),
+                data.data(), data.size(), digest.data(), &size)
+            == nullptr) {
+            throw std::runtime_error("HMAC-SHA1 failed");
+        }
+        return { digest.begin(), digest.begin() + size };
+    }
+
+    // Kuid, the password padded to 20 bytes
+    Bytes userKey(std::string_view password)
+    {
+        Bytes key(20, 0);
+        std::copy_n(password.begin(), std::min(password.size(), key.size()),
+            key.begin());
+        return key;
+    }
+
+    struct Keys final {
+        // Session integrity key, then K1 signs packets and K2 encrypts them
+        Bytes sik;
+        Bytes k1;
+        Bytes k2;
+
+        static Keys derive(View kg, View rm, View rc, std::uint8_t role,
+            std::string_view username)
+        {
+            Bytes data;
+            append(data, rm);
+            append(data, rc);
+            data.push_back(role);
+            data.push_back(static_cast<std::uint8_t>(username.size()));
+            append(data, username);
+
+            Keys keys;
+            keys.sik = hmac(kg, data);
+            keys.k1 = hmac(keys.sik, Bytes(20, 0x01));
+            keys.k2 = hmac(keys.sik, Bytes(20, 0x02));
+            return keys;
+        }
+    };
+
+    using CipherContext
+        = std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+
+    // AES-CBC-128: a random IV, then the data padded with 1, 2, 3... and
+    // the pad length
+    Bytes encrypt(const Keys& keys, View plain)
+    {
+        Bytes data(plain.begin(), plain.end());
+        const auto pad = (16 - (data.size() + 1) % 16) % 16;
+        for (std::size_t i = 1; i <= pad; ++i) {
+            data.push_back(static_cast<std::uint8_t>(i));
+        }
+        data.push_back(static_cast<std::uint8_t>(pad));
+
+        auto out = randomBytes(16);
+        out.resize(16 + data.size());
+        const CipherContext ctx(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+        int size = 0;
+        if (!ctx
+            || EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr,
+                   keys.k2.data(), out.data())
+                != 1
+            || EVP_CIPHER_CTX_set_padding(ctx.get(), 0) != 1
+            || EVP_EncryptUpdate(ctx.get(), out.data() + 16, &size,
+                   data.data(), static_cast<int>(data.size()))
+                != 1) {
+            throw std::runtime_error("AES-CBC-128 encryption failed");
+        }
+        return out;
+    }
+
+    std::optional<Bytes> decrypt(const Keys& keys, View data)
+    {
+        if (data.size() < 32 || data.size() % 16 != 0) {
+            return std::nullopt;
+        }
+
+        Bytes plain(data.size() - 16);
+        const CipherContext ctx(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+        int size = 0;
+        if (!ctx
+            || EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr,
+                   keys.k2.data(), data.data())
+                != 1
+            || EVP_CIPHER_CTX_set_padding(ctx.get(), 0) != 1
+            || EVP_DecryptUpdate(ctx.get(), plain.data(), &size,
+                   data.data() + 16, static_cast<int>(plain.size()))
+                != 1) {
+            return std::nullopt;
+        }
+
+        const auto pad = plain.back();
+        if (pad + 1U > plain.size()) {
+            return std::nullopt;
+        }
+        plain.resize(plain.size() - pad - 1);
+        return plain;
+    }
+
+    Bytes packet(std::uint8_t type, std::uint32_t sessionId,
+        std::uint32_t sequence, View payload)
+    {
+        Bytes out(rmcpHeader.begin(), rmcpHeader.end());
+        out.push_back(authTypeRMCPPlus);
+        out.push_back(type);
+        append32(out, sessionId);
+        append32(out, sequence);
+        out.push_back(static_cast<std::uint8_t>(payload.size()));
+        out.push_back(static_cast<std::uint8_t>(payload.size() >> 8));
+        append(out, payload);
+        return out;
+    }
+
+    // A packet of an established session, encrypted and signed
+    Bytes sealedPacket(const Keys& keys, std::uint8_t type,
+        std::uint32_t sessionId, std::uint32_t sequence, View payload)
+    {
+        auto out = packet(type | encryptedBit | authenticatedBit, sessionId,
+            sequence, encrypt(keys, payload));
+
+        // The signed part, from the auth type to the next header, is padded
+        // to a multiple of 4
+        std::uint8_t pad = 0;
+        while ((out.size() - rmcpHeader.size() + 2) % 4 != 0) {
+            out.push_back(0xFF);
+            ++pad;
+        }
+        out.push_back(pad);
+        out.push_back(0x07);
+        const auto code = hmac(keys.k1, View(out).subspan(rmcpHeader.size()));
+        out.insert(out.end(), code.begin(), code.begin() + authCodeSize);
+        return out;
+    }
+
+    struct Packet final {
+        std::uint8_t type = 0;
+        std::uint32_t sessionId = 0;
+        std::uint32_t sequence = 0;
+        Bytes payload;
+    };
+
+    // The session id of an RMCP+ packet, zero while the session is set up
+    std::optional<std::uint32_t> sessionOf(View datagram)
+    {
+        if (datagram.size() < headerSize || datagram[0] != rmcpHeader[0]
+            || datagram[3] != rmcpHeader[3]
+            || datagram[4] != authTypeRMCPPlus) {
+            return std::nullopt;
+        }
+        return read32(datagram, 6);
+    }
+
+    /* Reads an RMCP+ packet. Signed packets are checked and decrypted with
+     * @p keys, and rejected when there are none.
+     */
+    std::optional<Packet> parse(View datagram, const Keys* keys)
+    {
+        if (!sessionOf(datagram)) {
+            return std::nullopt;
+        }
+
+        const auto flags = datagram[5];
+        const std::size_t length = datagram[14] | (datagram[15] << 8);
+        if (headerSize + length > datagram.size()) {
+            return std::nullopt;
+        }
+
+        Packet packet { .type = static_cast<std::uint8_t>(flags & 0x3F),
+            .sessionId = read32(datagram, 6),
+            .sequence = read32(datagram, 10),
+            .payload = {} };
+        const auto body = datagram.subspan(headerSize, length);
+        if ((flags & authenticatedBit) != 0) {
+            if (keys == nullptr
+                || datagram.size() < headerSize + length + 2 + authCodeSize) {
+                return std::nullopt;
+            }
+            const auto code = hmac(keys->k1,
+                datagram.first(datagram.size() - authCodeSize)
+                    .subspan(rmcpHeader.size()));
+            if (!same(View(code).first(authCodeSize),
+                    datagram.last(authCodeSize))) {
+                return std::nullopt;
+            }
+        }
+
+        if ((flags & encryptedBit) != 0) {
+            if (keys == nullptr) {
+                return std::nullopt;
+            }
+            auto plain = decrypt(*keys, body);
+            if (!plain) {
+                return std::nullopt;
+            }
+            packet.payload = std::move(*plain);
+        } else {
+            packet.payload.assign(body.begin(), body.end());
+        }
+        return packet;
+    }
+
+    // An IPMI message, the data of a response starts with its completion code
+    struct Message final {
+        std::uint8_t netFn = 0;
+        std::uint8_t sequence = 0;
+        std::uint8_t command = 0;
+        Bytes data;
+    };
+
+    std::uint8_t checksum(View bytes)
+    {
+        std::uint8_t sum = 0;
+        for (const auto byte : bytes) {
+            sum += byte;
+        }
+        return static_cast<std::uint8_t>(0x100 - sum);
+    }
+
+    Bytes encode(std::uint8_t to, std::uint8_t from, const Message& message)
+    {
+        Bytes out { to, static_cast<std::uint8_t>(message.netFn << 2) };
+        out.push_back(checksum(out));
+        const auto start = out.size();
+        out.push_back(from);
+        out.push_back(static_cast<std::uint8_t>(message.sequence << 2));
+        out.push_back(message.command);
+        append(out, message.data);
+        out.push_back(checksum(View(out).subspan(start)));
+        return out;
+    }
+
+    std::optional<Message> decode(View bytes)
+    {
+        if (bytes.size() < 7 || checksum(bytes.first(3)) != 0
+            || checksum(bytes.subspan(3)) != 0) {
+            return std::nullopt;
+        }
+        return Message { .netFn = static_cast<std::uint8_t>(bytes[1] >> 2),
+            .sequence = static_cast<std::uint8_t>(bytes[4] >> 2),
+            .command = bytes[5],
+            .data = { bytes.begin() + 6, bytes.end() - 1 } };
+    }
+
+    class Failure final : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    struct Operation final {
+        enum class Kind : std::uint8_t {
+            PowerState,
+            Control,
+            BootDevice,
+            Netboot
+        };
+
+        Kind kind = Kind::PowerState;
+        ChassisControl control = ChassisControl::PowerOn;
+        BootDevice device = BootDevice::Network;
+        bool persistent = false;
+    };
+
+    // The datagrams of one BMC, queued by the receive loop
+    struct Conversation final {
+        explicit Conversation(const asio::any_io_executor& executor)
+            : wakeup(executor)
+        {
+        }
+
+        udp::endpoint remote;
+        asio::steady_timer wakeup;
+        std::deque<Bytes> inbox;
+    };
+
+    struct Session final {
+        Conversation& conversation;
+        Keys keys;
+        std::uint32_t bmcId = 0;
+        std::uint32_t sequence = 0;
+        std::uint8_t requestSequence = 0;
+    };
+
+    /* Runs an operation on a batch of BMCs. Every BMC has a coroutine, a
+     * receive loop per socket hands the datagrams to them by source address.
+     */
+    class Batch final {
+    public:
+        Batch(asio::io_context& ctx, const ClientOptions& options,
+            std::span<const Endpoint> bmcs, const Operation& operation)
+            : replies(bmcs.size())
+            , m_ctx(ctx)
+            , m_options(options)
+            , m_bmcs(bmcs)
+            , m_operation(operation)
+            , m_v4(ctx)
+            , m_v6(ctx)
+        {
+        }
+
+        std::vector<Reply> replies;
+
+        void start(std::size_t workers)
+        {
+            m_workers = workers;
+            for (std::size_t i = 0; i < workers; ++i) {
+                asio::co_spawn(m_ctx, worker(),
+                    [](const std::exception_ptr& eptr) {
+                        if (eptr) {
+                            std::rethrow_exception(eptr);
+                        }
+                    });
+            }
+        }
+
+    private:
+        asio::io_context& m_ctx;
+        const ClientOptions& m_options;
+        std::span<const Endpoint> m_bmcs;
+        const Operation& m_operation;
+        udp::socket m_v4;
+        udp::socket m_v6;
+        std::map<udp::endpoint, Conversation*> m_conversations;
+        std::size_t m_next = 0;
+        std::size_t m_workers = 0;
+
+        udp::socket& socket(const udp::endpoint& remote)
+        {
+            auto& socket = remote.address().is_v4() ? m_v4 : m_v6;
+            if (!socket.is_open()) {
+                socket.open(remote.protocol());
+                // Answers of every BMC of the batch land in this socket
+                boost::system::error_code ec;
+                socket.set_option(
+                    udp::socket::receive_buffer_size(4 * 1024 * 1024), ec);
+                asio::co_spawn(m_ctx, receive(socket), asio::detached);
+            }
+            return socket;
+        }
+
+        awaitable<void> receive(udp::socket& socket)
+        {
+            std::array<std::uint8_t, 1024> buffer {};
+            udp::endpoint sender;
+            while (socket.is_open()) {
+                boost::system::error_code ec;
+                const auto size = co_await socket.async_receive_from(
+                    asio::buffer(buffer), sender,
+                    asio::redirect_error(use_awaitable, ec));
+                if (ec == asio::error::operation_aborted) {
+                    co_return;
+                }
+                // ICMP errors of unreachable BMCs end up here too, they are
+                // left to time out
+                if (ec) {
+                    continue;
+                }
+
+                if (const auto conversation = m_conversations.find(sender);
+                    conversation != m_conversations.end()) {
+                    conversation->second->inbox.emplace_back(
+                        buffer.begin(), buffer.begin() + size);
+                    conversation->second->wakeup.cancel();
+                }
+            }
+        }
+
+        awaitable<void> worker()
+        {
+            while (m_next < m_bmcs.size()) {
+                const auto index = m_next++;
+                try {
+                    replies[index] = co_await talk(m_bmcs[index]);
+                } catch (const std::exception& ex) {
+                    replies[index].error = ex.what();
+                }
+            }
+
+            // The receive loops end with the sockets
+            if (--m_workers == 0) {
+                boost::system::error_code ec;
+                m_v4.close(ec);
+                m_v6.close(ec);
+            }
+        }
+
+        awaitable<udp::endpoint> resolve(const Endpoint& bmc)
+        {
+            boost::system::error_code ec;
+            const auto address = asio::ip::make_address(bmc.host, ec);
+            if (!ec) {
+                co_return udp::endpoint(address, bmc.port);
+            }
+
+            udp::resolver resolver(m_ctx);
+            const auto results = co_await resolver.async_resolve(bmc.host,
+                std::to_string(bmc.port),
+                asio::redirect_error(use_awaitable, ec));
+            if (ec || results.empty()) {
+                throw Failure(fmt::format("Cannot resolve {}", bmc.host));
+            }
+            co_return results.begin()->endpoint();
+        }
+
+        /* Sends @p datagram until an answer is accepted, @p attempts times
+         * at most, each waiting for the timeout.
+         */
+        awaitable<Packet> roundTrip(Conversation& conversation,
+            const Bytes& datagram, const Keys* keys,
+            std::function<bool(const Packet&)> accept, std::string_view step,
+            std::size_t attempts)
+        {
+            auto& socket = this->socket(conversation.remote);
+            for (std::size_t attempt = 0; attempt < attempts; ++attempt) {
+                co_await socket.async_send_to(
+                    asio::buffer(datagram), conversation.remote, use_awaitable);
+
+                const auto deadline
+                    = std::chrono::steady_clock::now() + m_options.timeout;
+                while (true) {
+                    while (!conversation.inbox.empty()) {
+                        const auto raw = std::move(conversation.inbox.front());
+                        conversation.inbox.pop_front();
+                        if (auto packet = parse(raw, keys);
+                            packet && accept(*packet)) {
+                            co_return std::move(*packet);
+                        }
+                    }
+                    if (std::chrono::steady_clock::now() >= deadline) {
+                        break;
+                    }
+                    conversation.wakeup.expires_at(deadline);
+                    boost::system::error_code ec;
+                    co_await conversation.wakeup.async_wait(
+                        asio::redirect_error(use_awaitable, ec));
+                }
+            }
+            throw Failure(fmt::format(
+                "No answer to {} after {} attempts", step, attempts));
+        }
+
+        // Pre-session exchanges, matched by payload type and message tag
+        awaitable<Bytes> handshake(Conversation& conversation,
+            std::uint8_t type, std::uint8_t answer, const Bytes& payload,
+            std::string_view step)
+        {
+            const auto tag = payload.front();
+            auto reply = co_await roundTrip(conversation,
+                packet(type, 0, 0, payload), nullptr,
+                [&](const Packet& packet) {
+                    return packet.type == answer && packet.payload.size() >= 2
+                        && packet.payload[0] == tag;
+                },
+                step, m_options.retries + 1);
+
+            if (const auto status = reply.payload[1]; status != 0) {
+                throw Failure(fmt::format("The BMC refused {}, {}", step,
+                    status == 0x0D ? "unknown user"
+                                   : fmt::format("status {:#04x}", status)));
+            }
+            co_return std::move(reply.payload);
+        }
+
+        // RMCP+ session with RAKP-HMAC-SHA1, HMAC-SHA1-96 and AES-CBC-128
+        awaitable<Session> open(
+            Conversation& conversation, const Endpoint& bmc)
+        {
+            std::uint32_t consoleId = 0;
+            while (consoleId == 0) {
+                consoleId = read32(randomBytes(4), 0);
+            }
+
+            Bytes request { 0x00, administrator, 0x00, 0x00 };
+            append32(request, consoleId);
+            // Authentication, integrity and confidentiality algorithms
+            for (const std::uint8_t type : { 0x00, 0x01, 0x02 }) {
+                append(request, Bytes { type, 0x00, 0x00, 0x08, 0x01, 0x00, 0x00, 0x00 });
+            }
+            const auto opened = co_await handshake(conversation,
+                payload::openSessionRequest, payload::openSessionResponse,
+                request, "Open Session");
+            if (opened.size() < 36 || read32(opened, 4) != consoleId) {
+                throw Failure("Malformed Open Session response");
+            }
+            if (opened[16] != 0x01 || opened[24] != 0x01 || opened[32] != 0x01) {
+                throw Failure("The BMC does not support cipher suite 3");
+            }
+            const auto bmcId = read32(opened, 8);
+
+            const auto username = std::string_view(bmc.username).substr(0, 16);
+            const auto rm = randomBytes(16);
+            Bytes rakp1 { 0x01, 0x00, 0x00, 0x00 };
+            append32(rakp1, bmcId);
+            append(rakp1, rm);
+            append(rakp1, Bytes { requestedRole, 0x00, 0x00,
+                              static_cast<std::uint8_t>(username.size()) });
+            append(rakp1, username);
+            const auto rakp2 = co_await handshake(conversation,
+                payload::rakp1, payload::rakp2, rakp1, "RAKP 1");
+            if (rakp2.size() < 60 || read32(rakp2, 4) != consoleId) {
+                throw Failure("Malformed RAKP 2 message");
+            }
+            const auto rc = View(rakp2).subspan(8, 16);
+            const auto guid = View(rakp2).subspan(24, 16);
+
+            const auto kuid = userKey(bmc.password);
+            Bytes exchanged;
+            append32(exchanged, consoleId);
+            append32(exchanged, bmcId);
+            append(exchanged, rm);
+            append(exchanged, rc);
+            append(exchanged, guid);
+            exchanged.push_back(requestedRole);
+            exchanged.push_back(static_cast<std::uint8_t>(username.size()));
+            append(exchanged, username);
+            if (!same(hmac(kuid, exchanged), View(rakp2).subspan(40, 20))) {
+                throw Failure("Wrong BMC password");
+            }
+
+            Bytes proof(rc.begin(), rc.end());
+            append32(proof, consoleId);
+            proof.push_back(requestedRole);
+            proof.push_back(static_cast<std::uint8_t>(username.size()));
+            append(proof, username);
+            Bytes rakp3 { 0x02, 0x00, 0x00, 0x00 };
+            append32(rakp3, bmcId);
+            append(rakp3, hmac(kuid, proof));
+            const auto rakp4 = co_await handshake(conversation,
+                payload::rakp3, payload::rakp4, rakp3, "RAKP 3");
+
+            auto keys = Keys::derive(kuid, rm, rc, requestedRole, username);
+            Bytes check(rm.begin(), rm.end());
+            append32(check, bmcId);
+            append(check, guid);
+            if (rakp4.size() < 8 + authCodeSize
+                || !same(View(hmac(keys.sik, check)).first(authCodeSize),
+                    View(rakp4).subspan(8, authCodeSize))) {
+                throw Failure("The BMC failed the session integrity check");
+            }
+
+            co_return Session { .conversation = conversation,
+                .keys = std::move(keys),
+                .bmcId = bmcId };
+        }
+
+        // The data of the response, after the completion code
+        awaitable<Bytes> request(Session& session, std::uint8_t netFn,
+            std::uint8_t cmd, const Bytes& data, std::string_view step,
+            std::size_t attempts)
+        {
+            session.requestSequence = (session.requestSequence + 1) & 0x3F;
+            const auto sequence = session.requestSequence;
+            const auto datagram = sealedPacket(session.keys, payload::ipmi,
+                session.bmcId, ++session.sequence,
+                encode(bmcAddress, consoleAddress,
+                    { .netFn = netFn,
+                        .sequence = sequence,
+                        .command = cmd,
+                        .data = data }));
+
+            const auto reply = co_await roundTrip(session.conversation,
+                datagram, &session.keys,
+                [&](const Packet& packet) {
+                    const auto message = decode(packet.payload);
+                    return packet.type == payload::ipmi && message
+                        && message->netFn == (netFn | 1)
+                        && message->sequence == sequence
+                        && message->command == cmd;
+                },
+                step, attempts);
+
+            auto message = decode(reply.payload).value();
+            if (message.data.empty()) {
+                throw Failure(fmt::format("Empty answer to {}", step));
+            }
+            if (message.data.front() != 0) {
+                throw Failure(fmt::format("{} failed with completion code {:#04x}",
+                    step, message.data.front()));
+            }
+            message.data.erase(message.data.begin());
+            co_return std::move(message.data);
+        }
+
+        awaitable<PowerState> power(Session& session)
+        {
+            const auto status = co_await request(session, netfn::chassis,
+                command::getChassisStatus, Bytes(), "Get Chassis Status",
+                m_options.retries + 1);
+            if (status.empty()) {
+                throw Failure("Malformed Get Chassis Status response");
+            }
+            co_return (status[0] & 0x01) != 0 ? PowerState::On
+                                              : PowerState::Off;
+        }
+
+        awaitable<void> control(Session& session, ChassisControl control)
+        {
+            const Bytes data { static_cast<std::uint8_t>(control) };
+            co_await request(session, netfn::chassis, command::chassisControl,
+                data, "Chassis Control", m_options.retries + 1);
+        }
+
+        awaitable<void> bootDevice(
+            Session& session, BootDevice device, bool persistent)
+        {
+            const Bytes data { bootFlagsParameter,
+                static_cast<std::uint8_t>(0x80 | (persistent ? 0x40 : 0x00)),
+                static_cast<std::uint8_t>(device), 0x00, 0x00, 0x00 };
+            co_await request(session, netfn::chassis, command::setBootOptions,
+                data, "Set System Boot Options", m_options.retries + 1);
+        }
+
+        awaitable<Reply> talk(const Endpoint& bmc)
+        {
+            Conversation conversation(m_ctx.get_executor());
+            conversation.remote = co_await resolve(bmc);
+            if (!m_conversations.emplace(conversation.remote, &conversation)
+                     .second) {
+                throw Failure(fmt::format(
+                    "{} is the BMC of another node", bmc.host));
+            }
+            // Erased however the conversation ends
+            const std::unique_ptr<Conversation, std::function<void(Conversation*)>>
+                registration(&conversation, [this](Conversation* done) {
+                    m_conversations.erase(done->remote);
+                });
+
+            auto session = co_await open(conversation, bmc);
+
+            Reply reply;
+            switch (m_operation.kind) {
+                case Operation::Kind::PowerState:
+                    reply.power = co_await power(session);
+                    break;
+                case Operation::Kind::Control:
+                    co_await control(session, m_operation.control);
+                    break;
+                case Operation::Kind::BootDevice:
+                    co_await bootDevice(
+                        session, m_operation.device, m_operation.persistent);
+                    break;
+                case Operation::Kind::Netboot:
+                    co_await bootDevice(session, BootDevice::Network, false);
+                    reply.power = co_await power(session);
+                    co_await control(session,
+                        reply.power == PowerState::On
+                            ? ChassisControl::HardReset
+                            : ChassisControl::PowerOn);
+                    break;
+            }
+
+            // BMCs only have a few session slots, a lost answer is not
+            // worth waiting for
+            try {
+                Bytes id;
+                append32(id, session.bmcId);
+                co_await request(session, netfn::app, command::closeSession, id,
+                    "Close Session", 1);
+            } catch (const Failure& ex) {
+                LOG_DEBUG("{}: {}", bmc.host, ex.what())
+            }
+            co_return reply;
+        }
+    };
+
+    std::vector<Reply> run(std::span<const Endpoint> bmcs,
+        const Operation& operation, const ClientOptions& options)
+    {
+        if (bmcs.empty()) {
+            return {};
+        }
+
+        // The batch must be destroyed before the io_context, it owns
+        // sockets bound to it
+        asio::io_context ctx;
+        Batch batch(ctx, options, bmcs, operation);
+        batch.start(std::clamp<std::size_t>(options.concurrency, 1, bmcs.size()));
+        ctx.run();
+        return std::move(batch.replies);
+    }
+
+} // namespace
+
+Client::Client(ClientOptions options)
+    : m_options(options)
+{
+}
+
+std::vector<Reply> Client::powerState(std::span<const Endpoint> bmcs)
+{
+    return run(bmcs, { .kind = Operation::Kind::PowerState }, m_options);
+}
+
+std::vector<Reply> Client::chassisControl(
+    std::span<const Endpoint> bmcs, ChassisControl control)
+{
+    return run(bmcs, { .kind = Operation::Kind::Control, .control = control },
+        m_options);
+}
+
+std::vector<Reply> Client::setBootDevice(
+    std::span<const Endpoint> bmcs, BootDevice device, bool persistent)
+{
+    return run(bmcs,
+        { .kind = Operation::Kind::BootDevice,
+            .device = device,
+            .persistent = persistent },
+        m_options);
+}
+
+std::vector<Reply> Client::netboot(std::span<const Endpoint> bmcs)
+{
+    return run(bmcs, { .kind = Operation::Kind::Netboot }, m_options);
+}
+
+Endpoint endpoint(const BMC& bmc)
+{
+    return { .host = bmc.getAddress(),
+        .username = bmc.getUsername(),
+        .password = bmc.getPassword() };
+}
+
+} // namespace cloyster::services::ipmi
+
+TEST_SUITE_BEGIN("cloyster::services::ipmi");
+
+namespace {
+
+using namespace cloyster::services::ipmi;
+
+/**
+ * @brief BMCs on loopback UDP ports for the tests
+ *
+ * Each BMC answers the RMCP+ handshake and the chassis commands the client
+ * sends, with a single user. A hard reset or power cycle of a chassis that
+ * is off fails, like on most real BMCs.
+ */
+class Simulator final {
+public:
+    struct Bmc final {
+        explicit Bmc(asio::io_context& ctx)
+            : socket(ctx, { asio::ip::make_address("127.0.0.1"), 0 })
+        {
+        }
+
+        struct Session final {
+            std::uint32_t consoleId = 0;
+            Bytes rm;
+            Bytes rc;
+            std::uint8_t role = 0;
+            std::string username;
+            std::optional<Keys> keys;
+            std::uint32_t sequence = 0;
+        };
+
+        udp::socket socket;
+        std::map<std::uint32_t, Session> sessions;
+        std::uint32_t nextId = 0x1000;
+
+        std::atomic<bool> on = false;
+        std::atomic<std::uint8_t> bootDevice = 0;
+        std::atomic<std::size_t> openSessions = 0;
+        // Datagrams to ignore, to make the client send them again
+        std::atomic<std::size_t> drop = 0;
+    };
+
+    explicit Simulator(std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i) {
+            m_bmcs.push_back(std::make_unique<Bmc>(m_ctx));
+            asio::co_spawn(m_ctx, serve(*m_bmcs.back()), asio::detached);
+        }
+        m_thread = std::thread([this]() { m_ctx.run(); });
+    }
+
+    ~Simulator()
+    {
+        m_ctx.stop();
+        m_thread.join();
+    }
+
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+    Simulator(Simulator&&) = delete;
+    Simulator& operator=(Simulator&&) = delete;
+
+    Bmc& bmc(std::size_t index) { return *m_bmcs[index]; }
+
+    [[nodiscard]] std::vector<Endpoint> endpoints() const
+    {
+        std::vector<Endpoint> endpoints;
+        for (const auto& bmc : m_bmcs) {
+            endpoints.push_back({ .host = "127.0.0.1",
+                .port = bmc->socket.local_endpoint().port(),
+                .username = username,
+                .password = password });
+        }
+        return endpoints;
+    }
+
+    static constexpr auto username = "admin";
+    static constexpr auto password = "secret";
+    static constexpr std::array<std::uint8_t, 16> guid { 0xC1, 0x05, 0x7E,
+        0x12 };
+
+private:
+    asio::io_context m_ctx;
+    std::vector<std::unique_ptr<Bmc>> m_bmcs;
+    std::thread m_thread;
+
+    awaitable<void> serve(Bmc& bmc)
+    {
+        std::array<std::uint8_t, 1024> buffer {};
+        udp::endpoint peer;
+        while (true) {
+            const auto size = co_await bmc.socket.async_receive_from(
+                asio::buffer(buffer), peer, use_awaitable);
+            if (bmc.drop > 0) {
+                --bmc.drop;
+                continue;
+            }
+            const auto reply = answer(bmc, View(buffer.data(), size));
+            bmc.openSessions = bmc.sessions.size();
+            if (!reply.empty()) {
+                co_await bmc.socket.async_send_to(
+                    asio::buffer(reply), peer, use_awaitable);
+            }
+        }
+    }
+
+    static Bytes answer(Bmc& bmc, View datagram)
+    {
+        const auto id = sessionOf(datagram);
+        if (!id) {
+            return {};
+        }
+        if (*id != 0) {
+            const auto session = bmc.sessions.find(*id);
+            if (session == bmc.sessions.end() || !session->second.keys) {
+                return {};
+            }
+            const auto received = parse(datagram, &*session->second.keys);
+            if (!received || received->type != payload::ipmi) {
+                return {};
+            }
+            return execute(bmc, session, received->payload);
+        }
+
+        const auto received = parse(datagram, nullptr);
+        if (!received || received->payload.size() < 8) {
+            return {};
+        }
+        const auto& request = received->payload;
+        const auto tag = request[0];
+        Bytes reply { tag, 0x00, 0x00, 0x00 };
+        switch (received->type) {
+            case payload::openSessionRequest: {
+                const auto sessionId = bmc.nextId++;
+                bmc.sessions[sessionId].consoleId = read32(request, 4);
+                reply[2] = administrator;
+                append32(reply, read32(request, 4));
+                append32(reply, sessionId);
+                append(reply, View(request).subspan(8));
+                return packet(payload::openSessionResponse, 0, 0, reply);
+            }
+
+            case payload::rakp1: {
+                auto found = bmc.sessions.find(read32(request, 4));
+                if (found == bmc.sessions.end() || request.size() < 28) {
+                    return {};
+                }
+                auto& session = found->second;
+                session.rm.assign(request.begin() + 8, request.begin() + 24);
+                session.role = request[24];
+                session.username.assign(
+                    request.begin() + 28, request.begin() + 28 + request[27]);
+                append32(reply, session.consoleId);
+                if (session.username != username) {
+                    reply[1] = 0x0D;
+                    return packet(payload::rakp2, 0, 0, reply);
+                }
+
+                session.rc = randomBytes(16);
+                Bytes exchanged;
+                append32(exchanged, session.consoleId);
+                append32(exchanged, found->first);
+                append(exchanged, session.rm);
+                append(exchanged, session.rc);
+                append(exchanged, guid);
+                exchanged.push_back(session.role);
+                exchanged.push_back(
+                    static_cast<std::uint8_t>(session.username.size()));
+                append(exchanged, session.username);
+
+                append(reply, session.rc);
+                append(reply, guid);
+                append(reply, hmac(userKey(password), exchanged));
+                return packet(payload::rakp2, 0, 0, reply);
+            }
+
+            case payload::rakp3: {
+                auto found = bmc.sessions.find(read32(request, 4));
+                if (found == bmc.sessions.end() || request.size() < 28) {
+                    return {};
+                }
+                auto& session = found->second;
+                Bytes proof = session.rc;
+                append32(proof, session.consoleId);
+                proof.push_back(session.role);
+                proof.push_back(
+                    static_cast<std::uint8_t>(session.username.size()));
+                append(proof, session.username);
+                append32(reply, session.consoleId);
+                if (!same(hmac(userKey(password), proof),
+                        View(request).subspan(8, 20))) {
+                    reply[1] = 0x0F;
+                    return packet(payload::rakp4, 0, 0, reply);
+                }
+
+                session.keys = Keys::derive(userKey(password), session.rm,
+                    session.rc, session.role, session.username);
+                Bytes check = session.rm;
+                append32(check, found->first);
+                append(check, guid);
+                const auto icv = hmac(session.keys->sik, check);
+                reply.insert(reply.end(), icv.begin(),
+                    icv.begin() + authCodeSize);
+                return packet(payload::rakp4, 0, 0, reply);
+            }
+
+            default:
+                return {};
+        }
+    }
+
+    static Bytes execute(Bmc& bmc,
+        std::map<std::uint32_t, Bmc::Session>::iterator session,
+        View payload)
+    {
+        const auto message = decode(payload);
+        if (!message) {
+            return {};
+        }
+
+        Bytes data { 0x00 };
+        auto close = false;
+        if (message->netFn == netfn::chassis
+            && message->command == command::getChassisStatus) {
+            append(data, Bytes { bmc.on ? std::uint8_t { 0x01 } : std::uint8_t { 0x00 }, 0x00, 0x00 });
+        } else if (message->netFn == netfn::chassis
+            && message->command == command::chassisControl
+            && !message->data.empty()) {
+            switch (static_cast<ChassisControl>(message->data[0])) {
+                case ChassisControl::PowerOn:
+                    bmc.on = true;
+                    break;
+                case ChassisControl::PowerOff:
+                case ChassisControl::SoftShutdown:
+                    bmc.on = false;
+                    break;
+                case ChassisControl::PowerCycle:
+                case ChassisControl::HardReset:
+                    // Not supported in the present state
+                    data[0] = bmc.on ? 0x00 : 0xD5;
+                    break;
+            }
+        } else if (message->netFn == netfn::chassis
+            && message->command == command::setBootOptions
+            && message->data.size() >= 3
+            && message->data[0] == bootFlagsParameter) {
+            bmc.bootDevice = message->data[2];
+        } else if (message->netFn == netfn::app
+            && message->command == command::closeSession) {
+            close = true;
+        } else {
+            // Invalid command
+            data[0] = 0xC1;
+        }
+
+        auto reply = sealedPacket(*session->second.keys, payload::ipmi,
+            session->second.consoleId, ++session->second.sequence,
+            encode(consoleAddress, bmcAddress,
+                { .netFn = static_cast<std::uint8_t>(message->netFn | 1),
+                    .sequence = message->sequence,
+                    .command = message->command,
+                    .data = data }));
+        if (close) {
+            bmc.sessions.erase(session);
+        }
+        return reply;
+    }
+};
+
+} // namespace
+
+TEST_CASE("RMCP+ packets")
+{
+    const auto keys = Keys::derive(userKey("secret"), randomBytes(16),
+        randomBytes(16), requestedRole, "admin");
+    const Bytes payload { 1, 2, 3, 4, 5 };
+
+    const auto sealed
+        = sealedPacket(keys, payload::ipmi, 0x1234, 7, payload);
+    // Everything after the RMCP header but the auth code is signed in
+    // blocks of 4 bytes
+    CHECK((sealed.size() - 4 - authCodeSize) % 4 == 0);
+    const auto opened = parse(sealed, &keys);
+    REQUIRE(opened.has_value());
+    CHECK(opened->type == payload::ipmi);
+    CHECK(opened->sessionId == 0x1234);
+    CHECK(opened->sequence == 7);
+    CHECK(opened->payload == payload);
+
+    // Tampered or unsigned
+    auto tampered = sealed;
+    tampered[headerSize + 20] ^= 0x01;
+    CHECK(!parse(tampered, &keys).has_value());
+    CHECK(!parse(sealed, nullptr).has_value());
+
+    const Message message { .netFn = netfn::chassis,
+        .sequence = 5,
+        .command = command::chassisControl,
+        .data = { 0x03 } };
+    const auto encoded = encode(bmcAddress, consoleAddress, message);
+    const auto decoded = decode(encoded);
+    REQUIRE(decoded.has_value());
+    CHECK(decoded->sequence == 5);
+    CHECK(decoded->command == command::chassisControl);
+    CHECK(decoded->data == Bytes { 0x03 });
+    auto corrupted = encoded;
+    corrupted.back() ^= 0xFF;
+    CHECK(!decode(corrupted).has_value());
+}
+
+TEST_CASE("Client against simulated BMCs")
+{
+    Simulator simulator(200);
+    const auto endpoints = simulator.endpoints();
+    Client client({ .timeout = 500ms });
+
+    const auto started = std::chrono::steady_clock::now();
+    const auto states = client.powerState(endpoints);
+    CHECK(std::chrono::steady_clock::now() - started < 1s);
+    REQUIRE(states.size() == endpoints.size());
+    CHECK(std::ranges::all_of(states, [](const Reply& reply) {
+        return reply.ok() && reply.power == PowerState::Off;
+    }));
+
+    // The node that is on is reset, the others are powered on
+    simulator.bmc(1).on = true;
+    const auto netboot = client.netboot(endpoints);
+    CHECK(std::ranges::all_of(netboot, &Reply::ok));
+    CHECK(netboot[0].power == PowerState::Off);
+    CHECK(netboot[1].power == PowerState::On);
+    for (std::size_t i = 0; i < endpoints.size(); ++i) {
+        CHECK(simulator.bmc(i).on);
+        CHECK(simulator.bmc(i).bootDevice
+            == static_cast<std::uint8_t>(BootDevice::Network));
+    }
+
+    // Every session was closed
+    CHECK(simulator.bmc(0).openSessions == 0);
+
+    const auto off = client.chassisControl(
+        std::span(endpoints).first(2), ChassisControl::PowerOff);
+    CHECK(std::ranges::all_of(off, &Reply::ok));
+    CHECK(!simulator.bmc(0).on);
+    const auto reset = client.chassisControl(
+        std::span(endpoints).first(1), ChassisControl::HardReset);
+    CHECK(reset[0].error.find("0xd5") != std::string::npos);
+}
+
+TEST_CASE("Client failures")
+{
+    Simulator simulator(3);
+    auto endpoints = simulator.endpoints();
+    endpoints[0].password = "wrong";
+    endpoints[1].username = "nobody";
+    // Lost datagrams are sent again
+    simulator.bmc(2).drop = 2;
+
+    Client client({ .timeout = 100ms, .retries = 2 });
+    const auto replies = client.powerState(endpoints);
+    CHECK(replies[0].error == "Wrong BMC password");
+    CHECK(replies[1].error.find("unknown user") != std::string::npos);
+    CHECK(replies[2].ok());
+
+    simulator.bmc(2).drop = 100;
+    const auto lost = client.powerState(std::span(endpoints).last(1));
+    CHECK(lost[0].error == "No answer to Open Session after 3 attempts");
+}
+
+TEST_SUITE_END();
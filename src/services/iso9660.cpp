@@ -0,0 +1,1152 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/services/cancellation.h>
+#include <cloysterhpc/services/copy.h>
+#include <cloysterhpc/services/descriptor.h>
+#include <cloysterhpc/services/iso9660.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/runner.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::iso9660 {
+
+using namespace std::string_view_literals;
+
+namespace {
+    // The first 16 sectors are the system area, descriptors follow
+    constexpr std::uint64_t firstDescriptor = 16;
+    constexpr std::uint64_t maxDescriptors = 64;
+    constexpr std::string_view standardId = "CD001";
+
+    enum DescriptorType : std::uint8_t {
+        Primary = 1,
+        Supplementary = 2,
+        Terminator = 255,
+    };
+
+    std::uint8_t byteAt(std::span<const std::byte> data, std::size_t offset)
+    {
+        return static_cast<std::uint8_t>(data[offset]);
+    }
+
+    // Both-endian fields, the little endian half comes first
+    std::uint32_t le32(std::span<const std::byte> data, std::size_t offset)
+    {
+        return static_cast<std::uint32_t>(byteAt(data, offset))
+            | static_cast<std::uint32_t>(byteAt(data, offset + 1)) << 8
+            | static_cast<std::uint32_t>(byteAt(data, offset + 2)) << 16
+            | static_cast<std::uint32_t>(byteAt(data, offset + 3)) << 24;
+    }
+
+    std::string_view chars(
+        std::span<const std::byte> data, std::size_t offset, std::size_t size)
+    {
+        return { reinterpret_cast<const char*>(data.data()) + offset, size };
+    }
+
+    std::string trim(std::string_view text)
+    {
+        const auto end = text.find_last_not_of(" \t\r\n\0"sv);
+        const auto begin = text.find_first_not_of(" \t\r\n"sv);
+        if (end == std::string_view::npos || begin > end) {
+            return {};
+        }
+        return std::string(text.substr(begin, end - begin + 1));
+    }
+
+    // Joliet names are UCS-2 big endian
+    std::string fromUcs2(std::string_view text)
+    {
+        std::string out;
+        for (std::size_t i = 0; i + 1 < text.size(); i += 2) {
+            const auto code = static_cast<std::uint16_t>(
+                static_cast<std::uint8_t>(text[i]) << 8
+                | static_cast<std::uint8_t>(text[i + 1]));
+            if (code < 0x80) {
+                out += static_cast<char>(code);
+            } else if (code < 0x800) {
+                out += static_cast<char>(0xC0 | (code >> 6));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            } else {
+                out += static_cast<char>(0xE0 | (code >> 12));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+        return out;
+    }
+
+    bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs)
+    {
+        return std::ranges::equal(lhs, rhs, [](char lchr, char rchr) {
+            return std::tolower(static_cast<unsigned char>(lchr))
+                == std::tolower(static_cast<unsigned char>(rchr));
+        });
+    }
+
+    // FILE.EXT;1 and DIR. are FILE.EXT and DIR
+    std::string_view isoName(std::string_view name)
+    {
+        if (const auto version = name.rfind(';');
+            version != std::string_view::npos) {
+            name = name.substr(0, version);
+        }
+        if (name.ends_with('.')) {
+            name.remove_suffix(1);
+        }
+        return name;
+    }
+
+    // The alternate name of a Rock Ridge NM entry, if there is one
+    std::optional<std::string> rockRidgeName(std::string_view systemUse)
+    {
+        std::optional<std::string> name;
+        while (systemUse.size() >= 4) {
+            const auto size = static_cast<std::uint8_t>(systemUse[2]);
+            if (size < 4 || size > systemUse.size()) {
+                break;
+            }
+            if (systemUse.starts_with("NM") && size >= 5) {
+                name = name.value_or("")
+                    + std::string(systemUse.substr(5, size - 5));
+            }
+            systemUse.remove_prefix(size);
+        }
+        return name;
+    }
+
+    using Ini = std::map<std::string, std::map<std::string, std::string>>;
+
+    Ini parseIni(std::string_view text)
+    {
+        Ini ini;
+        std::string section;
+        while (!text.empty()) {
+            const auto end = text.find('\n');
+            const auto line = trim(text.substr(0, end));
+            text.remove_prefix(
+                end == std::string_view::npos ? text.size() : end + 1);
+
+            if (line.empty() || line.starts_with('#') || line.starts_with(';')) {
+                continue;
+            }
+            if (line.starts_with('[') && line.ends_with(']')) {
+                section = line.substr(1, line.size() - 2);
+                continue;
+            }
+            const auto equal = line.find('=');
+            if (equal != std::string::npos) {
+                ini[section][trim(std::string_view(line).substr(0, equal))]
+                    = trim(std::string_view(line).substr(equal + 1));
+            }
+        }
+        return ini;
+    }
+
+    std::string lookup(const Ini& ini, const std::string& section,
+        const std::string& key)
+    {
+        const auto group = ini.find(section);
+        if (group == ini.end()) {
+            return {};
+        }
+        const auto value = group->second.find(key);
+        return value == group->second.end() ? std::string() : value->second;
+    }
+
+    std::string archFromLabel(std::string_view label)
+    {
+        for (const auto* arch : { "x86_64", "aarch64", "ppc64le", "s390x" }) {
+            if (label.contains(arch)) {
+                return arch;
+            }
+        }
+        return {};
+    }
+
+} // anonymous namespace
+
+Image::Image(const std::filesystem::path& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::filesystem::filesystem_error("Failed to open file", path,
+            std::error_code(errno, std::system_category()));
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) == -1) {
+        const int error = errno;
+        ::close(fd);
+        throw std::filesystem::filesystem_error("Failed to stat file", path,
+            std::error_code(error, std::system_category()));
+    }
+    const auto size = static_cast<std::size_t>(st.st_size);
+    if (size < (firstDescriptor + 1) * sectorSize) {
+        ::close(fd);
+        throw std::runtime_error(
+            fmt::format("{} is not an ISO9660 image", path.string()));
+    }
+
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(), "mmap");
+    }
+    // Only a handful of sectors are read, readahead would fetch megabytes
+    ::madvise(mapping, size, MADV_RANDOM);
+    m_data = { static_cast<const std::byte*>(mapping), size };
+
+    bool primary = false;
+    for (std::uint64_t block = firstDescriptor;
+         block < firstDescriptor + maxDescriptors; ++block) {
+        const auto descriptor = sectors(block, sectorSize);
+        if (chars(descriptor, 1, standardId.size()) != standardId) {
+            break;
+        }
+
+        const auto type = byteAt(descriptor, 0);
+        const auto root = descriptor.subspan(156, 34);
+        const Extent extent { .block = le32(root, 2),
+            .size = le32(root, 10),
+            .directory = true };
+        if (type == Primary && !primary) {
+            primary = true;
+            m_root = extent;
+            m_primary = VolumeDescriptor {
+                .systemId = trim(chars(descriptor, 8, 32)),
+                .volumeId = trim(chars(descriptor, 40, 32)),
+                .publisherId = trim(chars(descriptor, 318, 128)),
+                .applicationId = trim(chars(descriptor, 574, 128)),
+                .volumeSize = le32(descriptor, 80),
+            };
+        } else if (type == Supplementary) {
+            const auto escape = chars(descriptor, 88, 3);
+            if (escape == "%/@" || escape == "%/C" || escape == "%/E") {
+                m_jolietRoot = extent;
+            }
+        } else if (type == Terminator) {
+            break;
+        }
+    }
+
+    if (!primary) {
+        const auto error = fmt::format("{} is not an ISO9660 image", path.string());
+        ::munmap(mapping, size);
+        m_data = {};
+        throw std::runtime_error(error);
+    }
+    // Rock Ridge images start the root directory with a SUSP SP entry
+    const auto dot = sectors(m_root.block, sectorSize);
+    const auto dotLength = byteAt(dot, 0);
+    m_rockRidge = dotLength >= 41 && chars(dot, 34, 2) == "SP";
+
+    LOG_DEBUG("ISO9660 image {}: volume '{}', Rock Ridge {}, Joliet {}",
+        path.string(), m_primary.volumeId, m_rockRidge, joliet())
+}
+
+Image::Image(Image&& other) noexcept
+    : m_data(std::exchange(other.m_data, {}))
+    , m_primary(std::move(other.m_primary))
+    , m_root(other.m_root)
+    , m_jolietRoot(other.m_jolietRoot)
+    , m_rockRidge(other.m_rockRidge)
+{
+}
+
+Image::~Image()
+{
+    if (!m_data.empty()) {
+        ::munmap(const_cast<std::byte*>(m_data.data()), m_data.size());
+    }
+}
+
+std::span<const std::byte> Image::sectors(
+    std::uint64_t block, std::uint64_t size) const
+{
+    const auto offset = block * sectorSize;
+    if (offset > m_data.size() || size > m_data.size() - offset) {
+        throw std::runtime_error("ERROR: Truncated ISO9660 image");
+    }
+    return m_data.subspan(offset, size);
+}
+
+std::vector<Image::Record> Image::records(const Extent& directory) const
+{
+    const bool joliet = useJoliet();
+    const auto data = sectors(directory.block, directory.size);
+    std::vector<Record> records;
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+        const auto length = byteAt(data, offset);
+        if (length == 0) {
+            // Records never cross a sector, the rest of it is padding
+            offset = (offset / sectorSize + 1) * sectorSize;
+            continue;
+        }
+        if (length < 34 || offset + length > data.size()) {
+            break;
+        }
+
+        const auto record = data.subspan(offset, length);
+        offset += length;
+        const auto nameLength = byteAt(record, 32);
+        if (33U + nameLength > length) {
+            break;
+        }
+        const auto rawName = chars(record, 33, nameLength);
+        // The . and .. entries
+        if (nameLength == 1 && (rawName[0] == '\0' || rawName[0] == '\1')) {
+            continue;
+        }
+
+        std::string name;
+        if (joliet) {
+            name = isoName(fromUcs2(rawName));
+        } else {
+            const auto systemUse
+                = std::min<std::size_t>(length, 33U + nameLength + (nameLength % 2 == 0 ? 1 : 0));
+            name = rockRidgeName(chars(record, systemUse, length - systemUse))
+                       .value_or(std::string(isoName(rawName)));
+        }
+
+        const auto flags = byteAt(record, 25);
+        records.push_back({ .name = std::move(name),
+            .extent = { .block = le32(record, 2),
+                .size = le32(record, 10),
+                .directory = (flags & 0x02) != 0 },
+            .more = (flags & 0x80) != 0 });
+    }
+    return records;
+}
+
+std::optional<Image::Extent> Image::find(
+    const Extent& directory, std::string_view name) const
+{
+    for (const auto& record : records(directory)) {
+        if (equalsIgnoreCase(record.name, name)) {
+            return record.extent;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string> Image::readFile(
+    std::string_view path, std::size_t limit) const
+{
+    auto current = root();
+    while (!path.empty()) {
+        const auto slash = path.find('/');
+        const auto component = path.substr(0, slash);
+        path.remove_prefix(
+            slash == std::string_view::npos ? path.size() : slash + 1);
+        if (component.empty()) {
+            continue;
+        }
+        if (!current.directory) {
+            return std::nullopt;
+        }
+        auto next = find(current, component);
+        if (!next) {
+            return std::nullopt;
+        }
+        current = *next;
+    }
+
+    if (current.directory || current.size > limit) {
+        return std::nullopt;
+    }
+    const auto data = sectors(current.block, current.size);
+    return std::string(chars(data, 0, data.size()));
+}
+
+std::vector<Image::Entry> Image::entries() const
+{
+    // Directories that were already listed, a broken image could loop
+    std::set<std::uint32_t> visited;
+    std::vector<std::pair<std::string, Extent>> pending { { "", root() } };
+    std::vector<Entry> entries;
+
+    while (!pending.empty()) {
+        const auto [prefix, directory] = std::move(pending.back());
+        pending.pop_back();
+        if (!visited.insert(directory.block).second) {
+            continue;
+        }
+
+        std::optional<Entry> partial;
+        for (auto& record : records(directory)) {
+            const auto path = prefix + record.name;
+            if (record.extent.directory) {
+                entries.push_back({ .path = path, .directory = true });
+                pending.emplace_back(path + "/", record.extent);
+                continue;
+            }
+
+            // Files over 4GiB are split in several records with the same name
+            if (!partial || partial->path != path) {
+                partial = Entry { .path = path };
+            }
+            partial->size += record.extent.size;
+            partial->extents.emplace_back(
+                std::uint64_t { record.extent.block } * sectorSize,
+                record.extent.size);
+            if (!record.more) {
+                entries.push_back(std::move(*partial));
+                partial.reset();
+            }
+        }
+    }
+
+    std::ranges::sort(entries, {}, &Entry::path);
+    return entries;
+}
+
+std::optional<Release> probe(const std::filesystem::path& path)
+{
+    std::optional<Image> image;
+    try {
+        image.emplace(path);
+    } catch (const std::system_error&) {
+        throw;
+    } catch (const std::runtime_error& ex) {
+        LOG_DEBUG("{}", ex.what())
+        return std::nullopt;
+    }
+
+    Release release { .volumeId = image->primary().volumeId };
+    if (const auto treeinfo = image->readFile("/.treeinfo")) {
+        // productmd format first, then the older [general] format
+        const auto ini = parseIni(*treeinfo);
+        release.name = lookup(ini, "release", "name");
+        release.version = lookup(ini, "release", "version");
+        release.arch = lookup(ini, "tree", "arch");
+        if (release.name.empty()) {
+            release.name = lookup(ini, "general", "family");
+        }
+        if (release.version.empty()) {
+            release.version = lookup(ini, "general", "version");
+        }
+        if (release.arch.empty()) {
+            release.arch = lookup(ini, "general", "arch");
+        }
+    } else if (const auto media = image->readFile("/media.repo")) {
+        // name=Rocky Linux 9.5
+        const auto name = lookup(parseIni(*media), "InstallMedia", "name");
+        const auto space = name.rfind(' ');
+        if (space != std::string::npos && space + 1 < name.size()
+            && std::isdigit(static_cast<unsigned char>(name[space + 1]))) {
+            release.name = name.substr(0, space);
+            release.version = name.substr(space + 1);
+        } else {
+            release.name = name;
+        }
+        release.arch = archFromLabel(release.volumeId);
+    }
+
+    if (release.name.empty()) {
+        return std::nullopt;
+    }
+    LOG_DEBUG("Image {} is {} {} {}", path.string(), release.name,
+        release.version, release.arch)
+    return release;
+}
+
+namespace {
+    constexpr std::string_view manifestMagic = "CLOYSTER-EXTRACT 1";
+
+    // What a file looked like the last time it was seen
+    struct Identity final {
+        std::uint64_t device = 0;
+        std::uint64_t inode = 0;
+        std::uint64_t size = 0;
+        std::int64_t mtime = 0;
+
+        bool operator==(const Identity&) const = default;
+    };
+
+    std::optional<Identity> identityOf(const std::filesystem::path& path)
+    {
+        struct stat st {};
+        if (::stat(path.c_str(), &st) == -1) {
+            return std::nullopt;
+        }
+        return Identity { .device = st.st_dev,
+            .inode = st.st_ino,
+            .size = static_cast<std::uint64_t>(st.st_size),
+            .mtime = st.st_mtim.tv_sec * 1'000'000'000LL + st.st_mtim.tv_nsec };
+    }
+
+    /*
+     * The manifest lists the files copied from an image, with the offset
+     * they were read from and the identity of the copy:
+     *
+     *   CLOYSTER-EXTRACT 1
+     *   <device> <inode> <size> <mtime>              the image
+     *   <offset> <device> <inode> <size> <mtime> <path>
+     */
+    class Manifest final {
+    public:
+        struct Entry final {
+            std::uint64_t offset = 0;
+            Identity copy;
+        };
+
+        Identity image;
+        std::map<std::string, Entry> entries;
+
+        // Entries of a manifest written for another image are dropped
+        static Manifest load(
+            const std::filesystem::path& path, const Identity& image)
+        {
+            Manifest manifest { .image = image };
+            std::ifstream input(path);
+            std::string line;
+            if (!std::getline(input, line) || line != manifestMagic) {
+                return manifest;
+            }
+
+            Identity previous;
+            input >> previous.device >> previous.inode >> previous.size
+                >> previous.mtime;
+            if (!input || previous != image) {
+                return manifest;
+            }
+
+            Entry entry;
+            while (input >> entry.offset >> entry.copy.device
+                >> entry.copy.inode >> entry.copy.size >> entry.copy.mtime) {
+                input.get();
+                if (!std::getline(input, line)) {
+                    break;
+                }
+                manifest.entries.insert_or_assign(line, entry);
+            }
+            return manifest;
+        }
+
+        void save(const std::filesystem::path& path) const
+        {
+            const auto temporary = std::filesystem::path(path) += ".tmp";
+            {
+                std::ofstream output(temporary, std::ios::trunc);
+                output << manifestMagic << '\n'
+                       << fmt::format("{} {} {} {}\n", image.device,
+                              image.inode, image.size, image.mtime);
+                for (const auto& [name, entry] : entries) {
+                    output << fmt::format("{} {} {} {} {} {}\n", entry.offset,
+                        entry.copy.device, entry.copy.inode, entry.copy.size,
+                        entry.copy.mtime, name);
+                }
+                if (!output.flush()) {
+                    throw std::runtime_error(fmt::format(
+                        "Failed to write {}", temporary.string()));
+                }
+            }
+            std::filesystem::rename(temporary, path);
+        }
+    };
+
+    files::Descriptor openFile(const std::filesystem::path& path, int flags)
+    {
+        files::Descriptor file(::open(path.c_str(), flags | O_CLOEXEC, 0644));
+        if (file.get() == -1) {
+            throw std::system_error(
+                errno, std::system_category(), path.string());
+        }
+        return file;
+    }
+
+    // A piece of a file, the unit of work of the copy threads
+    struct Chunk final {
+        std::size_t file;
+        std::uint64_t source;
+        std::uint64_t target;
+        std::uint64_t size;
+    };
+
+    class Copier final {
+        const std::filesystem::path& m_image;
+        const std::vector<std::filesystem::path>& m_targets;
+
+    public:
+        std::atomic<std::uint64_t> copied = 0;
+        std::atomic<std::uint64_t> cloned = 0;
+
+        Copier(const std::filesystem::path& image,
+            const std::vector<std::filesystem::path>& targets)
+            : m_image(image)
+            , m_targets(targets)
+        {
+        }
+
+        // Copies chunks until there are none left, or @p stop is raised
+        void run(const std::vector<Chunk>& chunks, std::atomic<std::size_t>& next,
+            const std::atomic<bool>& stop)
+        {
+            const auto source = openFile(m_image, O_RDONLY);
+            files::Descriptor target;
+            std::size_t targetIndex = 0;
+
+            while (!stop) {
+                const auto index = next++;
+                if (index >= chunks.size()) {
+                    break;
+                }
+                const auto& chunk = chunks[index];
+                if (target.get() < 0 || targetIndex != chunk.file) {
+                    target = openFile(m_targets[chunk.file], O_WRONLY);
+                    targetIndex = chunk.file;
+                }
+
+                const auto method = files::copyExtent(source.get(),
+                    target.get(),
+                    { .source = chunk.source,
+                        .target = chunk.target,
+                        .size = chunk.size },
+                    m_image);
+                copied += chunk.size;
+                if (method == files::CopyMethod::Reflink) {
+                    cloned += chunk.size;
+                }
+            }
+        }
+    };
+
+} // anonymous namespace
+
+ExtractResult extract(const std::filesystem::path& image,
+    const std::filesystem::path& destination, const ExtractOptions& options)
+{
+    auto checkStopped = [&] {
+        if (options.stop.stop_requested()
+            || CancellationToken::global().cancelled()) {
+            throw CommandCancelledError(
+                fmt::format("extract {}", image.string()));
+        }
+    };
+
+    const auto imageIdentity = identityOf(image);
+    if (!imageIdentity) {
+        throw std::filesystem::filesystem_error("Failed to stat file", image,
+            std::error_code(errno, std::system_category()));
+    }
+    const auto entries = Image(image).entries();
+    checkStopped();
+
+    std::filesystem::create_directories(destination);
+    const auto manifestPath = destination / manifestName;
+    auto manifest = Manifest::load(manifestPath, *imageIdentity);
+
+    // Directories and empty files first, then the files that changed are
+    // created at their final size so the threads only fill them in
+    ExtractResult result;
+    std::vector<std::string> names;
+    std::vector<std::uint64_t> offsets;
+    std::vector<std::filesystem::path> targets;
+    std::vector<Chunk> chunks;
+    std::uint64_t total = 0;
+    for (const auto& entry : entries) {
+        const auto target = destination / entry.path;
+        if (entry.directory) {
+            std::filesystem::create_directories(target);
+            continue;
+        }
+
+        ++result.files;
+        const auto offset
+            = entry.extents.empty() ? 0 : entry.extents.front().first;
+        const auto previous = manifest.entries.find(entry.path);
+        if (previous != manifest.entries.end()
+            && previous->second.offset == offset
+            && previous->second.copy.size == entry.size
+            && identityOf(target) == previous->second.copy) {
+            ++result.skipped;
+            continue;
+        }
+        manifest.entries.erase(entry.path);
+
+        {
+            const auto file = openFile(target, O_WRONLY | O_CREAT | O_TRUNC);
+            if (::ftruncate(file.get(), static_cast<off_t>(entry.size)) == -1) {
+                throw std::system_error(
+                    errno, std::system_category(), target.string());
+            }
+        }
+
+        std::uint64_t position = 0;
+        for (const auto& [start, size] : entry.extents) {
+            for (std::uint64_t done = 0; done < size; done += options.chunkSize) {
+                const auto length = std::min(options.chunkSize, size - done);
+                chunks.push_back({ .file = targets.size(),
+                    .source = start + done,
+                    .target = position + done,
+                    .size = length });
+            }
+            position += size;
+        }
+        names.push_back(entry.path);
+        offsets.push_back(offset);
+        targets.push_back(target);
+        total += entry.size;
+    }
+
+    // In image order, so the source is read mostly sequentially
+    std::ranges::sort(chunks, {}, &Chunk::source);
+
+    const auto threads = std::max(1U,
+        std::min<unsigned>(options.threads != 0
+                ? options.threads
+                : std::min(8U, std::thread::hardware_concurrency()),
+            static_cast<unsigned>(std::max<std::size_t>(1, chunks.size()))));
+    LOG_DEBUG("Extracting {} of {} files from {} with {} threads",
+        targets.size(), result.files, image.string(), threads)
+
+    Copier copier(image, targets);
+    std::atomic<std::size_t> next = 0;
+    std::atomic<bool> stop = false;
+    std::atomic<std::size_t> running = threads;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+    {
+        std::vector<std::jthread> workers;
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back([&] {
+                try {
+                    copier.run(chunks, next, stop);
+                } catch (...) {
+                    const std::scoped_lock lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    stop = true;
+                }
+                const std::scoped_lock lock(mutex);
+                --running;
+                finished.notify_all();
+            });
+        }
+
+        std::unique_lock lock(mutex);
+        while (!finished.wait_for(lock, options.progressInterval,
+            [&] { return running == 0; })) {
+            if (options.stop.stop_requested()
+                || CancellationToken::global().cancelled()) {
+                stop = true;
+            }
+            if (options.progress) {
+                lock.unlock();
+                options.progress(copier.copied, total);
+                lock.lock();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    checkStopped();
+
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        manifest.entries.insert_or_assign(names[i],
+            Manifest::Entry { .offset = offsets[i],
+                .copy = identityOf(targets[i]).value_or(Identity {}) });
+    }
+    manifest.save(manifestPath);
+
+    if (options.progress) {
+        options.progress(copier.copied, total);
+    }
+    result.bytesCopied = copier.copied;
+    result.bytesCloned = copier.cloned;
+    LOG_DEBUG("Extracted {}: {} files, {} unchanged, {} bytes copied, {} "
+              "cloned",
+        image.string(), result.files, result.skipped, result.bytesCopied,
+        result.bytesCloned)
+    return result;
+}
+
+TEST_SUITE_BEGIN("cloyster::services::iso9660");
+
+namespace {
+    // Writes a small image with the given files, and optionally a Joliet
+    // tree. With Rock Ridge, every plain name gets an NM entry.
+    class ImageBuilder final {
+        std::map<std::string, std::string> m_files;
+
+        static void put32(std::string& out, std::size_t offset, std::uint32_t value)
+        {
+            for (int i = 0; i < 4; ++i) {
+                out[offset + i] = static_cast<char>(value >> (8 * i));
+                out[offset + 7 - i] = static_cast<char>(value >> (8 * i));
+            }
+        }
+
+        static std::string record(std::uint32_t block, std::uint32_t size,
+            bool directory, std::string_view name, std::string_view systemUse = {})
+        {
+            const std::size_t padding = name.size() % 2 == 0 ? 1 : 0;
+            std::string out(33 + name.size() + padding + systemUse.size(), '\0');
+            out[0] = static_cast<char>(out.size());
+            put32(out, 2, block);
+            put32(out, 10, size);
+            out[25] = directory ? 2 : 0;
+            out[32] = static_cast<char>(name.size());
+            out.replace(33, name.size(), name);
+            out.replace(33 + name.size() + padding, systemUse.size(), systemUse);
+            return out;
+        }
+
+        static std::string ucs2(std::string_view text)
+        {
+            std::string out;
+            for (const char chr : text) {
+                out += '\0';
+                out += chr;
+            }
+            return out;
+        }
+
+        static std::string padded(std::string_view text, std::size_t size)
+        {
+            std::string out(text);
+            out.resize(size, ' ');
+            return out;
+        }
+
+        static std::string parentOf(const std::string& path)
+        {
+            const auto slash = path.rfind('/');
+            return slash == std::string::npos ? "" : path.substr(0, slash);
+        }
+
+        static std::string nameOf(const std::string& path)
+        {
+            return path.substr(path.rfind('/') + 1);
+        }
+
+    public:
+        ImageBuilder& add(std::string path, std::string data)
+        {
+            m_files.insert_or_assign(std::move(path), std::move(data));
+            return *this;
+        }
+
+        void write(const std::filesystem::path& path, bool joliet,
+            bool rockRidge = true) const
+        {
+            // 16 system sectors, PVD, SVD and terminator, then a sector for
+            // each directory of both trees and the files
+            std::set<std::string> directories { "" };
+            for (const auto& [file, data] : m_files) {
+                for (auto parent = parentOf(file); !parent.empty();
+                     parent = parentOf(parent)) {
+                    directories.insert(parent);
+                }
+            }
+
+            std::uint32_t next = 19;
+            std::map<std::string, std::pair<std::uint32_t, std::uint32_t>> blocks;
+            for (const auto& directory : directories) {
+                blocks[directory] = { next, next + 1 };
+                next += 2;
+            }
+            std::map<std::string, std::uint32_t> fileBlocks;
+            for (const auto& [file, data] : m_files) {
+                fileBlocks[file] = next;
+                next += static_cast<std::uint32_t>(
+                    std::max<std::size_t>(1, (data.size() + sectorSize - 1) / sectorSize));
+            }
+            std::string image(std::size_t { next } * sectorSize, '\0');
+
+            auto descriptor = [&](std::uint32_t block, std::uint8_t type,
+                                  std::uint32_t root, std::string_view volume) {
+                std::string sector(sectorSize, '\0');
+                sector[0] = static_cast<char>(type);
+                sector.replace(1, 5, standardId);
+                sector[6] = 1;
+                sector.replace(8, 32, padded("LINUX", 32));
+                sector.replace(40, 32, padded(volume, 32));
+                put32(sector, 80, next);
+                const auto rootRecord = record(root, sectorSize, true, { "\0", 1 });
+                sector.replace(156, rootRecord.size(), rootRecord);
+                image.replace(std::size_t { block } * sectorSize, sectorSize, sector);
+            };
+            descriptor(16, Primary, blocks[""].first, "Rocky-9-5-x86_64-dvd");
+            if (joliet) {
+                descriptor(17, Supplementary, blocks[""].second, "Rocky-9-5");
+                image.replace(17 * sectorSize + 88, 3, "%/E");
+            } else {
+                image[17 * sectorSize + 1] = 'X';
+            }
+            image[18 * sectorSize] = static_cast<char>(Terminator);
+            image.replace(18 * sectorSize + 1, 5, standardId);
+
+            auto names = [&](const std::string& name, bool directory) {
+                std::string upper;
+                for (const char chr : name) {
+                    upper += chr == '.' ? '_'
+                                        : static_cast<char>(std::toupper(chr));
+                }
+                std::string nm;
+                if (rockRidge) {
+                    nm = "NM";
+                    nm += static_cast<char>(5 + name.size());
+                    nm += '\1';
+                    nm += '\0';
+                    nm += name;
+                }
+                return std::pair { directory ? upper : upper + ".;1", nm };
+            };
+
+            for (const auto& directory : directories) {
+                const auto [plainBlock, jolietBlock] = blocks[directory];
+                const auto [parentPlain, parentJoliet] = blocks[parentOf(directory)];
+                std::string sp;
+                if (rockRidge && directory.empty()) {
+                    sp = { "SP\7\1\xBE\xEF\0", 7 };
+                }
+                std::string plain = record(plainBlock, sectorSize, true, { "\0", 1 }, sp)
+                    + record(parentPlain, sectorSize, true, { "\1", 1 });
+                std::string unicode = record(jolietBlock, sectorSize, true, { "\0", 1 })
+                    + record(parentJoliet, sectorSize, true, { "\1", 1 });
+
+                for (const auto& child : directories) {
+                    if (child.empty() || parentOf(child) != directory) {
+                        continue;
+                    }
+                    const auto [name, nm] = names(nameOf(child), true);
+                    plain += record(blocks[child].first, sectorSize, true, name, nm);
+                    unicode += record(blocks[child].second, sectorSize, true,
+                        ucs2(nameOf(child)));
+                }
+                for (const auto& [file, data] : m_files) {
+                    if (parentOf(file) != directory) {
+                        continue;
+                    }
+                    const auto size = static_cast<std::uint32_t>(data.size());
+                    const auto [name, nm] = names(nameOf(file), false);
+                    plain += record(fileBlocks[file], size, false, name, nm);
+                    unicode += record(fileBlocks[file], size, false, ucs2(nameOf(file)));
+                    image.replace(std::size_t { fileBlocks[file] } * sectorSize,
+                        data.size(), data);
+                }
+
+                image.replace(std::size_t { plainBlock } * sectorSize, plain.size(), plain);
+                image.replace(std::size_t { jolietBlock } * sectorSize, unicode.size(), unicode);
+            }
+
+            std::ofstream(path, std::ios::binary)
+                .write(image.data(), static_cast<std::streamsize>(image.size()));
+        }
+    };
+
+    using cloyster::tests::TemporaryFile;
+
+    constexpr std::string_view treeinfo = R"([general]
+family = Rocky Linux
+version = 9.5
+arch = x86_64
+
+[release]
+name = Rocky Linux
+short = Rocky
+version = 9.5
+
+[tree]
+arch = x86_64
+)";
+}
+
+TEST_CASE("Image reads files from the Rock Ridge and Joliet trees")
+{
+    for (const auto [joliet, rockRidge] :
+        { std::pair { true, true }, { true, false }, { false, true } }) {
+        const TemporaryFile iso("image.iso");
+        ImageBuilder()
+            .add(".treeinfo", std::string(treeinfo))
+            .add("media.repo", "[InstallMedia]\nname=Rocky Linux 9.5\n")
+            .add("BaseOS/repodata/repomd.xml", "<repomd/>")
+            .write(iso.path, joliet, rockRidge);
+
+        const Image image(iso.path);
+        CHECK(image.joliet() == joliet);
+        CHECK(image.rockRidge() == rockRidge);
+        CHECK(image.primary().volumeId == "Rocky-9-5-x86_64-dvd");
+        CHECK(image.primary().systemId == "LINUX");
+        CHECK(image.readFile("/.treeinfo") == treeinfo);
+        CHECK(image.readFile("MEDIA.REPO").has_value());
+        CHECK(image.readFile("/BaseOS/repodata/repomd.xml") == "<repomd/>");
+        CHECK(image.readFile("/missing") == std::nullopt);
+        CHECK(image.readFile("/BaseOS") == std::nullopt);
+        CHECK(image.readFile("/.treeinfo", 16) == std::nullopt);
+    }
+
+    SUBCASE("plain ISO9660 names")
+    {
+        const TemporaryFile iso("image.iso");
+        ImageBuilder().add(".treeinfo", std::string(treeinfo)).write(iso.path, false, false);
+        const Image image(iso.path);
+        CHECK_FALSE(image.rockRidge());
+        CHECK(image.readFile("/_treeinfo") == treeinfo);
+    }
+}
+
+TEST_CASE("Image lists every entry")
+{
+    const TemporaryFile iso("image.iso");
+    ImageBuilder()
+        .add(".treeinfo", std::string(treeinfo))
+        .add("BaseOS/Packages/bash.rpm", std::string(5000, 'b'))
+        .add("BaseOS/repodata/repomd.xml", "<repomd/>")
+        .write(iso.path, true);
+
+    const auto entries = Image(iso.path).entries();
+    std::vector<std::string> paths;
+    for (const auto& entry : entries) {
+        paths.push_back(entry.path);
+    }
+    CHECK(paths
+        == std::vector<std::string> { ".treeinfo", "BaseOS", "BaseOS/Packages",
+            "BaseOS/Packages/bash.rpm", "BaseOS/repodata",
+            "BaseOS/repodata/repomd.xml" });
+
+    const auto& bash = entries[3];
+    CHECK_FALSE(bash.directory);
+    CHECK(bash.size == 5000);
+    REQUIRE(bash.extents.size() == 1);
+    CHECK(bash.extents[0].first % sectorSize == 0);
+    CHECK(bash.extents[0].second == 5000);
+    CHECK(entries[1].directory);
+}
+
+TEST_CASE("probe")
+{
+    SUBCASE(".treeinfo")
+    {
+        const TemporaryFile iso("image.iso");
+        ImageBuilder().add(".treeinfo", std::string(treeinfo)).write(iso.path, true);
+        const auto release = probe(iso.path);
+        REQUIRE(release.has_value());
+        CHECK(release->name == "Rocky Linux");
+        CHECK(release->version == "9.5");
+        CHECK(release->arch == "x86_64");
+    }
+
+    SUBCASE("media.repo and the volume label")
+    {
+        const TemporaryFile iso("image.iso");
+        ImageBuilder()
+            .add("media.repo", "[InstallMedia]\nname=Rocky Linux 9.5\n")
+            .write(iso.path, false);
+        const auto release = probe(iso.path);
+        REQUIRE(release.has_value());
+        CHECK(release->name == "Rocky Linux");
+        CHECK(release->version == "9.5");
+        CHECK(release->arch == "x86_64");
+    }
+
+    SUBCASE("other files")
+    {
+        const TemporaryFile iso("image.iso", std::string(64 * 1024, 'x'));
+        CHECK(probe(iso.path) == std::nullopt);
+        CHECK_THROWS_AS(probe("/nonexistent.iso"), std::filesystem::filesystem_error);
+
+        ImageBuilder().add("README", "hello").write(iso.path, true);
+        CHECK(probe(iso.path) == std::nullopt);
+    }
+}
+
+TEST_CASE("extract")
+{
+    const TemporaryFile iso("image.iso");
+    std::string large(300 * 1024, '\0');
+    for (std::size_t i = 0; i < large.size(); ++i) {
+        large[i] = static_cast<char>(i * 7 % 251);
+    }
+    ImageBuilder()
+        .add(".treeinfo", std::string(treeinfo))
+        .add("BaseOS/Packages/bash.rpm", large)
+        .add("BaseOS/repodata/repomd.xml", "<repomd/>")
+        .add("EMPTY", "")
+        .write(iso.path, true);
+
+    const cloyster::tests::TemporaryDirectory output;
+    const auto destination = output.path / "extract";
+
+    auto read = [&](const std::string& name) {
+        std::ifstream input(destination / name, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(input), {});
+    };
+
+    const ExtractOptions options { .threads = 3, .chunkSize = 64 * 1024 };
+    auto result = extract(iso.path, destination, options);
+    CHECK(result.files == 4);
+    CHECK(result.skipped == 0);
+    CHECK(result.bytesCopied == large.size() + treeinfo.size() + 9);
+    CHECK(read("BaseOS/Packages/bash.rpm") == large);
+    CHECK(read("BaseOS/repodata/repomd.xml") == "<repomd/>");
+    CHECK(read(".treeinfo") == treeinfo);
+    CHECK(std::filesystem::is_regular_file(destination / "EMPTY"));
+
+    SUBCASE("unchanged files are skipped")
+    {
+        result = extract(iso.path, destination, options);
+        CHECK(result.skipped == 4);
+        CHECK(result.bytesCopied == 0);
+
+        std::ofstream(destination / ".treeinfo") << "changed";
+        result = extract(iso.path, destination, options);
+        CHECK(result.skipped == 3);
+        CHECK(read(".treeinfo") == treeinfo);
+    }
+
+    SUBCASE("another image is extracted again")
+    {
+        ImageBuilder().add(".treeinfo", "[general]\n").write(iso.path, true);
+        result = extract(iso.path, destination, options);
+        CHECK(result.files == 1);
+        CHECK(result.skipped == 0);
+        CHECK(read(".treeinfo") == "[general]\n");
+    }
+
+    SUBCASE("stopping")
+    {
+        std::stop_source stop;
+        stop.request_stop();
+        CHECK_THROWS_AS(
+            extract(iso.path, destination, { .stop = stop.get_token() }),
+            CommandCancelledError);
+    }
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services::iso9660
@@ -1,5 +1,7 @@
 #include <cloysterhpc/services/options.h>
+#include <cloysterhpc/patterns/singleton.h>
 #include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/tracer.h>
 
 #include <CLI/CLI.hpp>
 #include <fstream>
@@ -25,7 +27,19 @@ std::unique_ptr<Options> options::factory(int argc, const char** argv)
         .airGap = false,
         .unattended = false,
         .disableMirrors = false,
+        .asyncRunner = false,
+        .persistentShell = false,
+        .verifyDiskImage = false,
+        .powerWaveByRack = false,
+        .nativeIpmi = false,
+        .listBackups = false,
         .logLevelInput = 3,
+        .commandTimeout = 0,
+        .nodeBatchSize = 1000,
+        .imageIoJobs = 2,
+        .powerWaveSize = 64,
+        .replayTimeScale = 0.0,
+        .powerWaveThreshold = 0.9,
         .error = "NO ERROR",
         .config = "",
         .helpText = "",
@@ -36,6 +50,10 @@ std::unique_ptr<Options> options::factory(int argc, const char** argv)
         .zabbixVersion = "6.4",
         .xcatVersion = "latest",
         .dumpAnswerfile = "",
+        .recordTrace = "",
+        .replayTrace = "",
+        .traceFile = "",
+        .restoreBackup = "",
     };
     // Define the CLI11 app
     CLI::App app("CloysterHPC Options");
@@ -43,11 +61,15 @@ std::unique_ptr<Options> options::factory(int argc, const char** argv)
     // Add options
     app.add_flag("-v,--version", opt.showVersion, "Show version information");
     app.add_flag("-r,--root", opt.runAsRoot, "Run as root");
-    app.add_flag("-d,--dry", opt.dryRun, "Perform a dry run installation");
+    auto* dryRun = app.add_flag("-d,--dry", opt.dryRun, "Perform a dry run installation");
     app.add_flag("-t,--tui", opt.enableTUI, "Enable TUI");
     app.add_flag("-c,--cli", opt.enableCLI, "Enable CLI");
     app.add_flag("-D,--daemon", opt.runAsDaemon, "Run as daemon");
     app.add_flag("--disable-mirrors", opt.disableMirrors, "Disable mirror URLs");
+    auto* asyncRunner = app.add_flag("--async", opt.asyncRunner, "Run commands asynchronously, overlapping long jobs");
+    app.add_flag("--persistent-shell", opt.persistentShell, "Run commands through a single long-lived bash process")
+        ->excludes(asyncRunner);
+    app.add_flag("--verify-disk-image", opt.verifyDiskImage, "Verify the SHA-256 of known disk images, reading the whole image");
     app.add_option("--mirror-url", opt.mirrorBaseUrl, "Base URL for mirror")
         ->default_str("https://mirror.versatushpc.com.br");
     app.add_option("--beegfs-version", opt.beegfsVersion, "BeeGFS default version")
@@ -69,6 +91,32 @@ std::unique_ptr<Options> options::factory(int argc, const char** argv)
         ->multi_option_policy(CLI::MultiOptionPolicy::TakeAll);
     app.add_flag("-u,--unattended", opt.unattended, "Perform an unattended installation");
     app.add_option("--dump-answerfile", opt.dumpAnswerfile, "Create an answerfile based on input and save to specified path");
+    app.add_option("--command-timeout", opt.commandTimeout, "Kill commands running for longer than this many seconds, 0 disables")
+        ->default_val(0);
+    app.add_option("--node-batch-size", opt.nodeBatchSize, "Number of nodes defined by each mkdef call")
+        ->default_val(1000)
+        ->check(CLI::PositiveNumber);
+    app.add_option("--image-io-jobs", opt.imageIoJobs, "Number of image build steps allowed to hit the disk at the same time")
+        ->default_val(2)
+        ->check(CLI::PositiveNumber);
+    app.add_option("--power-wave-size", opt.powerWaveSize, "Number of nodes reset at the same time, 0 resets them all at once")
+        ->default_val(64);
+    app.add_flag("--power-wave-by-rack", opt.powerWaveByRack, "Reset the nodes one rack at a time, as set by the xCAT rack attribute");
+    app.add_flag("--native-ipmi", opt.nativeIpmi, "Talk to the BMCs directly over IPMI 2.0 instead of through rsetboot and rpower");
+    app.add_option("--power-wave-threshold", opt.powerWaveThreshold, "Fraction of a wave that must fetch its image before the next wave is reset")
+        ->default_val(0.9)
+        ->check(CLI::Range(0.0, 1.0));
+    app.add_option("--record-trace", opt.recordTrace, "Record every command and its results to a trace file");
+    // The HTTP, file and ISO code does not go through the runner, only a dry
+    // run keeps a replay from touching the filesystem and the network
+    app.add_option("--replay-trace", opt.replayTrace, "Replay the results of a trace file instead of running commands, needs --dry")
+        ->needs(dryRun);
+    app.add_option("--replay-time-scale", opt.replayTimeScale, "Wait the recorded time of each command multiplied by this factor while replaying")
+        ->default_val(0.0)
+        ->check(CLI::NonNegativeNumber);
+    app.add_option("--trace-file", opt.traceFile, "Write the timing of every command to a Chrome trace-event JSON file");
+    app.add_flag("--list-backups", opt.listBackups, "List the files backed up by each run and exit");
+    app.add_option("--restore-backup", opt.restoreBackup, "Put back the files backed up by a run, as listed by --list-backups, and exit");
     app.add_option("--config", opt.config, "Config file to pass options for the command line from a configuration file");
 
 #ifndef NDEBUG
@@ -133,7 +181,14 @@ bool Options::shouldForce(const std::string& step) const
 
 void Options::maybeStopAfterStep(const std::string& step) const
 {
+    if (!traceFile.empty()) {
+        cloyster::Singleton<Tracer>::get()->step(step);
+    }
+
     if (stopAfterStep == step) {
+        if (!traceFile.empty()) {
+            cloyster::Singleton<Tracer>::get()->finish();
+        }
         LOG_INFO("Exiting after {}", step);
         std::exit(0);
     }
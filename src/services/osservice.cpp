@@ -18,29 +18,31 @@ public:
         auto runner = Singleton<IRunner>::get();
         // Get the kernel version from the kernel package, order by BUILDTIME
         // since there may be multiple kernels installed (previous kernels)
-        return runner->checkOutput(
+        return std::string(runner->captureOutput(
             "bash -c \"rpm -q kernel --qf '%{VERSION}-%{RELEASE}.%{ARCH} "
-            "%{BUILDTIME}\n' | sort -nrk 2 | head -1 | awk '{print $1}'\"")[0];
+            "%{BUILDTIME}\n' | sort -nrk 2 | head -1 | awk '{print $1}'\"")
+                .front());
     }
 
     [[nodiscard]] std::string getKernelRunning() const override
     {
-        return Singleton<IRunner>::get()->checkOutput("uname -r")[0];
+        return std::string(
+            Singleton<IRunner>::get()->captureOutput("uname -r").front());
     }
 
     [[nodiscard]] std::string getLocale() const override
     {
         // localectl status outputs a line like this System Locale:
         // LANG=en_US.utf8 The awk gets the en_US.utf8 part
-        return Singleton<IRunner>::get()->checkOutput(
+        return std::string(Singleton<IRunner>::get()->captureOutput(
             R"(bash -c "localectl status | awk -F'=' '/System Locale: / {print $2}'")")
-            [0];
+            .front());
     }
 
     [[nodiscard]] std::vector<std::string> getAvailableLocales() const override
     {
         auto runner = cloyster::Singleton<IRunner>::get();
-        return runner->checkOutput("locale -a");
+        return runner->captureOutput("locale -a").toVector();
     }
 
     [[nodiscard]] bool install(std::string_view package) const override
@@ -118,7 +120,7 @@ public:
 
     [[nodiscard]] std::vector<std::string> repolist() const override
     {
-        return Singleton<IRunner>::get()->checkOutput("dnf repolist");
+        return Singleton<IRunner>::get()->captureOutput("dnf repolist").toVector();
     }
 
     [[nodiscard]] bool enableService(std::string_view service) const override
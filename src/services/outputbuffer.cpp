@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cstring>
+
+#include <cloysterhpc/services/outputbuffer.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace {
+
+// Never let the arena fit in the small string buffer, so the line views
+// survive moving the buffer around
+constexpr std::size_t minimumCapacity = 256;
+
+}
+
+namespace cloyster::services {
+
+std::span<char> OutputBuffer::prepare(std::size_t size)
+{
+    if (m_data.size() - m_size < size) {
+        m_data.resize(
+            std::max({ m_size + size, m_data.size() * 2, minimumCapacity }));
+    }
+    return { m_data.data() + m_size, m_data.size() - m_size };
+}
+
+void OutputBuffer::commit(std::size_t size)
+{
+    const char* data = m_data.data();
+    const char* end = data + m_size + size;
+    for (const char* pos = data + m_size;
+         (pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos)));
+         ++pos) {
+        m_breaks.push_back(static_cast<std::size_t>(pos - data));
+    }
+    m_size += size;
+}
+
+void OutputBuffer::append(std::string_view data)
+{
+    std::ranges::copy(data, prepare(data.size()).begin());
+    commit(data.size());
+}
+
+std::size_t OutputBuffer::size() const
+{
+    // The last line may not end with a line break
+    const std::size_t lastStart = m_breaks.empty() ? 0 : m_breaks.back() + 1;
+    return m_breaks.size() + (m_size > lastStart ? 1 : 0);
+}
+
+std::string_view OutputBuffer::operator[](std::size_t index) const
+{
+    const std::size_t start = index == 0 ? 0 : m_breaks[index - 1] + 1;
+    const std::size_t end
+        = index < m_breaks.size() ? m_breaks[index] : m_size;
+    return { m_data.data() + start, end - start };
+}
+
+std::vector<std::string> OutputBuffer::toVector() const
+{
+    std::vector<std::string> output;
+    output.reserve(size());
+    for (const auto line : lines()) {
+        output.emplace_back(line);
+    }
+    return output;
+}
+
+void OutputBuffer::truncate(std::size_t size)
+{
+    m_size = std::min(m_size, size);
+    while (!m_breaks.empty() && m_breaks.back() >= m_size) {
+        m_breaks.pop_back();
+    }
+}
+
+void OutputBuffer::clear()
+{
+    m_size = 0;
+    m_breaks.clear();
+}
+
+TEST_SUITE_BEGIN("cloyster::services::outputbuffer");
+
+TEST_CASE("OutputBuffer")
+{
+    SUBCASE("splits lines across writes")
+    {
+        OutputBuffer output;
+        output.append("glibc-2.34\nker");
+        output.append("nel-5.14\n\nlast");
+        CHECK(output.size() == 4);
+        CHECK(output[0] == "glibc-2.34");
+        CHECK(output[1] == "kernel-5.14");
+        CHECK(output[2].empty());
+        CHECK(output.back() == "last");
+        CHECK(output.text() == "glibc-2.34\nkernel-5.14\n\nlast");
+    }
+
+    SUBCASE("trailing line break does not add a line")
+    {
+        OutputBuffer output;
+        CHECK(output.empty());
+        output.append("C.utf8\nen_US.utf8\n");
+        CHECK(output.toVector()
+            == std::vector<std::string> { "C.utf8", "en_US.utf8" });
+    }
+
+    SUBCASE("truncate drops lines and line breaks")
+    {
+        OutputBuffer output;
+        output.append("kept\npartial line\ngone\n");
+        output.truncate(12);
+        CHECK(output.toVector()
+            == std::vector<std::string> { "kept", "partial" });
+        output.truncate(5);
+        CHECK(output.toVector() == std::vector<std::string> { "kept" });
+        CHECK(output.text() == "kept\n");
+    }
+
+    SUBCASE("views survive a move")
+    {
+        OutputBuffer output;
+        output.append("x86_64\n");
+        const auto view = output.front();
+        OutputBuffer moved = std::move(output);
+        CHECK(view == "x86_64");
+        CHECK(view.data() == moved.front().data());
+    }
+
+    SUBCASE("large captures through prepare and commit")
+    {
+        OutputBuffer output;
+        for (int i = 0; i < 10000; ++i) {
+            const auto line = std::to_string(i) + '\n';
+            auto span = output.prepare(line.size());
+            std::ranges::copy(line, span.begin());
+            output.commit(line.size());
+        }
+        REQUIRE(output.size() == 10000);
+        CHECK(output[9999] == "9999");
+        CHECK(std::ranges::count_if(output.lines(),
+                  [](std::string_view line) { return line.ends_with('7'); })
+            == 1000);
+    }
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services
@@ -0,0 +1,552 @@
+#include <algorithm>
+#include <cmath>
+#include <list>
+
+#include <poll.h>
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#include <cloysterhpc/patterns/singleton.h>
+#include <cloysterhpc/services/cancellation.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/options.h>
+#include <cloysterhpc/services/power.h>
+#include <cloysterhpc/services/runner.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace cloyster::services::power {
+
+namespace {
+
+    // Sleeps for @p duration, or until the global token is cancelled
+    void wait(std::chrono::milliseconds duration)
+    {
+        auto& token = CancellationToken::global();
+        pollfd pfd { .fd = token.fd(), .events = POLLIN, .revents = 0 };
+        const auto deadline = std::chrono::steady_clock::now() + duration;
+        while (!token.cancelled()) {
+            const auto left
+                = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                return;
+            }
+            ::poll(&pfd, 1, static_cast<int>(left.count()));
+        }
+        throw CommandCancelledError("power rollout");
+    }
+
+    /* xCAT answers with a line per node, "n01: reset" or
+     * "n01: Error: ...". Returns the message of each node.
+     */
+    std::map<std::string, std::string> parseNodeLines(
+        const std::list<std::string>& lines)
+    {
+        std::map<std::string, std::string> messages;
+        for (const auto& line : lines) {
+            const auto colon = line.find(": ");
+            if (colon == std::string::npos || colon == 0) {
+                continue;
+            }
+            messages.insert_or_assign(
+                line.substr(0, colon), line.substr(colon + 2));
+        }
+        return messages;
+    }
+
+    std::map<std::string, std::string> queryNodes(
+        const std::string& command, const std::vector<std::string>& nodes)
+    {
+        std::list<std::string> output;
+        cloyster::Singleton<IRunner>::get()->executeCommand(
+            fmt::format("bash -c \"{} 2>&1\"",
+                fmt::format(fmt::runtime(command),
+                    fmt::join(nodes, ","))),
+            output);
+        return parseNodeLines(output);
+    }
+
+    /* Runs @p command on @p nodes and moves the nodes xCAT reported an
+     * error for, or did not mention at all, into @p errors.
+     */
+    std::vector<std::string> runOnNodes(const std::string& command,
+        const std::vector<std::string>& nodes,
+        std::map<std::string, std::string>& errors)
+    {
+        const auto messages = queryNodes(command, nodes);
+        std::vector<std::string> succeeded;
+        for (const auto& node : nodes) {
+            const auto message = messages.find(node);
+            if (message == messages.end()) {
+                errors.insert_or_assign(node, "no answer from xCAT");
+            } else if (message->second.starts_with("Error")) {
+                errors.insert_or_assign(node, message->second);
+            } else {
+                succeeded.push_back(node);
+            }
+        }
+        return succeeded;
+    }
+
+    /* Clears the status xCAT keeps for @p nodes before they are reset,
+     * a status left over from an earlier boot would otherwise be taken for
+     * this one. The nodes are moved into @p errors if it fails.
+     */
+    std::vector<std::string> clearStatus(const std::vector<std::string>& nodes,
+        std::map<std::string, std::string>& errors)
+    {
+        if (nodes.empty()
+            || cloyster::Singleton<IRunner>::get()->executeCommand(fmt::format(
+                   "chdef -t node -o {} status=", fmt::join(nodes, ",")))
+                == 0) {
+            return nodes;
+        }
+        for (const auto& node : nodes) {
+            errors.insert_or_assign(node, "could not clear the xCAT status");
+        }
+        return {};
+    }
+
+} // namespace
+
+std::map<std::string, std::string> XCATBackend::netboot(
+    const std::vector<std::string>& nodes)
+{
+    if (cloyster::Singleton<Options>::get()->dryRun) {
+        LOG_INFO("Dry Run: Would reset {} through the network",
+            fmt::join(nodes, ","))
+        return {};
+    }
+
+    std::map<std::string, std::string> errors;
+    const auto bootable
+        = clearStatus(runOnNodes("rsetboot {} net", nodes, errors), errors);
+    if (!bootable.empty()) {
+        (void)runOnNodes("rpower {} reset", bootable, errors);
+    }
+    return errors;
+}
+
+std::set<std::string> XCATBackend::fetched(
+    const std::vector<std::string>& nodes)
+{
+    if (cloyster::Singleton<Options>::get()->dryRun) {
+        return { nodes.begin(), nodes.end() };
+    }
+
+    // netboot() cleared the status, xCAT sets it again as the node
+    // downloads its image and boots, whoever reset it
+    std::set<std::string> fetched;
+    for (const auto& [node, status] :
+        queryNodes("lsdef -t node -o {} -i status -c", nodes)) {
+        if (status == "status=netbooting" || status == "status=booting"
+            || status == "status=booted") {
+            fetched.insert(node);
+        }
+    }
+    return fetched;
+}
+
+std::map<std::string, std::string> XCATBackend::racks(
+    const std::vector<std::string>& nodes)
+{
+    std::map<std::string, std::string> racks;
+    for (const auto& [node, rack] :
+        queryNodes("lsdef -t node -o {} -i rack -c", nodes)) {
+        if (rack.starts_with("rack=") && rack.size() > 5) {
+            racks.emplace(node, rack.substr(5));
+        }
+    }
+    return racks;
+}
+
+NativeBackend::NativeBackend(
+    ipmi::IPMIBackend& ipmi, std::map<std::string, ipmi::Endpoint> bmcs)
+    : m_ipmi(ipmi)
+    , m_bmcs(std::move(bmcs))
+{
+}
+
+std::map<std::string, std::string> NativeBackend::netboot(
+    const std::vector<std::string>& nodes)
+{
+    std::map<std::string, std::string> errors;
+    std::vector<std::string> names;
+    for (const auto& node : nodes) {
+        if (m_bmcs.contains(node)) {
+            names.push_back(node);
+        } else {
+            errors.emplace(node, "the node has no BMC");
+        }
+    }
+
+    // The BMCs never tell xCAT about the reset, so the status is cleared
+    // here for fetched() to only see what the nodes report afterwards
+    names = clearStatus(names, errors);
+    std::vector<ipmi::Endpoint> endpoints;
+    endpoints.reserve(names.size());
+    for (const auto& node : names) {
+        endpoints.push_back(m_bmcs.at(node));
+    }
+
+    const auto replies = m_ipmi.netboot(endpoints);
+    for (std::size_t i = 0; i < replies.size(); ++i) {
+        if (!replies[i].ok()) {
+            errors.emplace(names[i], replies[i].error);
+        }
+    }
+    return errors;
+}
+
+std::set<std::string> NativeBackend::fetched(
+    const std::vector<std::string>& nodes)
+{
+    return m_xcat.fetched(nodes);
+}
+
+std::size_t RolloutReport::count(State state) const
+{
+    return static_cast<std::size_t>(std::ranges::count(
+        nodes, state, &NodeResult::state));
+}
+
+std::vector<std::vector<std::string>> waves(
+    std::span<const Target> targets, const RolloutOptions& options)
+{
+    // Groups in the order they first show up
+    std::vector<std::vector<std::string>> groups;
+    std::map<std::string, std::size_t> groupIndex;
+    for (const auto& target : targets) {
+        if (!target.bmc) {
+            continue;
+        }
+        const auto [group, inserted] = groupIndex.try_emplace(
+            options.byGroup ? target.group : std::string(), groups.size());
+        if (inserted) {
+            groups.emplace_back();
+        }
+        groups[group->second].push_back(target.node);
+    }
+
+    std::vector<std::vector<std::string>> result;
+    for (const auto& group : groups) {
+        const auto size
+            = options.waveSize == 0 ? group.size() : options.waveSize;
+        for (std::size_t i = 0; i < group.size(); i += size) {
+            result.emplace_back(group.begin() + static_cast<std::ptrdiff_t>(i),
+                group.begin()
+                    + static_cast<std::ptrdiff_t>(
+                        std::min(i + size, group.size())));
+        }
+    }
+    return result;
+}
+
+RolloutReport rollout(std::span<const Target> targets, Backend& backend,
+    const RolloutOptions& options)
+{
+    RolloutReport report;
+    std::map<std::string, std::size_t> index;
+    for (const auto& target : targets) {
+        index.emplace(target.node, report.nodes.size());
+        report.nodes.push_back({ .node = target.node,
+            .error = target.bmc ? "" : "the node has no BMC" });
+    }
+
+    const auto plan = waves(targets, options);
+    report.waves = plan.size();
+    for (std::size_t wave = 0; wave < plan.size(); ++wave) {
+        LOG_INFO("Resetting wave {} of {}: {}", wave + 1, plan.size(),
+            fmt::join(plan[wave], ","))
+
+        std::vector<std::string> reset;
+        auto pending = plan[wave];
+        auto backoff = options.backoff;
+        for (unsigned attempt = 1;; ++attempt) {
+            const auto errors = backend.netboot(pending);
+            std::vector<std::string> failed;
+            for (const auto& node : pending) {
+                auto& result = report.nodes[index.at(node)];
+                result.wave = wave + 1;
+                result.attempts = attempt;
+                if (const auto error = errors.find(node);
+                    error != errors.end()) {
+                    result.state = State::Failed;
+                    result.error = error->second;
+                    failed.push_back(node);
+                } else {
+                    result.state = State::Reset;
+                    result.error.clear();
+                    reset.push_back(node);
+                }
+            }
+
+            if (failed.empty()) {
+                break;
+            }
+            if (attempt > options.retries) {
+                LOG_ERROR("Could not reset {}", fmt::join(failed, ","))
+                break;
+            }
+            LOG_WARN("Could not reset {}, trying again in {}ms",
+                fmt::join(failed, ","), backoff.count())
+            wait(backoff);
+            backoff = std::min(backoff * 2, options.maxBackoff);
+            pending = std::move(failed);
+        }
+
+        if (wave + 1 == plan.size() || reset.empty()) {
+            continue;
+        }
+
+        // Hold the next wave until the headnode is done serving this one
+        const auto needed = static_cast<std::size_t>(
+            std::ceil(options.threshold * static_cast<double>(reset.size())));
+        const auto deadline
+            = std::chrono::steady_clock::now() + options.waveTimeout;
+        std::size_t fetched = 0;
+        while (fetched < needed) {
+            for (const auto& node : backend.fetched(reset)) {
+                auto& result = report.nodes[index.at(node)];
+                if (result.state == State::Reset) {
+                    result.state = State::Fetched;
+                    ++fetched;
+                }
+            }
+            std::erase_if(reset, [&](const auto& node) {
+                return report.nodes[index.at(node)].state == State::Fetched;
+            });
+
+            if (fetched >= needed) {
+                break;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                LOG_WARN("Only {} of the {} nodes of wave {} fetched their "
+                         "image in time, going on with the next wave",
+                    fetched, fetched + reset.size(), wave + 1)
+                break;
+            }
+            wait(options.pollInterval);
+        }
+    }
+
+    return report;
+}
+
+std::vector<Target> targets(std::span<const cloyster::models::Node> nodes,
+    const std::map<std::string, std::string>& racks)
+{
+    std::vector<Target> targets;
+    targets.reserve(nodes.size());
+    for (const auto& node : nodes) {
+        const auto& bmc = node.getBMC();
+        const auto rack = racks.find(node.getHostname());
+        targets.push_back({ .node = node.getHostname(),
+            .group = rack == racks.end() ? "" : rack->second,
+            .bmc = bmc.has_value() && !bmc->getAddress().empty() });
+    }
+    return targets;
+}
+
+} // namespace cloyster::services::power
+
+TEST_SUITE_BEGIN("cloyster::services::power");
+
+namespace {
+
+using namespace cloyster::services::power;
+
+// Fails the nodes listed in failures as many times as asked, and reports
+// the nodes as fetched once they have been reset
+class FakeBackend final : public Backend {
+public:
+    std::map<std::string, unsigned> failures;
+    std::set<std::string> neverFetched;
+    std::vector<std::vector<std::string>> calls;
+    std::set<std::string> resetNodes;
+
+    std::map<std::string, std::string> netboot(
+        const std::vector<std::string>& nodes) override
+    {
+        calls.push_back(nodes);
+        std::map<std::string, std::string> errors;
+        for (const auto& node : nodes) {
+            if (auto& left = failures[node]; left > 0) {
+                --left;
+                errors.emplace(node, "Error: BMC did not answer");
+            } else {
+                resetNodes.insert(node);
+            }
+        }
+        return errors;
+    }
+
+    std::set<std::string> fetched(
+        const std::vector<std::string>& nodes) override
+    {
+        std::set<std::string> fetched;
+        for (const auto& node : nodes) {
+            if (resetNodes.contains(node) && !neverFetched.contains(node)) {
+                fetched.insert(node);
+            }
+        }
+        return fetched;
+    }
+};
+
+RolloutOptions fastOptions()
+{
+    return { .waveSize = 2,
+        .backoff = std::chrono::milliseconds(0),
+        .maxBackoff = std::chrono::milliseconds(0),
+        .pollInterval = std::chrono::milliseconds(0),
+        .waveTimeout = std::chrono::milliseconds(20) };
+}
+
+} // namespace
+
+TEST_CASE("waves")
+{
+    const std::vector<Target> targets = {
+        { .node = "n1", .group = "r1" },
+        { .node = "n2", .group = "r2" },
+        { .node = "n3", .group = "r1" },
+        { .node = "n4", .group = "r1", .bmc = false },
+        { .node = "n5", .group = "r2" },
+    };
+
+    auto options = fastOptions();
+    CHECK(waves(targets, options)
+        == std::vector<std::vector<std::string>> {
+            { "n1", "n2" }, { "n3", "n5" } });
+
+    options.byGroup = true;
+    CHECK(waves(targets, options)
+        == std::vector<std::vector<std::string>> {
+            { "n1", "n3" }, { "n2", "n5" } });
+
+    options.waveSize = 1;
+    CHECK(waves(targets, options).size() == 4);
+}
+
+TEST_CASE("rollout retries failed nodes and waits for each wave")
+{
+    const std::vector<Target> targets = {
+        { .node = "n1" },
+        { .node = "n2" },
+        { .node = "n3" },
+        { .node = "n4", .bmc = false },
+    };
+
+    FakeBackend backend;
+    backend.failures = { { "n2", 2 } };
+    const auto report = rollout(targets, backend, fastOptions());
+
+    CHECK(report.waves == 2);
+    CHECK(backend.calls
+        == std::vector<std::vector<std::string>> {
+            { "n1", "n2" }, { "n2" }, { "n2" }, { "n3" } });
+    CHECK(report.nodes[1].attempts == 3);
+    CHECK(report.nodes[1].state == State::Fetched);
+    CHECK(report.nodes[2].state == State::Reset);
+    CHECK(report.nodes[3].state == State::Skipped);
+    CHECK(report.count(State::Fetched) == 2);
+}
+
+TEST_CASE("rollout gives up on nodes past the retries")
+{
+    const std::vector<Target> targets = { { .node = "n1" }, { .node = "n2" },
+        { .node = "n3" } };
+
+    FakeBackend backend;
+    backend.failures = { { "n1", 100 } };
+    backend.neverFetched = { "n2" };
+    auto options = fastOptions();
+    options.retries = 1;
+    const auto report = rollout(targets, backend, options);
+
+    CHECK(report.nodes[0].state == State::Failed);
+    CHECK(report.nodes[0].attempts == 2);
+    CHECK(report.nodes[0].error == "Error: BMC did not answer");
+    // The wave timed out below the threshold, the next one still ran
+    CHECK(report.nodes[1].state == State::Reset);
+    CHECK(report.nodes[2].state == State::Reset);
+    CHECK(report.nodes[2].wave == 2);
+}
+
+TEST_CASE("xCAT answers")
+{
+    const std::list<std::string> lines = { "n01: reset",
+        "n02: Error: [headnode]: Unable to get IPMI session", "garbage",
+        "n03: status=booted" };
+    const auto messages = parseNodeLines(lines);
+    CHECK(messages.size() == 3);
+    CHECK(messages.at("n01") == "reset");
+    CHECK(messages.at("n02").starts_with("Error"));
+    CHECK(messages.at("n03") == "status=booted");
+}
+
+TEST_CASE("the status is cleared before the nodes are reset")
+{
+    class FakeIPMI final : public cloyster::services::ipmi::IPMIBackend {
+    public:
+        using Replies = std::vector<cloyster::services::ipmi::Reply>;
+        using Endpoints
+            = std::span<const cloyster::services::ipmi::Endpoint>;
+
+        std::vector<std::string> hosts;
+
+        Replies powerState(Endpoints bmcs) override
+        {
+            return Replies(bmcs.size());
+        }
+        Replies chassisControl(Endpoints bmcs,
+            cloyster::services::ipmi::ChassisControl /*control*/) override
+        {
+            return Replies(bmcs.size());
+        }
+        Replies setBootDevice(Endpoints bmcs,
+            cloyster::services::ipmi::BootDevice /*device*/,
+            bool /*persistent*/) override
+        {
+            return Replies(bmcs.size());
+        }
+        Replies netboot(Endpoints bmcs) override
+        {
+            for (const auto& bmc : bmcs) {
+                hosts.push_back(bmc.host);
+            }
+            return Replies(bmcs.size());
+        }
+    };
+
+    using cloyster::services::IRunner;
+    using cloyster::services::MockRunner;
+    cloyster::Singleton<cloyster::services::Options>::init(
+        std::make_unique<cloyster::services::Options>());
+    cloyster::Singleton<IRunner>::init(
+        std::unique_ptr<IRunner>(std::make_unique<MockRunner>()));
+    const auto* runner
+        = dynamic_cast<MockRunner*>(cloyster::Singleton<IRunner>::get().get());
+
+    FakeIPMI ipmi;
+    NativeBackend backend(ipmi,
+        { { "n1", { .host = "10.0.0.1" } },
+            { "n2", { .host = "10.0.0.2" } } });
+    const auto errors = backend.netboot({ "n1", "n2", "n3" });
+
+    CHECK(errors.size() == 1);
+    CHECK(errors.contains("n3"));
+    CHECK(ipmi.hosts == std::vector<std::string> { "10.0.0.1", "10.0.0.2" });
+    REQUIRE(!runner->listCommands().empty());
+    CHECK(runner->listCommands().front() == "chdef -t node -o n1,n2 status=");
+}
+
+TEST_SUITE_END();
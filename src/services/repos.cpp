@@ -4,6 +4,10 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <exception>
 #include <filesystem>
 #include <fmt/core.h>
 #include <fstream>
@@ -11,11 +15,15 @@
 #include <iterator>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <ranges>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -34,6 +42,7 @@
 #include <cloysterhpc/services/osservice.h>
 #include <cloysterhpc/services/repos.h>
 #include <cloysterhpc/services/runner.h>
+#include <cloysterhpc/tests.h>
 
 #ifdef BUILD_TESTING
 #include <doctest/doctest.h>
@@ -238,6 +247,8 @@ class RPMRepositoryFile final {
 
     // @FIXME: Double check if this is required to be shared_ptr
     std::map<std::string, std::shared_ptr<RPMRepository>> m_repos;
+    // A repository changed since the file was loaded or saved
+    bool m_dirty = false;
 
 public:
     explicit RPMRepositoryFile(auto path)
@@ -259,11 +270,30 @@ public:
 
     auto repo(const std::string& name) { return m_repos.at(name); }
 
+    // Enable/disable a repository, the file is written by flush()
+    void enable(const std::string& name, bool value)
+    {
+        auto& repo = m_repos.at(name);
+        if (repo->enabled() != value) {
+            repo->enabled(value);
+            m_dirty = true;
+        }
+    }
+
     void save() const
     {
         LOG_DEBUG("Saving {}", m_path.string());
         RPMRepositoryParser::unparse(m_repos, m_path);
     }
+
+    // Saves the file if a repository changed since it was loaded
+    void flush()
+    {
+        if (m_dirty) {
+            save();
+            m_dirty = false;
+        }
+    }
 };
 
 TEST_SUITE_BEGIN("cloyster::services::repos");
@@ -280,7 +310,96 @@ struct DefaultMirrorExistenceChecker final {
 
     [[nodiscard]] static bool urlExists(const std::string& url)
     {
-        return cloyster::functions::getHttpStatus(url) == "200";
+        std::unique_lock lock(mutex());
+        if (const auto cached = cache().find(url); cached != cache().end()) {
+            return cached->second;
+        }
+        lock.unlock();
+
+        const bool exists = cloyster::functions::getHttpStatus(url) == "200";
+        lock.lock();
+        if (remembering()) {
+            cache()[url] = exists;
+        }
+        return exists;
+    }
+
+    // Probe many URLs concurrently and keep the answers, so the urlExists
+    // calls done while assembling the repositories do not hit the network
+    static void prefetch(const std::vector<std::string>& urls)
+    {
+        std::vector<std::string> missing;
+        {
+            std::scoped_lock lock(mutex());
+            if (!remembering()) {
+                return;
+            }
+            for (const auto& url : urls) {
+                if (!cache().contains(url)) {
+                    missing.push_back(url);
+                }
+            }
+        }
+        if (missing.empty()) {
+            return;
+        }
+
+        LOG_DEBUG("Prefetching the status of {} URLs", missing.size());
+        const auto statuses = cloyster::functions::getHttpStatuses(missing);
+        std::scoped_lock lock(mutex());
+        for (const auto& [url, status] : statuses) {
+            cache()[url] = status == "200";
+        }
+    }
+
+    // The answers are only kept while remembering, during a RepoGenerator
+    // run, so a mirror that comes back or goes away is seen by the next one
+    static void remember(bool enabled)
+    {
+        std::scoped_lock lock(mutex());
+        cache().clear();
+        remembering() = enabled;
+    }
+
+private:
+    static std::unordered_map<std::string, bool>& cache()
+    {
+        static std::unordered_map<std::string, bool> urls;
+        return urls;
+    }
+
+    static bool& remembering()
+    {
+        static bool enabled = false;
+        return enabled;
+    }
+
+    static std::mutex& mutex()
+    {
+        static std::mutex mtx;
+        return mtx;
+    }
+};
+
+/**
+ * @brief Makes @p Checker remember the URLs it probed while alive, for the
+ *   checkers that can
+ */
+template <typename Checker>
+struct CheckerCache final {
+    CheckerCache() { remember(true); }
+    ~CheckerCache() { remember(false); }
+    CheckerCache(const CheckerCache&) = delete;
+    CheckerCache& operator=(const CheckerCache&) = delete;
+    CheckerCache(CheckerCache&&) = delete;
+    CheckerCache& operator=(CheckerCache&&) = delete;
+
+private:
+    static void remember(bool enabled)
+    {
+        if constexpr (requires { Checker::remember(enabled); }) {
+            Checker::remember(enabled);
+        }
     }
 };
 
@@ -383,6 +502,11 @@ struct MirrorRepo final {
         return std::string(url.substr(std::string_view("file://").length()));
     }
 
+    [[nodiscard]] std::string repomdUrl() const
+    {
+        return baseurl() + "/repodata/repomd.xml";
+    }
+
     [[nodiscard]] bool exists() const
     {
         if (paths.repo.empty()) {
@@ -392,7 +516,7 @@ struct MirrorRepo final {
         if (isLocalUrl(opts->mirrorBaseUrl)) {
             return MirrorExistenceChecker::pathExists(localPath(baseurl()));
         } else {
-            return MirrorExistenceChecker::urlExists(baseurl() + "/repodata/repomd.xml");
+            return MirrorExistenceChecker::urlExists(repomdUrl());
         }
     }
 };
@@ -444,9 +568,14 @@ struct UpstreamRepo final {
         return paths.gpgkey;
     };
 
+    [[nodiscard]] std::string repomdUrl() const
+    {
+        return baseurl() + "/repodata/repomd.xml";
+    }
+
     [[nodiscard]] constexpr bool exists() const
     {
-        return MirrorExistenceChecker::urlExists(baseurl() + "/repodata/repomd.xml");
+        return MirrorExistenceChecker::urlExists(repomdUrl());
     };
 
     [[nodiscard]] constexpr std::optional<std::string> gpgkey() const
@@ -875,49 +1004,167 @@ TEST_CASE("RepoConfigParser")
 // Installs and enable/disable RPM repositories
 class RPMRepoManager final {
     static constexpr auto m_parser = RPMRepositoryParser();
-    // Maps repo id to files
-    std::map<std::string, std::shared_ptr<RPMRepositoryFile>> m_filesIdx;
 
-public:
-    static constexpr std::string_view basedir = "/etc/yum.repos.d/";
+    struct Entry final {
+        std::shared_ptr<RPMRepository> repo;
+        // Position of the file in m_files
+        std::size_t file;
+    };
 
-    // Installs a single .repo file
-    void install(const std::filesystem::path& source)
+    // Files in the order they were loaded, a file installed again replaces
+    // the previous one
+    std::vector<RPMRepositoryFile> m_files;
+    // Every repository, the first file defining an id wins
+    std::vector<Entry> m_repos;
+    // Maps repo id to its position in m_repos
+    std::unordered_map<std::string, std::size_t> m_index;
+    // Where the .repo files are installed
+    std::filesystem::path m_basedir { basedir };
+
+    // Parses the files on a few threads, keeping their order
+    static std::vector<RPMRepositoryFile> parse(
+        const std::vector<std::filesystem::path>& paths)
+    {
+        std::vector<std::optional<RPMRepositoryFile>> parsed(paths.size());
+        const auto threads = static_cast<unsigned>(
+            std::min<std::size_t>(std::min(8U,
+                                      std::max(1U,
+                                          std::thread::hardware_concurrency())),
+                std::max<std::size_t>(1, paths.size())));
+
+        std::atomic<std::size_t> next = 0;
+        std::mutex mutex;
+        std::exception_ptr error;
+        {
+            std::vector<std::jthread> workers;
+            for (unsigned i = 0; i < threads; ++i) {
+                workers.emplace_back([&] {
+                    try {
+                        for (auto index = next++; index < paths.size();
+                            index = next++) {
+                            LOG_TRACE("Loading {}", paths[index].string());
+                            parsed[index].emplace(paths[index]);
+                        }
+                    } catch (...) {
+                        const std::scoped_lock lock(mutex);
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                        next = paths.size();
+                    }
+                });
+            }
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return parsed
+            | std::views::transform([](auto& file) { return std::move(*file); })
+            | std::ranges::to<std::vector>();
+    }
+
+    // Adds the files to the table, replacing the ones with the same path
+    void add(std::vector<RPMRepositoryFile>&& files)
     {
-        const auto& dest = basedir / source.filename();
-        const auto opts
-            = cloyster::Singleton<cloyster::services::Options>::get();
+        for (auto& file : files) {
+            LOG_ASSERT(file.repos().size() > 0, "BUG Loading file");
+            auto loaded = std::ranges::find_if(m_files,
+                [&](auto& other) { return other.path() == file.path(); });
+            if (loaded != m_files.end()) {
+                *loaded = std::move(file);
+            } else {
+                m_files.push_back(std::move(file));
+            }
+        }
+        reindex();
+    }
+
+    void reindex()
+    {
+        m_repos.clear();
+        m_index.clear();
+        for (std::size_t position = 0; position < m_files.size(); ++position) {
+            for (const auto& [id, repo] : m_files[position].repos()) {
+                if (m_index.try_emplace(id, m_repos.size()).second) {
+                    LOG_TRACE("{} loaded", id);
+                    m_repos.push_back({ .repo = repo, .file = position });
+                }
+            }
+        }
+    }
+
+    // Copies @p source to the basedir, returning where it was copied
+    std::filesystem::path copyToBasedir(
+        const std::filesystem::path& source) const
+    {
+        const auto dest = m_basedir / source.filename();
 
         // Do not copy the file to the basedir if it
         // is already there
         if (source != dest) {
             cloyster::functions::copyFile(source, dest);
         }
+        return dest;
+    }
+
+    const Entry& entry(const std::string& repoName) const
+    {
+        const auto found = m_index.find(repoName);
+        if (found == m_index.end()) {
+            throw std::out_of_range(repoName);
+        }
+        return m_repos[found->second];
+    }
+
+public:
+    static constexpr std::string_view basedir = "/etc/yum.repos.d/";
+
+    RPMRepoManager() = default;
+    // Manages the .repo files of @p dir instead of the basedir
+    explicit RPMRepoManager(std::filesystem::path dir)
+        : m_basedir(std::move(dir))
+    {
+    }
+
+    // Installs a single .repo file
+    void install(const std::filesystem::path& source)
+    {
+        install(std::vector { source });
+    }
+
+    // Installs .repo files, parsing them at the same time
+    void install(const std::vector<std::filesystem::path>& sources)
+    {
+        const auto opts
+            = cloyster::Singleton<cloyster::services::Options>::get();
+        auto paths = sources
+            | std::views::transform(
+                [this](const auto& source) { return copyToBasedir(source); })
+            | std::ranges::to<std::vector>();
 
         if (opts->dryRun) {
-            LOG_INFO("Dry Run: Would open {}", dest.string());
+            for (const auto& path : paths) {
+                LOG_INFO("Dry Run: Would open {}", path.string());
+            }
             return;
         }
 
-        const auto& repofile
-            = std::make_shared<RPMRepositoryFile>(RPMRepositoryFile(dest));
-        LOG_ASSERT(repofile->repos().size() > 0, "BUG Loading file");
-        for (auto& [repo, _] : repofile->repos()) {
-            LOG_TRACE("{} loaded", repo);
-            m_filesIdx.emplace(repo, repofile);
-        }
+        add(parse(paths));
     }
 
     // Install all .repo files inside a folder
     void install(std::filesystem::directory_iterator&& dirIter)
     {
+        std::vector<std::filesystem::path> paths;
         for (const auto& fil : std::move(dirIter)) {
-            std::string fname = fil.path().filename().string();
-            if (fname.ends_with(".repo")) {
-                LOG_TRACE("Loading {}", fname);
-                install(fil);
+            if (fil.path().filename().string().ends_with(".repo")) {
+                paths.push_back(fil.path());
             }
         }
+        // Keep the first file defining a repository id stable
+        std::ranges::sort(paths);
+        install(paths);
     }
 
     // Install all .repos files inside a folder
@@ -933,25 +1180,24 @@ public:
         install(std::filesystem::directory_iterator(path));
     }
 
-    void loadBaseDir() { loadDir(basedir); }
+    void loadBaseDir() { loadDir(m_basedir); }
 
-    auto repo(const std::string& repoName)
+    auto repo(const std::string& repoName) const
     {
-        try {
-            auto repoFile = m_filesIdx.at(repoName);
-            auto repoObj = repoFile->repo(repoName);
-            return std::make_unique<const RPMRepository>(
-                *repoObj); // copy to unique ptr
-        } catch (const std::out_of_range& e) {
-            auto repos = m_filesIdx
+        const auto found = m_index.find(repoName);
+        if (found == m_index.end()) {
+            auto repos = m_repos
                 | std::views::transform(
-                    [](const auto& pair) { return pair.first; });
+                    [](const auto& entry) { return entry.repo->id(); });
             auto msg
                 = fmt::format("Cannot find repository {}, no such repository "
                               "loaded, repositories: available: {}",
                     repoName, fmt::join(repos, ","));
             throw std::runtime_error(msg);
         }
+        // copy to unique ptr
+        return std::make_unique<const RPMRepository>(
+            *m_repos[found->second].repo);
     }
 
     static std::vector<std::unique_ptr<const IRepository>> repoFile(
@@ -976,71 +1222,115 @@ public:
     }
 
     // Enable/disable a repository by name
-    void enable(const auto& repo, bool value)
-    {
-        if (value) {
-            LOG_DEBUG("Enabling RPM repo {}", repo);
-        } else {
-            LOG_DEBUG("Disabling RPM repo {}", repo);
-        }
-        auto& repofile = m_filesIdx.at(repo);
-        repofile->repo(repo)->enabled(value);
-        repofile->save();
-    }
-
-    // Enable a repo but dot not save the repofile, (used internally)
-    void enable(const auto& repo, auto& repofile, bool value)
+    void enable(const std::string& repo, bool value)
     {
         LOG_DEBUG("{} RPM repo {}", value ? "Enabling" : "Disabling", repo);
-        repofile->repo(repo)->enabled(value);
+        auto& repofile = m_files[entry(repo).file];
+        repofile.enable(repo, value);
+        repofile.flush();
     }
 
-    // Enable/disable multiple repositories by name
+    // Enable/disable multiple repositories by name, each file changed is
+    // written once, at the end
     void enable(const std::vector<std::string>& repos, bool value)
     {
-        auto byIdPtr = [](const std::shared_ptr<RPMRepositoryFile>& rptr) {
-            return std::hash<std::string> {}(rptr->path());
-        };
-        std::unordered_set<std::shared_ptr<RPMRepositoryFile>,
-            decltype(byIdPtr)>
-            toSave;
         for (const auto& repo : repos) {
+            LOG_DEBUG(
+                "{} RPM repo {}", value ? "Enabling" : "Disabling", repo);
             try {
-                auto& rfile = m_filesIdx.at(repo);
-                toSave.emplace(rfile);
-                enable(repo, rfile, value);
+                const auto& found = entry(repo);
+                m_files[found.file].enable(repo, value);
             } catch (const std::out_of_range&) {
                 cloyster::functions::abort("Trying to enable unknown repository {}, "
                           "failed because the repository was not found.",
                     repo);
             }
         }
-        for (const auto& repoFil : toSave) {
-            repoFil->save();
+        for (auto& file : m_files) {
+            file.flush();
         }
     }
 
     // List repositories through a const unique pointer vector
     //
     // Rationale: IRepository type is to keep client code generic
-    std::vector<std::unique_ptr<const IRepository>> repos()
+    std::vector<std::unique_ptr<const IRepository>> repos() const
     {
-        // Function to iterate over map by id
-        constexpr auto byId
-            = [](auto& repo) { return std::hash<std::string> {}(repo.id()); };
+        return m_repos | std::views::transform([](const auto& entry) {
+            return std::make_unique<const RPMRepository>(*entry.repo);
+        }) | std::ranges::to<std::vector<std::unique_ptr<const IRepository>>>();
+    }
+};
+
+TEST_CASE("RPMRepoManager")
+{
+    namespace fs = std::filesystem;
+    cloyster::Singleton<Options>::init(std::make_unique<Options>(Options {}));
+
+    const cloyster::tests::TemporaryDirectory temporary;
+    const auto& dir = temporary.path;
 
-        std::unordered_set<RPMRepository, decltype(byId)> output;
-        for (auto& [_id1, repoFile] : m_filesIdx) {
-            for (const auto& [_id2, repo] : repoFile->repos()) {
-                output.emplace(*repo); // copy
+    const auto stanza = [](std::string_view id, std::string_view name) {
+        return fmt::format("[{}]\nname={}\nbaseurl=https://example.com/{}/\n"
+                           "enabled=0\ngpgcheck=0\n\n",
+            id, name, id);
+    };
+    // More files than parsing threads, "shared" is defined twice and the
+    // later file is written first
+    constexpr std::size_t count = 12;
+    for (std::size_t i = count; i-- > 0;) {
+        std::string contents = stanza(fmt::format("repo-{:02}", i), "Repo");
+        if (i == 3 || i == 7) {
+            contents += stanza("shared", fmt::format("From {:02}", i));
+        }
+        std::ofstream(dir / fmt::format("{:02}.repo", i)) << contents;
+    }
+    std::ofstream(dir / "ignored.conf") << stanza("ignored", "Ignored");
+
+    RPMRepoManager manager(dir);
+    manager.loadBaseDir();
+
+    CHECK(manager.repos().size() == count + 1);
+    CHECK_THROWS(manager.repo("ignored"));
+    // The first file in path order wins
+    CHECK(manager.repo("shared")->name() == "From 03");
+    CHECK(manager.repo("shared")->source() == (dir / "03.repo").string());
+
+    // Only the files written since age() have a newer time
+    const auto past = fs::file_time_type::clock::now() - std::chrono::hours(1);
+    const auto written = [&]() {
+        std::set<std::string> files;
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto path = dir / fmt::format("{:02}.repo", i);
+            if (fs::last_write_time(path) != past) {
+                files.insert(path.filename().string());
             }
         }
+        return files;
+    };
+    const auto age = [&]() {
+        for (std::size_t i = 0; i < count; ++i) {
+            fs::last_write_time(dir / fmt::format("{:02}.repo", i), past);
+        }
+    };
 
-        return output | std::views::transform([](auto&& repo) {
-            return std::make_unique<const RPMRepository>(repo);
-        }) | std::ranges::to<std::vector<std::unique_ptr<const IRepository>>>();
-    }
-};
+    age();
+    manager.enable(std::vector<std::string> { "repo-01", "shared", "repo-03",
+                       "repo-10", "repo-01" },
+        true);
+    CHECK(written()
+        == std::set<std::string> { "01.repo", "03.repo", "10.repo" });
+    CHECK(manager.repo("repo-01")->enabled());
+    CHECK(manager.repo("shared")->enabled());
+    CHECK(RPMRepositoryFile(dir / "03.repo").repo("shared")->enabled());
+    CHECK(!RPMRepositoryFile(dir / "07.repo").repo("shared")->enabled());
+    CHECK(RPMRepositoryFile(dir / "10.repo").repo("repo-10")->enabled());
+
+    // The files are clean once written, enabling them again writes nothing
+    age();
+    manager.enable(std::vector<std::string> { "repo-01", "repo-10" }, true);
+    CHECK(written().empty());
+}
 
 // Adpater for simplifying the conversion from RepoConfig
 // to RPMRepository and RPMRepositoryFiles, may do HTTP requests
@@ -1301,6 +1591,10 @@ struct RepoGenerator final {
     static std::size_t generate(const RepoConfFiles& conffiles,
         const OS& osinfo, const std::filesystem::path& path)
     {
+        // The checkers only remember the URLs for this run
+        const CheckerCache<MChecker> mirrorCache;
+        const CheckerCache<UChecker> upstreamCache;
+
         const auto existingRepoFiles
             = cloyster::functions::getFilesByExtension(path, ".repo");
         const auto &distroRepos = conffiles.distroRepos.filesnames();
@@ -1317,6 +1611,8 @@ struct RepoGenerator final {
             }
         }
 
+        prefetch(conffiles, reposToGenerate);
+
         std::vector<RPMRepositoryFile> repofiles = RepoConfAdapter<MChecker, UChecker>::fromConfFile(
                 conffiles.distroRepos, reposToGenerate, path);
         auto&& nonDistroRepositories = RepoConfAdapter<MChecker, UChecker>::fromConfFile(
@@ -1334,6 +1630,54 @@ struct RepoGenerator final {
         return repofiles.size();
     }
 
+    // Collect every URL RepoConfAdapter may check for the repositories
+    // being generated and hand them to the checkers in one batch, if they
+    // support it
+    static void prefetch(const RepoConfFiles& conffiles,
+        const std::vector<std::string>& reposToGenerate)
+    {
+        const auto opts = cloyster::Singleton<Options>::get();
+        std::vector<std::string> mirrorUrls;
+        std::vector<std::string> upstreamUrls;
+        for (const auto* conffile :
+            { &conffiles.distroRepos, &conffiles.nonDistroRepos }) {
+            for (const auto& [filename, configs] : conffile->files()) {
+                if (!cloyster::functions::isIn(reposToGenerate, filename)) {
+                    continue;
+                }
+
+                for (const auto& config : configs) {
+                    const MirrorRepo<MChecker> mirror { .paths = config.mirror };
+                    const UpstreamRepo<UChecker> upstream { .paths
+                        = config.upstream };
+                    if (!opts->disableMirrors && !config.mirror.repo.empty()
+                        && !MirrorRepo<MChecker>::isLocalUrl(
+                            opts->mirrorBaseUrl)) {
+                        mirrorUrls.push_back(mirror.repomdUrl());
+                    }
+                    upstreamUrls.push_back(upstream.repomdUrl());
+                    if (const auto gpgurl = upstream.gpgurl()) {
+                        upstreamUrls.push_back(gpgurl.value());
+                    }
+                }
+            }
+        }
+
+        if constexpr (std::same_as<MChecker, UChecker>) {
+            mirrorUrls.insert(
+                mirrorUrls.end(), upstreamUrls.begin(), upstreamUrls.end());
+            upstreamUrls.clear();
+        }
+        if constexpr (requires { MChecker::prefetch(mirrorUrls); }) {
+            MChecker::prefetch(mirrorUrls);
+        }
+        if constexpr (requires { UChecker::prefetch(upstreamUrls); }) {
+            if (!upstreamUrls.empty()) {
+                UChecker::prefetch(upstreamUrls);
+            }
+        }
+    }
+
     static std::size_t generate(
         const OS& osinfo,
         const RepoConfigVars& vars)
@@ -1478,6 +1822,55 @@ TEST_SUITE("repos urls")
             }
         }
     }
+
+    TEST_CASE("[slow] repo.conf urls in one batch")
+    {
+        using namespace cloyster::services;
+        cloyster::services::initializeSingletonsOptions(
+            std::make_unique<Options>(Options{}));
+        const auto repos = std::filesystem::path("./repos");
+        REQUIRE(cloyster::functions::exists(repos / "repos.conf"));
+        const auto confs = cloyster::functions::getFilesByExtension(repos, ".conf");
+        REQUIRE(confs.size() > 0);
+        using fmt::print;
+        std::vector<std::string> urls;
+        for (const auto& configStr : confs) {
+            RepoConfFile output = RepoConfigParser::parseTest(repos / configStr);
+            for (const auto& [repofile, configs] : output.files()) {
+                for (const auto& config : configs) {
+                    if (cloyster::functions::isIn(
+                        blacklistedFiles, config.repoId.filename)) {
+
+                        continue;
+                    }
+
+                    urls.push_back(config.upstream.repo + "repodata/repomd.xml");
+                    if (config.upstream.gpgkey) {
+                        urls.push_back(config.upstream.gpgkey.value());
+                    }
+
+                    if (cloyster::functions::isIn(
+                        blacklistedMirrorFiles, config.repoId.filename) ||
+                        config.mirror.repo.empty()) {
+                        continue;
+                    }
+
+                    urls.push_back("https://mirror.versatushpc.com.br/"
+                        + config.mirror.repo + "repodata/repomd.xml");
+                    if (config.mirror.gpgkey) {
+                        urls.push_back("https://mirror.versatushpc.com.br/"
+                            + config.mirror.gpgkey.value());
+                    }
+                }
+            }
+        }
+
+        const auto statuses = cloyster::functions::getHttpStatuses(urls);
+        for (const auto& url : urls) {
+            print("Checking {} {}\n", url, statuses.at(url));
+            CHECK(statuses.at(url) == "200");
+        }
+    }
 }
 }; // namespace cloyster::services::repos {
 
@@ -1672,8 +2065,22 @@ void RepoManager::install(const std::filesystem::path& path)
 
 void RepoManager::install(const std::vector<std::filesystem::path>& paths)
 {
-    for (const auto& repo : paths) {
-        install(repo);
+    for (const auto& path : paths) {
+        LOG_ASSERT(path.is_absolute(),
+            "RepoManager::install called with relative path");
+        LOG_ASSERT(path.has_filename(),
+            "RepoManager::install called with a directory?");
+        LOG_INFO("Installing repository {}", path.string());
+    }
+
+    auto osinfo
+        = cloyster::Singleton<models::Cluster>::get()->getHeadnode().getOS();
+    switch (osinfo.getPackageType()) {
+        case OS::PackageType::RPM:
+            m_impl->rpm.install(paths);
+            break;
+        default:
+            throw std::logic_error("Not implemented");
     }
 }
 
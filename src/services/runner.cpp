@@ -1,27 +1,86 @@
 #include <cloysterhpc/const.h>
 #include <cloysterhpc/functions.h>
+#include <cloysterhpc/services/cancellation.h>
+#include <cloysterhpc/services/downloader.h>
+#include <cloysterhpc/services/http.h>
 #include <cloysterhpc/services/log.h>
 #include <cloysterhpc/services/options.h>
 #include <cloysterhpc/services/runner.h>
 #include <cloysterhpc/services/files.h>
+#include <cloysterhpc/tests.h>
 
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <span>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/process/extend.hpp>
 #include <fmt/format.h>
 #include <ranges>
 
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+using cloyster::services::CancellationToken;
+using cloyster::services::CommandCancelledError;
 using cloyster::services::CommandProxy;
+using cloyster::services::CommandTimeoutError;
+using cloyster::services::ScopedTimeout;
 using cloyster::services::Stream;
+using cloyster::services::process::deadlineAfter;
+using cloyster::services::process::terminateGroup;
+using cloyster::services::process::waitFor;
+using Clock = std::chrono::steady_clock;
 
 namespace {
 
-std::tuple<bool, std::optional<std::string>> retrieveLine(
-    boost::process::ipstream& pipe_stream,
-    const std::function<std::string(boost::process::ipstream&)>& linecheck)
+constexpr std::size_t readChunkSize = 64 * 1024;
+
+thread_local std::optional<std::chrono::milliseconds> scopedTimeout;
+
+// Every command leads its own process group, so a timeout or a cancellation
+// also reaches whatever the command started
+const auto newProcessGroup = boost::process::extend::on_exec_setup(
+    [](auto& /*executor*/) { ::setpgid(0, 0); });
+
+// Throws if the command has to stop now, after killing its process group
+void checkInterrupted(boost::process::child& child, const std::string& command,
+    std::chrono::milliseconds timeout, Clock::time_point deadline)
 {
-    if (pipe_stream.good()) {
-        return make_tuple(true, make_optional(linecheck(pipe_stream)));
+    if (CancellationToken::global().cancelled()) {
+        LOG_WARN("Cancelling command: {}", command)
+        terminateGroup(child);
+        throw CommandCancelledError(command);
     }
+    if (Clock::now() >= deadline) {
+        LOG_WARN("Command timed out after {}ms: {}", timeout.count(), command)
+        terminateGroup(child);
+        throw CommandTimeoutError(command, timeout);
+    }
+}
 
-    return make_tuple(pipe_stream.good(), std::nullopt);
+// Readable once the child exits, -1 where pidfds are not supported
+int openPidfd(const boost::process::child& child)
+{
+    return static_cast<int>(::syscall(SYS_pidfd_open, child.id(), 0));
 }
 
 CommandProxy runCommandIter(
@@ -30,42 +89,92 @@ CommandProxy runCommandIter(
     auto opts = cloyster::Singleton<cloyster::services::Options>::get();
     if (!opts->dryRun || overrideDryRun) {
         LOG_DEBUG("Running interative command: {}", command)
-        boost::process::ipstream pipe_stream;
-
-        if (out == Stream::Stderr) {
-            boost::process::child child(
-                command, boost::process::std_err > pipe_stream);
-            return CommandProxy { .valid = true,
-                .child = std::move(child),
-                .pipe_stream = std::move(pipe_stream) };
-
-        } else {
-            boost::process::child child(
-                command, boost::process::std_out > pipe_stream);
-            return CommandProxy { .valid = true,
-                .child = std::move(child),
-                .pipe_stream = std::move(pipe_stream) };
+        if (CancellationToken::global().cancelled()) {
+            throw CommandCancelledError(command);
         }
+        boost::process::pipe stdoutPipe;
+        boost::process::pipe stderrPipe;
+        boost::process::child child(command,
+            boost::process::std_out > stdoutPipe,
+            boost::process::std_err > stderrPipe, newProcessGroup);
+        return CommandProxy(command, std::move(child), std::move(stdoutPipe),
+            std::move(stderrPipe), out, ScopedTimeout::current());
     }
 
     return CommandProxy {};
 }
 
-int runCommand(const std::string& command, std::list<std::string>& output,
-    bool overrideDryRun)
+int runCommand(const std::string& command,
+    cloyster::services::OutputBuffer& output, bool overrideDryRun,
+    std::chrono::milliseconds timeout = ScopedTimeout::current())
 {
     auto opts = cloyster::Singleton<cloyster::services::Options>::get();
     if (!opts->dryRun || overrideDryRun) {
         LOG_DEBUG("Running command: {}", command)
-        boost::process::ipstream pipe_stream;
+        auto& token = CancellationToken::global();
+        if (token.cancelled()) {
+            throw CommandCancelledError(command);
+        }
+
+        const auto deadline = deadlineAfter(timeout);
+        boost::process::pipe pipe;
         boost::process::child child(
-            command, boost::process::std_out > pipe_stream);
+            command, boost::process::std_out > pipe, newProcessGroup);
+        const int pidfd = openPidfd(child);
+
+        // Wait for the output, the exit, the token and the deadline at once.
+        // Negative descriptors are ignored by poll.
+        std::array<pollfd, 3> fds {
+            pollfd { .fd = pipe.native_source(), .events = POLLIN },
+            pollfd { .fd = token.fd(), .events = POLLIN },
+            pollfd { .fd = pidfd, .events = POLLIN },
+        };
 
-        std::string line;
+        // Read straight into the buffer arena, no intermediate strings
+        const auto first = output.size();
+        bool exited = false;
+        try {
+            while (fds[0].fd != -1 || (pidfd != -1 && !exited)) {
+                const int count = ::poll(fds.data(), fds.size(), waitFor(deadline));
+                if (count == -1 && errno != EINTR) {
+                    throw std::system_error(errno, std::system_category(), "poll");
+                }
+                checkInterrupted(child, command, timeout, deadline);
+                if (count <= 0) {
+                    continue;
+                }
 
-        while (pipe_stream && std::getline(pipe_stream, line)) {
+                // The pidfd stays readable once the child exits, polling it
+                // again would spin while a grandchild keeps stdout open
+                if (fds[2].revents != 0) {
+                    exited = true;
+                    fds[2].fd = -1;
+                }
+                if (fds[0].revents == 0) {
+                    continue;
+                }
+                auto span = output.prepare(readChunkSize);
+                const auto size = ::read(fds[0].fd, span.data(), span.size());
+                if (size > 0) {
+                    output.commit(static_cast<std::size_t>(size));
+                } else if (size == 0) {
+                    fds[0].fd = -1;
+                } else if (errno != EINTR) {
+                    throw std::system_error(errno, std::system_category(), "read");
+                }
+            }
+        } catch (...) {
+            if (pidfd != -1) {
+                ::close(pidfd);
+            }
+            throw;
+        }
+        if (pidfd != -1) {
+            ::close(pidfd);
+        }
+
+        for (const auto line : output.lines() | std::views::drop(first)) {
             LOG_TRACE("{}", line)
-            output.emplace_back(line);
         }
 
         child.wait();
@@ -77,54 +186,367 @@ int runCommand(const std::string& command, std::list<std::string>& output,
     }
 }
 
+int runCommand(const std::string& command, std::list<std::string>& output,
+    bool overrideDryRun)
+{
+    cloyster::services::OutputBuffer buffer;
+    const int exitCode = runCommand(command, buffer, overrideDryRun);
+    for (const auto line : buffer.lines()) {
+        output.emplace_back(line);
+    }
+    return exitCode;
+}
+
 int runCommand(const std::string& command, bool overrideDryRun)
 {
-    std::list<std::string> output;
+    cloyster::services::OutputBuffer output;
     return runCommand(command, output, overrideDryRun);
 }
 
+std::size_t batchWorkers(std::size_t concurrency, std::size_t commands)
+{
+    if (concurrency == 0) {
+        concurrency = std::max(1U, std::thread::hardware_concurrency());
+    }
+    return std::clamp<std::size_t>(concurrency, 1, commands);
+}
+
 }; // namespace {
 
 namespace cloyster::services {
 
-std::optional<std::string> CommandProxy::getline()
+namespace process {
+
+    Clock::time_point deadlineAfter(std::chrono::milliseconds timeout)
+    {
+        return timeout > std::chrono::milliseconds::zero()
+            ? Clock::now() + timeout
+            : Clock::time_point::max();
+    }
+
+    int waitFor(Clock::time_point deadline)
+    {
+        if (deadline == Clock::time_point::max()) {
+            return -1;
+        }
+        const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+            deadline - Clock::now());
+        return static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(
+            remaining.count(), 0, std::numeric_limits<int>::max()));
+    }
+
+    void terminateGroup(boost::process::child& child)
+    {
+        const auto group = static_cast<pid_t>(child.id());
+        ::killpg(group, SIGTERM);
+
+        const auto giveUp = Clock::now() + terminateGracePeriod;
+        while (child.running() && Clock::now() < giveUp) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+
+        // The group outlives its leader while any member is alive
+        ::killpg(group, SIGKILL);
+        if (child.running()) {
+            child.wait();
+        }
+    }
+
+} // namespace process
+
+CommandTimeoutError::CommandTimeoutError(
+    const std::string& command, std::chrono::milliseconds timeout)
+    : std::runtime_error(fmt::format(
+          "ERROR: Command timed out after {}ms '{}'", timeout.count(), command))
 {
+}
+
+CommandCancelledError::CommandCancelledError(const std::string& command)
+    : std::runtime_error(
+          fmt::format("ERROR: Command cancelled '{}'", command))
+{
+}
+
+ScopedTimeout::ScopedTimeout(std::chrono::milliseconds timeout)
+    : m_previous(std::exchange(scopedTimeout, timeout))
+{
+}
+
+ScopedTimeout::~ScopedTimeout() { scopedTimeout = m_previous; }
+
+std::chrono::milliseconds ScopedTimeout::current()
+{
+    if (scopedTimeout) {
+        return *scopedTimeout;
+    }
+    return std::chrono::seconds(
+        cloyster::Singleton<Options>::get()->commandTimeout);
+}
+
+void IRunner::checkBatch(
+    const std::vector<std::string>& cmds, std::size_t concurrency)
+{
+    const auto results = executeBatch(cmds, concurrency);
+    std::vector<std::string> failed;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        if (results[i].exitCode != 0) {
+            failed.push_back(cmds[i]);
+        }
+    }
+
+    if (!failed.empty()) {
+        throw std::runtime_error(fmt::format(
+            "ERROR: {} of {} commands failed: '{}'", failed.size(),
+            cmds.size(), fmt::join(failed, "', '")));
+    }
+}
 
-    if (!valid)
+std::future<CommandResult> IRunner::submit(const std::string& cmd)
+{
+    std::promise<CommandResult> promise;
+    try {
+        promise.set_value(std::move(executeBatch({ cmd }, 1).front()));
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+    return promise.get_future();
+}
+
+CommandProxy::CommandProxy(std::string command, boost::process::child&& child,
+    boost::process::pipe&& out, boost::process::pipe&& err, Stream follow,
+    std::chrono::milliseconds timeout)
+    : m_command(std::move(command))
+    , m_child(std::move(child))
+    , m_deadline(deadlineAfter(timeout))
+    , m_timeout(timeout)
+    , m_follow(follow)
+{
+    m_channels[0].pipe = std::move(out);
+    m_channels[1].pipe = std::move(err);
+
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll == -1) {
+        throw std::system_error(errno, std::system_category(), "epoll_create1");
+    }
+
+    for (std::uint32_t index = 0; index < m_channels.size(); ++index) {
+        auto& channel = m_channels[index];
+        const int fd = channel.pipe.native_source();
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+            throw std::system_error(
+                errno, std::system_category(), "fcntl(O_NONBLOCK)");
+        }
+
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.u32 = index;
+        if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+            throw std::system_error(errno, std::system_category(), "epoll_ctl");
+        }
+
+        channel.buffer = std::make_unique_for_overwrite<char[]>(bufferSize);
+        channel.open = true;
+    }
+
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.u32 = tokenEvent;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, CancellationToken::global().fd(),
+            &event)
+        == -1) {
+        throw std::system_error(errno, std::system_category(), "epoll_ctl");
+    }
+}
+
+CommandProxy::CommandProxy(CommandProxy&& other) noexcept
+    : m_command(std::move(other.m_command))
+    , m_child(std::move(other.m_child))
+    , m_channels(std::move(other.m_channels))
+    , m_epoll(std::exchange(other.m_epoll, -1))
+    , m_deadline(other.m_deadline)
+    , m_timeout(other.m_timeout)
+    , m_follow(other.m_follow)
+    , m_pending(other.m_pending)
+    , m_pendingSize(std::exchange(other.m_pendingSize, 0))
+    , m_exitCode(other.m_exitCode)
+{
+}
+
+CommandProxy& CommandProxy::operator=(CommandProxy&& other) noexcept
+{
+    if (this != &other) {
+        if (m_epoll != -1) {
+            ::close(m_epoll);
+        }
+        m_command = std::move(other.m_command);
+        m_child = std::move(other.m_child);
+        m_channels = std::move(other.m_channels);
+        m_epoll = std::exchange(other.m_epoll, -1);
+        m_deadline = other.m_deadline;
+        m_timeout = other.m_timeout;
+        m_follow = other.m_follow;
+        m_pending = other.m_pending;
+        m_pendingSize = std::exchange(other.m_pendingSize, 0);
+        m_exitCode = other.m_exitCode;
+    }
+    return *this;
+}
+
+CommandProxy::~CommandProxy()
+{
+    if (m_epoll != -1) {
+        ::close(m_epoll);
+    }
+}
+
+std::optional<CommandProxy::Line> CommandProxy::takeLine(
+    std::size_t index, char delimiter)
+{
+    auto& channel = m_channels[index];
+    const std::string_view data(
+        channel.buffer.get() + channel.begin, channel.end - channel.begin);
+    if (data.empty()) {
         return std::nullopt;
+    }
 
-    auto [new_valid, out_line]
-        = retrieveLine(pipe_stream, [this](boost::process::ipstream& pipe) {
-              if (std::string line = ""; std::getline(pipe, line)) {
-                  return line;
-              }
+    std::size_t size = data.find(delimiter);
+    std::size_t consumed = size + 1;
+    if (size == std::string_view::npos) {
+        // Either the last line without a line break, or a line that does
+        // not fit the buffer
+        if (channel.open && data.size() < bufferSize) {
+            return std::nullopt;
+        }
+        size = consumed = data.size();
+    }
+
+    m_pending = index;
+    m_pendingSize = consumed;
+    return Line { .stream = static_cast<Stream>(index),
+        .text = data.substr(0, size) };
+}
 
-              valid = false;
-              return std::string {};
-          });
+void CommandProxy::fill(Channel& channel)
+{
+    if (channel.begin > 0) {
+        std::memmove(channel.buffer.get(), channel.buffer.get() + channel.begin,
+            channel.end - channel.begin);
+        channel.end -= channel.begin;
+        channel.begin = 0;
+    }
 
-    valid = new_valid;
-    return out_line;
+    const int fd = channel.pipe.native_source();
+    while (channel.end < bufferSize) {
+        const auto size = ::read(
+            fd, channel.buffer.get() + channel.end, bufferSize - channel.end);
+        if (size > 0) {
+            channel.end += static_cast<std::size_t>(size);
+        } else if (size == 0) {
+            close(channel);
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else if (errno != EINTR) {
+            throw std::system_error(errno, std::system_category(), "read");
+        }
+    }
 }
 
-std::optional<std::string> CommandProxy::getUntil(char chr)
+void CommandProxy::close(Channel& channel)
+{
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, channel.pipe.native_source(), nullptr);
+    channel.pipe.close();
+    channel.open = false;
+}
+
+std::optional<CommandProxy::Line> CommandProxy::next(char delimiter)
 {
-    if (!valid) {
+    if (!valid()) {
         return std::nullopt;
     }
 
-    auto [new_valid, out_line] = retrieveLine(
-        pipe_stream, [this, chr](boost::process::ipstream& pipe) {
-            if (std::string line; std::getline(pipe, line, chr)) {
+    // The previous line is only dropped now, its view was valid until here
+    m_channels[m_pending].begin += std::exchange(m_pendingSize, 0);
+
+    while (true) {
+        // Start after the stream of the last line, so a chatty stream cannot
+        // starve the other one
+        for (std::size_t i = 1; i <= m_channels.size(); ++i) {
+            const auto index = (m_pending + i) % m_channels.size();
+            if (auto line = takeLine(index, delimiter)) {
                 return line;
             }
+        }
 
-            valid = false;
-            return std::string {};
-        });
+        if (std::ranges::none_of(
+                m_channels, [](const auto& channel) { return channel.open; })) {
+            if (!m_exitCode) {
+                m_child.wait();
+                m_exitCode = m_child.exit_code();
+                LOG_DEBUG("Exit code: {}", *m_exitCode)
+            }
+            return std::nullopt;
+        }
+
+        std::array<epoll_event, 3> events {};
+        const int count = epoll_wait(m_epoll, events.data(),
+            static_cast<int>(events.size()), waitFor(m_deadline));
+        if (count == -1 && errno != EINTR) {
+            throw std::system_error(errno, std::system_category(), "epoll_wait");
+        }
+        checkInterrupted(m_child, m_command, m_timeout, m_deadline);
+
+        for (const auto& event : std::span(events.data(), std::max(count, 0))) {
+            if (event.data.u32 != tokenEvent) {
+                fill(m_channels[event.data.u32]);
+            }
+        }
+    }
+}
+
+bool CommandProxy::ready() const
+{
+    if (!valid()) {
+        return true;
+    }
+
+    bool open = false;
+    for (std::size_t index = 0; index < m_channels.size(); ++index) {
+        const auto& channel = m_channels[index];
+        const auto begin
+            = channel.begin + (index == m_pending ? m_pendingSize : 0);
+        const std::string_view data(
+            channel.buffer.get() + begin, channel.end - begin);
+        if (data.contains('\n') || data.size() == bufferSize
+            || (!channel.open && !data.empty())) {
+            return true;
+        }
+        open = open || channel.open;
+    }
 
-    valid = new_valid;
-    return out_line;
+    return !open;
+}
+
+std::optional<std::string> CommandProxy::getFollowed(char delimiter)
+{
+    while (auto line = next(delimiter)) {
+        if (line->stream == m_follow) {
+            return std::string(line->text);
+        }
+        LOG_TRACE("{}", line->text)
+    }
+
+    return std::nullopt;
+}
+
+std::optional<std::string> CommandProxy::getline()
+{
+    return getFollowed('\n');
+}
+
+std::optional<std::string> CommandProxy::getUntil(char chr)
+{
+    return getFollowed(chr);
 }
 
 // Runner impl
@@ -138,6 +560,11 @@ int Runner::executeCommand(const std::string& cmd, std::list<std::string>& outpu
     return runCommand(cmd, output, true);
 }
 
+int Runner::executeCommand(const std::string& cmd, OutputBuffer& output)
+{
+    return runCommand(cmd, output, true);
+}
+
 int Runner::run(const ScriptBuilder& script)
 {
     std::string&& content = script.toString();
@@ -149,15 +576,42 @@ int Runner::run(const ScriptBuilder& script)
     return 0;
 }
 
-CommandProxy Runner::executeCommandIter(const std::string& cmd, Stream /*out*/)
+CommandProxy Runner::executeCommandIter(const std::string& cmd, Stream out)
 {
-    return CommandProxy {}; // Return an invalid CommandProxy
+    return runCommandIter(cmd, out, true);
 }
 
 int Runner::downloadFile(const std::string& url, const std::string& file)
 {
-    auto cmd = fmt::format("wget -NP {} {}", file, url);
-    return this->executeCommand(cmd);
+    // Same contract as wget -NP, file is the destination directory
+    const auto parsed = http::Url::parse(url);
+    if (!parsed) {
+        LOG_ERROR("Cannot download invalid URL {}", url)
+        return 1;
+    }
+    const auto path = parsed->target.substr(0, parsed->target.find('?'));
+    const auto name = path.substr(path.rfind('/') + 1);
+    const auto target
+        = std::filesystem::path(file) / (name.empty() ? "index.html" : name);
+
+    http::DownloadOptions options;
+    options.progressInterval = std::chrono::seconds(10);
+    options.progress = [&](const http::DownloadProgress& progress) {
+        LOG_INFO("Downloading {}: {:.1f}% at {:.1f} MiB/s", name,
+            progress.percent().value_or(0),
+            progress.bytesPerSecond / (1024 * 1024))
+    };
+
+    LOG_DEBUG("Downloading {} to {}", url, target.string())
+    try {
+        http::download(url, target, options);
+        return 0;
+    } catch (const CommandCancelledError&) {
+        throw;
+    } catch (const std::exception& ex) {
+        LOG_ERROR("Download of {} failed: {}", url, ex.what())
+        return 1;
+    }
 }
 
 void Runner::checkCommand(const std::string& cmd)
@@ -170,12 +624,59 @@ void Runner::checkCommand(const std::string& cmd)
 
 std::vector<std::string> Runner::checkOutput(const std::string& cmd)
 {
-    std::list<std::string> output;
+    return captureOutput(cmd).toVector();
+}
+
+OutputBuffer Runner::captureOutput(const std::string& cmd)
+{
+    OutputBuffer output;
     if (runCommand(cmd, output, false) != 0) {
         throw std::runtime_error(
             fmt::format("ERROR: Command failed '{}'", cmd));
     }
-    return output | std::ranges::to<std::vector>();
+    return output;
+}
+
+std::vector<CommandResult> Runner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t concurrency)
+{
+    std::vector<CommandResult> results(cmds.size());
+    if (cmds.empty()) {
+        return results;
+    }
+
+    const auto workers = batchWorkers(concurrency, cmds.size());
+    LOG_DEBUG("Running {} commands with {} workers", cmds.size(), workers);
+
+    // The workers do not see the timeout scoped to this thread
+    const auto timeout = ScopedTimeout::current();
+
+    // Each task only touches its own slot, so no locking is needed
+    std::vector<std::exception_ptr> errors(cmds.size());
+    boost::asio::thread_pool pool(workers);
+    for (std::size_t i = 0; i < cmds.size(); ++i) {
+        boost::asio::post(pool, [&, i]() {
+            try {
+                OutputBuffer output;
+                results[i].exitCode
+                    = runCommand(cmds[i], output, true, timeout);
+                results[i].output = output.toVector();
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    pool.join();
+
+    // Behave like executeCommand in a loop, but only after every command
+    // had its chance to run
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    return results;
 }
 
 int DryRunner::executeCommand(const std::string& cmd)
@@ -189,6 +690,12 @@ int DryRunner::executeCommand(const std::string& cmd, std::list<std::string>& ou
     return 0;
 }
 
+int DryRunner::executeCommand(
+    const std::string& /*cmd*/, OutputBuffer& /*output*/)
+{
+    return 0;
+}
+
 void DryRunner::checkCommand(const std::string& cmd)
 {
     LOG_WARN("Dry Run: Would execute command: {}", cmd);
@@ -207,6 +714,23 @@ std::vector<std::string> DryRunner::checkOutput(const std::string& cmd)
             cmd));
 }
 
+OutputBuffer DryRunner::captureOutput(const std::string& cmd)
+{
+    throw std::runtime_error(
+        fmt::format(
+            "Cannot capture the output of a command during dry-run mode: {}",
+            cmd));
+}
+
+std::vector<CommandResult> DryRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t /*concurrency*/)
+{
+    for (const auto& cmd : cmds) {
+        LOG_WARN("Dry Run: Would execute command: {}", cmd);
+    }
+    return std::vector<CommandResult>(cmds.size());
+}
+
 CommandProxy DryRunner::executeCommandIter(
     const std::string& cmd, Stream /*out*/)
 {
@@ -232,6 +756,13 @@ int MockRunner::executeCommand(const std::string& cmd, std::list<std::string>& o
     return 0;
 }
 
+int MockRunner::executeCommand(
+    const std::string& cmd, OutputBuffer& /*output*/)
+{
+    m_cmds.push_back(cmd);
+    return 0;
+}
+
 
 void MockRunner::checkCommand(const std::string& cmd) { }
 
@@ -240,6 +771,11 @@ std::vector<std::string> MockRunner::checkOutput(const std::string& /*cmd*/)
     return {};
 }
 
+OutputBuffer MockRunner::captureOutput(const std::string& /*cmd*/)
+{
+    return {};
+}
+
 const std::vector<std::string>& MockRunner::listCommands() const
 {
     return m_cmds;
@@ -264,4 +800,238 @@ int MockRunner::run(const ScriptBuilder& script)
     return 0;
 }
 
+std::vector<CommandResult> MockRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t /*concurrency*/)
+{
+    // Recorded in input order so tests can assert on it
+    m_cmds.insert(m_cmds.end(), cmds.begin(), cmds.end());
+    return std::vector<CommandResult>(cmds.size());
+}
+
+TEST_SUITE_BEGIN("cloyster::services::runner");
+
+TEST_CASE("executeBatch")
+{
+    cloyster::Singleton<Options>::init(std::make_unique<Options>(Options {}));
+
+    SUBCASE("Runner keeps the input order")
+    {
+        Runner runner;
+        const auto results = runner.executeBatch(
+            {
+                R"(sh -c "sleep 0.3; echo first")",
+                "echo second",
+                R"(sh -c "exit 3")",
+                "echo fourth",
+            },
+            4);
+        REQUIRE(results.size() == 4);
+        CHECK(results[0].exitCode == 0);
+        CHECK(results[0].output == std::vector<std::string> { "first" });
+        CHECK(results[1].output == std::vector<std::string> { "second" });
+        CHECK(results[2].exitCode == 3);
+        CHECK(results[3].output == std::vector<std::string> { "fourth" });
+    }
+
+    SUBCASE("Runner::checkBatch throws on failures")
+    {
+        Runner runner;
+        CHECK_NOTHROW(runner.checkBatch({ "true", "true" }, 2));
+        CHECK_THROWS_AS(
+            runner.checkBatch({ "true", "false", "true" }, 2),
+            std::runtime_error);
+    }
+
+    SUBCASE("MockRunner records the commands in order")
+    {
+        MockRunner runner;
+        runner.executeCommand("before");
+        const auto results
+            = runner.executeBatch({ "mkdef n01", "mkdef n02", "mkdef n03" }, 2);
+        CHECK(results.size() == 3);
+        CHECK(runner.listCommands()
+            == std::vector<std::string> {
+                "before", "mkdef n01", "mkdef n02", "mkdef n03" });
+    }
+
+    SUBCASE("DryRunner runs nothing")
+    {
+        DryRunner runner;
+        const auto results = runner.executeBatch({ "false", "false" });
+        CHECK(results.size() == 2);
+        CHECK(std::ranges::all_of(results,
+            [](const auto& result) { return result.exitCode == 0; }));
+    }
+}
+
+TEST_CASE("captureOutput")
+{
+    cloyster::Singleton<Options>::init(std::make_unique<Options>(Options {}));
+    Runner runner;
+
+    auto output = runner.captureOutput("seq 1 50000");
+    REQUIRE(output.size() == 50000);
+    CHECK(output.front() == "1");
+    CHECK(output.back() == "50000");
+    CHECK(runner.checkOutput(R"(sh -c "echo a; echo b")")
+        == std::vector<std::string> { "a", "b" });
+    CHECK_THROWS_AS(runner.captureOutput("false"), std::runtime_error);
+
+    OutputBuffer partial;
+    CHECK(runner.executeCommand(R"(sh -c "printf x; exit 2")", partial) == 2);
+    CHECK(partial.toVector() == std::vector<std::string> { "x" });
+}
+
+TEST_CASE("executeCommandIter")
+{
+    cloyster::Singleton<Options>::init(std::make_unique<Options>(Options {}));
+
+    SUBCASE("both streams are demultiplexed")
+    {
+        Runner runner;
+        auto proxy = runner.executeCommandIter(
+            R"(sh -c "echo out1; echo err1 >&2; echo out2; exit 5")");
+        REQUIRE(proxy.valid());
+
+        std::vector<std::string> out;
+        std::vector<std::string> err;
+        while (auto line = proxy.next()) {
+            auto& lines = line->stream == Stream::Stdout ? out : err;
+            lines.emplace_back(line->text);
+        }
+        CHECK(out == std::vector<std::string> { "out1", "out2" });
+        CHECK(err == std::vector<std::string> { "err1" });
+        CHECK(proxy.exitCode() == 5);
+        CHECK(proxy.ready());
+    }
+
+    SUBCASE("getline follows one stream and drains the other")
+    {
+        Runner runner;
+        // Enough stdout to fill the pipe if nobody was reading it
+        auto proxy = runner.executeCommandIter(
+            R"(sh -c "seq 1 100000; echo done >&2")", Stream::Stderr);
+        CHECK(proxy.getline() == "done");
+        CHECK(proxy.getline() == std::nullopt);
+        CHECK(proxy.exitCode() == 0);
+    }
+
+    SUBCASE("long and unterminated lines")
+    {
+        Runner runner;
+        auto proxy = runner.executeCommandIter(fmt::format(
+            R"(sh -c "head -c {} /dev/zero; printf tail")",
+            CommandProxy::bufferSize + 10));
+        std::vector<std::size_t> sizes;
+        while (auto line = proxy.next()) {
+            sizes.push_back(line->text.size());
+        }
+        CHECK(sizes
+            == std::vector<std::size_t> { CommandProxy::bufferSize, 14 });
+    }
+
+    SUBCASE("invalid proxies")
+    {
+        CommandProxy proxy;
+        CHECK_FALSE(proxy.valid());
+        CHECK(proxy.getline() == std::nullopt);
+        CHECK(proxy.exitCode() == std::nullopt);
+
+        MockRunner mock;
+        CHECK_FALSE(mock.executeCommandIter("wget -NP /root iso").valid());
+    }
+}
+
+TEST_CASE("timeouts and cancellation")
+{
+    cloyster::Singleton<Options>::init(std::make_unique<Options>(Options {}));
+
+    SUBCASE("a command past its timeout is killed")
+    {
+        Runner runner;
+        const ScopedTimeout timeout(std::chrono::milliseconds(200));
+        const auto start = Clock::now();
+        CHECK_THROWS_AS(runner.executeCommand("sleep 5"), CommandTimeoutError);
+        CHECK(Clock::now() - start < std::chrono::seconds(2));
+        CHECK(runner.executeCommand("true") == 0);
+    }
+
+    SUBCASE("the whole process group is killed")
+    {
+        Runner runner;
+        const cloyster::tests::TemporaryFile pid("sleep.pid");
+        const auto& pidFile = pid.path;
+        {
+            const ScopedTimeout timeout(std::chrono::milliseconds(300));
+            CHECK_THROWS_AS(runner.executeCommand(fmt::format(
+                                R"(sh -c "sleep 30 & echo $! > {}; wait")",
+                                pidFile.string())),
+                CommandTimeoutError);
+        }
+
+        pid_t grandchild = 0;
+        std::ifstream(pidFile) >> grandchild;
+        REQUIRE(grandchild > 0);
+        // Gone, or a zombie waiting for init to reap it
+        std::string state = "Z";
+        std::ifstream stat(fmt::format("/proc/{}/stat", grandchild));
+        if (stat) {
+            std::string field;
+            stat >> field >> field >> state;
+        }
+        CHECK(state == "Z");
+    }
+
+    SUBCASE("the token cancels a running command")
+    {
+        Runner runner;
+        std::thread canceller([] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            CancellationToken::global().cancel();
+        });
+        CHECK_THROWS_AS(
+            runner.executeCommand("sleep 5"), CommandCancelledError);
+        canceller.join();
+        // Nothing starts until the token is reset
+        CHECK_THROWS_AS(runner.executeBatch({ "true" }), CommandCancelledError);
+        CancellationToken::global().reset();
+        CHECK(runner.executeCommand("true") == 0);
+    }
+
+    SUBCASE("the interactive proxy times out")
+    {
+        Runner runner;
+        const ScopedTimeout timeout(std::chrono::milliseconds(200));
+        auto proxy
+            = runner.executeCommandIter(R"(sh -c "echo first; sleep 5")");
+        CHECK(proxy.getline() == "first");
+        CHECK_THROWS_AS(proxy.getline(), CommandTimeoutError);
+    }
+
+    SUBCASE("a child keeping stdout open does not spin the wait")
+    {
+        Runner runner;
+        std::list<std::string> output;
+        const auto cpu = std::clock();
+        CHECK(runner.executeCommand(
+                  R"(sh -c "(sleep 0.5; echo late) & exit 0")", output)
+            == 0);
+        CHECK(output == std::list<std::string> { "late" });
+        CHECK(static_cast<double>(std::clock() - cpu) / CLOCKS_PER_SEC < 0.2);
+    }
+
+    SUBCASE("scoped timeouts nest")
+    {
+        CHECK(ScopedTimeout::current() == std::chrono::milliseconds::zero());
+        const ScopedTimeout outer(std::chrono::seconds(10));
+        {
+            const ScopedTimeout inner(std::chrono::seconds(1));
+            CHECK(ScopedTimeout::current() == std::chrono::seconds(1));
+        }
+        CHECK(ScopedTimeout::current() == std::chrono::seconds(10));
+    }
+}
+
+TEST_SUITE_END();
+
 } // namespace cloyster::services
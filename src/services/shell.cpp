@@ -5,6 +5,7 @@
  */
 
 #include <cloysterhpc/functions.h>
+#include <cloysterhpc/services/fileedit.h>
 #include <cloysterhpc/services/log.h>
 #include <cloysterhpc/services/options.h>
 #include <cloysterhpc/services/osservice.h>
@@ -187,13 +188,15 @@ void Shell::disableNetworkManagerDNSOverride()
     std::string_view filename
         = CHROOT "/etc/NetworkManager/conf.d/90-dns-none.conf";
 
-    // TODO: We should not violently remove the file, we may need to backup if
-    //  the file exists, and remove after the copy
-    functions::removeFile(filename);
+    // TODO: We should backup the file if it exists
     // TODO: Would be better handled with a .conf function
-    functions::addStringToFile(filename,
-        "[main]\n"
-        "dns=none\n");
+    if (Singleton<Options>::get()->dryRun) {
+        LOG_INFO("Dry Run: Would write file {}", filename)
+    } else {
+        files::writeFileAtomically(filename,
+            "[main]\n"
+            "dns=none\n");
+    }
 
     osservice()->restartService("NetworkManager");
 }
@@ -325,6 +328,7 @@ void Shell::configureTimeService(const std::list<Connection>& connections)
 
     functions::backupFile(filename);
 
+    files::FileEditSession session(filename);
     for (const auto& connection : std::as_const(connections)) {
         if ((connection.getNetwork()->getProfile()
                 == Network::Profile::Management)
@@ -332,15 +336,15 @@ void Shell::configureTimeService(const std::list<Connection>& connections)
                 == Network::Profile::Service)) {
 
             // Configure server as local stratum (serve time without sync)
-            functions::addStringToFile(filename, "local stratum 10\n");
+            session.appendIfAbsent("local stratum 10\n");
 
-            functions::addStringToFile(filename,
-                fmt::format("allow {}/{}\n",
-                    connection.getAddress().to_string(),
-                    connection.getNetwork()->cidr.at(
-                        connection.getNetwork()->getSubnetMask().to_string())));
+            session.appendIfAbsent(fmt::format("allow {}/{}\n",
+                connection.getAddress().to_string(),
+                connection.getNetwork()->cidr.at(
+                    connection.getNetwork()->getSubnetMask().to_string())));
         }
     }
+    session.commit();
 
     osservice()->enableService("chronyd");
 }
@@ -521,25 +525,19 @@ void Shell::install()
 
     LOG_INFO("[{}] Setting up the provisioner", provisionerName)
     provisioner->setup();
-    const auto imageType = XCAT::ImageType::Netboot;
-    const auto nodeType = XCAT::NodeType::Compute;
-
     opts->maybeStopAfterStep("provisioner-setup");
-    const auto imageInstallArgs = provisioner->getImageInstallArgs(imageType, nodeType);
     const auto osinfo = cluster()->getHeadnode().getOS();
 
-    // Customizations to the image
-    const auto nfsImageInstallScript =
-        networkFileSystem.imageInstallScript(
-            osinfo,
-            imageInstallArgs);
+    // One compute image for each architecture of the nodes
+    auto images = XCAT::computeImages();
+    for (auto& image : images) {
+        // Customizations to the image
+        image.customizations.emplace_back(networkFileSystem.imageInstallScript(
+            osinfo, XCAT::getImageInstallArgs(image)));
+    }
 
     LOG_INFO("[{}] Creating node images", provisionerName);
-    provisioner->createImage(
-        imageType, nodeType, {
-        // Customizations to the image
-        nfsImageInstallScript
-    });
+    provisioner->createImages(std::move(images));
     opts->maybeStopAfterStep("provisioner-create-image");
 
     LOG_INFO("[{}] Adding compute nodes", provisionerName)
@@ -550,8 +548,7 @@ void Shell::install()
 
     LOG_INFO("[{}] Setting up boot settings via IPMI, if available",
         provisionerName);
-    provisioner->setNodesBoot();
-    provisioner->resetNodes();
+    provisioner->bootNodes();
 }
 
 }
@@ -51,12 +51,13 @@ std::multimap<std::string, std::string> Timezone::fetchAvailableTimezones()
 
     LOG_DEBUG("Fetching available system timezones")
     auto runner = cloyster::Singleton<functions::IRunner>::get();
-    auto output = runner->checkOutput(
+    const auto output = runner->captureOutput(
         fmt::format("timedatectl list-timezones --no-pager"));
 
-    for (const std::string& tz : output) {
-        timezones.insert(std::make_pair(
-            tz.substr(0, tz.find('/')), tz.substr(tz.find('/') + 1)));
+    for (const std::string_view tz : output.lines()) {
+        timezones.emplace(
+            std::string(tz.substr(0, tz.find('/'))),
+            std::string(tz.substr(tz.find('/') + 1)));
     }
 
     return timezones;
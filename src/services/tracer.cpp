@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/tracer.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace {
+
+using cloyster::services::Tracer;
+
+std::string jsonEscape(std::string_view text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (const char chr : text) {
+        switch (chr) {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(chr) < 0x20) {
+                    escaped += fmt::format("\\u{:04x}", chr);
+                } else {
+                    escaped += chr;
+                }
+        }
+    }
+    return escaped;
+}
+
+long long micros(Tracer::Clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+        .count();
+}
+
+double seconds(Tracer::Clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+std::size_t lineBytes(const std::vector<std::string>& lines)
+{
+    return std::accumulate(lines.begin(), lines.end(), std::size_t { 0 },
+        [](std::size_t sum, const auto& line) { return sum + line.size() + 1; });
+}
+
+} // anonymous namespace
+
+namespace cloyster::services {
+
+Tracer::Tracer(std::filesystem::path output, std::size_t summarySize)
+    : m_output(std::move(output))
+    , m_summarySize(summarySize)
+    , m_origin(Clock::now())
+{
+}
+
+void Tracer::command(std::string command, Clock::time_point start,
+    Clock::time_point end, int exitCode, std::size_t outputBytes)
+{
+    std::scoped_lock lock(m_mutex);
+    const auto thread = m_threads
+                            .try_emplace(std::this_thread::get_id(),
+                                m_threads.size())
+                            .first->second;
+    m_commands.push_back({ .command = std::move(command),
+        .step = m_steps.size(),
+        .thread = thread,
+        .start = start,
+        .end = end,
+        .exitCode = exitCode,
+        .outputBytes = outputBytes });
+}
+
+void Tracer::step(const std::string& name)
+{
+    std::scoped_lock lock(m_mutex);
+    const auto start = m_steps.empty() ? m_origin : m_steps.back().end;
+    m_steps.push_back({ .name = name, .start = start, .end = Clock::now() });
+    LOG_DEBUG("Step {} took {:.3f}s", name,
+        seconds(m_steps.back().end - m_steps.back().start))
+}
+
+void Tracer::finish()
+{
+    {
+        std::scoped_lock lock(m_mutex);
+        if (m_finished) {
+            return;
+        }
+        m_finished = true;
+    }
+
+    // Whatever ran after the last step mark
+    step("remaining");
+
+    std::ofstream file(m_output, std::ios::trunc);
+    if (!file.is_open()) {
+        LOG_ERROR("Cannot write the trace file {}", m_output.string())
+    } else {
+        file << json();
+        LOG_INFO("Command trace written to {}", m_output.string())
+    }
+
+    logSummary();
+}
+
+std::string Tracer::json() const
+{
+    std::scoped_lock lock(m_mutex);
+    const auto pid = ::getpid();
+    std::string json = R"({"displayTimeUnit":"ms","traceEvents":[)";
+    json += fmt::format(R"({{"name":"thread_name","ph":"M","pid":{},"tid":0,)"
+                        R"("args":{{"name":"steps"}}}})",
+        pid);
+
+    for (const auto& step : m_steps) {
+        json += fmt::format(
+            R"(,{{"name":"{}","cat":"step","ph":"X","ts":{},"dur":{},)"
+            R"("pid":{},"tid":0}})",
+            jsonEscape(step.name), micros(step.start - m_origin),
+            micros(step.end - step.start), pid);
+    }
+
+    for (const auto& command : m_commands) {
+        const std::string_view step = command.step < m_steps.size()
+            ? std::string_view(m_steps[command.step].name)
+            : std::string_view("remaining");
+        json += fmt::format(
+            R"(,{{"name":"{}","cat":"command","ph":"X","ts":{},"dur":{},)"
+            R"("pid":{},"tid":{},"args":{{"exitCode":{},"outputBytes":{},)"
+            R"("step":"{}"}}}})",
+            jsonEscape(command.command), micros(command.start - m_origin),
+            micros(command.duration()), pid, command.thread + 1,
+            command.exitCode, command.outputBytes, jsonEscape(step));
+    }
+
+    json += "]}\n";
+    return json;
+}
+
+std::vector<Tracer::Command> Tracer::slowest(std::size_t count) const
+{
+    std::scoped_lock lock(m_mutex);
+    auto commands = m_commands;
+    count = std::min(count, commands.size());
+    std::ranges::partial_sort(commands, commands.begin() + count,
+        std::ranges::greater {}, &Command::duration);
+    commands.resize(count);
+    return commands;
+}
+
+std::vector<Tracer::Step> Tracer::steps() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_steps;
+}
+
+void Tracer::logSummary() const
+{
+    LOG_INFO("Slowest {} commands:", m_summarySize)
+    for (const auto& command : slowest(m_summarySize)) {
+        LOG_INFO("{:>10.3f}s  exit {:>3}  {}", seconds(command.duration()),
+            command.exitCode, command.command)
+    }
+
+    std::scoped_lock lock(m_mutex);
+    LOG_INFO("Time per step:")
+    for (std::size_t index = 0; index < m_steps.size(); ++index) {
+        const auto& step = m_steps[index];
+        const auto commands = std::ranges::count(
+            m_commands, index, &Command::step);
+        LOG_INFO("{:>10.3f}s  {} ({} commands)", seconds(step.end - step.start),
+            step.name, commands)
+    }
+}
+
+TracingRunner::TracingRunner(std::unique_ptr<IRunner> runner, Tracer& tracer)
+    : m_runner(std::move(runner))
+    , m_tracer(tracer)
+{
+}
+
+int TracingRunner::executeCommand(const std::string& cmd)
+{
+    OutputBuffer output;
+    return executeCommand(cmd, output);
+}
+
+int TracingRunner::executeCommand(
+    const std::string& cmd, std::list<std::string>& output)
+{
+    OutputBuffer buffer;
+    const int exitCode = executeCommand(cmd, buffer);
+    for (const auto line : buffer.lines()) {
+        output.emplace_back(line);
+    }
+    return exitCode;
+}
+
+int TracingRunner::executeCommand(const std::string& cmd, OutputBuffer& output)
+{
+    const auto start = Tracer::Clock::now();
+    const auto before = output.text().size();
+    const int exitCode = m_runner->executeCommand(cmd, output);
+    m_tracer.command(cmd, start, Tracer::Clock::now(), exitCode,
+        output.text().size() - before);
+    return exitCode;
+}
+
+CommandProxy TracingRunner::executeCommandIter(
+    const std::string& cmd, Stream out)
+{
+    // Only the start is known, the caller consumes the output
+    const auto start = Tracer::Clock::now();
+    m_tracer.command(cmd, start, start, 0, 0);
+    return m_runner->executeCommandIter(cmd, out);
+}
+
+void TracingRunner::checkCommand(const std::string& cmd)
+{
+    const auto start = Tracer::Clock::now();
+    try {
+        m_runner->checkCommand(cmd);
+    } catch (...) {
+        // The exit code is lost in the exception
+        m_tracer.command(cmd, start, Tracer::Clock::now(), 1, 0);
+        throw;
+    }
+    m_tracer.command(cmd, start, Tracer::Clock::now(), 0, 0);
+}
+
+std::vector<std::string> TracingRunner::checkOutput(const std::string& cmd)
+{
+    const auto start = Tracer::Clock::now();
+    try {
+        auto output = m_runner->checkOutput(cmd);
+        m_tracer.command(
+            cmd, start, Tracer::Clock::now(), 0, lineBytes(output));
+        return output;
+    } catch (...) {
+        m_tracer.command(cmd, start, Tracer::Clock::now(), 1, 0);
+        throw;
+    }
+}
+
+OutputBuffer TracingRunner::captureOutput(const std::string& cmd)
+{
+    const auto start = Tracer::Clock::now();
+    try {
+        auto output = m_runner->captureOutput(cmd);
+        m_tracer.command(
+            cmd, start, Tracer::Clock::now(), 0, output.text().size());
+        return output;
+    } catch (...) {
+        m_tracer.command(cmd, start, Tracer::Clock::now(), 1, 0);
+        throw;
+    }
+}
+
+int TracingRunner::downloadFile(const std::string& url, const std::string& file)
+{
+    const auto start = Tracer::Clock::now();
+    const int exitCode = m_runner->downloadFile(url, file);
+    m_tracer.command(fmt::format("download {} to {}", url, file), start,
+        Tracer::Clock::now(), exitCode, 0);
+    return exitCode;
+}
+
+int TracingRunner::run(const ScriptBuilder& script)
+{
+    const auto start = Tracer::Clock::now();
+    const int exitCode = m_runner->run(script);
+    m_tracer.command(fmt::format("run /tmp/{}.sh",
+                         cloyster::services::files::checksum(script.toString())),
+        start, Tracer::Clock::now(), exitCode, 0);
+    return exitCode;
+}
+
+std::vector<CommandResult> TracingRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t concurrency)
+{
+    const auto start = Tracer::Clock::now();
+    auto results = m_runner->executeBatch(cmds, concurrency);
+    const auto end = Tracer::Clock::now();
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        m_tracer.command(cmds[i], start, end, results[i].exitCode,
+            lineBytes(results[i].output));
+    }
+    return results;
+}
+
+std::future<CommandResult> TracingRunner::submit(const std::string& cmd)
+{
+    const auto start = Tracer::Clock::now();
+    return std::async(std::launch::async,
+        [this, cmd, start, job = m_runner->submit(cmd)]() mutable {
+            auto result = job.get();
+            m_tracer.command(cmd, start, Tracer::Clock::now(),
+                result.exitCode, lineBytes(result.output));
+            return result;
+        });
+}
+
+TEST_SUITE_BEGIN("cloyster::services::tracer");
+
+TEST_CASE("Tracer")
+{
+    const cloyster::tests::TemporaryDirectory directory;
+    const auto output = directory.path / "trace.json";
+    Tracer tracer(output, 2);
+    TracingRunner runner(std::make_unique<MockRunner>(), tracer);
+
+    runner.executeCommand("dnf -y install \"Development Tools\"");
+    tracer.step("install-required-packages");
+
+    const auto start = Tracer::Clock::now();
+    tracer.command("genimage compute", start - std::chrono::seconds(30), start,
+        0, 1024);
+    runner.executeBatch({ "mkdef n01", "mkdef n02" });
+    tracer.finish();
+    tracer.finish();
+
+    const auto steps = tracer.steps();
+    REQUIRE(steps.size() == 2);
+    CHECK(steps[0].name == "install-required-packages");
+    CHECK(steps[1].name == "remaining");
+
+    const auto slowest = tracer.slowest(2);
+    REQUIRE(slowest.size() == 2);
+    CHECK(slowest[0].command == "genimage compute");
+    CHECK(slowest[0].step == 1);
+
+    const auto json = tracer.json();
+    CHECK(json.starts_with(R"({"displayTimeUnit":"ms","traceEvents":[)"));
+    CHECK(json.contains(R"("name":"dnf -y install \"Development Tools\"")"));
+    CHECK(json.contains(R"("step":"install-required-packages")"));
+    CHECK(json.contains(R"("outputBytes":1024)"));
+    CHECK(std::filesystem::exists(output));
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <cloysterhpc/patterns/singleton.h>
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/log.h>
+#include <cloysterhpc/services/options.h>
+#include <cloysterhpc/services/tracerunner.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
+
+namespace {
+
+using cloyster::services::CommandResult;
+using cloyster::services::TraceRecord;
+using std::chrono::microseconds;
+
+constexpr std::string_view traceHeader = "CLOYSTER-TRACE 1";
+
+std::string joinLines(const std::vector<std::string>& lines)
+{
+    std::string text;
+    for (const auto& line : lines) {
+        text += line;
+        text += '\n';
+    }
+    return text;
+}
+
+std::vector<std::string> splitLines(const std::string& text)
+{
+    cloyster::services::OutputBuffer buffer;
+    buffer.append(text);
+    return buffer.toVector();
+}
+
+CommandResult toResult(const TraceRecord& record)
+{
+    return { .exitCode = record.exitCode,
+        .output = splitLines(record.output),
+        .errorOutput = splitLines(record.errorOutput) };
+}
+
+std::string scriptKey(const cloyster::services::ScriptBuilder& script)
+{
+    // Same name Runner::run gives to the script file
+    return fmt::format(
+        "run /tmp/{}.sh", cloyster::services::files::checksum(script.toString()));
+}
+
+std::string downloadKey(const std::string& url, const std::string& file)
+{
+    return fmt::format("download {} {}", url, file);
+}
+
+std::string readBytes(std::istream& stream, std::size_t size)
+{
+    std::string bytes(size, '\0');
+    if (!stream.read(bytes.data(), static_cast<std::streamsize>(size))) {
+        throw std::runtime_error("Truncated command trace");
+    }
+    return bytes;
+}
+
+std::vector<TraceRecord> readTrace(const std::filesystem::path& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open()) {
+        throw std::runtime_error(
+            fmt::format("Cannot open command trace {}", path.string()));
+    }
+
+    std::string header;
+    if (!std::getline(stream, header) || header != traceHeader) {
+        throw std::runtime_error(
+            fmt::format("{} is not a command trace", path.string()));
+    }
+
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    long long duration = 0;
+    std::size_t commandSize = 0;
+    std::size_t outputSize = 0;
+    std::size_t errorSize = 0;
+    while (stream >> record.exitCode >> duration >> commandSize >> outputSize
+        >> errorSize) {
+        // Skip the line break ending the record header
+        stream.get();
+        record.duration = microseconds(duration);
+        record.command = readBytes(stream, commandSize);
+        record.output = readBytes(stream, outputSize);
+        record.errorOutput = readBytes(stream, errorSize);
+        records.push_back(std::move(record));
+    }
+
+    if (!stream.eof()) {
+        throw std::runtime_error(
+            fmt::format("Malformed command trace {}", path.string()));
+    }
+    return records;
+}
+
+} // anonymous namespace
+
+namespace cloyster::services {
+
+RecordingRunner::RecordingRunner(
+    std::unique_ptr<IRunner> runner, const std::filesystem::path& trace)
+    : m_runner(std::move(runner))
+    , m_trace(trace, std::ios::binary | std::ios::trunc)
+{
+    if (!m_trace.is_open()) {
+        throw std::runtime_error(
+            fmt::format("Cannot write command trace {}", trace.string()));
+    }
+    LOG_INFO("Recording the commands to {}", trace.string())
+    m_trace << traceHeader << '\n';
+}
+
+void RecordingRunner::record(const TraceRecord& record)
+{
+    std::scoped_lock lock(m_mutex);
+    m_trace << record.exitCode << ' ' << record.duration.count() << ' '
+            << record.command.size() << ' ' << record.output.size() << ' '
+            << record.errorOutput.size() << '\n'
+            << record.command << record.output << record.errorOutput << '\n';
+    // Keep the trace usable if the installation is interrupted
+    m_trace.flush();
+}
+
+int RecordingRunner::executeCommand(const std::string& cmd)
+{
+    OutputBuffer output;
+    return executeCommand(cmd, output);
+}
+
+int RecordingRunner::executeCommand(
+    const std::string& cmd, std::list<std::string>& output)
+{
+    OutputBuffer buffer;
+    const int exitCode = executeCommand(cmd, buffer);
+    for (const auto line : buffer.lines()) {
+        output.emplace_back(line);
+    }
+    return exitCode;
+}
+
+int RecordingRunner::executeCommand(const std::string& cmd, OutputBuffer& output)
+{
+    const auto start = std::chrono::steady_clock::now();
+    OutputBuffer captured;
+    const int exitCode = m_runner->executeCommand(cmd, captured);
+    record({ .command = cmd,
+        .exitCode = exitCode,
+        .duration = std::chrono::duration_cast<microseconds>(
+            std::chrono::steady_clock::now() - start),
+        .output = std::string(captured.text()),
+        .errorOutput = {} });
+    output.append(captured.text());
+    return exitCode;
+}
+
+CommandProxy RecordingRunner::executeCommandIter(
+    const std::string& cmd, Stream out)
+{
+    // The output goes to the caller as the command runs, only keep the
+    // command itself
+    record({ .command = cmd,
+        .exitCode = 0,
+        .duration = {},
+        .output = {},
+        .errorOutput = {} });
+    return m_runner->executeCommandIter(cmd, out);
+}
+
+void RecordingRunner::checkCommand(const std::string& cmd)
+{
+    if (executeCommand(cmd) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+}
+
+std::vector<std::string> RecordingRunner::checkOutput(const std::string& cmd)
+{
+    return captureOutput(cmd).toVector();
+}
+
+OutputBuffer RecordingRunner::captureOutput(const std::string& cmd)
+{
+    OutputBuffer output;
+    if (executeCommand(cmd, output) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+    return output;
+}
+
+int RecordingRunner::downloadFile(const std::string& url, const std::string& file)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const int exitCode = m_runner->downloadFile(url, file);
+    record({ .command = downloadKey(url, file),
+        .exitCode = exitCode,
+        .duration = std::chrono::duration_cast<microseconds>(
+            std::chrono::steady_clock::now() - start),
+        .output = {},
+        .errorOutput = {} });
+    return exitCode;
+}
+
+int RecordingRunner::run(const ScriptBuilder& script)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const int exitCode = m_runner->run(script);
+    record({ .command = scriptKey(script),
+        .exitCode = exitCode,
+        .duration = std::chrono::duration_cast<microseconds>(
+            std::chrono::steady_clock::now() - start),
+        .output = {},
+        .errorOutput = {} });
+    return exitCode;
+}
+
+std::vector<CommandResult> RecordingRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t concurrency)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto results = m_runner->executeBatch(cmds, concurrency);
+    const auto duration = std::chrono::duration_cast<microseconds>(
+        std::chrono::steady_clock::now() - start);
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        record({ .command = cmds[i],
+            .exitCode = results[i].exitCode,
+            .duration = duration,
+            .output = joinLines(results[i].output),
+            .errorOutput = joinLines(results[i].errorOutput) });
+    }
+    return results;
+}
+
+std::future<CommandResult> RecordingRunner::submit(const std::string& cmd)
+{
+    const auto start = std::chrono::steady_clock::now();
+    return std::async(std::launch::async,
+        [this, cmd, start, job = m_runner->submit(cmd)]() mutable {
+            auto result = job.get();
+            record({ .command = cmd,
+                .exitCode = result.exitCode,
+                .duration = std::chrono::duration_cast<microseconds>(
+                    std::chrono::steady_clock::now() - start),
+                .output = joinLines(result.output),
+                .errorOutput = joinLines(result.errorOutput) });
+            return result;
+        });
+}
+
+ReplayRunner::ReplayRunner(const std::filesystem::path& trace, double timeScale)
+    : m_timeScale(timeScale)
+{
+    auto records = readTrace(trace);
+    LOG_INFO("Replaying {} commands from {}", records.size(), trace.string())
+    for (auto& record : records) {
+        m_commands[record.command].records.push_back(std::move(record));
+    }
+}
+
+TraceRecord ReplayRunner::take(const std::string& cmd)
+{
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_commands.find(cmd);
+    if (it == m_commands.end()) {
+        LOG_WARN("Replay: command not in the trace: {}", cmd)
+        m_unmatched.push_back(cmd);
+        return { .command = cmd,
+            .exitCode = 0,
+            .duration = {},
+            .output = {},
+            .errorOutput = {} };
+    }
+
+    auto& recorded = it->second;
+    const auto index = std::min(recorded.next++, recorded.records.size() - 1);
+    LOG_DEBUG("Replay: {}", cmd)
+    return recorded.records[index];
+}
+
+void ReplayRunner::wait(microseconds duration) const
+{
+    if (m_timeScale > 0.0) {
+        std::this_thread::sleep_for(
+            std::chrono::duration_cast<microseconds>(duration * m_timeScale));
+    }
+}
+
+TraceRecord ReplayRunner::replay(const std::string& cmd)
+{
+    auto record = take(cmd);
+    wait(record.duration);
+    return record;
+}
+
+std::vector<std::string> ReplayRunner::unmatched() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_unmatched;
+}
+
+int ReplayRunner::executeCommand(const std::string& cmd)
+{
+    return replay(cmd).exitCode;
+}
+
+int ReplayRunner::executeCommand(
+    const std::string& cmd, std::list<std::string>& output)
+{
+    auto record = replay(cmd);
+    std::ranges::move(splitLines(record.output), std::back_inserter(output));
+    return record.exitCode;
+}
+
+int ReplayRunner::executeCommand(const std::string& cmd, OutputBuffer& output)
+{
+    auto record = replay(cmd);
+    output.append(record.output);
+    return record.exitCode;
+}
+
+CommandProxy ReplayRunner::executeCommandIter(
+    const std::string& cmd, Stream /*out*/)
+{
+    replay(cmd);
+    return CommandProxy {}; // Return an invalid CommandProxy
+}
+
+void ReplayRunner::checkCommand(const std::string& cmd)
+{
+    if (executeCommand(cmd) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+}
+
+std::vector<std::string> ReplayRunner::checkOutput(const std::string& cmd)
+{
+    return captureOutput(cmd).toVector();
+}
+
+OutputBuffer ReplayRunner::captureOutput(const std::string& cmd)
+{
+    OutputBuffer output;
+    if (executeCommand(cmd, output) != 0) {
+        throw std::runtime_error(
+            fmt::format("ERROR: Command failed '{}'", cmd));
+    }
+    return output;
+}
+
+int ReplayRunner::downloadFile(const std::string& url, const std::string& file)
+{
+    return replay(downloadKey(url, file)).exitCode;
+}
+
+int ReplayRunner::run(const ScriptBuilder& script)
+{
+    return replay(scriptKey(script)).exitCode;
+}
+
+std::vector<CommandResult> ReplayRunner::executeBatch(
+    const std::vector<std::string>& cmds, std::size_t /*concurrency*/)
+{
+    // Every command of a recorded batch carries the time of the whole batch
+    std::vector<CommandResult> results;
+    results.reserve(cmds.size());
+    microseconds duration {};
+    for (const auto& cmd : cmds) {
+        auto record = take(cmd);
+        duration = std::max(duration, record.duration);
+        results.push_back(toResult(record));
+    }
+    wait(duration);
+    return results;
+}
+
+std::future<CommandResult> ReplayRunner::submit(const std::string& cmd)
+{
+    return std::async(std::launch::async,
+        [this, cmd]() { return toResult(replay(cmd)); });
+}
+
+TEST_SUITE_BEGIN("cloyster::services::tracerunner");
+
+TEST_CASE("Record and replay")
+{
+    cloyster::Singleton<Options>::init(std::make_unique<Options>(Options {}));
+    const cloyster::tests::TemporaryDirectory directory;
+    const auto trace = directory.path / "trace";
+
+    {
+        RecordingRunner recorder(std::make_unique<Runner>(), trace);
+        CHECK(recorder.checkOutput(R"(sh -c "echo first; echo second")")
+            == std::vector<std::string> { "first", "second" });
+        CHECK(recorder.executeCommand(R"(sh -c "exit 3")") == 3);
+        CHECK(recorder.executeCommand("sleep 0.2") == 0);
+        CHECK(recorder.executeCommand("date +%N") == 0);
+        CHECK(recorder.executeCommand("date +%N") == 0);
+        recorder.executeBatch({ "echo batch", "true" }, 2);
+    }
+
+    SUBCASE("results are served back")
+    {
+        ReplayRunner replay(trace);
+        CHECK(replay.checkOutput(R"(sh -c "echo first; echo second")")
+            == std::vector<std::string> { "first", "second" });
+        CHECK(replay.executeCommand(R"(sh -c "exit 3")") == 3);
+        CHECK_THROWS_AS(
+            replay.checkCommand(R"(sh -c "exit 3")"), std::runtime_error);
+
+        // Repeated commands keep their order, then the last one repeats
+        const auto first = replay.checkOutput("date +%N");
+        const auto second = replay.checkOutput("date +%N");
+        CHECK(first != second);
+        CHECK(replay.checkOutput("date +%N") == second);
+
+        const auto batch = replay.executeBatch({ "echo batch", "true" });
+        REQUIRE(batch.size() == 2);
+        CHECK(batch[0].output == std::vector<std::string> { "batch" });
+
+        CHECK(replay.executeCommand("mkdef -t node n01") == 0);
+        CHECK(replay.unmatched() == std::vector<std::string> { "mkdef -t node n01" });
+    }
+
+    SUBCASE("time scaling")
+    {
+        ReplayRunner fast(trace);
+        auto start = std::chrono::steady_clock::now();
+        fast.executeCommand("sleep 0.2");
+        CHECK(std::chrono::steady_clock::now() - start
+            < std::chrono::milliseconds(100));
+
+        ReplayRunner scaled(trace, 0.5);
+        start = std::chrono::steady_clock::now();
+        scaled.executeCommand("sleep 0.2");
+        CHECK(std::chrono::steady_clock::now() - start
+            >= std::chrono::milliseconds(100));
+    }
+
+    SUBCASE("not a trace")
+    {
+        CHECK_THROWS_AS(ReplayRunner("/etc/hostname"), std::runtime_error);
+    }
+}
+
+TEST_SUITE_END();
+
+} // namespace cloyster::services
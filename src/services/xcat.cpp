@@ -4,19 +4,43 @@
  */
 
 #include <algorithm>
+#include <cerrno>
+#include <condition_variable>
 #include <cstdlib> // setenv / getenv
 
 #include <filesystem>
 #include <fmt/format.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <span>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <cloysterhpc/functions.h>
 #include <cloysterhpc/models/cluster.h>
 #include <cloysterhpc/models/os.h>
+#include <cloysterhpc/services/copy.h>
+#include <cloysterhpc/services/fileedit.h>
+#include <cloysterhpc/services/files.h>
+#include <cloysterhpc/services/iso9660.h>
 #include <cloysterhpc/services/options.h>
 #include <cloysterhpc/services/osservice.h>
+#include <cloysterhpc/services/power.h>
 #include <cloysterhpc/services/repos.h>
 #include <cloysterhpc/services/runner.h>
 #include <cloysterhpc/services/xcat.h>
+#include <cloysterhpc/tests.h>
+
+#ifdef BUILD_TESTING
+#include <doctest/doctest.h>
+#else
+#define DOCTEST_CONFIG_DISABLE
+#include <doctest/doctest.h>
+#endif
 
 namespace {
 using cloyster::models::Cluster;
@@ -50,6 +74,91 @@ std::string getOSImageDistroVersion()
     }
     return osimage;
 }
+
+/* Limits how many image builds run at once. Each step asks for some CPUs
+ * and some disk slots and waits until both are free; a step that asks for
+ * more than the whole budget gets the whole budget.
+ */
+class BuildBudget final {
+public:
+    struct Cost {
+        unsigned cpu = 1;
+        std::size_t io = 1;
+    };
+
+    class Lease final {
+    public:
+        Lease(BuildBudget& budget, Cost cost)
+            : m_budget(budget)
+            , m_cost(cost)
+        {
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() { m_budget.release(m_cost); }
+
+    private:
+        BuildBudget& m_budget;
+        Cost m_cost;
+    };
+
+    BuildBudget(unsigned cpu, std::size_t io)
+        : m_cpu(cpu)
+        , m_io(io)
+    {
+    }
+
+    [[nodiscard]] Lease acquire(Cost cost)
+    {
+        cost.cpu = std::min(cost.cpu, m_cpu);
+        cost.io = std::min(cost.io, m_io);
+
+        std::unique_lock lock(m_mutex);
+        m_available.wait(lock, [&] {
+            return m_cpuUsed + cost.cpu <= m_cpu && m_ioUsed + cost.io <= m_io;
+        });
+        m_cpuUsed += cost.cpu;
+        m_ioUsed += cost.io;
+        return { *this, cost };
+    }
+
+private:
+    void release(Cost cost)
+    {
+        {
+            const std::scoped_lock lock(m_mutex);
+            m_cpuUsed -= cost.cpu;
+            m_ioUsed -= cost.io;
+        }
+        m_available.notify_all();
+    }
+
+    const unsigned m_cpu;
+    const std::size_t m_io;
+    unsigned m_cpuUsed = 0;
+    std::size_t m_ioUsed = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_available;
+};
+
+/* dnf repoquery for the latest version of the packages, looking only at the
+ * given repositories. The runner splits the command without a shell, so it
+ * must not depend on single quotes or globs.
+ */
+std::string repoqueryCommand(std::string_view arch,
+    const std::vector<std::string>& repos, std::string_view packages)
+{
+    auto command = fmt::format(
+        "dnf repoquery --quiet --latest-limit=1 --forcearch={}", arch);
+    for (std::size_t i = 0; i < repos.size(); ++i) {
+        command += fmt::format(" --repofrompath=cloysterhpc-image-{0},{1} "
+                               "--repo=cloysterhpc-image-{0}",
+            i, repos[i]);
+    }
+    command += fmt::format(
+        " --queryformat \"%{{name}}-%{{evr}}.%{{arch}}\\n\" {}", packages);
+    return command;
+}
 }; // namespace{}
 
 namespace cloyster::services {
@@ -74,7 +183,8 @@ XCAT::XCAT()
     setenv("PERL_BADLANG", "0", false);
 
     // Ensure image name is setted
-    generateOSImageName(ImageType::Netboot, NodeType::Compute);
+    m_stateless = makeImage(ImageType::Netboot, NodeType::Compute,
+        cluster()->getNodes()[0].getOS().getArch());
 }
 
 XCAT::Image XCAT::getImage() const { return m_stateless; }
@@ -134,6 +244,13 @@ void XCAT::setDomain(std::string_view domain)
 }
 
 namespace {
+    constexpr std::string_view synclists
+        = "/etc/passwd -> /etc/passwd\n"
+          "/etc/group -> /etc/group\n"
+          "/etc/shadow -> /etc/shadow\n"
+          //"/etc/slurm/slurm.conf -> /etc/slurm/slurm.conf\n"
+          "/etc/munge/munge.key -> /etc/munge/munge.key\n";
+
     constexpr bool imageExists(const std::string& image)
     {
         LOG_ASSERT(
@@ -153,8 +270,9 @@ namespace {
         std::list<std::string> output;
         auto exitCode = runner->executeCommand(fmt::format("lsdef -t osimage {}", image), output);
         if (exitCode == 0) { // image exists
-            LOG_WARN("Skipping image generation {}, use --force=genimage to force",
-                image, image);
+            LOG_INFO("Image {} exists, it is only generated again if its "
+                     "inputs changed, use --force=genimage to force",
+                image);
             LOG_DEBUG("Command output: {}", fmt::join(output, "\n"));
             return true;
         }
@@ -162,30 +280,334 @@ namespace {
         return false;
     }
 
+    // Copies the DOCA kernel packages built for @p kernelVersion to the
+    // local repository @p directory
+    void copyDocaKernelPackages(
+        std::string_view kernelVersion, const std::filesystem::path& directory)
+    {
+        namespace fs = std::filesystem;
+
+        if (cloyster::Singleton<Options>::get()->dryRun) {
+            LOG_INFO("Dry Run: Would copy /usr/share/doca-host-*/Modules/{}/"
+                     "*.rpm to {}",
+                kernelVersion, directory.string())
+            return;
+        }
+
+        std::vector<fs::path> packages;
+        for (const auto& share : fs::directory_iterator("/usr/share")) {
+            const auto modules = share.path() / "Modules" / kernelVersion;
+            if (!share.path().filename().string().starts_with("doca-host-")
+                || !fs::is_directory(modules)) {
+                continue;
+            }
+            for (const auto& entry : fs::directory_iterator(modules)) {
+                if (entry.is_regular_file()
+                    && entry.path().extension() == ".rpm") {
+                    packages.push_back(entry.path());
+                }
+            }
+        }
+        if (packages.empty()) {
+            throw std::runtime_error(fmt::format(
+                "No DOCA kernel packages for {} in /usr/share/doca-host-*",
+                kernelVersion));
+        }
+
+        const auto report = files::copyFiles(packages, directory,
+            { .overwrite = true, .preserveOwner = true, .jobs = 0 });
+        LOG_INFO("Copied {} DOCA kernel packages to {}, {} bytes, {} "
+                 "reflinked",
+            report.files, directory.string(), report.bytes, report.reflinked)
+    }
+
+    // Where xCAT keeps the media and where it ships its templates
+    struct XcatDirectories {
+        std::filesystem::path install { "/install" };
+        std::filesystem::path root { "/opt/xcat" };
+    };
+
+    /* Reads the installdir of the site table and XCATROOT, the directories
+     * copycds works with. Keeps the xCAT defaults, with a warning, when the
+     * site table cannot be read.
+     */
+    XcatDirectories xcatDirectories()
+    {
+        XcatDirectories directories;
+        if (const auto* root = std::getenv("XCATROOT");
+            root != nullptr && *root != '\0') {
+            directories.root = root;
+        }
+
+        const auto runner = cloyster::Singleton<IRunner>::get();
+        constexpr std::string_view key = "installdir=";
+        try {
+            // Prints "clustersite: installdir=/install"
+            for (const auto& line : runner->checkOutput(
+                     "lsdef -t site -o clustersite -i installdir -c")) {
+                const auto pos = line.find(key);
+                if (pos != std::string::npos
+                    && pos + key.size() < line.size()) {
+                    directories.install = line.substr(pos + key.size());
+                    return directories;
+                }
+            }
+            LOG_WARN("The xCAT site table has no installdir, assuming {}",
+                directories.install.string())
+        } catch (const CommandCancelledError&) {
+            throw;
+        } catch (const std::exception& ex) {
+            LOG_WARN("Could not read the installdir of the xCAT site table, "
+                     "assuming {}: {}",
+                directories.install.string(), ex.what())
+        }
+        return directories;
+    }
+
+    // The directories copycds takes the templates of @p distro from, the
+    // custom one first, then the shipped ones
+    std::vector<std::filesystem::path> templateDirectories(
+        const XcatDirectories& directories, std::string_view distro)
+    {
+        const auto basename
+            = distro.substr(0, distro.find_first_of("0123456789"));
+        const auto netboot = directories.root / "share/xcat/netboot";
+        return { directories.install / "custom/netboot" / basename,
+            netboot / basename, netboot / "rh" };
+    }
+
+    // Finds the xCAT template of @p profile for the distro, looking where
+    // copycds looks
+    std::optional<std::filesystem::path> findImageTemplate(
+        const XcatDirectories& directories, std::string_view profile,
+        std::string_view distro, std::string_view arch,
+        std::string_view extension)
+    {
+        const auto basename
+            = distro.substr(0, distro.find_first_of("0123456789"));
+        const auto version = distro.substr(basename.size());
+        const auto major = version.substr(0, version.find('.'));
+
+        const std::vector<std::string> versions { std::string(distro),
+            fmt::format("{}{}", basename, major), fmt::format("rhels{}", major) };
+
+        for (const auto& directory : templateDirectories(directories, distro)) {
+            std::vector<std::string> names;
+            for (const auto& osvers : versions) {
+                names.push_back(
+                    fmt::format("{}.{}.{}.{}", profile, osvers, arch, extension));
+                names.push_back(
+                    fmt::format("{}.{}.{}", profile, osvers, extension));
+            }
+            names.push_back(fmt::format("{}.{}.{}", profile, arch, extension));
+            names.push_back(fmt::format("{}.{}", profile, extension));
+
+            for (const auto& name : names) {
+                const auto path = directory / name;
+                if (std::filesystem::exists(path)) {
+                    return path;
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    /* Defines the osdistro of the media extracted to
+     * <installdir>/<distro>/<arch> and its netboot osimages, as copycds does
+     * after copying the files. Returns false when xCAT has no package list
+     * for the compute profile.
+     */
+    bool registerMedia(const XcatDirectories& directories,
+        std::string_view distro, std::string_view arch)
+    {
+        const auto runner = cloyster::Singleton<services::IRunner>::get();
+        const auto basename
+            = distro.substr(0, distro.find_first_of("0123456789"));
+        const auto version = distro.substr(basename.size());
+        const auto dot = version.find('.');
+        const auto osdistro = fmt::format("{}-{}", distro, arch);
+        const auto install = directories.install.string();
+        const auto pkgdir = fmt::format("{}/{}/{}", install, distro, arch);
+
+        if (!findImageTemplate(
+                directories, "compute", distro, arch, "pkglist")) {
+            std::vector<std::string> searched;
+            for (const auto& directory :
+                templateDirectories(directories, distro)) {
+                searched.push_back(directory.string());
+            }
+            LOG_WARN("No xCAT compute package list for {} in {}, leaving the "
+                     "registration to copycds",
+                osdistro, fmt::join(searched, ", "))
+            return false;
+        }
+
+        runner->checkCommand(fmt::format(
+            "mkdef -f -t osdistro -o {} basename={} majorversion={} "
+            "minorversion={} arch={} type=Linux dirpaths={}",
+            osdistro, basename, version.substr(0, dot),
+            dot == std::string_view::npos ? "" : version.substr(dot + 1), arch,
+            pkgdir));
+
+        for (const auto* profile : { "compute", "service" }) {
+            const auto pkglist = findImageTemplate(
+                directories, profile, distro, arch, "pkglist");
+            if (!pkglist) {
+                continue;
+            }
+
+            auto command = fmt::format(
+                "mkdef -f -t osimage -o {0}-netboot-{1} imagetype=linux "
+                "provmethod=netboot profile={1} osname=Linux osvers={2} "
+                "osarch={3} osdistroname={0} pkgdir={4} pkglist={5} "
+                "rootimgdir={6}/netboot/{2}/{3}/{1} "
+                "otherpkgdir={6}/post/otherpkgs/{2}/{3} permission=755",
+                osdistro, profile, distro, arch, pkgdir, pkglist->string(),
+                install);
+            for (const auto* extension : { "exlist", "postinstall" }) {
+                if (const auto path = findImageTemplate(
+                        directories, profile, distro, arch, extension)) {
+                    command += fmt::format(" {}={}", extension, path->string());
+                }
+            }
+            runner->checkCommand(command);
+        }
+        return true;
+    }
+
+    // Throws unless the osdistro and the compute osimage are defined
+    void checkMediaRegistered(std::string_view distro, std::string_view arch)
+    {
+        const auto runner = cloyster::Singleton<services::IRunner>::get();
+        const auto osdistro = fmt::format("{}-{}", distro, arch);
+        for (const auto& [type, name] :
+            { std::pair { "osdistro", osdistro },
+                std::pair { "osimage",
+                    fmt::format("{}-netboot-compute", osdistro) } }) {
+            if (runner->executeCommand(
+                    fmt::format("lsdef -t {} -o {}", type, name))
+                != 0) {
+                throw std::runtime_error(fmt::format(
+                    "The {} {} is not defined after copying the media", type,
+                    name));
+            }
+        }
+    }
+
+    /* A stanza file only root can read. mkostemps creates it with mode
+     * 0600 and refuses existing files and symbolic links; the destructor
+     * removes it however the command ends.
+     */
+    class StanzaFile final {
+        std::string m_path;
+
+    public:
+        explicit StanzaFile(std::string_view contents)
+            : m_path((std::filesystem::temp_directory_path()
+                  / "cloysterhpc-nodes-XXXXXX.stanza")
+                      .string())
+        {
+            const int fd = ::mkostemps(m_path.data(), 7, O_CLOEXEC);
+            if (fd == -1) {
+                throw std::system_error(errno, std::system_category(),
+                    fmt::format("Failed to create {}", m_path));
+            }
+            while (!contents.empty()) {
+                const auto written
+                    = ::write(fd, contents.data(), contents.size());
+                if (written == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (written == -1) {
+                    const auto error = errno;
+                    ::close(fd);
+                    ::unlink(m_path.c_str());
+                    throw std::system_error(error, std::system_category(),
+                        fmt::format("Failed to write {}", m_path));
+                }
+                contents.remove_prefix(static_cast<std::size_t>(written));
+            }
+            ::close(fd);
+        }
+        ~StanzaFile() { ::unlink(m_path.c_str()); }
+        StanzaFile(const StanzaFile&) = delete;
+        StanzaFile& operator=(const StanzaFile&) = delete;
+        StanzaFile(StanzaFile&&) = delete;
+        StanzaFile& operator=(StanzaFile&&) = delete;
+
+        [[nodiscard]] const std::string& path() const { return m_path; }
+    };
+
 }; // anonymous namespace
 
-void XCAT::copycds(const std::filesystem::path& diskImage) const
+std::future<CommandResult> XCAT::copycds(
+    const std::filesystem::path& diskImage, OS::Arch imageArch)
 {
-    cloyster::Singleton<IRunner>::get()->checkCommand(
-        fmt::format("copycds {}", diskImage.string()));
+    const auto runner = cloyster::Singleton<IRunner>::get();
+    const auto distro = getOSImageDistroVersion();
+    const auto arch = cloyster::utils::enums::toString(imageArch);
+
+    // Copies the whole media and defines the osdistro and its osimages
+    const auto command = fmt::format(
+        "copycds -n {} -a {} {}", distro, arch, diskImage.string());
+    if (cloyster::Singleton<Options>::get()->dryRun) {
+        return runner->submit(command);
+    }
+
+    return std::async(std::launch::async, [=] {
+        const auto directories = xcatDirectories();
+        const auto destination
+            = std::filesystem::path(
+                  fmt::format(CHROOT "{}", directories.install.string()))
+            / distro / arch;
+        iso9660::ExtractOptions options;
+        options.progressInterval = std::chrono::seconds(10);
+        options.progress = [&](std::uint64_t copied, std::uint64_t total) {
+            LOG_INFO("Extracting {}: {}%", diskImage.filename().string(),
+                total == 0 ? 100 : copied * 100 / total)
+        };
+
+        bool registered = false;
+        try {
+            const auto result = iso9660::extract(diskImage, destination, options);
+            LOG_INFO("Extracted {} files to {}, {} were unchanged",
+                result.files, destination.string(), result.skipped)
+            registered = registerMedia(directories, distro, arch);
+        } catch (const CommandCancelledError&) {
+            throw;
+        } catch (const std::exception& ex) {
+            LOG_WARN("Could not extract and register {}, leaving it to copycds: {}",
+                diskImage.string(), ex.what())
+        }
+
+        CommandResult result;
+        if (!registered) {
+            result = runner->submit(command).get();
+            if (result.exitCode != 0) {
+                return result;
+            }
+        }
+        checkMediaRegistered(distro, arch);
+        return result;
+    });
 }
 
-void XCAT::genimage()
+void XCAT::genimage(const Image& image)
 {
     cloyster::Singleton<IRunner>::get()->checkCommand(
-        fmt::format("genimage {}", m_stateless.osimage));
+        fmt::format("genimage {}", image.osimage));
 }
 
-void XCAT::packimage()
+void XCAT::packimage(const Image& image)
 {
     cloyster::Singleton<IRunner>::get()->checkCommand(
-        fmt::format("packimage {}", m_stateless.osimage));
+        fmt::format("packimage {}", image.osimage));
 }
 
-void XCAT::nodeset(std::string_view nodes)
+void XCAT::nodeset(std::string_view nodes, const Image& image)
 {
     cloyster::Singleton<IRunner>::get()->checkCommand(
-        fmt::format("nodeset {} osimage={}", nodes, m_stateless.osimage));
+        fmt::format("nodeset {} osimage={}", nodes, image.osimage));
 }
 
 void XCAT::createDirectoryTree()
@@ -193,34 +615,37 @@ void XCAT::createDirectoryTree()
     functions::createDirectory(CHROOT "/install/custom/netboot");
 }
 
-void XCAT::configureSELinux()
+void XCAT::configureSELinux(Image& image)
 {
-    m_stateless.postinstall.emplace_back(fmt::format(
+    image.postinstall.emplace_back(fmt::format(
         "echo \"SELINUX=disabled\nSELINUXTYPE=targeted\" > $IMG_ROOTIMGDIR/etc/selinux/config\n\n"));
 }
 
-void XCAT::configureOpenHPC()
+void XCAT::configureOpenHPC(Image& image)
 {
     const auto packages = { "ohpc-base-compute", "lmod-ohpc", "lua" };
 
-    m_stateless.otherpkgs.reserve(packages.size());
+    image.otherpkgs.reserve(packages.size());
     for (const auto& package : std::as_const(packages)) {
-        m_stateless.otherpkgs.emplace_back(package);
+        image.otherpkgs.emplace_back(package);
     }
 
     // We always sync local Unix files to keep services consistent, even with
     // external directory services
-    m_stateless.synclists.emplace_back("/etc/passwd -> /etc/passwd\n"
-                                       "/etc/group -> /etc/group\n"
-                                       "/etc/shadow -> /etc/shadow\n");
+    image.synclists.emplace_back("/etc/passwd -> /etc/passwd\n"
+                                 "/etc/group -> /etc/group\n"
+                                 "/etc/shadow -> /etc/shadow\n");
 }
 
-void XCAT::configureTimeService()
+void XCAT::configureTimeService(Image& image)
 {
-    m_stateless.otherpkgs.emplace_back("chrony");
+    image.otherpkgs.emplace_back("chrony");
 
-    m_stateless.postinstall.emplace_back(fmt::format(
-        "echo \"server {} iburst\" >> $IMG_ROOTIMGDIR/etc/chrony.conf\n\n",
+    // The postinstall scripts also run again on existing images, the lines
+    // are only added once
+    image.postinstall.emplace_back(fmt::format(
+        "grep -qxF \"server {0} iburst\" $IMG_ROOTIMGDIR/etc/chrony.conf || "
+        "echo \"server {0} iburst\" >> $IMG_ROOTIMGDIR/etc/chrony.conf\n\n",
         cluster()
             ->getHeadnode()
             .getConnection(Network::Profile::Management)
@@ -228,27 +653,27 @@ void XCAT::configureTimeService()
             .to_string()));
 }
 
-void XCAT::configureInfiniband()
+void XCAT::configureInfiniband() { configureInfiniband(m_stateless); }
+
+void XCAT::configureInfiniband(Image& image)
 {
-    LOG_INFO("[xCAT] Configuring infiniband");
+    LOG_INFO("[xCAT] Configuring infiniband for {}", image.osimage);
     if (const auto& ofed = cluster()->getOFED()) {
         switch (ofed->getKind()) {
             case OFED::Kind::Inbox:
-                m_stateless.otherpkgs.emplace_back("@infiniband");
+                image.otherpkgs.emplace_back("@infiniband");
 
                 break;
 
             case OFED::Kind::Mellanox: {
                 auto repoManager = cloyster::Singleton<RepoManager>::get();
                 auto runner = cloyster::Singleton<IRunner>::get();
-                auto arch = cloyster::utils::enums::toString(
-                    cluster()->getNodes()[0].getOS().getArch());
                 auto osService = cloyster::Singleton<IOSService>::get();
                 auto opts = cloyster::Singleton<Options>::get();
 
                 // Add the rpm to the image
-                m_stateless.otherpkgs.emplace_back("mlnx-ofa_kernel");
-                m_stateless.otherpkgs.emplace_back("doca-ofed");
+                image.otherpkgs.emplace_back("mlnx-ofa_kernel");
+                image.otherpkgs.emplace_back("doca-ofed");
 
                 // The kernel modules are build by the OFED.cpp module, see
                 // OFED.cpp
@@ -261,26 +686,22 @@ void XCAT::configureInfiniband()
                     = fmt::format("doca-kernel-{}", kernelVersion);
                 const auto localRepo = functions::createHTTPRepo(repoName);
 
-                // Create the RPM repository
-                runner->checkCommand(fmt::format(
-                    "bash -c \"cp -v "
-                    "/usr/share/doca-host-*/Modules/{}/*.rpm {}\"",
-                    kernelVersion, localRepo.directory.string()));
-                runner->checkCommand(
-                    fmt::format("createrepo {}", localRepo.directory.string()));
+                // Create the RPM repository, once for all the images
+                if (m_localRepos.insert(repoName).second) {
+                    copyDocaKernelPackages(
+                        kernelVersion, localRepo.directory);
+                    runner->checkCommand(fmt::format(
+                        "createrepo {}", localRepo.directory.string()));
+                }
 
                 // dryRun does not initialize the repositories
                 if (!opts->dryRun) {
                     auto docaUrl = repoManager->repo("doca")->uri().value();
-                    runner->checkCommand(fmt::format(
-                        "bash -c \"chdef -t osimage {} --plus otherpkgdir={}\"",
-                        m_stateless.osimage, docaUrl));
+                    image.otherpkgdirs.emplace_back(docaUrl);
                 }
 
                 // Add the local repository to the stateless image
-                runner->checkCommand(fmt::format(
-                    "bash -c \"chdef -t osimage {} --plus otherpkgdir={}\"",
-                    m_stateless.osimage, localRepo.url));
+                image.otherpkgdirs.emplace_back(localRepo.url);
 
             } break;
 
@@ -293,12 +714,12 @@ void XCAT::configureInfiniband()
     }
 }
 
-void XCAT::configureSLURM()
+void XCAT::configureSLURM(Image& image)
 {
-    m_stateless.otherpkgs.emplace_back("ohpc-slurm-client");
+    image.otherpkgs.emplace_back("ohpc-slurm-client");
 
     // TODO: Deprecate this for SRV entries on DNS: _slurmctld._tcp 0 100 6817
-    m_stateless.postinstall.emplace_back(
+    image.postinstall.emplace_back(
         fmt::format("echo SLURMD_OPTIONS=\\\"--conf-server {}\\\" > "
                     "$IMG_ROOTIMGDIR/etc/sysconfig/slurmd\n\n",
             cluster()
@@ -311,136 +732,144 @@ void XCAT::configureSLURM()
     // TODO: Consider pam_slurm_adopt.so
     //  * https://github.com/openhpc/ohpc/issues/1022
     //  * https://slurm.schedmd.com/pam_slurm_adopt.html
-    m_stateless.postinstall.emplace_back(
+    image.postinstall.emplace_back(
+        "if ! grep -q pam_slurm.so $IMG_ROOTIMGDIR/etc/pam.d/sshd; then\n"
         "echo \"# Block queue evasion\" >> "
         "$IMG_ROOTIMGDIR/etc/pam.d/sshd\n"
         "echo \"account    required     pam_slurm.so\" >> "
         "$IMG_ROOTIMGDIR/etc/pam.d/sshd\n"
+        "fi\n"
         "\n");
 
     // Enable services on image
-    m_stateless.postinstall.emplace_back(
+    image.postinstall.emplace_back(
         "chroot $IMG_ROOTIMGDIR systemctl enable munge\n"
         "chroot $IMG_ROOTIMGDIR systemctl enable slurmd\n"
         "\n");
 
-    m_stateless.synclists.emplace_back(
+    image.synclists.emplace_back(
         // Stateless config: we don't need slurm.conf to be synced.
         //"/etc/slurm/slurm.conf -> /etc/slurm/slurm.conf\n"
         "/etc/munge/munge.key -> /etc/munge/munge.key\n"
         "\n");
 }
 
-void XCAT::generateOtherPkgListFile()
+void XCAT::generateOtherPkgListFile(const Image& image)
 {
-    std::string_view filename
-        = CHROOT "/install/custom/netboot/compute.otherpkglist";
+    const auto filename = image.otherpkglistFile().string();
 
-    functions::removeFile(filename);
-    functions::addStringToFile(
-        filename, fmt::format("{}\n", fmt::join(m_stateless.otherpkgs, "\n")));
+    if (cloyster::Singleton<Options>::get()->dryRun) {
+        LOG_INFO("Dry Run: Would write file {}", filename)
+        return;
+    }
+    files::writeFileAtomically(
+        filename, fmt::format("{}\n", fmt::join(image.otherpkgs, "\n")));
 }
 
-void XCAT::generatePostinstallFile()
+void XCAT::generatePostinstallFile(Image& image)
 {
-    std::string_view filename
-        = CHROOT "/install/custom/netboot/compute.postinstall";
-
-    functions::removeFile(filename);
+    const auto filename = image.postinstallFile().string();
 
-    m_stateless.postinstall.emplace_back(
+    image.postinstall.emplace_back(
+        "grep -q '^\\* soft memlock unlimited' "
+        "$IMG_ROOTIMGDIR/etc/security/limits.conf || "
         "perl -pi -e 's/# End of file/\\* soft memlock unlimited\\n$&/s' "
         "$IMG_ROOTIMGDIR/etc/security/limits.conf\n"
+        "grep -q '^\\* hard memlock unlimited' "
+        "$IMG_ROOTIMGDIR/etc/security/limits.conf || "
         "perl -pi -e 's/# End of file/\\* hard memlock unlimited\\n$&/s' "
         "$IMG_ROOTIMGDIR/etc/security/limits.conf\n"
         "\n");
 
-    m_stateless.postinstall.emplace_back("systemctl disable firewalld\n");
-
-    for (const auto& entries : std::as_const(m_stateless.postinstall)) {
-        functions::addStringToFile(filename, entries);
-    }
+    image.postinstall.emplace_back("systemctl disable firewalld\n");
 
     auto opts = cloyster::Singleton<cloyster::services::Options>::get();
 
     if (opts->dryRun) {
-        LOG_INFO("Dry Run: Would change file {} permissions", filename)
+        LOG_INFO("Dry Run: Would write file {} and make it executable",
+            filename)
         return;
     }
+    files::writeFileAtomically(
+        filename, fmt::format("{}", fmt::join(image.postinstall, "")));
     std::filesystem::permissions(filename,
         std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec
             | std::filesystem::perms::others_exec,
         std::filesystem::perm_options::add);
 }
 
-void XCAT::generateSynclistsFile()
+void XCAT::generateSynclistsFile(const Image& image)
 {
-    std::string_view filename
-        = CHROOT "/install/custom/netboot/compute.synclists";
+    const auto filename = image.synclistsFile().string();
 
-    functions::removeFile(filename);
-    functions::addStringToFile(filename,
-        "/etc/passwd -> /etc/passwd\n"
-        "/etc/group -> /etc/group\n"
-        "/etc/shadow -> /etc/shadow\n"
-        //"/etc/slurm/slurm.conf -> /etc/slurm/slurm.conf\n"
-        "/etc/munge/munge.key -> /etc/munge/munge.key\n");
+    if (cloyster::Singleton<Options>::get()->dryRun) {
+        LOG_INFO("Dry Run: Would write file {}", filename)
+        return;
+    }
+    files::writeFileAtomically(filename, synclists);
 }
 
-void XCAT::configureOSImageDefinition()
+void XCAT::configureOSImageDefinition(
+    const Image& image, const std::vector<std::string>& repos)
 {
     auto opts = cloyster::Singleton<cloyster::services::Options>::get();
     auto runner = cloyster::Singleton<IRunner>::get();
-    runner->executeCommand(
-        fmt::format("chdef -t osimage {} --plus otherpkglist="
-                    "/install/custom/netboot/compute.otherpkglist",
-            m_stateless.osimage));
-
-    runner->executeCommand(
-        fmt::format("chdef -t osimage {} --plus postinstall="
-                    "/install/custom/netboot/compute.postinstall",
-            m_stateless.osimage));
-
-    runner->executeCommand(
-        fmt::format("chdef -t osimage {} --plus synclists="
-                    "/install/custom/netboot/compute.synclists",
-            m_stateless.osimage));
+    // Replace, not --plus: the osimage starts out with the compute.*
+    // templates of xCAT, and those would still run next to our files
+    runner->checkCommand(fmt::format(
+        "chdef -t osimage {} otherpkglist={} postinstall={} synclists={}",
+        image.osimage, image.otherpkglistFile().string(),
+        image.postinstallFile().string(), image.synclistsFile().string()));
+
+    if (!image.otherpkgdirs.empty()) {
+        runner->checkCommand(
+            fmt::format("chdef -t osimage {} --plus otherpkgdir={}",
+                image.osimage, fmt::join(image.otherpkgdirs, ",")));
+    }
 
     /* Add external repositories to otherpkgdir */
     if (!opts->dryRun) {
-        std::vector<std::string> repos = getxCATOSImageRepos();
         runner->executeCommand(
             fmt::format("chdef -t osimage {} --plus otherpkgdir={}",
-                m_stateless.osimage, fmt::join(repos, ",")));
+                image.osimage, fmt::join(repos, ",")));
     }
 }
 
-void XCAT::customizeImage(const std::vector<ScriptBuilder>& customizations) const
+void XCAT::customizeImage(const Image& image)
 {
     auto runner = cloyster::Singleton<IRunner>::get();
+    auto opts = cloyster::Singleton<Options>::get();
     // @TODO: Extract the munge fixes to its own customization script
     // Permission fixes for munge
     if (cluster()->getQueueSystem().value()->getKind()
         == models::QueueSystem::Kind::SLURM) {
-        cloyster::functions::createDirectory(m_stateless.chroot / "etc");
-        runner->executeCommand(
-            fmt::format("cp -f /etc/passwd /etc/group /etc/shadow {}/etc",
-                m_stateless.chroot.string()));
+        cloyster::functions::createDirectory(image.chroot / "etc");
+        if (opts->dryRun) {
+            LOG_INFO("Dry Run: Would copy the users and groups to {}/etc",
+                image.chroot.string())
+        } else {
+            const std::vector<std::filesystem::path> accounts
+                = { "/etc/passwd", "/etc/group", "/etc/shadow" };
+            files::copyFiles(accounts, image.chroot / "etc",
+                { .overwrite = true, .preserveOwner = true, .jobs = 0 });
+        }
         runner->executeCommand(
             fmt::format("mkdir -p {0}/var/lib/munge {0}/var/log/munge "
                         "{0}/etc/munge {0}/run/munge",
-                m_stateless.chroot.string()));
-        runner->executeCommand(fmt::format(
-            "chown munge:munge {}/var/lib/munge", m_stateless.chroot.string()));
-        runner->executeCommand(fmt::format(
-            "chown munge:munge {}/var/log/munge", m_stateless.chroot.string()));
-        runner->executeCommand(fmt::format(
-            "chown munge:munge {}/etc/munge", m_stateless.chroot.string()));
-        runner->executeCommand(fmt::format(
-            "chown munge:munge {}/run/munge", m_stateless.chroot.string()));
-    }
-
-    for (const auto& script : customizations) {
+                image.chroot.string()));
+        runner->executeBatch({
+            fmt::format("chown munge:munge {}/var/lib/munge",
+                image.chroot.string()),
+            fmt::format("chown munge:munge {}/var/log/munge",
+                image.chroot.string()),
+            fmt::format("chown munge:munge {}/etc/munge",
+                image.chroot.string()),
+            fmt::format("chown munge:munge {}/run/munge",
+                image.chroot.string()),
+        });
+    }
+
+    for (const auto& script : image.customizations) {
         runner->run(script);
     };
 }
@@ -504,77 +933,335 @@ void XCAT::configureEL9()
         commands.insert(commands.end(), temp.begin(), temp.end());
     }
 
+    // The symlinks are independent from each other
     auto runner = cloyster::Singleton<IRunner>::get();
-    for (const auto& command : commands) {
-        runner->executeCommand(command);
-    }
+    runner->executeBatch(commands);
 }
 
 cloyster::services::XCAT::ImageInstallArgs
 XCAT::getImageInstallArgs(ImageType imageType, NodeType nodeType)
 {
-    generateOSImageName(imageType, nodeType);
-    generateOSImagePath(imageType, nodeType);
-    LOG_ASSERT(!m_stateless.osimage.empty(), "Empty osimage name");
+    return getImageInstallArgs(makeImage(
+        imageType, nodeType, cluster()->getNodes()[0].getOS().getArch()));
+}
+
+cloyster::services::XCAT::ImageInstallArgs
+XCAT::getImageInstallArgs(const Image& image)
+{
+    LOG_ASSERT(!image.osimage.empty(), "Empty osimage name");
     return ImageInstallArgs {
-        .imageName = m_stateless.osimage,
-        .rootfs = m_stateless.chroot,
-        .postinstall = "/install/custom/netboot/compute.postinstall",
-        .pkglist = "/install/custom/netboot/compute.otherpkglist"
+        .imageName = image.osimage,
+        .rootfs = image.chroot,
+        .postinstall = image.postinstallFile(),
+        .pkglist = image.otherpkglistFile()
     };
 }
 
+std::filesystem::path XCAT::Image::otherpkglistFile() const
+{
+    return fmt::format(CHROOT "/install/custom/netboot/{}.otherpkglist", osimage);
+}
+
+std::filesystem::path XCAT::Image::postinstallFile() const
+{
+    return fmt::format(CHROOT "/install/custom/netboot/{}.postinstall", osimage);
+}
+
+std::filesystem::path XCAT::Image::synclistsFile() const
+{
+    return fmt::format(CHROOT "/install/custom/netboot/{}.synclists", osimage);
+}
+
+XCAT::Image XCAT::makeImage(ImageType imageType, NodeType nodeType, OS::Arch arch)
+{
+    const auto profile = nodeType == NodeType::Compute ? "compute" : "service";
+    Image image { .imageType = imageType, .nodeType = nodeType, .arch = arch };
+    image.osimage = fmt::format("{}-{}-{}-{}", getOSImageDistroVersion(),
+        cloyster::utils::enums::toString(arch),
+        imageType == ImageType::Install ? "install" : "netboot", profile);
+
+    // Only stateless images have a rootimg
+    if (imageType == ImageType::Netboot) {
+        image.chroot = fmt::format("/install/netboot/{}/{}/{}/rootimg",
+            getOSImageDistroVersion(), cloyster::utils::enums::toString(arch),
+            profile);
+    }
+    return image;
+}
+
+std::vector<XCAT::Image> XCAT::computeImages()
+{
+    std::vector<Image> images;
+    for (const auto& node : cluster()->getNodes()) {
+        const auto arch = node.getOS().getArch();
+        if (std::ranges::find(images, arch, &Image::arch) == images.end()) {
+            images.push_back(
+                makeImage(ImageType::Netboot, NodeType::Compute, arch));
+        }
+    }
+    return images;
+}
+
 /* This method will create an image for compute nodes, by default it will be a
  * stateless image with default services.
  */
 void XCAT::createImage(ImageType imageType, NodeType nodeType, const std::vector<ScriptBuilder>& customizations)
 {
-    configureEL9();
+    m_stateless = makeImage(
+        imageType, nodeType, cluster()->getNodes()[0].getOS().getArch());
+    m_stateless.customizations = customizations;
+    createImages({ m_stateless });
+}
 
-    generateOSImageName(imageType, nodeType);
+void XCAT::createImages(std::vector<Image> images)
+{
+    configureEL9();
 
     const auto opts = cloyster::Singleton<Options>::get();
-    const auto imageExists_ = imageExists(m_stateless.osimage);
     const auto runner = cloyster::Singleton<IRunner>::get();
-    if (!imageExists_ || opts->shouldSkip("copycds")) {
+    const auto mediaArch = cluster()->getHeadnode().getOS().getArch();
+
+    // The installation media is copied once, the disk image only carries the
+    // architecture of the headnode
+    std::future<CommandResult> copycdsJob;
+    std::vector<bool> rebuild;
+    for (auto& image : images) {
+        if (image.imageType != ImageType::Netboot) {
+            throw std::logic_error(
+                "Image path is only available on Netboot (Stateless) images");
+        }
+
+        const auto imageExists_ = imageExists(image.osimage);
+        rebuild.push_back(!imageExists_ || opts->shouldSkip("copycds"));
         if (opts->shouldSkip("copycds")) {
             // Remove rootfs and cleanup otherpkgs and postinstall scripts
             runner->executeCommand(fmt::format(
                 "bash -c \"rm -rf {} && echo > {} && echo > {}\"", 
-                m_stateless.chroot,
-                "/install/custom/netboot/compute.otherpkglist", 
-                "/install/custom/netboot/compute.postinstall"));
+                image.chroot.string(),
+                image.otherpkglistFile().string(),
+                image.postinstallFile().string()));
+        } else if (!imageExists_ && image.arch == mediaArch) {
+            if (!copycdsJob.valid()) {
+                copycdsJob = copycds(cluster()->getDiskImage().getPath(), mediaArch);
+            }
+        } else if (!imageExists_) {
+            LOG_WARN("The disk image has no {} media, {} needs it imported "
+                     "with copycds beforehand", 
+                cloyster::utils::enums::toString(image.arch), image.osimage)
+        }
+    }
+
+    // Nothing below touches the osimage definitions until
+    // configureOSImageDefinition, so this overlaps with copycds when
+    // the runner is asynchronous. The files are generated for existing
+    // images too, they are the inputs of the fingerprint
+    createDirectoryTree();
+    for (auto& image : images) {
+        configureSELinux(image);
+        configureOpenHPC(image);
+        configureTimeService(image);
+        configureInfiniband(image);
+        configureSLURM(image);
+
+        generateOtherPkgListFile(image);
+        generatePostinstallFile(image);
+        generateSynclistsFile(image);
+    }
+
+    if (copycdsJob.valid() && copycdsJob.get().exitCode != 0) {
+        throw std::runtime_error(fmt::format(
+            "ERROR: Command failed 'copycds {}'",
+            cluster()->getDiskImage().getPath().string()));
+    }
+
+    // Decide what each image needs, xCAT definitions are changed one at a
+    // time since they all go through xcatd
+    struct ImageBuild {
+        enum class Step : bool { Full, Postinstall };
+        Image image;
+        Fingerprint fingerprint;
+        Step step;
+    };
+
+    const auto repos = opts->dryRun ? std::vector<std::string> {}
+                                    : getxCATOSImageRepos();
+    std::vector<ImageBuild> builds;
+    for (std::size_t i = 0; i < images.size(); ++i) {
+        const auto& image = images[i];
+        const auto fingerprint = imageFingerprint(image, repos);
+        const auto stored
+            = rebuild[i] ? std::nullopt : storedFingerprint(image);
+        if (!stored || stored->packages != fingerprint.packages) {
+            if (stored) {
+                LOG_INFO("The packages of {} changed, generating it again",
+                    image.osimage)
+            }
+            configureOSImageDefinition(image, repos);
+            builds.push_back({ image, fingerprint, ImageBuild::Step::Full });
+        } else if (stored->configuration != fingerprint.configuration) {
+            LOG_INFO("Only the configuration of {} changed, running its "
+                     "postinstall scripts again", image.osimage)
+            builds.push_back(
+                { image, fingerprint, ImageBuild::Step::Postinstall });
         } else {
-            copycds(cluster()->getDiskImage().getPath());
+            LOG_INFO("Image {} is up to date, use --force=genimage to "
+                     "generate it again", image.osimage)
         }
-        generateOSImagePath(imageType, nodeType);
+    }
+    if (builds.empty()) {
+        return;
+    }
 
-        createDirectoryTree();
-        configureSELinux();
-        configureOpenHPC();
-        configureTimeService();
-        configureInfiniband();
-        configureSLURM();
+    // dnf inside genimage is mostly one core and the disk, packimage
+    // compresses with every core it gets
+    const auto cpus = std::max(1U, std::thread::hardware_concurrency());
+    BuildBudget budget(cpus, std::max<std::size_t>(1, opts->imageIoJobs));
+    const BuildBudget::Cost generateCost { .cpu = 1, .io = 1 };
+    const BuildBudget::Cost packCost { .cpu = std::max(1U, cpus / 2), .io = 1 };
 
-        generateOtherPkgListFile();
-        generatePostinstallFile();
-        generateSynclistsFile();
+    LOG_INFO("Building {} images", builds.size())
+    std::mutex mutex;
+    std::exception_ptr error;
+    {
+        std::vector<std::jthread> workers;
+        for (const auto& build : builds) {
+            workers.emplace_back([this, &build, &budget, &generateCost,
+                                     &packCost, &mutex, &error] {
+                try {
+                    if (build.step == ImageBuild::Step::Full) {
+                        customizeImage(build.image);
+                        const auto lease = budget.acquire(generateCost);
+                        genimage(build.image);
+                    } else {
+                        {
+                            const auto lease = budget.acquire(generateCost);
+                            rerunPostinstall(build.image);
+                        }
+                        customizeImage(build.image);
+                    }
+                    {
+                        const auto lease = budget.acquire(packCost);
+                        packimage(build.image);
+                    }
+                    storeFingerprint(build.image, build.fingerprint);
+                } catch (...) {
+                    LOG_ERROR("Failed to build the image {}", build.image.osimage)
+                    const std::scoped_lock lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            });
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
 
-        configureOSImageDefinition();
+XCAT::Fingerprint XCAT::imageFingerprint(
+    const Image& image, const std::vector<std::string>& repos)
+{
+    auto runner = cloyster::Singleton<IRunner>::get();
 
-        customizeImage(customizations);
-        genimage();
-        packimage();
+    // Versions the package names resolve to right now, a repository update
+    // changes the image even when the lists stay the same. The query only
+    // sees the repositories genimage installs the packages from, the
+    // otherpkgdir of the image, for its architecture. Images with the same
+    // lists and repositories share the query
+    const auto arch = cloyster::utils::enums::toString(image.arch);
+    std::vector<std::string> imageRepos = image.otherpkgdirs;
+    imageRepos.insert(imageRepos.end(), repos.begin(), repos.end());
+    const auto packageList = fmt::format("{}", fmt::join(image.otherpkgs, " "));
+    const auto query = fmt::format(
+        "{} {} {}", arch, fmt::join(imageRepos, ","), packageList);
+    auto [resolved, inserted] = m_resolvedPackages.try_emplace(query);
+    if (inserted && !cloyster::Singleton<Options>::get()->dryRun
+        && !image.otherpkgs.empty()) {
+        const auto command = repoqueryCommand(arch, imageRepos, packageList);
+        if (runner->executeCommand(command, resolved->second) != 0) {
+            m_resolvedPackages.erase(resolved);
+            throw std::runtime_error(
+                fmt::format("ERROR: Command failed '{}'", command));
+        }
+        resolved->second.sort();
     }
+
+    std::string packages = fmt::format("osimage {}\nmedia {}\n",
+        image.osimage,
+        cluster()->getDiskImage().getPath().filename().string());
+    packages += fmt::format("otherpkgs {}\n", packageList);
+    packages += fmt::format("otherpkgdirs {}\n", fmt::join(image.otherpkgdirs, " "));
+    packages += fmt::format("repos {}\n", fmt::join(repos, " "));
+    packages += fmt::format("nevras {}\n", fmt::join(resolved->second, " "));
+
+    std::string configuration = fmt::format("postinstall {}\nsynclists {}\n",
+        fmt::join(image.postinstall, ""), synclists);
+    for (const auto& script : image.customizations) {
+        configuration += script.toString();
+    }
+
+    return { .packages = files::checksum(packages),
+        .configuration = files::checksum(configuration) };
 }
 
-void XCAT::addNode(const Node& node)
+std::filesystem::path XCAT::fingerprintPath(const Image& image)
 {
-    LOG_DEBUG("Adding node {} to xCAT", node.getHostname())
+    // Next to the rootimg directory, genimage leaves it alone
+    return image.chroot.parent_path() / "cloysterhpc.fingerprint";
+}
+
+std::optional<XCAT::Fingerprint> XCAT::storedFingerprint(const Image& image)
+{
+    std::ifstream input(fingerprintPath(image));
+    Fingerprint fingerprint;
+    std::string packages;
+    std::string configuration;
+    if (input >> packages >> fingerprint.packages >> configuration
+            >> fingerprint.configuration
+        && packages == "packages" && configuration == "configuration") {
+        return fingerprint;
+    }
+
+    LOG_DEBUG("No fingerprint for {} at {}", image.osimage,
+        fingerprintPath(image).string())
+    return std::nullopt;
+}
+
+void XCAT::storeFingerprint(const Image& image, const Fingerprint& fingerprint)
+{
+    if (cloyster::Singleton<Options>::get()->dryRun) {
+        LOG_INFO("Dry Run: Would store the fingerprint of {} at {}",
+            image.osimage, fingerprintPath(image).string())
+        return;
+    }
 
-    std::string command = fmt::format(
-        "mkdef -f -t node {} arch={} ip={} mac={} groups=compute,all "
-        "netboot=xnba ",
+    // A crash while storing must not leave half of a fingerprint behind
+    files::writeFileAtomically(fingerprintPath(image),
+        fmt::format("packages {}\nconfiguration {}\n", fingerprint.packages,
+            fingerprint.configuration));
+}
+
+void XCAT::rerunPostinstall(const Image& image)
+{
+    // The same arguments and environment genimage runs postinstall with
+    cloyster::Singleton<IRunner>::get()->checkCommand(fmt::format(
+        "bash -c \"IMG_ROOTIMGDIR={0} {1} {0} {2} {3} {4}\"",
+        image.chroot.string(), image.postinstallFile().string(),
+        getOSImageDistroVersion(),
+        cloyster::utils::enums::toString(image.arch),
+        image.nodeType == NodeType::Compute ? "compute" : "service"));
+}
+
+std::string XCAT::nodeStanza(const Node& node)
+{
+    std::string stanza = fmt::format("{}:\n"
+                                     "    objtype=node\n"
+                                     "    arch={}\n"
+                                     "    ip={}\n"
+                                     "    mac={}\n"
+                                     "    groups=compute,all\n"
+                                     "    netboot=xnba\n",
         node.getHostname(),
         cloyster::utils::enums::toString(node.getOS().getArch()),
         node.getConnection(Network::Profile::Management)
@@ -583,8 +1270,13 @@ void XCAT::addNode(const Node& node)
         node.getConnection(Network::Profile::Management).getMAC().value());
 
     if (const auto& bmc = node.getBMC())
-        command += fmt::format("bmc={} bmcusername={} bmcpassword={} mgt=ipmi "
-                               "cons=ipmi serialport={} serialspeed={} ",
+        stanza += fmt::format("    bmc={}\n"
+                              "    bmcusername={}\n"
+                              "    bmcpassword={}\n"
+                              "    mgt=ipmi\n"
+                              "    cons=ipmi\n"
+                              "    serialport={}\n"
+                              "    serialspeed={}\n",
             bmc->m_address, bmc->m_username, bmc->m_password, bmc->m_serialPort,
             bmc->m_serialSpeed);
 
@@ -593,113 +1285,140 @@ void XCAT::addNode(const Node& node)
     //  * This is __BAD__ implementation. We cannot use try/catch as return *
     //  *********************************************************************
     try {
-        command += fmt::format(
-            "nicips.ib0={} nictypes.ib0=\"InfiniBand\" nicnetworks.ib0=ib0 ",
+        stanza += fmt::format("    nicips.ib0={}\n"
+                              "    nictypes.ib0=InfiniBand\n"
+                              "    nicnetworks.ib0=ib0\n",
             node.getConnection(Network::Profile::Application)
                 .getAddress()
                 .to_string());
     } catch (...) {
     }
 
-    cloyster::Singleton<IRunner>::get()->executeCommand(command);
+    return stanza + "\n";
 }
 
-void XCAT::addNodes()
+bool XCAT::importNodes(std::span<const Node> nodes)
 {
-    for (const auto& node : cluster()->getNodes()) {
-        addNode(node);
+    std::string stanzas;
+    for (const auto& node : nodes) {
+        stanzas += nodeStanza(node);
     }
 
     auto runner = cloyster::Singleton<IRunner>::get();
+    if (cloyster::Singleton<Options>::get()->dryRun) {
+        LOG_INFO("Dry Run: Would define {} nodes with mkdef -z", nodes.size())
+        return runner->executeCommand(
+                   "bash -c \"mkdef -z -f < cloysterhpc-nodes.stanza\"")
+            == 0;
+    }
 
-    // TODO: Create separate functions
-    runner->executeCommand("makehosts");
-    runner->executeCommand("makedhcp -n");
-    runner->executeCommand("makedns -n");
-    runner->executeCommand("makegocons");
-    setNodesImage();
+    // The stanzas carry the BMC passwords
+    const StanzaFile file(stanzas);
+    return runner->executeCommand(
+               fmt::format("bash -c \"mkdef -z -f < {}\"", file.path()))
+        == 0;
 }
 
-void XCAT::setNodesImage()
+void XCAT::addNode(const Node& node)
 {
-    // TODO: For now we always run nodeset for all computes
-    nodeset("compute");
+    LOG_DEBUG("Adding node {} to xCAT", node.getHostname())
+    importNodes({ &node, 1 });
 }
 
-void XCAT::setNodesBoot()
+void XCAT::addNodes()
 {
-    // TODO: Do proper checking if a given node have BMC support, and then issue
-    //  rsetboot only on the compatible machines instead of running in compute.
-    auto runner = cloyster::Singleton<IRunner>::get();
-    runner->executeCommand("rsetboot compute net");
-}
+    const auto& nodes = cluster()->getNodes();
+
+    // A single mkdef -z defines a whole batch in one xcatd request and one
+    // database transaction, the batches keep the requests to a sane size
+    const auto batchSize
+        = std::max<std::size_t>(1, cloyster::Singleton<Options>::get()->nodeBatchSize);
+    LOG_INFO("Adding {} nodes to xCAT", nodes.size());
+    for (std::size_t first = 0; first < nodes.size(); first += batchSize) {
+        const auto batch = std::span(nodes).subspan(
+            first, std::min(batchSize, nodes.size() - first));
+        LOG_DEBUG("Adding nodes {} to {} to xCAT", batch.front().getHostname(),
+            batch.back().getHostname())
+        if (!importNodes(batch)) {
+            LOG_ERROR("Failed to add nodes {} to {} to xCAT",
+                batch.front().getHostname(), batch.back().getHostname());
+        }
+    }
 
-void XCAT::resetNodes()
-{
+    // TODO: Create separate functions
     auto runner = cloyster::Singleton<IRunner>::get();
-    runner->executeCommand("rpower compute reset");
+    runner->executeCommand("makehosts");
+    runner->executeCommand("makedhcp -n");
+    runner->executeCommand("makedns -n");
+    runner->executeCommand("makegocons");
+    setNodesImage();
 }
 
-void XCAT::generateOSImageName(ImageType imageType, NodeType nodeType)
+void XCAT::setNodesImage()
 {
-    std::string osimage = getOSImageDistroVersion();
-    osimage += "-";
-
-    switch (cluster()->getNodes()[0].getOS().getArch()) {
-        case OS::Arch::x86_64:
-            osimage += "x86_64";
-            break;
-        case OS::Arch::ppc64le:
-            osimage += "ppc64le";
-            break;
-    }
-    osimage += "-";
-
-    switch (imageType) {
-        case ImageType::Install:
-            osimage += "install";
-            break;
-        case ImageType::Netboot:
-            osimage += "netboot";
-            break;
+    const auto images = computeImages();
+    if (images.size() == 1) {
+        nodeset("compute", images.front());
+        return;
     }
-    osimage += "-";
 
-    switch (nodeType) {
-        case NodeType::Compute:
-            osimage += "compute";
-            break;
-        case NodeType::Service:
-            osimage += "service";
-            break;
+    for (const auto& image : images) {
+        std::vector<std::string> nodes;
+        for (const auto& node : cluster()->getNodes()) {
+            if (node.getOS().getArch() == image.arch) {
+                nodes.emplace_back(node.getHostname());
+            }
+        }
+        nodeset(fmt::format("{}", fmt::join(nodes, ",")), image);
     }
-
-    m_stateless.osimage = osimage;
 }
 
-void XCAT::generateOSImagePath(ImageType imageType, NodeType nodeType)
+void XCAT::bootNodes()
 {
-
-    if (imageType != XCAT::ImageType::Netboot) {
-        throw std::logic_error(
-            "Image path is only available on Netboot (Stateless) images");
+    const auto opts = cloyster::Singleton<Options>::get();
+    const auto& nodes = cluster()->getNodes();
+
+    power::RolloutOptions options { .waveSize = opts->powerWaveSize,
+        .byGroup = opts->powerWaveByRack,
+        .threshold = opts->powerWaveThreshold };
+    std::map<std::string, std::string> racks;
+    if (options.byGroup && !opts->dryRun) {
+        std::vector<std::string> hostnames;
+        for (const auto& node : nodes) {
+            hostnames.emplace_back(node.getHostname());
+        }
+        racks = power::XCATBackend::racks(hostnames);
     }
 
-    std::filesystem::path chroot = "/install/netboot/";
-    chroot += getOSImageDistroVersion();
-    chroot += "/";
+    const auto targets = power::targets(nodes, racks);
+    const auto report = [&] {
+        if (!opts->nativeIpmi || opts->dryRun) {
+            power::XCATBackend backend;
+            return power::rollout(targets, backend, options);
+        }
 
-    switch (cluster()->getNodes()[0].getOS().getArch()) {
-        case OS::Arch::x86_64:
-            chroot += "x86_64";
-            break;
-        case OS::Arch::ppc64le:
-            chroot += "ppc64le";
-            break;
+        std::map<std::string, ipmi::Endpoint> bmcs;
+        for (const auto& node : nodes) {
+            if (const auto& bmc = node.getBMC()) {
+                bmcs.emplace(node.getHostname(), ipmi::endpoint(*bmc));
+            }
+        }
+        ipmi::Client client;
+        power::NativeBackend backend(client, std::move(bmcs));
+        return power::rollout(targets, backend, options);
+    }();
+
+    for (const auto& result : report.nodes) {
+        if (result.state == power::State::Skipped) {
+            LOG_WARN("{} has no BMC, it must be booted by hand", result.node)
+        } else if (result.state == power::State::Failed) {
+            LOG_ERROR("Failed to reset {} after {} attempts: {}",
+                result.node, result.attempts, result.error)
+        }
     }
-
-    chroot += "/compute/rootimg";
-    m_stateless.chroot = chroot;
+    LOG_INFO("Reset {} of {} nodes in {} waves",
+        report.count(power::State::Reset) + report.count(power::State::Fetched),
+        report.nodes.size(), report.waves)
 }
 
 std::vector<std::string> XCAT::getxCATOSImageRepos() const
@@ -739,3 +1458,72 @@ std::vector<std::string> XCAT::getxCATOSImageRepos() const
 }
 
 };
+
+TEST_SUITE_BEGIN("cloyster::services::xcat");
+
+TEST_CASE("repoquery reaches dnf with one argument per option")
+{
+    cloyster::Singleton<cloyster::services::Options>::init(
+        std::make_unique<cloyster::services::Options>(
+            cloyster::services::Options {}));
+
+    // A dnf that prints the arguments it was given, one per line. It runs by
+    // its absolute path because boost::process skips the first PATH entry.
+    const cloyster::tests::TemporaryDirectory bin;
+    std::ofstream(bin.path / "dnf") << "#!/bin/sh\nprintf '%s\\n' \"$@\"\n";
+    std::filesystem::permissions(
+        bin.path / "dnf", std::filesystem::perms::owner_all);
+    auto command = repoqueryCommand("x86_64",
+        { "/install/post/otherpkgs/rocky9.5/x86_64/OpenHPC",
+            "https://mirror.example.com/epel/9/Everything/x86_64/" },
+        "slurm-ohpc munge");
+    REQUIRE(command.starts_with("dnf "));
+    command.replace(0, 3, (bin.path / "dnf").string());
+    const auto argv = cloyster::services::Runner().checkOutput(command);
+
+    CHECK(argv
+        == std::vector<std::string> { "repoquery", "--quiet",
+            "--latest-limit=1", "--forcearch=x86_64",
+            "--repofrompath=cloysterhpc-image-0,"
+            "/install/post/otherpkgs/rocky9.5/x86_64/OpenHPC",
+            "--repo=cloysterhpc-image-0",
+            "--repofrompath=cloysterhpc-image-1,"
+            "https://mirror.example.com/epel/9/Everything/x86_64/",
+            "--repo=cloysterhpc-image-1", "--queryformat",
+            "%{name}-%{evr}.%{arch}\\n", "slurm-ohpc", "munge" });
+}
+
+TEST_CASE("a missing compute template leaves the media to copycds")
+{
+    using cloyster::services::IRunner;
+    using cloyster::services::MockRunner;
+    using cloyster::services::XcatDirectories;
+    using cloyster::services::findImageTemplate;
+    using cloyster::services::registerMedia;
+    using cloyster::services::xcatDirectories;
+    cloyster::Singleton<cloyster::services::Options>::init(
+        std::make_unique<cloyster::services::Options>());
+    cloyster::Singleton<IRunner>::init(
+        std::unique_ptr<IRunner>(std::make_unique<MockRunner>()));
+
+    // Without a site table the xCAT default stays
+    CHECK(xcatDirectories().install == "/install");
+
+    const cloyster::tests::TemporaryDirectory install;
+    const cloyster::tests::TemporaryDirectory root;
+    const XcatDirectories directories { install.path, root.path };
+    CHECK_FALSE(findImageTemplate(
+        directories, "compute", "rocky9.5", "x86_64", "pkglist"));
+    CHECK_FALSE(registerMedia(directories, "rocky9.5", "x86_64"));
+
+    // The shipped template of the major version is taken once it exists
+    const auto shipped = root.path / "share/xcat/netboot/rocky";
+    std::filesystem::create_directories(shipped);
+    std::ofstream(shipped / "compute.rocky9.x86_64.pkglist") << "bash\n";
+    CHECK(findImageTemplate(directories, "compute", "rocky9.5", "x86_64",
+              "pkglist")
+        == shipped / "compute.rocky9.x86_64.pkglist");
+    CHECK(registerMedia(directories, "rocky9.5", "x86_64"));
+}
+
+TEST_SUITE_END();
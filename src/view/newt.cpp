@@ -93,17 +93,15 @@ std::vector<const char*> Newt::convertToNewtList(
 }
 
 /**
- * Show a progress message dialog
+ * Show a progress dialog driven by an event source
  * @param title
  * @param message
- * @param command
- * @param fPercent A function to transform a command output
- * into a percent (a 0 to 100 value)
+ * @param fd A descriptor that polls readable when there is news
+ * @param fProgress Called when fd is readable, returns a percent and a
+ * status line shown below the message, or std::nullopt once it is over
  */
-bool Newt::progressMenu(const char* title, const char* message,
-    cloyster::services::CommandProxy&& cmd,
-    std::function<std::optional<double>(cloyster::services::CommandProxy&)>
-        fPercent)
+bool Newt::progressMenu(const char* title, const char* message, int fd,
+    std::function<std::optional<std::pair<double, std::string>>()> fProgress)
 {
 
     std::string text;
@@ -111,7 +109,7 @@ bool Newt::progressMenu(const char* title, const char* message,
     auto* form = newtForm(nullptr, nullptr, 0);
 
     auto* progress = newtScale(10, -1, 61, 1000);
-    auto* label = newtTextbox(-1, -1, 61, 1, NEWT_TEXTBOX_WRAP);
+    auto* label = newtTextbox(-1, -1, 61, 3, NEWT_TEXTBOX_WRAP);
     newtTextboxSetText(label, text.c_str());
 
     char* dtitle = strdup(title);
@@ -130,7 +128,7 @@ bool Newt::progressMenu(const char* title, const char* message,
     newtGridWrappedWindow(grid, dtitle);
 
     newtFormAddComponents(form, progress, label, b1, nullptr);
-    newtFormWatchFd(form, cmd.pipe_stream.pipe().native_source(), NEWT_FD_READ);
+    newtFormWatchFd(form, fd, NEWT_FD_READ);
     newtScaleSet(progress, 0);
     newtDrawForm(form);
 
@@ -139,11 +137,15 @@ bool Newt::progressMenu(const char* title, const char* message,
     newtExitStruct es = {};
     newtFormRun(form, &es);
     while (es.reason == 2) {
-        auto last_value = fPercent(cmd);
+        auto last_value = fProgress();
         if (!last_value)
             break;
 
-        newtScaleSet(progress, unsigned(*last_value * 10));
+        newtScaleSet(progress, unsigned(last_value->first * 10));
+        if (!last_value->second.empty()) {
+            text = fmt::format("{}\n{}", message, last_value->second);
+            newtTextboxSetText(label, text.c_str());
+        }
 
         newtFormRun(form, &es);
     }